@@ -0,0 +1,179 @@
+/*
+ * kvstore_bench.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ *
+ * Compares LevelDB and RocksDB backend on the workload of the document database. Documents
+ * are written with their sequence numbers and history (docs, seq, doc_revs, object_index),
+ * then the benchmark measures updates, document lookups, reading of changes, reading
+ * of the history (batched lookups) and erasing of the database.
+ *
+ * Usage: kvstore_bench <directory> [documents]
+ *
+ * No results are recorded yet, the RocksDB backend is considered unmeasured until they are
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <leveldb/cache.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/options.h>
+#include "../libsofa/keyformat.h"
+#include "../libsofa/kvapi_leveldb.h"
+#include "../libsofa/kvapi_rocksdb.h"
+#include "../libsofa/types.h"
+
+using namespace sofadb;
+
+static const std::uint32_t dbid = 1;
+static const std::size_t batchSize = 100;
+
+struct State {
+	std::vector<SeqNum> lastSeq;
+	std::vector<std::vector<SeqNum> > history;
+	SeqNum nextSeq = 1;
+	SeqNum nextHist = 1;
+};
+
+static std::string docId(std::size_t n) {
+	char buff[32];
+	snprintf(buff, sizeof(buff), "doc%010lu", static_cast<unsigned long>(n));
+	return buff;
+}
+
+static void writeDoc(AbstractChangeset &chng, State &st, std::size_t n, std::minstd_rand &rnd) {
+	std::string key, value(300, 'a' + rnd() % 26);
+	std::string id = docId(n);
+	if (st.lastSeq[n]) {
+		//previous revision goes to the history
+		key_seq(key, dbid, st.lastSeq[n]);
+		chng.erase(key);
+		key_doc_revs(key, dbid, id, st.nextHist);
+		chng.put(key, std::string(16, 'h'));
+		key_object_index(key, dbid, st.nextHist);
+		chng.put(key, value);
+		st.history[n].push_back(st.nextHist++);
+	}
+	key_docs(key, dbid, id);
+	chng.put(key, value);
+	key_seq(key, dbid, st.nextSeq);
+	chng.put(key, id);
+	st.lastSeq[n] = st.nextSeq++;
+}
+
+static double measure(const char *name, std::size_t ops, const std::function<void()> &fn) {
+	auto start = std::chrono::steady_clock::now();
+	fn();
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double r = ops / sec;
+	printf("  %-10s %12.0f ops/s\n", name, r);
+	return r;
+}
+
+static void run(PKeyValueDatabase db, std::size_t docs) {
+	State st;
+	st.lastSeq.resize(docs, 0);
+	st.history.resize(docs);
+	std::minstd_rand rnd(1);
+
+	measure("load", docs, [&] {
+		for (std::size_t i = 0; i < docs; i += batchSize) {
+			PChangeset chng = db->createChangeset();
+			for (std::size_t j = i; j < docs && j < i + batchSize; j++) writeDoc(*chng, st, j, rnd);
+			chng->commit();
+		}
+	});
+	measure("update", docs, [&] {
+		for (std::size_t i = 0; i < docs; i += batchSize) {
+			PChangeset chng = db->createChangeset();
+			for (std::size_t j = 0; j < batchSize; j++) writeDoc(*chng, st, rnd() % docs, rnd);
+			chng->commit();
+		}
+	});
+	measure("get", docs, [&] {
+		PinnedValue v;
+		std::string key;
+		for (std::size_t i = 0; i < docs; i++) {
+			key_docs(key, dbid, docId(rnd() % docs));
+			db->lookupPinned(key, v);
+		}
+	});
+	std::size_t scans = docs / 100;
+	measure("changes", scans * 100, [&] {
+		std::string key1, key2;
+		key_seq(key2, dbid+1);
+		for (std::size_t i = 0; i < scans; i++) {
+			key_seq(key1, dbid, rnd() % st.nextSeq);
+			Iterator iter(db->findRange(key1, key2));
+			for (int j = 0; j < 100 && iter.getNext(); j++) {}
+		}
+	});
+	measure("history", docs, [&] {
+		std::string key;
+		std::vector<std::string> okeys;
+		for (std::size_t i = 0; i < docs; i++) {
+			std::size_t n = rnd() % docs;
+			key_doc_revs(key, dbid, docId(n));
+			_misc::addSep(key);
+			okeys.clear();
+			Iterator iter(db->findRange(key));
+			for (auto &&h: st.history[n]) {
+				if (!iter.getNext()) break;
+				okeys.push_back(std::string());
+				key_object_index(okeys.back(), dbid, h);
+			}
+			db->lookupMulti(std::vector<std::string_view>(okeys.begin(), okeys.end()),
+					[](std::size_t, const std::string_view &) {});
+		}
+	});
+	measure("erase", 1, [&] {
+		std::string key;
+		PChangeset chng = db->createChangeset();
+		key_docs(key, dbid);
+		chng->erasePrefix(key);
+		key_seq(key, dbid);
+		chng->erasePrefix(key);
+		key_doc_revs(key, dbid);
+		chng->erasePrefix(key);
+		key_object_index(key, dbid);
+		chng->erasePrefix(key);
+		chng->commit();
+	});
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <directory> [documents]\n", argv[0]);
+		return 1;
+	}
+	std::string dir = argv[1];
+	std::size_t docs = argc > 2?std::strtoul(argv[2], nullptr, 10):200000;
+
+	{
+		leveldb::Options opts;
+		std::unique_ptr<leveldb::Cache> cache(leveldb::NewLRUCache(256*1024*1024));
+		std::unique_ptr<const leveldb::FilterPolicy> filter(leveldb::NewBloomFilterPolicy(10));
+		opts.create_if_missing = true;
+		opts.block_cache = cache.get();
+		opts.filter_policy = filter.get();
+		printf("leveldb\n");
+		PKeyValueDatabase db = leveldb_open(opts, dir + "/leveldb");
+		run(db, docs);
+		db->destroy();
+	}
+	{
+		RocksDBConfig cfg;
+		printf("rocksdb\n");
+		PKeyValueDatabase db = rocksdb_open(cfg, dir + "/rocksdb");
+		run(db, docs);
+		db->destroy();
+	}
+	return 0;
+}
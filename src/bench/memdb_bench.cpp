@@ -0,0 +1,171 @@
+/*
+ * memdb_bench.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ *
+ * Multithreaded benchmark of the MemDB. Compares MemDB with a std::map guarded by
+ * a single mutex (the original implementation of the MemDB). Readers perform lookups
+ * and short range scans while one thread writes batches
+ *
+ * Usage: memdb_bench [keys] [seconds per run]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../libsofa/kvapi_memdb.h"
+
+using namespace sofadb;
+
+class Target {
+public:
+	virtual void write(const std::vector<std::pair<std::string, std::string> > &batch) = 0;
+	virtual bool lookup(const std::string &key, std::string &value) = 0;
+	virtual std::size_t scan(const std::string &start, std::size_t count) = 0;
+	virtual ~Target() {}
+};
+
+class LockedMapTarget: public Target {
+public:
+	virtual void write(const std::vector<std::pair<std::string, std::string> > &batch) {
+		std::lock_guard<std::recursive_mutex> _(lock);
+		for (auto &&x: batch) {
+			MemDBCommon::Value &v = data[json::String(x.first)];
+			v.data = json::String(x.second);
+			v.valid = true;
+		}
+	}
+	virtual bool lookup(const std::string &key, std::string &value) {
+		std::lock_guard<std::recursive_mutex> _(lock);
+		auto iter = data.find(json::StrViewA(key));
+		if (iter == data.end() || !iter->second.valid) return false;
+		value = iter->second.data.str();
+		return true;
+	}
+	virtual std::size_t scan(const std::string &start, std::size_t count) {
+		std::size_t n = 0;
+		std::string last;
+		std::unique_lock<std::recursive_mutex> l(lock);
+		auto iter = data.lower_bound(json::StrViewA(start));
+		l.unlock();
+		//the original iterator locked the map for every step
+		while (n < count) {
+			l.lock();
+			if (iter == data.end()) break;
+			last = iter->second.data.str();
+			++iter;
+			l.unlock();
+			n++;
+		}
+		return n;
+	}
+protected:
+	std::recursive_mutex lock;
+	std::map<json::String, MemDBCommon::Value, std::less<json::StrViewA> > data;
+};
+
+class MemDBTarget: public Target {
+public:
+	MemDBTarget():db(new MemDB) {}
+	virtual void write(const std::vector<std::pair<std::string, std::string> > &batch) {
+		PChangeset chng = db->createChangeset();
+		for (auto &&x: batch) chng->put(x.first, x.second);
+		chng->commit();
+	}
+	virtual bool lookup(const std::string &key, std::string &value) {
+		return db->lookup(key, value);
+	}
+	virtual std::size_t scan(const std::string &start, std::size_t count) {
+		std::size_t n = 0;
+		Iterator iter(db->findRange(start, "\xFF"));
+		while (n < count && iter.getNext()) n++;
+		return n;
+	}
+protected:
+	PKeyValueDatabase db;
+};
+
+static std::string makeKey(std::size_t n) {
+	char buff[32];
+	snprintf(buff, sizeof(buff), "key%010lu", static_cast<unsigned long>(n));
+	return buff;
+}
+
+struct Result {
+	double reads_per_sec;
+	double writes_per_sec;
+};
+
+static Result run(Target &t, std::size_t keys, unsigned int readers, unsigned int seconds) {
+	std::atomic<bool> stop(false);
+	std::atomic<std::size_t> reads(0), writes(0);
+	std::vector<std::thread> thrs;
+	for (unsigned int i = 0; i < readers; i++) {
+		thrs.push_back(std::thread([&, i] {
+			std::minstd_rand rnd(i + 1);
+			std::string value;
+			std::size_t cnt = 0;
+			while (!stop) {
+				std::size_t k = rnd() % keys;
+				if (k % 10 == 0) t.scan(makeKey(k), 20);
+				else t.lookup(makeKey(k), value);
+				cnt++;
+			}
+			reads += cnt;
+		}));
+	}
+	thrs.push_back(std::thread([&] {
+		std::minstd_rand rnd(12345);
+		std::vector<std::pair<std::string, std::string> > batch;
+		std::size_t cnt = 0;
+		while (!stop) {
+			batch.clear();
+			for (int j = 0; j < 10; j++) batch.push_back(std::pair(makeKey(rnd() % keys), std::string(100, 'x' + j)));
+			t.write(batch);
+			cnt += batch.size();
+		}
+		writes += cnt;
+	}));
+	std::this_thread::sleep_for(std::chrono::seconds(seconds));
+	stop = true;
+	for (auto &&x: thrs) x.join();
+	return Result{static_cast<double>(reads) / seconds, static_cast<double>(writes) / seconds};
+}
+
+static void fill(Target &t, std::size_t keys) {
+	std::vector<std::pair<std::string, std::string> > batch;
+	for (std::size_t i = 0; i < keys; i++) {
+		batch.push_back(std::pair(makeKey(i), std::string(100, 'a')));
+		if (batch.size() == 1000) {
+			t.write(batch);
+			batch.clear();
+		}
+	}
+	t.write(batch);
+}
+
+int main(int argc, char **argv) {
+	std::size_t keys = argc > 1?std::strtoul(argv[1], nullptr, 10):1000000;
+	unsigned int seconds = argc > 2?std::strtoul(argv[2], nullptr, 10):5;
+
+	LockedMapTarget lm;
+	MemDBTarget mdb;
+	fill(lm, keys);
+	fill(mdb, keys);
+
+	printf("%8s %16s %16s %16s %16s\n", "readers", "map reads/s", "map writes/s", "memdb reads/s", "memdb writes/s");
+	for (unsigned int readers: {1, 2, 4, 8, 16}) {
+		Result a = run(lm, keys, readers, seconds);
+		Result b = run(mdb, keys, readers, seconds);
+		printf("%8u %16.0f %16.0f %16.0f %16.0f\n", readers, a.reads_per_sec, a.writes_per_sec, b.reads_per_sec, b.writes_per_sec);
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * scan_bench.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ *
+ * Measures speed of range scans (rows per second) read row by row (getNext) and
+ * by batches (getNextBatch) on the MemDB and the LevelDB storage
+ *
+ * Usage: scan_bench <directory> [keys] [rounds]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <leveldb/cache.h>
+#include <leveldb/options.h>
+#include "../libsofa/kvapi_leveldb.h"
+#include "../libsofa/kvapi_memdb.h"
+
+using namespace sofadb;
+
+static std::string makeKey(std::size_t n) {
+	char buff[32];
+	snprintf(buff, sizeof(buff), "key%010lu", static_cast<unsigned long>(n));
+	return buff;
+}
+
+static void fill(PKeyValueDatabase db, std::size_t keys) {
+	PChangeset chng = db->createChangeset();
+	for (std::size_t i = 0; i < keys; i++) {
+		chng->put(makeKey(i), std::string(50, 'a' + i % 26));
+		if (i % 1000 == 999) chng->commit();
+	}
+	chng->commit();
+}
+
+static double measure(std::size_t rounds, const std::function<std::size_t()> &fn) {
+	std::size_t rows = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < rounds; i++) rows += fn();
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return rows / sec;
+}
+
+static void run(const char *name, PKeyValueDatabase db, std::size_t rounds) {
+	//the sum prevents the compiler to optimize out the loops
+	std::size_t sum = 0;
+	double single = measure(rounds, [&] {
+		std::size_t n = 0;
+		Iterator iter(db->findRange("key"));
+		while (iter.getNext()) {
+			sum += iter->second.size();
+			n++;
+		}
+		return n;
+	});
+	double batch = measure(rounds, [&] {
+		std::size_t n = 0;
+		KeyValue rows[64];
+		Iterator iter(db->findRange("key"));
+		while (std::size_t cnt = iter.getNextBatch(rows, 64)) {
+			for (std::size_t i = 0; i < cnt; i++) sum += rows[i].second.size();
+			n += cnt;
+		}
+		return n;
+	});
+	printf("%-8s %14.0f %14.0f %8.2fx\n", name, single, batch, batch / single);
+	if (sum == 0) printf("empty\n");
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <directory> [keys] [rounds]\n", argv[0]);
+		return 1;
+	}
+	std::string dir = argv[1];
+	std::size_t keys = argc > 2?std::strtoul(argv[2], nullptr, 10):1000000;
+	std::size_t rounds = argc > 3?std::strtoul(argv[3], nullptr, 10):5;
+
+	printf("%-8s %14s %14s %9s\n", "storage", "getNext rows/s", "batch rows/s", "speedup");
+	{
+		PKeyValueDatabase db = new MemDB;
+		fill(db, keys);
+		run("memdb", db, rounds);
+	}
+	{
+		leveldb::Options opts;
+		std::unique_ptr<leveldb::Cache> cache(leveldb_newCache(256*1024*1024));
+		opts.create_if_missing = true;
+		opts.block_cache = cache.get();
+		PKeyValueDatabase db = leveldb_open(opts, dir + "/scan_bench");
+		fill(db, keys);
+		run("leveldb", db, rounds);
+		db->destroy();
+	}
+	return 0;
+}
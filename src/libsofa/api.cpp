@@ -5,6 +5,8 @@
  *      Author: ondra
  */
 
+#include <limits>
+#include <tuple>
 #include <imtjson/object.h>
 #include <imtjson/string.h>
 #include "api.h"
@@ -14,21 +16,23 @@ namespace sofadb {
 
 using namespace json;
 
-SofaDB::SofaDB(PKeyValueDatabase kvdatabase)
-	:dbcore(kvdatabase)
+SofaDB::SofaDB(PKeyValueDatabase kvdatabase, PKeyValueDatabase durabledb)
+	:dbcore(kvdatabase, durabledb)
 	,docdb(dbcore)
 	,eventRouter(new EventRouter(Worker::create(1)))
 	,mtask(dbcore)
+	,btask(docdb)
 {
 	dbcore.setObserver(eventRouter->createObserver());
 	mtask.init(eventRouter);
 }
 
-SofaDB::SofaDB(PKeyValueDatabase kvdatabase, Worker worker)
-	:dbcore(kvdatabase)
+SofaDB::SofaDB(PKeyValueDatabase kvdatabase, Worker worker, PKeyValueDatabase durabledb)
+	:dbcore(kvdatabase, durabledb)
 	,docdb(dbcore)
 	,eventRouter(new EventRouter(worker))
 	,mtask(dbcore)
+	,btask(docdb)
 
 {
 	dbcore.setObserver(eventRouter->createObserver());
@@ -36,6 +40,8 @@ SofaDB::SofaDB(PKeyValueDatabase kvdatabase, Worker worker)
 }
 
 SofaDB::~SofaDB() {
+	btask.stop();
+	mtask.stop();
 	eventRouter->stop();
 }
 
@@ -77,11 +83,22 @@ bool SofaDB::allDocs(Handle db, OutputFormat outputFormat,
 	return docdb.listDocs(db, start_key, end_key,outputFormat,std::move(cb));
 }
 
+bool SofaDB::allDocs(Handle db, OutputFormat outputFormat,
+		const std::string_view& prefix, const std::string_view& after, bool reversed,
+		ResultCB&& cb) {
+	return docdb.listDocs(db, prefix, after, reversed, outputFormat,std::move(cb));
+}
+
 PutStatus SofaDB::put(Handle db, const json::Value& doc, json::Value &newrev) {
 	auto st = docdb.client_put(db,doc, newrev);
 	return st;
 }
 
+void SofaDB::put(Handle db, const std::basic_string_view<json::Value> &docs, bool atomic,
+		std::vector<PutStatus> &status, std::vector<json::Value> &newrevs) {
+	docdb.client_put_bulk(db, docs, atomic, status, newrevs);
+}
+
 PutStatus SofaDB::replicatorPut(Handle db, const json::Value& doc, json::String &newrev) {
 	return docdb.replicator_put(db, doc,newrev);
 }
@@ -108,11 +125,15 @@ PutStatus SofaDB::erase(Handle h, const std::string_view& docid, const std::stri
 }
 
 void SofaDB::purge(Handle h, const std::string_view& docid,	const std::string_view& revid) {
-	//docdb.purge(docid, revid);
+	RevID rev = DocumentDB::parseStrRev(revid);
+	auto lk = dbcore.lockWrite(h);
+	dbcore.eraseHistoricalDoc(h, docid, rev);
 }
 
 void SofaDB::purge(Handle h, const std::string_view& docid) {
-	//docdb.purge(docid);
+	DatabaseCore::KeySet modifiedKeys;
+	auto lk = dbcore.lockWrite(h);
+	dbcore.eraseDoc(h, docid, modifiedKeys);
 }
 
 SofaDB::ObserverHandle SofaDB::registerObserver(GlobalObserver&& observer) {
@@ -149,26 +170,40 @@ bool SofaDB::cancelWaitForChanges(WaitHandle wh, bool notify_fn) {
 PEventRouter SofaDB::getEventRouter() {
 	return eventRouter;
 }
+
+MaintenanceTask& SofaDB::getMaintenanceTask() {
+	return mtask;
+}
+
+BootstrapTask& SofaDB::getBootstrapTask() {
+	return btask;
+}
+
 void SofaDB::readDocChanges(Handle h, const std::string_view &id, Timestamp since, bool reversed,OutputFormat format, ResultCB &&callback) {
-	std::vector<std::pair<std::size_t,Value> > list;
+	readDocChanges(h, id, since, std::numeric_limits<Timestamp>::max(), reversed, format, std::move(callback));
+}
+
+void SofaDB::readDocChanges(Handle h, const std::string_view &id, Timestamp since, Timestamp until, bool reversed,OutputFormat format, ResultCB &&callback) {
+	//revisions with the same timestamp are ordered by revision id, so the order is stable between calls
+	std::vector<std::tuple<Timestamp,RevID,Value> > list;
 	dbcore.enumAllRevisions(h,id,[&](const DatabaseCore::RawDocument &rawdoc){
-		if (rawdoc.timestamp > since) {
-			list.push_back(std::pair(rawdoc.timestamp,docdb.parseDocument(rawdoc,format)));
+		if (rawdoc.timestamp > since && rawdoc.timestamp < until) {
+			list.push_back(std::tuple(rawdoc.timestamp,rawdoc.revision,docdb.parseDocument(rawdoc,format)));
 		}
 	});
 
 	if (reversed) {
 		std::sort(list.begin(),list.end(), [&](auto &&a, auto &&b) {
-			return a.first > b.first;
+			return std::tie(std::get<0>(a),std::get<1>(a)) > std::tie(std::get<0>(b),std::get<1>(b));
 		});
 	} else {
 		std::sort(list.begin(),list.end(), [&](auto &&a, auto &&b) {
-			return a.first < b.first;
+			return std::tie(std::get<0>(a),std::get<1>(a)) < std::tie(std::get<0>(b),std::get<1>(b));
 		});
 	}
 
 	for (auto &&c: list) {
-		if (!callback(c.second)) break;
+		if (!callback(std::get<2>(c))) break;
 	}
 }
 
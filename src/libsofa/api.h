@@ -16,6 +16,7 @@
 #include "replication.h"
 #include "filter.h"
 #include "maintenancetask.h"
+#include "bootstraptask.h"
 
 namespace sofadb {
 
@@ -24,8 +25,8 @@ namespace sofadb {
 class SofaDB{
 public:
 
-	SofaDB(PKeyValueDatabase kvdatabase);
-	SofaDB(PKeyValueDatabase kvdatabase, Worker worker);
+	SofaDB(PKeyValueDatabase kvdatabase, PKeyValueDatabase durabledb = nullptr);
+	SofaDB(PKeyValueDatabase kvdatabase, Worker worker, PKeyValueDatabase durabledb = nullptr);
 	~SofaDB();
 
 	using Handle = DatabaseCore::Handle;
@@ -115,6 +116,20 @@ public:
 	 * @retval false stopped or not found
 	 */
 	bool allDocs(Handle db, OutputFormat outputFormat, const std::string_view &start_key, const std::string_view &end_key, ResultCB &&cb);
+	///List documents with the prefix, continues after given document
+	/**
+	 * @param db database handle
+	 * @param outputFormat output format
+	 * @param prefix name prefix
+	 * @param after id of the last document of the previous page. The listing seeks directly to the
+	 * next document, so the cost of the page doesn't depend on its position. Use empty string
+	 * for the first page
+	 * @param reversed set true to return results in reversed order
+	 * @param cb callback function which is called for every result. The callback can return false to stop reading
+	 * @retval true processed
+	 * @retval false stopped or not found
+	 */
+	bool allDocs(Handle db, OutputFormat outputFormat, const std::string_view &prefix, const std::string_view &after, bool reversed, ResultCB &&cb);
 
 
 	///Puts document to the database
@@ -131,6 +146,18 @@ public:
 	 * of revision
 	 */
 	PutStatus put(Handle db, const json::Value &doc, json::Value  &newrev);
+	///Puts multiple documents to the database in single batch
+	/**
+	 * @param db database handle
+	 * @param docs documents to put
+	 * @param atomic true to store all documents or nothing, false to store every document independently
+	 * @param status receives status for each document
+	 * @param newrevs receives new revision for each document
+	 *
+	 * @see DocumentDB::client_put_bulk
+	 */
+	void put(Handle db, const std::basic_string_view<json::Value> &docs, bool atomic,
+			std::vector<PutStatus> &status, std::vector<json::Value> &newrevs);
 	///Replicates document from other database
 	/**
 	 * @param db database handle
@@ -172,6 +199,19 @@ public:
 	 * @param callback
 	 */
 	void readDocChanges(Handle h, const std::string_view &id, Timestamp since, bool reversed,OutputFormat format, ResultCB &&callback);
+	///Reads historical changes on specified document in range of timestamps
+	/**
+	 * @param h handle
+	 * @param id document id
+	 * @param since revisions after this timestamp are returned
+	 * @param until revisions before this timestamp are returned
+	 * @param reversed return list starting by most recent revision
+	 * @param format output format
+	 * @param callback function called for every revision
+	 *
+	 * @note revisions with the same timestamp are ordered by their revision ID
+	 */
+	void readDocChanges(Handle h, const std::string_view &id, Timestamp since, Timestamp until, bool reversed,OutputFormat format, ResultCB &&callback);
 
 	///Erases document (sets is deleted)
 	/**
@@ -283,6 +323,8 @@ public:
 	DatabaseCore &getDBCore();
 	DocumentDB &getDocDB();
 	PEventRouter getEventRouter();
+	MaintenanceTask &getMaintenanceTask();
+	BootstrapTask &getBootstrapTask();
 
 
 protected:
@@ -292,6 +334,7 @@ protected:
 	DocumentDB docdb;
 	PEventRouter eventRouter;
 	MaintenanceTask mtask;
+	BootstrapTask btask;
 
 };
 
@@ -0,0 +1,166 @@
+/*
+ * bootstraptask.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <chrono>
+#include <vector>
+#include <shared/logOutput.h>
+#include "bootstraptask.h"
+#include "replicationserver.h"
+
+namespace sofadb {
+
+using ondra_shared::logInfo;
+using ondra_shared::logError;
+using ondra_shared::logWarning;
+
+class BootstrapTask::Follower: public ReplicationTask {
+public:
+	Follower(BootstrapTask &owner, Handle h, PProtocol &&source, PProtocol &&target)
+		:ReplicationTask(std::move(source), std::move(target)),owner(owner),h(h) {}
+
+	virtual void onUpdate(SeqNum seqnum) {
+		owner.updateSeqNum(h, seqnum);
+	}
+	virtual void onWarning(Side side, int code, std::string &&text) {
+		logWarning("Bootstrap replication of db $1: $2 $3 $4", h, static_cast<int>(side), code, text);
+	}
+
+protected:
+	BootstrapTask &owner;
+	Handle h;
+};
+
+BootstrapTask::BootstrapTask(DocumentDB &docdb):docdb(docdb),exitFlag(false) {}
+
+BootstrapTask::~BootstrapTask() {
+	stop();
+}
+
+void BootstrapTask::start(PEventRouter router, unsigned int threads) {
+	this->router = router;
+	exitFlag = false;
+	if (threads < 1) threads = 1;
+	thr = std::thread([=]{worker(threads);});
+}
+
+bool BootstrapTask::getStats(Handle h, Stats &stats) const {
+	Lock _(lock);
+	auto iter = this->stats.find(h);
+	if (iter == this->stats.end()) return false;
+	stats = iter->second;
+	return true;
+}
+
+void BootstrapTask::stop() {
+	exitFlag = true;
+	if (thr.joinable()) thr.join();
+	std::map<Handle, PFollower> f;
+	{
+		Lock _(lock);
+		std::swap(f, followers);
+	}
+	for (auto &&x: f) x.second->stop();
+}
+
+void BootstrapTask::updateSeqNum(Handle h, SeqNum seqnum) {
+	Lock _(lock);
+	auto iter = stats.find(h);
+	if (iter != stats.end()) iter->second.seqnum = seqnum;
+}
+
+void BootstrapTask::worker(unsigned int threads) {
+	DatabaseCore &core = docdb.getDBCore();
+	std::vector<std::pair<Handle, std::string> > dblist;
+	core.list([&](std::string_view, Handle h){
+		DatabaseCore::DBConfig cfg;
+		if ((h & DatabaseCore::memdb_mask) && core.getConfig(h, cfg) && !cfg.bootstrap.empty())
+			dblist.push_back(std::pair(h, cfg.bootstrap));
+		return true;
+	});
+
+	for (auto &&x: dblist) {
+		if (exitFlag) break;
+		Handle h = x.first;
+		Handle src = core.getHandle(x.second);
+		if (src == DatabaseCore::invalid_handle || (src & DatabaseCore::memdb_mask)) {
+			logWarning("Bootstrap of db $1: source '$2' is not a permanent database", h, x.second);
+			continue;
+		}
+		{
+			Lock _(lock);
+			Stats &st = stats[h];
+			st.source = x.second;
+			st.loading = true;
+		}
+		try {
+			auto start = std::chrono::steady_clock::now();
+			SeqNum seqnum;
+			std::size_t docs = load(h, src, seqnum, threads);
+			core.endBulkLoad(h);
+			std::size_t time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - start).count();
+			logInfo("Bootstrap $1 from $2: $3 documents in $4 ms", h, x.second, docs, time_ms);
+			if (exitFlag) break;
+
+			PFollower f(new Follower(*this, h,
+					ReplicationTask::PProtocol(new ReplicationServer(docdb, router, src)),
+					ReplicationTask::PProtocol(new ReplicationServer(docdb, router, h))));
+			ReplicationTask::Config rcfg = f->getConfig();
+			rcfg.initial_sync = false;
+			f->setConfig(rcfg);
+			Lock _(lock);
+			Stats &st = stats[h];
+			st.loading = false;
+			st.docs = docs;
+			st.time_ms = time_ms;
+			st.seqnum = seqnum;
+			f->start(seqnum, json::undefined, true);
+			followers[h] = std::move(f);
+		} catch (std::exception &e) {
+			logError("Bootstrap of db $1 failed: $2", h, e.what());
+			Lock _(lock);
+			stats[h].loading = false;
+		}
+	}
+}
+
+std::size_t BootstrapTask::load(Handle h, Handle src, SeqNum &seqnum, unsigned int threads) {
+	DatabaseCore &core = docdb.getDBCore();
+	PKeyValueDatabaseSnapshot snap = core.createSnapshot(src, seqnum);
+
+	//key space is split into ranges by first byte of the document id
+	std::atomic<unsigned int> nextRange(0);
+	std::atomic<std::size_t> count(0);
+	std::atomic<bool> failed(false);
+	std::mutex errlock;
+	std::string error;
+
+	auto copyWorker = [&] {
+		try {
+			unsigned int r;
+			while (!exitFlag && !failed && (r = nextRange++) < 256) {
+				std::string start(1, static_cast<char>(r));
+				std::string end(r == 255?std::string():std::string(1, static_cast<char>(r+1)));
+				if (r == 0) start.clear();
+				count += core.copyDocRange(h, snap, src, start, end);
+			}
+		} catch (std::exception &e) {
+			failed = true;
+			std::lock_guard<std::mutex> _(errlock);
+			error = e.what();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threads; i++) workers.push_back(std::thread(copyWorker));
+	copyWorker();
+	for (auto &&t: workers) t.join();
+	if (failed) throw std::runtime_error(error);
+	return count;
+}
+
+} /* namespace sofadb */
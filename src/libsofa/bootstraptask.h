@@ -0,0 +1,93 @@
+/*
+ * bootstraptask.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_LIBSOFA_BOOTSTRAPTASK_H_
+#define SRC_LIBSOFA_BOOTSTRAPTASK_H_
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "docdb.h"
+#include "eventrouter.h"
+#include "replicationtask.h"
+
+namespace sofadb {
+
+///Loads memory databases from permanent storage at startup
+/** Every memory database which has configured a bootstrap source (see
+ * DatabaseCore::DBConfig::bootstrap) is filled from a snapshot of the source database.
+ * The documents are copied directly between storages without parsing, the key space of
+ * the source is split into ranges by the first byte of the document id and the ranges
+ * are copied by multiple threads in parallel.
+ *
+ * When the copy is complete, the task starts continuous replication from the source
+ * database starting by the sequence number of the snapshot, so the memory
+ * database follows changes made after the snapshot was taken
+ */
+class BootstrapTask {
+public:
+	using Handle = DatabaseCore::Handle;
+
+	struct Stats {
+		///name of the source database
+		std::string source;
+		///true while documents are being copied
+		bool loading = false;
+		///count of copied documents
+		std::size_t docs = 0;
+		///duration of the copy in milliseconds
+		std::size_t time_ms = 0;
+		///sequence number of the source reached by the replication
+		SeqNum seqnum = 0;
+	};
+
+	BootstrapTask(DocumentDB &docdb);
+	~BootstrapTask();
+
+	///Starts the bootstrap at background
+	/**
+	 * @param router event router used by the replication
+	 * @param threads count of threads copying documents of single database
+	 */
+	void start(PEventRouter router, unsigned int threads);
+
+	///Retrieves statistics of the bootstrap
+	/**
+	 * @param h handle to memory database
+	 * @param stats receives statistics
+	 * @retval true success
+	 * @retval false database is not bootstrapped
+	 */
+	bool getStats(Handle h, Stats &stats) const;
+
+	///Stops the bootstrap and all replications
+	void stop();
+
+protected:
+
+	class Follower;
+	using PFollower = std::unique_ptr<Follower>;
+	using Lock = std::unique_lock<std::mutex>;
+
+	DocumentDB &docdb;
+	PEventRouter router;
+	mutable std::mutex lock;
+	std::map<Handle, Stats> stats;
+	std::map<Handle, PFollower> followers;
+	std::thread thr;
+	std::atomic<bool> exitFlag;
+
+	void worker(unsigned int threads);
+	std::size_t load(Handle h, Handle src, SeqNum &seqnum, unsigned int threads);
+	void updateSeqNum(Handle h, SeqNum seqnum);
+};
+
+} /* namespace sofadb */
+
+#endif /* SRC_LIBSOFA_BOOTSTRAPTASK_H_ */
@@ -12,12 +12,19 @@
 #include "keyformat.h"
 #include "kvapi_leveldb.h"
 #include "kvapi_memdb.h"
+#include <unordered_set>
 
 namespace sofadb {
 
-DatabaseCore::DatabaseCore(PKeyValueDatabase db):maindb(db) {
+///count of rows retrieved by single call of the iterator in scan loops
+static const std::size_t scanBatch = 64;
+
+std::string prefixLastKey(const std::string_view &prefix);
+
+DatabaseCore::DatabaseCore(PKeyValueDatabase db, PKeyValueDatabase durabledb):maindb(db),durabledb(durabledb) {
 
 	memdb = new MemDB;
+	if (this->durabledb == nullptr) this->durabledb = memdb;
 
 	idmap.clear();
 	dblist.clear();
@@ -25,9 +32,9 @@ DatabaseCore::DatabaseCore(PKeyValueDatabase db):maindb(db) {
 	loadDBs();
 }
 
-SeqNum DatabaseCore::getSeqNumFromDB(const std::string_view &prefix) {
+SeqNum DatabaseCore::getSeqNumFromDB(const PKeyValueDatabase &db, const std::string_view &prefix) {
 	SeqNum sq;
-	Iterator maxseq (maindb->findRange(prefix, true));
+	Iterator maxseq (db->findRange(prefix, true));
 
 	if (maxseq.getNext()) {
 		extract_from_key(maxseq->first,prefix.length(),sq);
@@ -41,22 +48,45 @@ SeqNum DatabaseCore::getSeqNumFromDB(const std::string_view &prefix) {
 void DatabaseCore::loadDBs() {
 	std::string key;
 
+	dblist.clear();
+	generations.clear();
+	dropped.clear();
+
+	key_drop_list(key);
+	Iterator diter (maindb->findRange(key));
+	while (diter.getNext()) {
+		Handle h;
+		extract_from_key(diter->first, 1, h);
+		dropped[h];
+		std::size_t slot = h & slot_mask;
+		if (generations.size() <= slot) generations.resize(slot+1, 0);
+		generations[slot] = h & generation_mask;
+	}
+
 	key_db_map(key);
 	Iterator iter (maindb->findRange(key));
-	dblist.clear();
 	loadDB(iter);
 }
 
 
-DatabaseCore::Handle DatabaseCore::allocSlot() {
-	std::size_t cnt = dblist.size();
-	for (std::size_t i = 0; i < cnt; i++) {
+DatabaseCore::Handle DatabaseCore::allocSlot(Handle mask) {
+	for (std::size_t i = 0; i <= slot_mask; i++) {
+		if (dblist.size() <= i) dblist.resize(i+1);
 		if (dblist[i] == nullptr) {
-			return i;
+			if (generations.size() <= i) generations.resize(i+1, 0);
+			Handle gen = generations[i];
+			//next generation of the slot, skip generations which are still waiting to sweep
+			for (Handle j = 0; j <= (generation_mask >> generation_shift); j++) {
+				gen = (gen + (1U << generation_shift)) & generation_mask;
+				Handle h = static_cast<Handle>(i) | gen | mask;
+				if (dropped.find(h) == dropped.end()) {
+					generations[i] = gen;
+					return h;
+				}
+			}
 		}
 	}
-	dblist.resize(cnt+1);
-	return cnt;
+	return invalid_handle;
 }
 
 DatabaseCore::Handle DatabaseCore::create(const std::string_view& name, Storage storage) {
@@ -69,9 +99,8 @@ DatabaseCore::Handle DatabaseCore::create(const std::string_view& name, Storage
 	if (xf != idmap.end()) return xf->second;
 	if (name.empty()) return invalid_handle;
 
-	Handle h = allocSlot();
-
-	if (storage == Storage::memory) h |= memdb_mask;
+	Handle h = allocSlot(storageMask(storage));
+	if (h == invalid_handle) return invalid_handle;
 
 	key_db_map(key,h);
 	serialize_value(value,name);
@@ -101,44 +130,39 @@ bool DatabaseCore::erase(Handle h) {
 	PInfo nfo = getDatabaseState(h);
 	if (nfo == nullptr) return false;
 
+	h = nfo->handle;
 	idmap.erase(nfo->name);
 
-	if (observer) observer(event_close, h,nfo->nextSeqNum);
-
 	onBatchClose(h,[h,this]() {
 
 		std::string key,value;
 
-		std::unique_ptr<Info> nfo (std::move(dblist[h]));
+		std::unique_ptr<Info> nfo;
+		{
+			std::lock_guard<std::recursive_mutex> _(lock);
+			nfo = std::move(dblist[h & slot_mask]);
+		}
 		if (nfo == nullptr) return;
 
-		PChangeset chst = selectDB(h)->createChangeset();
-
-
-		key_docs(key,h);
-		chst->erasePrefix(key);
-		key_doc_revs(key, h);
-		chst->erasePrefix(key);
-		key_dbconfig(key, h);
-		chst->erasePrefix(key);
-		key_seq(key, h);
-		chst->erasePrefix(key);
-		key_object_index(key, h);
-		chst->erasePrefix(key);
-		key_view_docs(key, h);
-		chst->erasePrefix(key);
-		key_view_map(key, h);
-		chst->erasePrefix(key);
-		key_view_state(key, h);
-		chst->erasePrefix(key);
-		chst->commit();
+		flushWriteState(*nfo);
 
-		chst = maindb->createChangeset();
+		//keys of the database are no longer reachable through any handle,
+		//they are deleted later by sweepDropped(). The drop list keeps the handle
+		//reserved until it is done
+		PChangeset chst = maindb->createChangeset();
 		key_db_map(key, h);
 		chst->erase(key);
+		key_drop_list(key, h);
+		serialize_value(value, nfo->name);
+		chst->put(key, value);
 		chst->commit();
 
-		flushWriteState(nfo->writeState);
+		{
+			std::lock_guard<std::recursive_mutex> _(lock);
+			dropped[h];
+		}
+
+		if (observer) observer(event_close, h,nfo->nextSeqNum);
 	});
 
 
@@ -147,15 +171,85 @@ bool DatabaseCore::erase(Handle h) {
 
 }
 
+std::vector<DatabaseCore::Handle> DatabaseCore::getDropped() const {
+	std::lock_guard<std::recursive_mutex> _(lock);
+	std::vector<Handle> out;
+	for (auto &&c: dropped) out.push_back(c.first);
+	return out;
+}
+
+std::size_t DatabaseCore::sweepDropped(Handle h, std::size_t limit) {
+	std::string cursor, start, end;
+	{
+		std::lock_guard<std::recursive_mutex> _(lock);
+		auto iter = dropped.find(h);
+		if (iter == dropped.end()) return 0;
+		cursor = iter->second;
+	}
+
+	PKeyValueDatabase db = selectDB(h);
+	PChangeset chst = db->createChangeset();
+	std::size_t cnt = 0;
+	//every family of the database is prefixed by the type and the handle
+	unsigned int first = cursor.empty()?static_cast<unsigned int>(IndexType::dbconfig):static_cast<unsigned char>(cursor[0]);
+	for (unsigned int t = first; t <= static_cast<unsigned int>(IndexType::object_index) && cnt < limit; t++) {
+		IndexType type = static_cast<IndexType>(t);
+		if (t == first && !cursor.empty()) start = cursor; else build_key(start, type, h);
+		build_key(end, type, h+1);
+		Iterator iter(db->findRange(start, end, ReadHint::bulk(ReadType::maintenance)));
+		while (cnt < limit && iter.getNext()) {
+			chst->erase(iter->first);
+			cursor = iter->first;
+			++cnt;
+		}
+	}
+	chst->commit();
+
+	if (cnt < limit) {
+		for (unsigned int t = static_cast<unsigned int>(IndexType::dbconfig); t <= static_cast<unsigned int>(IndexType::object_index); t++) {
+			build_key(start, static_cast<IndexType>(t), h);
+			build_key(end, static_cast<IndexType>(t), h+1);
+			db->compact(start, end);
+		}
+		chst = maindb->createChangeset();
+		key_drop_list(start, h);
+		chst->erase(start);
+		chst->commit();
+		std::lock_guard<std::recursive_mutex> _(lock);
+		dropped.erase(h);
+	} else {
+		std::lock_guard<std::recursive_mutex> _(lock);
+		dropped[h] = cursor;
+	}
+	return cnt;
+}
+
 DatabaseCore::PInfo DatabaseCore::getDatabaseState(Handle h) {
 	std::lock_guard<std::recursive_mutex> _(lock);
-	h &= index_mask;
-	if (h >= dblist.size()) return nullptr;
-	else return PInfo(dblist[h].get());
+	std::size_t slot = h & slot_mask;
+	if (slot >= dblist.size()) return nullptr;
+	Info *nfo = dblist[slot].get();
+	//handle of the dropped database doesn't match the new database in the slot
+	if (nfo == nullptr || ((nfo->handle ^ h) & index_mask) != 0) return nullptr;
+	return PInfo(nfo);
 }
 
-void DatabaseCore::flushWriteState(WriteState &st) {
-	if (st.curBatch != nullptr) st.curBatch->commit();
+void DatabaseCore::flushWriteState(Info &nfo) {
+	WriteState &st = nfo.writeState;
+	try {
+		if (st.curBatch != nullptr) st.curBatch->commit();
+	} catch (...) {
+		st.changes.clear();
+		st.eventSeq = 0;
+		throw;
+	}
+	if (!st.changes.empty()) nfo.recentChanges->push(st.changes);
+	//one event for whole batch, after the changes are visible
+	if (st.eventSeq) {
+		SeqNum seq = st.eventSeq;
+		st.eventSeq = 0;
+		if (observer) observer(event_update, st.eventHandle, seq);
+	}
 	while (!st.waiting.empty() && st.lockCount == 0) {
 		auto &&fn = std::move(st.waiting.front());
 		st.waiting.pop();
@@ -172,7 +266,10 @@ bool DatabaseCore::beginBatch(Handle h, bool exclusive ) {
 }
 
 PChangeset DatabaseCore::beginBatch(const PInfo &nfo) {
-	++nfo->writeState.lockCount;
+	if (nfo->writeState.lockCount++ == 0) {
+		nfo->writeState.batchSeq = nfo->nextSeqNum;
+		nfo->writeState.batchHistSeq = nfo->nextHistSeqNum;
+	}
 	if (nfo->writeState.curBatch == nullptr)
 		nfo->writeState.curBatch = selectDB(nfo->storage)->createChangeset();
 	return nfo->writeState.curBatch;
@@ -229,11 +326,23 @@ bool DatabaseCore::storeUpdate(Handle h, const RawDocument& doc) {
 	serialize_value(value,doc.revision,doc.docId);
 	//put it to database
 	chng->put(key,value);
+	//record change, it is published once the batch is committed
+	{
+		RecentChanges::Record rec;
+		rec.docid = doc.docId;
+		rec.revid = doc.revision;
+		rec.seqnum = seqid;
+		if (nfo->recentChanges->isKeepDocs()) {
+			document2value(value, doc, seqid);
+			rec.value = std::make_shared<std::string>(std::move(value));
+		}
+		nfo->writeState.changes.push_back(std::move(rec));
+	}
+	nfo->writeState.eventSeq = seqid;
+	nfo->writeState.eventHandle = h;
 	//all done
 	endBatch(nfo);
 
-	if (observer) observer(event_update, h, seqid);
-
 	return true;
 }
 
@@ -276,50 +385,72 @@ void DatabaseCore::endBatch(Handle h) {
 	endBatch(nfo);
 }
 
-bool DatabaseCore::findDoc(Handle h, const std::string_view& docid, RawDocument& content, std::string &storage) {
+void DatabaseCore::abortBatch(Handle h) {
+	PInfo nfo = getDatabaseState(h);
+	if (nfo == nullptr) return ;
+	WriteState &st = nfo->writeState;
+	if (st.lockCount == 0) return;
+	if (st.curBatch != nullptr) st.curBatch->rollback();
+	st.changes.clear();
+	st.eventSeq = 0;
+	nfo->nextSeqNum = st.batchSeq;
+	nfo->nextHistSeqNum = st.batchHistSeq;
+	endBatch(nfo);
+}
+
+bool DatabaseCore::findDoc(Handle h, const std::string_view& docid, RawDocument& content, PinnedValue &storage, const ReadHint &hint) {
 	std::string key;
 	key_docs(key, h, docid);
-	if (!selectDB(h)->lookup(key,storage)) return false;
+	if (!selectDB(h)->lookupPinned(key,storage,hint)) return false;
 	value2document(storage, content);
 	content.docId = docid;
 	return true;
 }
 
-bool DatabaseCore::findDoc(Handle h, const std::string_view& docid, RevID revid, RawDocument& content, std::string &storage) {
+bool DatabaseCore::findDoc(Handle h, const std::string_view& docid, RevID revid, RawDocument& content, PinnedValue &storage, const ReadHint &hint) {
 	std::string key;
 	key_docs(key, h, docid);
 	PKeyValueDatabase db = selectDB(h);
-	if (!db->lookup(key,storage)) return false;
+	if (!db->lookupPinned(key,storage,hint)) return false;
 	value2document(storage, content);
 	content.docId = docid;
 	if (content.revision != revid) {
 		key_doc_revs(key,h,docid,revid);
-		if (!db->lookup(key,storage)) return false;
+		if (!db->lookupPinned(key,storage,hint)) return false;
 		SeqNum sq;
-		extract_value(storage, sq);
+		extract_value(storage.data(), sq);
 		key_object_index(key, h, sq);
-		if (!db->lookup(key, storage)) return false;
+		if (!db->lookupPinned(key, storage, hint)) return false;
 	}
 	value2document(storage, content);
 	return true;
 }
 
+bool DatabaseCore::findDoc(Handle h, const ChangeRec &rc, RawDocument &content, PinnedValue &storage, const ReadHint &hint) {
+	if (rc.value.empty()) return findDoc(h, rc.docid, rc.revid, content, storage, hint);
+	value2document(rc.value, content);
+	content.docId = rc.docid;
+	return true;
+}
+
 bool DatabaseCore::enumAllRevisions(Handle h, const std::string_view& docid,
 		std::function<void(const RawDocument&)> callback) {
 
-	std::string key,value;
+	std::string key;
+	PinnedValue value;
 	RawDocument docinfo;
 	docinfo.docId = docid;
-	if (!findDoc(h, docid, docinfo, key)) return false;
+	if (!findDoc(h, docid, docinfo, value)) return false;
 	callback(docinfo);
 	key_doc_revs(key, h, docid);
+	_misc::addSep(key);
 	auto db = selectDB(h);
 	Iterator iter(db->findRange(key));
 	while (iter.getNext()) {
 		SeqNum sq;
 		extract_value(iter->second, sq);
 		key_object_index(key, h ,sq);
-		if (db->lookup(key, value)) {
+		if (db->lookupPinned(key, value)) {
 			value2document(value, docinfo);
 			callback(docinfo);
 		}
@@ -331,18 +462,31 @@ void DatabaseCore::eraseDoc(Handle h, const std::string_view& docid, KeySet &mod
 	PInfo nfo = getDatabaseState(h);
 	if (nfo == nullptr) return ;
 
-	std::string key;
+	std::string key,value;
+	RawDocument topdoc;
 
 
 	PChangeset chng = beginBatch(nfo);
-	enumAllRevisions(h, docid,[&](const RawDocument &docinf) {
-		key_doc_revs(key, h, docid, docinf.revision);
-		chng->erase(key);
-		key_seq(key, h, docinf.seq_number);
+	//historical revisions
+	key_doc_revs(key, h, docid);
+	_misc::addSep(key);
+	Iterator iter(selectDB(h)->findRange(key));
+	while (iter.getNext()) {
+		SeqNum sq;
+		extract_value(iter->second, sq);
+		key_object_index(value, h, sq);
+		chng->erase(value);
+		chng->erase(iter->first);
+	}
+	//current revision
+	PinnedValue storage;
+	if (findDoc(h, docid, topdoc, storage)) {
+		key_seq(key, h, topdoc.seq_number);
 		chng->erase(key);
-	});
+	}
 	key_docs(key,h, docid);
 	chng->erase(key);
+	nfo->recentChanges->erase(docid);
 
 /*	for (auto &&v : nfo->viewState) {
 		view_updateDocument(h, v.first, docid, std::basic_string_view<ViewUpdateRow>(), modifiedKeys);
@@ -374,17 +518,20 @@ void DatabaseCore::eraseHistoricalDoc(Handle h, const std::string_view& docid, R
 }
 
 bool DatabaseCore::enumDocs(Handle h, const std::string_view& prefix,
-		 bool reversed, std::function<bool(const RawDocument&)> callback) {
+		 bool reversed, std::function<bool(const RawDocument&)> callback, const ReadHint &hint) {
 
 	RawDocument dinfo;
 	std::string key;
 	key_docs(key,h,prefix);
-	Iterator iter(selectDB(h)->findRange(key, reversed));
+	Iterator iter(selectDB(h)->findRange(key, reversed, hint));
 	auto skip = key.length() - prefix.length();
-	while (iter.getNext()) {
-		value2document(iter->second, dinfo);
-		extract_from_key(iter->first, skip, dinfo.docId);
-		if (!callback(dinfo)) return false;
+	KeyValue rows[scanBatch];
+	while (std::size_t n = iter.getNextBatch(rows, scanBatch)) {
+		for (std::size_t i = 0; i < n; i++) {
+			value2document(rows[i].second, dinfo);
+			extract_from_key(rows[i].first, skip, dinfo.docId);
+			if (!callback(dinfo)) return false;
+		}
 	}
 	return true;
 
@@ -392,21 +539,242 @@ bool DatabaseCore::enumDocs(Handle h, const std::string_view& prefix,
 
 bool DatabaseCore::enumDocs(Handle h, const std::string_view& start_include,
 		const std::string_view& end_exclude,
-		std::function<bool(const RawDocument&)> callback) {
+		std::function<bool(const RawDocument&)> callback, const ReadHint &hint) {
 
 	RawDocument dinfo;
 	std::string key1, key2;
 	key_docs(key1,h,start_include);
 	key_docs(key2,h,end_exclude);
-	Iterator iter(selectDB(h)->findRange(key1, key2));
+	Iterator iter(selectDB(h)->findRange(key1, key2, hint));
 	auto skip = key1.length() - start_include.length();
-	while (iter.getNext()) {
+	KeyValue rows[scanBatch];
+	while (std::size_t n = iter.getNextBatch(rows, scanBatch)) {
+		for (std::size_t i = 0; i < n; i++) {
+			value2document(rows[i].second, dinfo);
+			extract_from_key(rows[i].first, skip, dinfo.docId);
+			if (!callback(dinfo)) return false;
+		}
+	}
+	return true;
+
+}
+
+bool DatabaseCore::enumDocs(Handle h, const std::string_view &prefix, const std::string_view &after, bool reversed,
+		std::function<bool(const RawDocument &)> callback, const ReadHint &hint) {
+
+	if (after.empty()) return enumDocs(h, prefix, reversed, std::move(callback), hint);
+
+	RawDocument dinfo;
+	std::string pfx, key1, key2;
+	key_docs(pfx,h,prefix);
+	auto skip = pfx.length() - prefix.length();
+	key_docs(key1,h,after);
+	if (reversed) {
+		//reversed range excludes both keys, the key of empty id is below all documents
+		key_docs(key2,h);
+	} else {
+		key1.push_back(0);
+		key2 = prefixLastKey(pfx);
+	}
+	Iterator iter(selectDB(h)->findRange(key1, key2, hint));
+	KeyValue rows[scanBatch];
+	while (std::size_t n = iter.getNextBatch(rows, scanBatch)) {
+		for (std::size_t i = 0; i < n; i++) {
+			if (rows[i].first.substr(0, pfx.length()) != pfx) return true;
+			value2document(rows[i].second, dinfo);
+			extract_from_key(rows[i].first, skip, dinfo.docId);
+			if (!callback(dinfo)) return false;
+		}
+	}
+	return true;
+}
+
+PKeyValueDatabaseSnapshot DatabaseCore::createSnapshot(Handle h, SeqNum &seqnum) {
+	PInfo nfo = getDatabaseState(h);
+	if (nfo == nullptr) return nullptr;
+
+	PKeyValueDatabaseSnapshot snap = selectDB(h)->createSnapshot();
+	std::string key;
+	key_seq(key, h);
+	Iterator iter(snap->findRange(key, true));
+	if (iter.getNext()) extract_from_key(iter->first, key.length(), seqnum);
+	else seqnum = 0;
+	return snap;
+}
+
+bool DatabaseCore::readDocRange(const PKeyValueDatabaseSnapshot &snap, Handle h, const std::string_view &start_exclude,
+		std::size_t limit, std::function<void(const RawDocument &, bool)> &&callback) {
+
+	RawDocument dinfo, hinfo;
+	std::string key1, key2, hkey;
+	std::vector<std::string> okeys;
+	const ReadHint hint = ReadHint::bulk(ReadType::replication);
+	key_docs(key1, h, start_exclude);
+	auto skip = key1.length() - start_exclude.length();
+	//first key above start_exclude
+	if (!start_exclude.empty()) key1.push_back(0);
+	key_docs(key2, h+1);
+	Iterator iter(snap->findRange(key1, key2, hint));
+	while (limit) {
+		if (!iter.getNext()) return false;
 		value2document(iter->second, dinfo);
 		extract_from_key(iter->first, skip, dinfo.docId);
-		if (!callback(dinfo)) return false;
+		callback(dinfo, false);
+		//separator prevents to match documents having this id as prefix
+		key_doc_revs(hkey, h, dinfo.docId);
+		_misc::addSep(hkey);
+		Iterator hiter(snap->findRange(hkey, false, hint));
+		okeys.clear();
+		while (hiter.getNext()) {
+			SeqNum sq;
+			extract_value(hiter->second, sq);
+			okeys.push_back(std::string());
+			key_object_index(okeys.back(), h, sq);
+		}
+		//historical revisions are read by single batched lookup
+		snap->lookupMulti(std::vector<std::string_view>(okeys.begin(), okeys.end()),
+				[&](std::size_t, const std::string_view &value) {
+			value2document(value, hinfo);
+			hinfo.docId = dinfo.docId;
+			callback(hinfo, true);
+		}, hint);
+		--limit;
 	}
-	return true;
+	return iter.getNext();
+}
+
+std::size_t DatabaseCore::copyDocRange(Handle h, const PKeyValueDatabaseSnapshot &snap, Handle src,
+		const std::string_view &start_include, const std::string_view &end_exclude) {
+
+	//documents are copied by chunks, each chunk is written by single changeset
+	static const std::size_t chunkSize = 1000;
+
+	struct DocRec {
+		std::string docId;
+		std::string value;
+		std::vector<std::string> history;
+	};
+
+	std::string key1, key2, hkey, value;
+	std::vector<std::string> okeys;
+	const ReadHint hint = ReadHint::bulk(ReadType::replication);
+	key_docs(key1, src, start_include);
+	auto skip = key1.length() - start_include.length();
+	if (end_exclude.empty()) key_docs(key2, src+1);
+	else key_docs(key2, src, end_exclude);
+	Iterator iter(snap->findRange(key1, key2, hint));
+	PKeyValueDatabase db = selectDB(h);
+	std::vector<DocRec> chunk;
+	std::size_t count = 0;
+	bool eof = false;
+
+	while (!eof) {
+		chunk.clear();
+		std::size_t histCount = 0;
+		while (chunk.size() < chunkSize) {
+			if (!iter.getNext()) {
+				eof = true;
+				break;
+			}
+			DocRec rec;
+			std::string_view docId;
+			extract_from_key(iter->first, skip, docId);
+			rec.docId = docId;
+			rec.value = iter->second;
+			key_doc_revs(hkey, src, docId);
+			_misc::addSep(hkey);
+			Iterator hiter(snap->findRange(hkey, false, hint));
+			okeys.clear();
+			while (hiter.getNext()) {
+				SeqNum sq;
+				extract_value(hiter->second, sq);
+				okeys.push_back(std::string());
+				key_object_index(okeys.back(), src, sq);
+			}
+			snap->lookupMulti(std::vector<std::string_view>(okeys.begin(), okeys.end()),
+					[&](std::size_t, const std::string_view &value) {
+				rec.history.push_back(std::string(value));
+			}, hint);
+			histCount += rec.history.size();
+			chunk.push_back(std::move(rec));
+		}
+		if (chunk.empty()) break;
 
+		//the write lock is held until the chunk is committed, so a client's write can't
+		//be committed between the check and the write below. It also serializes allocation
+		//of the sequence numbers with the other copying threads and the clients
+		Lock lk = lockWrite(h);
+		PInfo nfo = getDatabaseState(h);
+		if (nfo == nullptr) return count;
+		//documents written by clients during the load are newer, they are not overwritten.
+		//This includes documents in the batch which is not committed yet
+		std::unordered_set<std::string_view> pending;
+		for (auto &&c: nfo->writeState.changes) pending.insert(c.docid);
+		std::size_t docCount = 0;
+		for (auto &&rec: chunk) {
+			key_docs(key1, h, rec.docId);
+			if (pending.find(rec.docId) != pending.end() || db->lookup(key1, value)) {
+				histCount -= rec.history.size();
+				rec.docId.clear();
+			} else {
+				++docCount;
+			}
+		}
+		SeqNum seq = nfo->nextSeqNum;
+		nfo->nextSeqNum += docCount;
+		SeqNum histSeq = nfo->nextHistSeqNum;
+		nfo->nextHistSeqNum += histCount;
+
+		PChangeset chng = db->createChangeset();
+		RawDocument doc;
+		RecentChanges::RecordList changes;
+		changes.reserve(docCount);
+		for (auto &&rec: chunk) {
+			if (rec.docId.empty()) continue;
+			value2document(rec.value, doc);
+			doc.docId = rec.docId;
+			document2value(value, doc, seq);
+			key_docs(key1, h, rec.docId);
+			chng->put(key1, value);
+			{
+				RecentChanges::Record chrec;
+				chrec.docid = doc.docId;
+				chrec.revid = doc.revision;
+				chrec.seqnum = seq;
+				if (nfo->recentChanges->isKeepDocs()) chrec.value = std::make_shared<std::string>(value);
+				changes.push_back(std::move(chrec));
+			}
+			key_seq(key1, h, seq);
+			serialize_value(value, doc.revision, doc.docId);
+			chng->put(key1, value);
+			++seq;
+			for (auto &&hv: rec.history) {
+				value2document(hv, doc);
+				doc.docId = rec.docId;
+				key_doc_revs(key1, h, rec.docId, doc.revision);
+				serialize_value(value, histSeq, doc.timestamp);
+				chng->put(key1, value);
+				key_object_index(key1, h, histSeq);
+				chng->put(key1, hv);
+				++histSeq;
+			}
+		}
+		chng->commit();
+		//still under the lock, so the records are pushed in order of sequence numbers
+		nfo->recentChanges->push(changes);
+		count += docCount;
+	}
+	return count;
+}
+
+void DatabaseCore::endBulkLoad(Handle h) {
+	SeqNum seq;
+	{
+		PInfo nfo = getDatabaseState(h);
+		if (nfo == nullptr) return;
+		seq = nfo->nextSeqNum - 1;
+	}
+	if (observer) observer(event_update, h, seq);
 }
 
 bool DatabaseCore::findDocBySeqNum(Handle h, SeqNum seqNum, DocID &docid) {
@@ -418,24 +786,53 @@ bool DatabaseCore::findDocBySeqNum(Handle h, SeqNum seqNum, DocID &docid) {
 
 }
 
+std::shared_ptr<RecentChanges> DatabaseCore::getRecentChanges(Handle h) {
+	PInfo nfo = getDatabaseState(h);
+	if (nfo == nullptr) return nullptr;
+	return nfo->recentChanges;
+}
+
 SeqNum DatabaseCore::readChanges(Handle h, SeqNum from, bool reversed,
-		std::function<bool(const ChangeRec &)>&& fn)  {
+		std::function<bool(const ChangeRec &)>&& fn, const ReadHint &hint)  {
+
+	if (!reversed) {
+		//serve from recent changes while 'from' is inside of the window
+		//records are copied by chunks, so the database is not locked during callback
+		std::shared_ptr<RecentChanges> rch = getRecentChanges(h);
+		if (rch != nullptr) {
+			RecentChanges::RecordList chunk;
+			while (rch->read(from, 64, chunk)) {
+				if (chunk.empty()) return from;
+				for (auto &&r: chunk) {
+					from = r.seqnum;
+					std::string_view value;
+					if (r.value != nullptr) value = *r.value;
+					if (!fn(ChangeRec({r.docid, r.revid, r.seqnum, value}))) return from;
+				}
+			}
+			//window moved away, continue by reading the database
+		}
+	}
+
 	std::string key1, key2;
 	int adj = reversed?0:1;
 	key_seq(key1, h, from+adj);
 	key_seq(key2, h);
 	std::size_t skip = key2.length();
 	key_seq(key2, h+adj, 0);
-	Iterator iter(selectDB(h)->findRange(key1, key2));
+	Iterator iter(selectDB(h)->findRange(key1, key2, hint));
 
 	std::string_view docId;
 	SeqNum seq = from;
 	RevID revid;
+	KeyValue rows[scanBatch];
 
-	while (iter.getNext()) {
-		extract_value(iter->second,revid,docId);
-		extract_from_key(iter->first, skip, seq);
-		if (!fn(ChangeRec({docId,revid,seq}))) return seq;
+	while (std::size_t n = iter.getNextBatch(rows, scanBatch)) {
+		for (std::size_t i = 0; i < n; i++) {
+			extract_value(rows[i].second,revid,docId);
+			extract_from_key(rows[i].first, skip, seq);
+			if (!fn(ChangeRec({docId,revid,seq,std::string_view()}))) return seq;
+		}
 	}
 	return seq;
 }
@@ -445,7 +842,7 @@ void DatabaseCore::endBatch(const PInfo &nfo) {
 	if (nfo->writeState.lockCount > 0) {
 		--nfo->writeState.lockCount;
 		if (nfo->writeState.lockCount == 0) {
-			flushWriteState(nfo->writeState);
+			flushWriteState(*nfo.ptr);
 		}
 	}
 }
@@ -504,12 +901,8 @@ bool DatabaseCore::rename(Handle h, const std::string_view& newname) {
 void DatabaseCore::setObserver(Observer&& observer) {
 	std::lock_guard<std::recursive_mutex> _(lock);
 	this->observer = std::move(observer);
-	Handle h = 0;
 	for (auto &&c: dblist) {
-		if (c != nullptr) this->observer(event_create,
-				(c->storage == Storage::memory?memdb_mask:0)|h,
-				c->nextSeqNum-1);
-		++h;
+		if (c != nullptr) this->observer(event_create, c->handle, c->nextSeqNum-1);
 	}
 }
 
@@ -524,6 +917,17 @@ void json2dbconfig(json::Value data, DatabaseCore::DBConfig &cfg) {
 	if (v.defined()) cfg.history_min_count = v.getUInt();
 	v = data["logsize"];
 	if (v.defined()) cfg.logsize = v.getUInt();
+	v = data["changes_cache"];
+	if (v.defined()) cfg.changes_cache = v.getUInt();
+	v = data["changes_cache_docs"];
+	if (v.defined()) cfg.changes_cache_docs = v.getBool();
+	v = data["tombstone_ttl"];
+	if (v.defined()) cfg.tombstone_ttl = v.getUInt();
+	v = data["bootstrap"];
+	if (v.defined()) {
+		std::string_view src = v.getString();
+		cfg.bootstrap = src;
+	}
 }
 
 bool DatabaseCore::loadDBConfig(Handle h, DBConfig &cfg) {
@@ -545,7 +949,11 @@ json::Value dbconfig2json(const DatabaseCore::DBConfig &cfg) {
 		   ("history_max_count",cfg.history_max_count)
 		   ("history_max_deleted",cfg.history_max_deleted)
 		   ("history_min_count",cfg.history_min_count)
-		   ("logsize",cfg.logsize);
+		   ("logsize",cfg.logsize)
+		   ("changes_cache",cfg.changes_cache)
+		   ("changes_cache_docs",cfg.changes_cache_docs)
+		   ("tombstone_ttl",cfg.tombstone_ttl)
+		   ("bootstrap",cfg.bootstrap.empty()?json::Value():json::Value(cfg.bootstrap));
 
 	return obj;
 }
@@ -563,6 +971,9 @@ bool DatabaseCore::storeDBConfig(Handle h, const DBConfig &cfg) {
 	key_dbconfig(key,h,"config");
 	PChangeset chs = maindb->createChangeset();
 	chs->put(key, value);
+	if (dbf->cfg.changes_cache != cfg.changes_cache || dbf->cfg.changes_cache_docs != cfg.changes_cache_docs) {
+		dbf->recentChanges->reset(cfg.changes_cache, cfg.changes_cache_docs, dbf->nextSeqNum-1);
+	}
 	dbf->cfg = cfg;
 	chs->commit();
 	return true;
@@ -575,6 +986,80 @@ bool DatabaseCore::getConfig(Handle h, DBConfig &cfg)  {
 	return true;
 }
 
+bool DatabaseCore::storeProperty(Handle h, const std::string_view &name, const json::Value &value) {
+	std::string key,data;
+	PInfo dbf = getDatabaseState(h);
+	if (dbf == nullptr) return false;
+
+	value.serializeBinary(JsonTarget(data), json::compressKeys);
+	key_dbconfig(key,h,name);
+	PChangeset chs = beginBatch(dbf);
+	chs->put(key, data);
+	endBatch(dbf);
+	return true;
+}
+
+bool DatabaseCore::loadProperty(Handle h, const std::string_view &name, json::Value &value) {
+	std::string key,data;
+	key_dbconfig(key,h,name);
+	if (!selectDB(h)->lookup(key,data)) return false;
+	std::string_view src(data);
+	value = json::Value::parseBinary(JsonSource(src),json::utf8encoding);
+	return true;
+}
+
+bool DatabaseCore::eraseProperty(Handle h, const std::string_view &name) {
+	std::string key;
+	PInfo dbf = getDatabaseState(h);
+	if (dbf == nullptr) return false;
+
+	key_dbconfig(key,h,name);
+	PChangeset chs = beginBatch(dbf);
+	chs->erase(key);
+	endBatch(dbf);
+	return true;
+}
+
+static const std::string_view checkpoint_prefix("repl.");
+
+bool DatabaseCore::storeCheckpoint(Handle h, const std::string_view &name, SeqNum seqnum) {
+	std::string pname(checkpoint_prefix);
+	pname.append(name);
+	return storeProperty(h, pname, seqnum);
+}
+
+bool DatabaseCore::eraseCheckpoint(Handle h, const std::string_view &name) {
+	std::string pname(checkpoint_prefix);
+	pname.append(name);
+	return eraseProperty(h, pname);
+}
+
+bool DatabaseCore::getMinCheckpoint(Handle h, SeqNum &seqnum) {
+	std::string key;
+	key_dbconfig(key,h,checkpoint_prefix);
+	Iterator iter(selectDB(h)->findRange(key));
+	bool found = false;
+	while (iter.getNext()) {
+		std::string_view src(iter->second);
+		SeqNum sq = json::Value::parseBinary(JsonSource(src),json::utf8encoding).getUInt();
+		if (!found || sq < seqnum) seqnum = sq;
+		found = true;
+	}
+	return found;
+}
+
+void DatabaseCore::compact(Handle h, SeqNum from, SeqNum to, const std::string_view &first_doc, const std::string_view &last_doc) {
+	std::string key1, key2;
+	PKeyValueDatabase db = selectDB(h);
+	key_seq(key1, h, from);
+	key_seq(key2, h, to+1);
+	db->compact(key1, key2);
+	key_docs(key1, h, first_doc);
+	key_docs(key2, h, last_doc);
+	key2.push_back(0);
+	db->compact(key1, key2);
+}
+
 std::size_t DatabaseCore::getMaxLogSize(Handle h)  {
 	PInfo dbf = getDatabaseState(h);
 	if (dbf == nullptr) return 0;
@@ -591,16 +1076,18 @@ struct HistStat {
 	SeqNum sq;
 };
 
-bool DatabaseCore::cleanHistory(Handle h, const std::string_view &docid, const RevMap &revision_map) {
+bool DatabaseCore::cleanHistory(Handle h, const std::string_view &docid, const RevMap &revision_map, std::size_t *erased) {
 
 	RawDocument topdoc;
+	PinnedValue storage;
 	std::string key;
-	if (!findDoc(h,docid,topdoc, key)) return false;
+	if (!findDoc(h,docid,topdoc, storage)) return false;
 
 	DBConfig cfg;
 	getConfig(h,cfg);
 
 	key_doc_revs(key, h, docid);
+	_misc::addSep(key);
 	auto db = selectDB(h);
 	Iterator iter(db->findRange(key));
 
@@ -609,7 +1096,7 @@ bool DatabaseCore::cleanHistory(Handle h, const std::string_view &docid, const R
 
 	while (iter.getNext()) {
 		HistStat h;
-		extract_from_key(iter->first, key.length()+2, h.rev);
+		extract_from_key(iter->first, key.length(), h.rev);
 		auto iter2 = revision_map.find(h.rev);
 		if (iter2 == revision_map.end()) {
 			todel.push_back(h.rev);
@@ -672,6 +1159,7 @@ bool DatabaseCore::cleanHistory(Handle h, const std::string_view &docid, const R
 		for (auto &&c: todel) {
 			eraseHistoricalDoc(h,docid,c);
 		}
+		if (erased) *erased += todel.size();
 		endBatch(h);
 	} catch (...) {
 		endBatch(h);
@@ -681,10 +1169,23 @@ bool DatabaseCore::cleanHistory(Handle h, const std::string_view &docid, const R
 }
 
 PKeyValueDatabase DatabaseCore::selectDB(Handle h) const {
-	if (h & memdb_mask) return memdb; else return maindb;
+	if (h & memdb_mask) return memdb;
+	else if (h & durable_mask) return durabledb;
+	else return maindb;
 }
 PKeyValueDatabase DatabaseCore::selectDB(Storage storage) const {
-	if (storage == Storage::memory) return memdb; else return maindb;
+	switch (storage) {
+	case Storage::memory: return memdb;
+	case Storage::durable: return durabledb;
+	default: return maindb;
+	}
+}
+DatabaseCore::Handle DatabaseCore::storageMask(Storage storage) {
+	switch (storage) {
+	case Storage::memory: return memdb_mask;
+	case Storage::durable: return durable_mask;
+	default: return 0;
+	}
 }
 
 
@@ -695,22 +1196,32 @@ void DatabaseCore::loadDB(Iterator &iter) {
 		std::string_view name;
 		extract_from_key(iter->first, 1, h);
 		extract_value(iter->second, name);
-		std::size_t idx = h & index_mask;
+		std::size_t idx = h & slot_mask;
 		if (dblist.size()<=idx)
 			dblist.resize(idx+1);
+		if (generations.size()<=idx)
+			generations.resize(idx+1, 0);
+		generations[idx] = h & generation_mask;
 
 		auto nfo = std::make_unique<Info>();
 
 		nfo->name = name;
+		nfo->handle = h;
 		idmap[nfo->name] = h;
 
 		if ((h & memdb_mask) == 0) {
 
+			PKeyValueDatabase db = selectDB(h);
 			key_seq(key, h);
-			nfo->nextSeqNum = getSeqNumFromDB(key);
+			nfo->nextSeqNum = getSeqNumFromDB(db, key);
 			key_object_index(key, h);
-			nfo->nextHistSeqNum = getSeqNumFromDB(key);
-			nfo->storage = Storage::permanent;
+			nfo->nextHistSeqNum = getSeqNumFromDB(db, key);
+			if (h & durable_mask) {
+				nfo->storage = Storage::durable;
+				if (db == memdb) ondra_shared::logWarning("Durable storage is not configured, database '$1' is held in memory only", nfo->name);
+			} else {
+				nfo->storage = Storage::permanent;
+			}
 
 		} else {
 			nfo->nextSeqNum = 1;
@@ -719,11 +1230,13 @@ void DatabaseCore::loadDB(Iterator &iter) {
 		}
 
 		loadDBConfig(h,nfo->cfg);
+		nfo->recentChanges = std::make_shared<RecentChanges>(nfo->cfg.changes_cache, nfo->cfg.changes_cache_docs, nfo->nextSeqNum-1);
 
 
 
-		key_view_state(key,idx);
-		Iterator vi ( maindb->findRange(key,false) );
+		//view states are stored along with the views
+		key_view_state(key,h);
+		Iterator vi ( selectDB(h)->findRange(key,false) );
 		while (vi.getNext()) {
 			std::uint32_t viewid;
 			extract_from_key(vi->first, key.length(), viewid);
@@ -989,11 +1502,14 @@ SeqNum DatabaseCore::view_list(Handle h, ViewID viewId,
 		extract_value(value,num);
 		key_view_map(key,h,viewId,prefix);
 		Iterator iter(snap->findRange(key,reversed));
-		while (iter.getNext()) {
-			std::string_view kv,docId;
-			extract_from_key(iter->first, key.length()-prefix.length(), kv, docId);
-			if (!callback(ViewResult{docId,kv,iter->second}))
-				break;
+		KeyValue rows[scanBatch];
+		while (std::size_t n = iter.getNextBatch(rows, scanBatch)) {
+			for (std::size_t i = 0; i < n; i++) {
+				std::string_view kv,docId;
+				extract_from_key(rows[i].first, key.length()-prefix.length(), kv, docId);
+				if (!callback(ViewResult{docId,kv,rows[i].second}))
+					return num;
+			}
 		}
 	}
 	return num;
@@ -1020,11 +1536,14 @@ SeqNum DatabaseCore::view_list(Handle h, ViewID viewId,
 		key_view_map(key1,h,viewId,start_key);
 		key_view_map(key2,h,viewId,end_key);
 		Iterator iter(snap->findRange(key1,key2));
-		while (iter.getNext()) {
-			std::string_view kv,docId;
-			extract_from_key(iter->first, key1.length()-start_key.length(), kv, docId);
-			if (!callback(ViewResult{docId,kv,iter->second}))
-				break;
+		KeyValue rows[scanBatch];
+		while (std::size_t n = iter.getNextBatch(rows, scanBatch)) {
+			for (std::size_t i = 0; i < n; i++) {
+				std::string_view kv,docId;
+				extract_from_key(rows[i].first, key1.length()-start_key.length(), kv, docId);
+				if (!callback(ViewResult{docId,kv,rows[i].second}))
+					return num;
+			}
 		}
 	}
 	return num;
@@ -1035,7 +1554,7 @@ bool DatabaseCore::view_update(Handle h, ViewID viewId, std::size_t limit, ViewU
 		try {
 			SeqNum seqnum = view_getSeqNum(h,viewId);
 			std::string_view docId;
-			std::string tmp;
+			PinnedValue tmp;
 			std::basic_string<std::pair<std::string, std::string> > kvdata;
 
 			ViewEmitFn emitFn = [&](std::string_view key, std::string_view value) {
@@ -13,8 +13,10 @@
 #include <vector>
 #include <queue>
 #include <memory>
+#include <imtjson/value.h>
 #include "types.h"
 #include "kvapi.h"
+#include "recentchanges.h"
 #include <mutex>
 #include <functional>
 #include <unordered_set>
@@ -23,7 +25,9 @@
 namespace sofadb {
 enum class Storage {
 	permanent,
-	memory
+	memory,
+	///memory database persisted by the write-ahead log (see DurableMemDB)
+	durable
 };
 
 class DatabaseCore {
@@ -41,7 +45,15 @@ public:
 	typedef std::uint32_t Handle;
 	static const Handle invalid_handle = static_cast<Handle>(-1);
 	static const Handle memdb_mask = 0x80000000;
-	static const Handle index_mask = 0x7FFFFFFF;
+	static const Handle durable_mask = 0x40000000;
+	static const Handle index_mask = 0x3FFFFFFF;
+	///index bits of the handle consist of the slot and the generation of the slot
+	/** Generation is increased every time the slot is reused, so the keys of the dropped
+	 * database (which are swept later) never collide with keys of the new database
+	 */
+	static const Handle slot_mask = 0x000FFFFF;
+	static const Handle generation_mask = 0x3FF00000;
+	static const unsigned int generation_shift = 20;
 
 	typedef std::function<void()> Callback;
 	typedef std::function<void(ObserverEvent, Handle, SeqNum)> Observer;
@@ -92,12 +104,36 @@ public:
 		 * deleted documents.
 		 */
 		std::size_t history_max_deleted = 0;
+		///Count of recent changes kept in memory
+		/** Readers of changes which are not too far behind are served from memory without
+		 * need to scan the database. Set 0 to disable
+		 */
+		std::size_t changes_cache = 1000;
+		///Keep also documents of recent changes in memory
+		/** Readers then don't need to lookup documents. It costs memory, so enable this only
+		 * for databases with many subscribers
+		 */
+		bool changes_cache_docs = false;
+		///Age of tombstones in milliseconds after which they are purged from the database. Set 0 to keep them forever
+		/** Tombstone is purged with all its revisions. It is purged only if it was already
+		 * processed by all registered replications and by all peers of the replication
+		 * listener (see storeCheckpoint)
+		 */
+		std::size_t tombstone_ttl = 0;
+		///Name of a permanent database used to bootstrap this memory database
+		/** When set, the memory database is loaded from the source database at startup
+		 * and then it follows changes of the source (see BootstrapTask). Ignored for
+		 * permanent databases
+		 */
+		std::string bootstrap;
 	};
 
 	struct ChangeRec {
 		std::string_view docid;
 		RevID revid;
 		SeqNum seqnum;
+		///serialized document, if available (otherwise empty). Use findDoc(h, ChangeRec, ...)
+		std::string_view value;
 	};
 
 	struct ViewResult {
@@ -115,6 +151,15 @@ private:
 		PChangeset curBatch;
 		unsigned int lockCount = 0;
 		std::queue<Callback> waiting;
+		///changes stored in current batch, they are published to recent changes after commit
+		RecentChanges::RecordList changes;
+		///last sequence number stored in current batch, the observer is notified after commit (0 - no change)
+		SeqNum eventSeq = 0;
+		///handle of the database for the observer
+		Handle eventHandle = 0;
+		///sequence numbers when the batch was opened, they are restored when the batch is aborted
+		SeqNum batchSeq = 0;
+		SeqNum batchHistSeq = 0;
 	};
 
 	struct ViewState {
@@ -135,11 +180,13 @@ private:
 
 	struct Info {
 		std::string name;
+		Handle handle;
 		SeqNum nextSeqNum = 1;
 		SeqNum nextHistSeqNum = 1;
 		Storage storage;
 
 		DBConfig cfg;
+		std::shared_ptr<RecentChanges> recentChanges;
 
 		std::recursive_mutex lock;
 		WriteState writeState;
@@ -175,11 +222,21 @@ private:
 
 public:
 
-	DatabaseCore(PKeyValueDatabase db);
+	///Constructor
+	/**
+	 * @param db permanent storage
+	 * @param durabledb storage of durable databases. If not set, durable databases
+	 * are held in memory only
+	 */
+	DatabaseCore(PKeyValueDatabase db, PKeyValueDatabase durabledb = nullptr);
 
 
 	Handle create(const std::string_view &name, Storage storage = Storage::permanent);
 	Handle getHandle(const std::string_view &name) const;
+	///Drops the database
+	/** The database disappears immediately, its keys are deleted later by sweepDropped().
+	 * The handle is never reused while the keys are not deleted
+	 */
 	bool erase(Handle h);
 	bool rename(Handle h, const std::string_view &newname);
 
@@ -271,17 +328,28 @@ public:
 	///Closes batch and flushes all changes to DB
 	void endBatch(Handle h);
 
+	///Closes batch and discards all its changes
+	/** Nothing written to the batch is stored, and no event is generated. The batch is
+	 * shared, so changes of the other openers are discarded too. Intended for the
+	 * opener of the outermost batch, which holds lockWrite()
+	 *
+	 * @param h handle to database
+	 */
+	void abortBatch(Handle h);
+
 
 	///Retrieve single document from the database
 	/**
 	 * @param h handle to database
 	 * @param docid ID of document
 	 * @param content this structure is filled by content
-	 * @param storage used to hold actual content of the document because RawDocument doesn't have space for the data
+	 * @param storage holds actual content of the document because RawDocument doesn't have space for the data.
+	 * The content is pinned in the storage when possible, so it is not copied
+	 * @param hint read hint
 	 * @retval true found
 	 * @retval false not found
 	 */
-	bool findDoc(Handle h, const std::string_view &docid, RawDocument &content, std::string &storage);
+	bool findDoc(Handle h, const std::string_view &docid, RawDocument &content, PinnedValue &storage, const ReadHint &hint = ReadHint());
 
 	///Retrieve historical document from the database
 	/**
@@ -290,11 +358,27 @@ public:
 	 * @param docid document id
 	 * @param revid revision id
 	 * @param content this strutcure is filled by content
-	 * @param storage used to hold actual content of the document because RawDocument doesn't have space for the data
+	 * @param storage holds actual content of the document because RawDocument doesn't have space for the data.
+	 * The content is pinned in the storage when possible, so it is not copied
+	 * @param hint read hint
+	 * @retval true found
+	 * @retval false not found
+	 */
+	bool findDoc(Handle h, const std::string_view &docid, RevID revid, RawDocument &content, PinnedValue &storage, const ReadHint &hint = ReadHint());
+
+	///Retrieve document of the change record
+	/** If the change record carries the document (from recent changes), it is decoded without lookup.
+	 *
+	 * @param h handle to database
+	 * @param rc change record
+	 * @param content this strutcure is filled by content
+	 * @param storage holds actual content of the document because RawDocument doesn't have space for the data.
+	 * The content is pinned in the storage when possible, so it is not copied
+	 * @param hint read hint
 	 * @retval true found
 	 * @retval false not found
 	 */
-	bool findDoc(Handle h, const std::string_view &docid, RevID revid, RawDocument &content, std::string &storage);
+	bool findDoc(Handle h, const ChangeRec &rc, RawDocument &content, PinnedValue &storage, const ReadHint &hint = ReadHint());
 
 
 	///Lists all revisions of the document
@@ -337,8 +421,75 @@ public:
 	void eraseHistoricalDoc(Handle h, const std::string_view &docid, RevID revision);
 
 
-	bool enumDocs(Handle h, const std::string_view &prefix,  bool reversed, std::function<bool(const RawDocument &)> callback);
-	bool enumDocs(Handle h, const std::string_view &start_include, const std::string_view &end_exclude, std::function<bool(const RawDocument &)> callback);
+	///Enumerates documents
+	/** Enumeration is a bulk scan, by default it doesn't fill the cache (see ReadHint) */
+	bool enumDocs(Handle h, const std::string_view &prefix,  bool reversed, std::function<bool(const RawDocument &)> callback,
+			const ReadHint &hint = ReadHint::bulk(ReadType::enum_docs));
+	bool enumDocs(Handle h, const std::string_view &start_include, const std::string_view &end_exclude, std::function<bool(const RawDocument &)> callback,
+			const ReadHint &hint = ReadHint::bulk(ReadType::enum_docs));
+	///Enumerates documents with the prefix, continues after given document
+	/**
+	 * @param h handle to database
+	 * @param prefix prefix of the document id
+	 * @param after id of the last document of the previous page. Enumeration seeks directly to
+	 * the next document (previous document if reversed). Empty string starts at beginning of the prefix
+	 * @param reversed enumerate in reversed order
+	 * @param callback called for every document
+	 * @param hint read hint
+	 * @retval true processed
+	 * @retval false stopped
+	 */
+	bool enumDocs(Handle h, const std::string_view &prefix, const std::string_view &after, bool reversed,
+			std::function<bool(const RawDocument &)> callback, const ReadHint &hint = ReadHint::bulk(ReadType::enum_docs));
+
+	///Creates snapshot of the database
+	/**
+	 * @param h handle to database
+	 * @param seqnum receives sequence number of the last change visible in the snapshot
+	 * @return snapshot, or nullptr if database doesn't exist
+	 *
+	 * @note snapshots of the memory storage keep old versions of modified keys until they are released
+	 */
+	PKeyValueDatabaseSnapshot createSnapshot(Handle h, SeqNum &seqnum);
+
+	///Reads documents from the snapshot ordered by document id, including historical revisions
+	/**
+	 * @param snap snapshot (see createSnapshot)
+	 * @param h handle to database
+	 * @param start_exclude id of the last document of the previous range. Use empty string to start at the beginning
+	 * @param limit maximum count of documents
+	 * @param callback function called for current revision of each document (history = false)
+	 * followed by all historical revisions of that document (history = true)
+	 * @retval true there are more documents
+	 * @retval false end of the database reached
+	 */
+	bool readDocRange(const PKeyValueDatabaseSnapshot &snap, Handle h, const std::string_view &start_exclude,
+			std::size_t limit, std::function<void(const RawDocument &, bool history)> &&callback);
+
+	///Copies range of documents from a snapshot of other database
+	/** Documents including historical revisions are written directly to the storage of the
+	 * target database and they receive new sequence numbers. The function doesn't check
+	 * conflicts, it is intended to fill an empty database. Documents which already exist
+	 * in the target database are skipped, because they were written by clients during the load
+	 * and they are newer. Each chunk is written under the write lock (see lockWrite) and
+	 * published to the recent changes. It can be called from multiple threads for different ranges.
+	 * Call endBulkLoad() when all ranges are copied
+	 *
+	 * @param h target database
+	 * @param snap snapshot of the source database (see createSnapshot)
+	 * @param src handle of the source database
+	 * @param start_include first document id of the range
+	 * @param end_exclude end of the range, use empty string to copy until end of the database
+	 * @return count of copied documents
+	 */
+	std::size_t copyDocRange(Handle h, const PKeyValueDatabaseSnapshot &snap, Handle src,
+			const std::string_view &start_include, const std::string_view &end_exclude);
+
+	///Finishes bulk load of the database
+	/** Notifies observers about new sequence number
+	 * @param h handle to database
+	 */
+	void endBulkLoad(Handle h);
 
 	///Finds document by sequence number if exists
 	/**
@@ -356,9 +507,11 @@ public:
 	 * @param from seqnum where reading starts
 	 * @param reversed set true to read backward (from present to history)
 	 * @param fn function called with every result
+	 * @param hint read hint of changes which are not in the recent changes. By default the scan doesn't fill the cache
 	 * @return SeqNum of last result, if zero returned, then no records are found for this DB
 	 */
-	SeqNum readChanges(Handle h, SeqNum from, bool reversed, std::function<bool(const ChangeRec &)> &&fn);
+	SeqNum readChanges(Handle h, SeqNum from, bool reversed, std::function<bool(const ChangeRec &)> &&fn,
+			const ReadHint &hint = ReadHint::bulk(ReadType::changes));
 
 
 	///Sets observer
@@ -383,6 +536,83 @@ public:
 
 	bool getConfig(Handle h, DBConfig &cfg) ;
 
+	///Stores a property of the database
+	/** The property is written through the current batch of the database, so it is
+	 * stored atomically with other changes made in the batch
+	 *
+	 * @param h handle to database
+	 * @param name name of the property
+	 * @param value value
+	 * @retval true stored
+	 * @retval false database not found
+	 */
+	bool storeProperty(Handle h, const std::string_view &name, const json::Value &value);
+
+	///Loads a property of the database
+	/**
+	 * @param h handle to database
+	 * @param name name of the property
+	 * @param value receives the value
+	 * @retval true found
+	 * @retval false not found
+	 */
+	bool loadProperty(Handle h, const std::string_view &name, json::Value &value);
+
+	///Erases a property of the database
+	/**
+	 * @param h handle to database
+	 * @param name name of the property
+	 * @retval true erased
+	 * @retval false database not found
+	 */
+	bool eraseProperty(Handle h, const std::string_view &name);
+
+	///Stores checkpoint of a replication which reads the database
+	/** Tombstones are not purged until all registered replications process them
+	 *
+	 * @param h handle to database
+	 * @param name name of the replication
+	 * @param seqnum sequence number processed by the replication
+	 * @retval true stored
+	 * @retval false database not found
+	 */
+	bool storeCheckpoint(Handle h, const std::string_view &name, SeqNum seqnum);
+
+	///Removes replication checkpoint
+	bool eraseCheckpoint(Handle h, const std::string_view &name);
+
+	///Retrieves lowest replication checkpoint
+	/**
+	 * @param h handle to database
+	 * @param seqnum receives lowest checkpoint
+	 * @retval true found
+	 * @retval false there is no checkpoint
+	 */
+	bool getMinCheckpoint(Handle h, SeqNum &seqnum);
+
+	///Requests compaction of the storage for the range of changes and documents
+	/** Call this after large amount of keys has been erased
+	 *
+	 * @param h handle to database
+	 * @param from first sequence number
+	 * @param to last sequence number
+	 * @param first_doc first document id
+	 * @param last_doc last document id
+	 */
+	void compact(Handle h, SeqNum from, SeqNum to, const std::string_view &first_doc, const std::string_view &last_doc);
+
+	///Retrieves handles of dropped databases which keys were not deleted yet
+	std::vector<Handle> getDropped() const;
+
+	///Deletes keys of the dropped database
+	/**
+	 * @param h handle of the dropped database
+	 * @param limit maximum count of keys deleted by the call
+	 * @return count of deleted keys. If the count is less than limit, the sweep is complete,
+	 * the range is compacted and the database is removed from the list of dropped databases
+	 */
+	std::size_t sweepDropped(Handle h, std::size_t limit);
+
 	bool setConfig(Handle h, const DBConfig &cfg);
 
 	std::size_t getMaxLogSize(Handle h) ;
@@ -397,9 +627,10 @@ public:
 	 * 	this map are deleted. Revisions included in this map may be saved. If the
 	 * 	revision is marked with true (as value in map), the revision is always saved.
 	 * 	Other revisions are saved only if they are not too old depend on database configuration
+	 * @param erased (optional) pointer to variable, which is increased by count of erased revisions
 	 * @return
 	 */
-	bool cleanHistory(Handle h, const std::string_view &docid, const RevMap &revision_map);
+	bool cleanHistory(Handle h, const std::string_view &docid, const RevMap &revision_map, std::size_t *erased = nullptr);
 
 	///Prevents writes to other threads while the lock is held
 	Lock lockWrite(Handle h);
@@ -526,18 +757,23 @@ public:
 
 protected:
 
-	PKeyValueDatabase maindb,memdb;
+	PKeyValueDatabase maindb,memdb,durabledb;
 	DBList dblist;
 	NameToIDMap idmap;
 	mutable std::recursive_mutex lock;
 	Observer observer;
+	///last generation of every slot
+	std::vector<Handle> generations;
+	///dropped databases waiting to sweep, value contains last deleted key
+	std::map<Handle, std::string> dropped;
 
 
 
 
-	Handle allocSlot() ;
+	Handle allocSlot(Handle mask) ;
 
-	void flushWriteState(WriteState &st);
+	void flushWriteState(Info &nfo);
+	std::shared_ptr<RecentChanges> getRecentChanges(Handle h);
 	PInfo getDatabaseState(Handle h);
 	PChangeset beginBatch(const PInfo &nfo);
 	void endBatch(const PInfo &nfo);
@@ -560,10 +796,11 @@ protected:
 	bool storeDBConfig(Handle h, const DBConfig &cfg);
 
 	void storeToHistory(PInfo dbf, Handle h, const RawDocument &doc);
-	SeqNum getSeqNumFromDB(const std::string_view &prefix);
+	SeqNum getSeqNumFromDB(const PKeyValueDatabase &db, const std::string_view &prefix);
 
 	PKeyValueDatabase selectDB(Handle h) const;
 	PKeyValueDatabase selectDB(Storage storage) const;
+	static Handle storageMask(Storage storage);
 
 	void loadDB(Iterator &iter);
 
@@ -5,6 +5,8 @@
  *      Author: ondra
  */
 
+#include <condition_variable>
+#include <mutex>
 #include <unordered_set>
 #include <imtjson/array.h>
 #include <imtjson/object.h>
@@ -14,6 +16,7 @@
 #include <imtjson/operations.h>
 #include <imtjson/string.h>
 #include <libsofa/keyformat.h>
+#include <libsofa/fasthash.h>
 #include <libsofa/merge.h>
 #include <shared/logOutput.h>
 #include "merge_logs.h"
@@ -82,6 +85,72 @@ json::Value DocumentDB::serializeStrRevArr(const json::Value &arr){
 DocumentDB::DocumentDB(DatabaseCore& core):core(core) {
 }
 
+void DocumentDB::setWorker(Worker worker) {
+	this->worker = worker;
+}
+
+const DocumentDB::Worker *DocumentDB::getWorker() const {
+	return worker?&*worker:nullptr;
+}
+
+void DocumentDB::forEachChunk(std::size_t cnt, std::size_t chunk, const std::function<void(std::size_t, std::size_t)> &fn) const {
+	//count of helper tasks queued to the worker by one call, the worker limits count of threads
+	static const std::size_t maxHelpers = 16;
+
+	if (!worker || cnt <= chunk) {
+		fn(0, cnt);
+		return;
+	}
+
+	//state is shared with the helpers, a helper can start after the call returns. Such helper
+	//doesn't find a free chunk, so it never calls the function
+	struct State {
+		std::mutex lock;
+		std::condition_variable cond;
+		std::size_t next = 0;
+		std::size_t cnt;
+		std::size_t chunk;
+		std::size_t active = 0;
+		const std::function<void(std::size_t, std::size_t)> *fn;
+		std::exception_ptr error;
+
+		void run() {
+			std::unique_lock<std::mutex> lk(lock);
+			while (next < cnt) {
+				std::size_t b = next;
+				std::size_t e = std::min(b + chunk, cnt);
+				next = e;
+				++active;
+				lk.unlock();
+				try {
+					(*fn)(b, e);
+				} catch (...) {
+					lk.lock();
+					if (!error) error = std::current_exception();
+					next = cnt;
+					lk.unlock();
+				}
+				lk.lock();
+				if (--active == 0) cond.notify_all();
+			}
+		}
+	};
+
+	auto st = std::make_shared<State>();
+	st->cnt = cnt;
+	st->chunk = chunk;
+	st->fn = &fn;
+	std::size_t helpers = std::min((cnt + chunk - 1) / chunk - 1, maxHelpers);
+	Worker w = *worker;
+	for (std::size_t i = 0; i < helpers; i++) {
+		w >> [st] {st->run();};
+	}
+	st->run();
+	std::unique_lock<std::mutex> lk(st->lock);
+	st->cond.wait(lk, [&]{return st->active == 0;});
+	if (st->error) std::rethrow_exception(st->error);
+}
+
 PutStatus DocumentDB::createPayload(const json::Value &doc, json::Value &payload) {
 
 	Value data = doc["data"];
@@ -95,23 +164,33 @@ PutStatus DocumentDB::createPayload(const json::Value &doc, json::Value &payload
 
 json::Value DocumentDB::get(Handle h, const std::string_view& id, OutputFormat oform) {
 	DatabaseCore::RawDocument rdoc;
-	std::string tmp;
+	PinnedValue tmp;
 	if (!core.findDoc(h,id,rdoc,tmp)) return nullptr;
 	return parseDocument(rdoc, oform);
 }
 
 json::Value DocumentDB::get(Handle h, const std::string_view& id, const std::string_view& rev, OutputFormat oform) {
 	DatabaseCore::RawDocument rdoc;
-	std::string tmp;
+	PinnedValue tmp;
 	if (!core.findDoc(h,id,parseStrRev(rev), rdoc,tmp)) return nullptr;
 	return parseDocument(rdoc, oform);
 }
 
+void DocumentDB::serializeBody(const json::Value &conflicts, const json::Value &data, std::string &out) {
+	conflicts.stripKey().serializeBinary(JsonTarget(out),0);
+	data.stripKey().serializeBinary(JsonTarget(out),json::compressKeys);
+}
+
+void DocumentDB::serializePayload(const json::Value &newhst, const std::string_view &body,  std::string &tmp) {
+	tmp.clear();
+	newhst.stripKey().serializeBinary(JsonTarget(tmp),0);
+	tmp.append(body);
+}
+
 void DocumentDB::serializePayload(const json::Value &newhst, const json::Value &conflicts, const json::Value &payload,  std::string &tmp) {
 	tmp.clear();
 	newhst.stripKey().serializeBinary(JsonTarget(tmp),0);
-	conflicts.stripKey().serializeBinary(JsonTarget(tmp),0);
-	payload.stripKey().serializeBinary(JsonTarget(tmp),json::compressKeys);
+	serializeBody(conflicts, payload, tmp);
 }
 
 PutStatus DocumentDB::json2rawdoc(const json::Value &doc, DatabaseCore::RawDocument  &rawdoc, bool new_edit) {
@@ -139,7 +218,7 @@ PutStatus DocumentDB::json2rawdoc(const json::Value &doc, DatabaseCore::RawDocum
 	rawdoc.docId = id;
 	rawdoc.revision = rev;
 	rawdoc.timestamp = timestamp;
-	rawdoc.version = 0;
+	rawdoc.version = (new_edit || doc["revhash"].getUInt() == 0)?0:version_rev_hash;
 	rawdoc.seq_number = 0;
 	return PutStatus::stored;
 }
@@ -168,20 +247,31 @@ PutStatus DocumentDB::loadDataConflictsLog(const json::Value &doc,
 	return PutStatus::stored;
 }
 
-RevID DocumentDB::calcRevisionID(json::Value data,json::Value conflicts, json::Value timestamp, json::Value deleted) {
+RevID DocumentDB::calcRevisionIDFNV(json::Value data,json::Value conflicts, json::Value timestamp, json::Value deleted) {
 	RevID newRev;
 	Value({data, conflicts, timestamp, deleted}).serializeBinary(FNV1a<sizeof(RevID)>(newRev),0);
 	return newRev;
 }
 
+RevID DocumentDB::calcRevisionID(const std::string_view &body, std::uint64_t timestamp, bool deleted) {
+	//timestamp and deleted flag are mixed into the seed, so the body is hashed only once
+	std::uint64_t seed = (timestamp << 1) | (deleted?1:0);
+	return static_cast<RevID>(FastHash64::hash(body, seed));
+}
+
 json::Value DocumentDB::convertClientPut2ReplicatorPut(json::Value doc) {
+	std::string body;
+	return convertClientPut2ReplicatorPut(doc, body);
+}
+
+json::Value DocumentDB::convertClientPut2ReplicatorPut(json::Value doc, std::string &body) {
 	Object newdoc;
-	Value data = doc["data"];
-	Value id = doc["id"];
 	Value conflicts = doc["conflicts"];
-	Value timestamp = getTimestamp();
+	std::uint64_t timestamp = getTimestamp();
 	Value deleted = doc["deleted"];
-	RevID newRev = calcRevisionID(data,conflicts,timestamp,deleted);
+	body.clear();
+	serializeBody(parseStrRevArr(conflicts), doc["data"], body);
+	RevID newRev = calcRevisionID(body,timestamp,deleted.getBool());
 
 	newdoc.set(doc["id"]);
 	newdoc.set(doc["data"]);
@@ -190,6 +280,7 @@ json::Value DocumentDB::convertClientPut2ReplicatorPut(json::Value doc) {
 	newdoc.set("timestamp", timestamp);
 	newdoc.set("deleted", deleted);
 	newdoc.set("conflicts", conflicts);
+	newdoc.set("revhash", rev_hash_fast);
 
 	return newdoc;
 }
@@ -197,11 +288,12 @@ json::Value DocumentDB::convertClientPut2ReplicatorPut(json::Value doc) {
 
 PutStatus DocumentDB::client_put(Handle h, const json::Value &doc, json::Value &outrev) {
 
-	Value conv = convertClientPut2ReplicatorPut(doc);
+	std::string body;
+	Value conv = convertClientPut2ReplicatorPut(doc, body);
 	String mergerev;
 	outrev = conv["rev"].toString();
 
-	auto st = replicator_put(h, conv,mergerev);
+	auto st = replicator_put(h, conv,mergerev, body);
 	if (st == PutStatus::merged) {
 		outrev = {outrev,  mergerev};
 	}
@@ -224,7 +316,8 @@ PutStatus DocumentDB::client_put(Handle h, const json::Value &doc, json::Value &
 	RevID newRev = calcRevisionID(data,conflicts,rawdoc.timestamp,rawdoc.deleted);
 	bool prevrev_ndefined = doc["rev"].getString().empty();
 
-	bool exists = core.findDoc(h,rawdoc.docId,prevdoc, tmp);
+	PinnedValue prevstorage;
+	bool exists = core.findDoc(h,rawdoc.docId,prevdoc, prevstorage);
 	if (exists) {
 		if (prevrev_ndefined) {
 			if (prevdoc.deleted) {
@@ -258,10 +351,12 @@ PutStatus DocumentDB::client_put(Handle h, const json::Value &doc, json::Value &
 
 
 PutStatus DocumentDB::replicator_put(Handle h, const json::Value &doc, json::String &outrev) {
+	return replicator_put(h, doc, outrev, std::string_view());
+}
+
+PutStatus DocumentDB::replicator_put(Handle h, const json::Value &doc, json::String &outrev, const std::string_view &body) {
 	DatabaseCore::RawDocument rawdoc;
-	DatabaseCore::RawDocument prevdoc;
 	std::string tmp;
-	Value newhst;
 	Value data;
 	Value conflicts;
 	Value log;
@@ -275,10 +370,23 @@ PutStatus DocumentDB::replicator_put(Handle h, const json::Value &doc, json::Str
 	if (st != PutStatus::stored) return st;
 
 	auto lock = core.lockWrite(h);
+	st = replicator_store(h, rawdoc, data, conflicts, log, body, tmp);
+	lock.unlock();
+
+	if (st == PutStatus::conflict) return replicator_merge(h, doc, outrev);
+	if (st == PutStatus::stored) outrev = doc["rev"].toString();
+	return st;
+}
+
+PutStatus DocumentDB::replicator_connect(Handle h, const DatabaseCore::RawDocument &rawdoc, const json::Value &conflicts,
+		const json::Value &log, bool &present, json::Value &newhst) {
+	DatabaseCore::RawDocument prevdoc;
+	PinnedValue prevstorage;
 
-	if (core.findDoc(h, rawdoc.docId, rawdoc.revision, prevdoc, tmp)) return PutStatus::stored;
+	present = core.findDoc(h, rawdoc.docId, rawdoc.revision, prevdoc, prevstorage);
+	if (present) return PutStatus::stored;
 
-	bool exists = core.findDoc(h,rawdoc.docId, prevdoc, tmp);
+	bool exists = core.findDoc(h,rawdoc.docId, prevdoc, prevstorage);
 	if (exists) {
 		Array hl;
 		bool found = false;
@@ -301,15 +409,7 @@ PutStatus DocumentDB::replicator_put(Handle h, const json::Value &doc, json::Str
 					break;
 				}
 			}
-			if (!found) {
-				lock.unlock();
-				Value resolved;
-				if (resolveConflict(h, doc, resolved) && isSuccess(replicator_put(h, resolved, outrev))) {
-						replicator_put_history(h, doc);
-						return PutStatus::merged;
-				}
-				return PutStatus::conflict;
-			}
+			if (!found) return PutStatus::conflict;
 		} else {
 			Value hst = Value::parseBinary(JsonSource(prevdoc.payload));
 			for (Value c:hst) hl.push_back(c.getUInt());
@@ -318,14 +418,187 @@ PutStatus DocumentDB::replicator_put(Handle h, const json::Value &doc, json::Str
 	} else {
 		newhst = parseStrRevArr(log);
 	}
-	serializePayload(newhst, parseStrRevArr(conflicts), data, tmp);
+	return PutStatus::stored;
+}
+
+PutStatus DocumentDB::replicator_store(Handle h, DatabaseCore::RawDocument &rawdoc, const json::Value &data,
+		const json::Value &conflicts, const json::Value &log, const std::string_view &body, std::string &tmp) {
+	Value newhst;
+	bool present;
+
+	PutStatus st = replicator_connect(h, rawdoc, conflicts, log, present, newhst);
+	if (st != PutStatus::stored || present) return st;
+	if (body.empty()) serializePayload(newhst, parseStrRevArr(conflicts), data, tmp);
+	else serializePayload(newhst, body, tmp);
 	rawdoc.payload = tmp;
 	core.storeUpdate(h,rawdoc);
 	tmp.clear();
-	outrev = doc["rev"].toString();
 	return PutStatus::stored;
 }
 
+PutStatus DocumentDB::replicator_merge(Handle h, const json::Value &doc, json::String &outrev) {
+	Value resolved;
+	if (resolveConflict(h, doc, resolved) && isSuccess(replicator_put(h, resolved, outrev))) {
+			replicator_put_history(h, doc);
+			return PutStatus::merged;
+	}
+	return PutStatus::conflict;
+}
+
+void DocumentDB::replicator_put_bulk(Handle h, const std::basic_string_view<json::Value> &docs, std::vector<PutStatus> &status,
+		const std::basic_string_view<json::Value> &history) {
+
+	struct Prepared {
+		DatabaseCore::RawDocument rawdoc;
+		Value data;
+		Value conflicts;
+		Value log;
+	};
+
+	std::size_t cnt = docs.size();
+	std::vector<Prepared> prep(cnt);
+	status.resize(cnt);
+
+	//validate documents before the database is locked
+	for (std::size_t i = 0; i < cnt; i++) {
+		Prepared &p = prep[i];
+		status[i] = json2rawdoc(docs[i], p.rawdoc, false);
+		if (status[i] == PutStatus::stored)
+			status[i] = loadDataConflictsLog(docs[i], &p.data, &p.conflicts, &p.log);
+	}
+
+	std::vector<std::size_t> conflicted;
+	{
+		auto lock = core.lockWrite(h);
+		if (!core.beginBatch(h)) {
+			for (auto &&st: status) if (st == PutStatus::stored) st = PutStatus::db_not_found;
+			return;
+		}
+		try {
+			std::unordered_set<std::string_view> ids;
+			std::string tmp;
+			//history is written first, invalid revisions are skipped
+			for (auto &&c: history) replicator_put_history(h, c);
+			for (std::size_t i = 0; i < cnt; i++) {
+				if (status[i] != PutStatus::stored) continue;
+				Prepared &p = prep[i];
+				//lookups don't see uncommitted changes, so commit the batch when document repeats
+				if (!ids.insert(p.rawdoc.docId).second) {
+					core.endBatch(h);
+					core.beginBatch(h);
+					ids.clear();
+					ids.insert(p.rawdoc.docId);
+				}
+				status[i] = replicator_store(h, p.rawdoc, p.data, p.conflicts, p.log, std::string_view(), tmp);
+				if (status[i] == PutStatus::conflict) conflicted.push_back(i);
+			}
+		} catch (...) {
+			//nothing of the failed batch is written
+			core.abortBatch(h);
+			throw;
+		}
+		core.endBatch(h);
+	}
+
+	//conflicts are merged one by one, merge needs to read the stored documents
+	json::String dummy;
+	for (std::size_t i: conflicted) {
+		status[i] = replicator_merge(h, docs[i], dummy);
+	}
+}
+
+void DocumentDB::client_put_bulk(Handle h, const std::basic_string_view<json::Value> &docs, bool atomic,
+		std::vector<PutStatus> &status, std::vector<json::Value> &revs) {
+
+	struct Prepared {
+		Value conv;
+		std::string body;
+		DatabaseCore::RawDocument rawdoc;
+		Value data;
+		Value conflicts;
+		Value log;
+	};
+
+	//documents prepared in one step, batches up to this size are prepared in the calling thread
+	static const std::size_t chunk = 64;
+
+	std::size_t cnt = docs.size();
+	std::vector<Prepared> prep(cnt);
+	status.resize(cnt);
+	revs.resize(cnt);
+
+	//conversion, validation and hashing don't need the database, so they run in parallel
+	forEachChunk(cnt, chunk, [&](std::size_t b, std::size_t e) {
+		for (std::size_t i = b; i < e; i++) {
+			Prepared &p = prep[i];
+			p.conv = convertClientPut2ReplicatorPut(docs[i], p.body);
+			revs[i] = p.conv["rev"].toString();
+			status[i] = json2rawdoc(p.conv, p.rawdoc, false);
+			if (status[i] == PutStatus::stored)
+				status[i] = loadDataConflictsLog(p.conv, &p.data, &p.conflicts, &p.log);
+		}
+	});
+
+	std::vector<std::size_t> conflicted;
+	{
+		auto lock = core.lockWrite(h);
+		if (!core.beginBatch(h)) {
+			for (auto &&st: status) if (st == PutStatus::stored) st = PutStatus::db_not_found;
+			return;
+		}
+		try {
+			std::string tmp;
+			bool ok = true;
+			if (atomic) {
+				//check every document before anything is written, the database is locked, so the
+				//result of the check is valid while the batch is written. Repeated document
+				//can't be checked, because it is connected to the uncommitted revision
+				std::unordered_set<std::string_view> ids;
+				Value newhst;
+				bool present;
+				for (std::size_t i = 0; i < cnt; i++) {
+					if (status[i] == PutStatus::stored) {
+						if (!ids.insert(prep[i].rawdoc.docId).second) status[i] = PutStatus::conflict;
+						else status[i] = replicator_connect(h, prep[i].rawdoc, prep[i].conflicts, prep[i].log, present, newhst);
+					}
+					ok = ok && status[i] == PutStatus::stored;
+				}
+				if (!ok) {
+					for (auto &&st: status) if (st == PutStatus::stored) st = PutStatus::aborted;
+				}
+			}
+			if (ok) {
+				std::unordered_set<std::string_view> ids;
+				for (std::size_t i = 0; i < cnt; i++) {
+					if (status[i] != PutStatus::stored) continue;
+					Prepared &p = prep[i];
+					//lookups don't see uncommitted changes, so commit the batch when document repeats
+					if (!ids.insert(p.rawdoc.docId).second) {
+						core.endBatch(h);
+						core.beginBatch(h);
+						ids.clear();
+						ids.insert(p.rawdoc.docId);
+					}
+					status[i] = replicator_store(h, p.rawdoc, p.data, p.conflicts, p.log, p.body, tmp);
+					if (status[i] == PutStatus::conflict) conflicted.push_back(i);
+				}
+			}
+		} catch (...) {
+			//nothing of the failed batch is written, atomic put stores all or nothing
+			core.abortBatch(h);
+			throw;
+		}
+		core.endBatch(h);
+	}
+
+	//conflicts are merged one by one, merge needs to read the stored documents
+	for (std::size_t i: conflicted) {
+		json::String mergerev;
+		status[i] = replicator_merge(h, prep[i].conv, mergerev);
+		if (status[i] == PutStatus::merged) revs[i] = {revs[i], mergerev};
+	}
+}
+
 PutStatus DocumentDB::replicator_put_history(Handle h, const json::Value &doc) {
 	DatabaseCore::RawDocument rawdoc;
 	DatabaseCore::RawDocument prevdoc;
@@ -342,7 +615,8 @@ PutStatus DocumentDB::replicator_put_history(Handle h, const json::Value &doc) {
 	st = loadDataConflictsLog(doc, &data, &conflicts,&log);
 	if (st != PutStatus::stored) return st;
 
-	if (core.findDoc(h, rawdoc.docId, rawdoc.revision,prevdoc, tmp)) return PutStatus::stored;
+	PinnedValue prevstorage;
+	if (core.findDoc(h, rawdoc.docId, rawdoc.revision,prevdoc, prevstorage)) return PutStatus::stored;
 
 	serializePayload(parseStrRevArr(log), parseStrRevArr(conflicts), data, tmp);
 	rawdoc.payload = tmp;
@@ -388,6 +662,8 @@ Value DocumentDB::parseDocument(const DatabaseCore::RawDocument& doc, OutputForm
 		}
 		if (format == OutputFormat::log) {
 			jdoc.set("log",serializeStrRevArr(log));
+			if (doc.version & version_rev_hash)
+				jdoc.set("revhash", rev_hash_fast);
 		}
 	}
 	return jdoc;
@@ -412,11 +688,16 @@ bool DocumentDB::listDocs(Handle h, const std::string_view& start,
 	return core.enumDocs(h,start,end,createJsonSerializer(format,callback));
 }
 
+bool DocumentDB::listDocs(Handle h, const std::string_view& prefix, const std::string_view& after,
+		bool reversed, OutputFormat format, ResultCB&& callback) {
+	return core.enumDocs(h,prefix,after,reversed,createJsonSerializer(format,callback));
+}
+
 SeqNum DocumentDB::readChanges(Handle h, const SeqNum &since, bool reversed, OutputFormat format,  ResultCB &&cb) {
-	std::string tmp;
+	PinnedValue tmp;
 	return core.readChanges(h, since, reversed, [&](const DatabaseCore::ChangeRec &rc) {
 		DatabaseCore::RawDocument rawdoc;
-		if (!core.findDoc(h,rc.docid,rc.revid, rawdoc, tmp)) return true;
+		if (!core.findDoc(h,rc, rawdoc, tmp, ReadHint::bulk(ReadType::changes))) return true;
 		Value v = parseDocument(rawdoc, format);
 		if (v.isNull()) return true;
 		return cb(v);
@@ -426,11 +707,11 @@ SeqNum DocumentDB::readChanges(Handle h, const SeqNum &since, bool reversed, Out
 
 SeqNum DocumentDB::readChanges(Handle h, const SeqNum &since, bool reversed, OutputFormat format, DocFilter &&flt, ResultCB &&cb) {
 	if (flt == nullptr) return readChanges(h,since,reversed,format,std::move(cb));
-	std::string tmp;
+	PinnedValue tmp;
 	return core.readChanges(h, since, reversed,
 				[&](const DatabaseCore::ChangeRec &rc) {
 		DatabaseCore::RawDocument rawdoc;
-		if (!core.findDoc(h,rc.docid, rc.revid, rawdoc, tmp)) return true;
+		if (!core.findDoc(h,rc, rawdoc, tmp, ReadHint::bulk(ReadType::changes))) return true;
 		Value doc = parseDocument(rawdoc, format | OutputFormat::data | OutputFormat::log);
 		if (doc.isNull()) return true;
 		Value v = flt(doc);
@@ -534,8 +815,10 @@ bool DocumentDB::resolveConflict(Handle h, json::Value newdoc, json::Value &merg
 		return log.indexOf(z) == Value::npos;
 	});
 
-	Value timestamp = getTimestamp();
-	RevID newrev = calcRevisionID(data,conflicts,timestamp,finaldel);
+	std::uint64_t timestamp = getTimestamp();
+	std::string body;
+	serializeBody(parseStrRevArr(conflicts), data, body);
+	RevID newrev = calcRevisionID(body,timestamp,finaldel);
 
 
 	resdoc.set("id",StrViewA(id))
@@ -544,6 +827,7 @@ bool DocumentDB::resolveConflict(Handle h, json::Value newdoc, json::Value &merg
 			  ("conflicts",conflicts)
 			  ("deleted",finaldel)
 			  ("timestamp", timestamp)
+			  ("revhash", rev_hash_fast)
 			  ("data",data);
 	merged = resdoc;
 	return !conflicted;
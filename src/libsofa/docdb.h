@@ -9,7 +9,9 @@
 #define SRC_LIBSOFA_DOCDB_H_
 
 
+#include <optional>
 #include <imtjson/value.h>
+#include <shared/worker.h>
 #include "types.h"
 #include "databasecore.h"
 #include "filter.h"
@@ -49,9 +51,16 @@ class DocumentDB {
 public:
 	DocumentDB(DatabaseCore &core);
 
+	using Worker = ondra_shared::Worker;
 
-
-
+	///Sets worker which executes CPU bound tasks (resolving of the replication conflicts, preparation of bulk puts)
+	/** The worker limits count of threads of such tasks. Without worker, tasks are executed
+	 * in the calling thread. Set the worker before the object is copied, because replication
+	 * servers hold own copy
+	 */
+	void setWorker(Worker worker);
+	///Retrieves worker of CPU bound tasks, or nullptr, if there is no worker
+	const Worker *getWorker() const;
 
 	typedef DatabaseCore::Handle Handle;
 
@@ -67,6 +76,25 @@ public:
 	 * @caller can open batch at DatabaseCore if it need to put documents atomically
 	 */
 	PutStatus client_put(Handle h, const json::Value &doc, json::Value &rev);
+	///Puts multiple edited documents in single batch
+	/**
+	 * Documents are converted, validated and hashed in parallel, then they are written
+	 * in single batch, so there is one commit and one change event for the whole batch.
+	 *
+	 * @param h handle
+	 * @param docs documents to put (same format as client_put)
+	 * @param atomic if set to true, documents are stored only if all of them can be stored
+	 * without merge. Otherwise nothing is stored, failed documents receive their error
+	 * and other documents receive PutStatus::aborted. If set to false, every document is
+	 * stored independently and conflicted documents are merged after the batch is written
+	 * @param status receives status for each document
+	 * @param revs receives revision for each document (see client_put)
+	 *
+	 * @note documents are prepared by the worker (see setWorker) together with the calling
+	 * thread. Small batches are prepared in the calling thread only
+	 */
+	void client_put_bulk(Handle h, const std::basic_string_view<json::Value> &docs, bool atomic,
+			std::vector<PutStatus> &status, std::vector<json::Value> &revs);
 	///Puts replicated d1ocument
 	/**
 	 * The replicated document contains rev which have its actual revision. It must
@@ -79,6 +107,32 @@ public:
 	 * @return status
 	 */
 	PutStatus replicator_put(Handle h, const json::Value &doc, json::String &rev);
+	///Puts replicated document with already serialized body
+	/**
+	 * @param h handle
+	 * @param doc document to put
+	 * @param rev stores revision
+	 * @param body serialized body of the document (from convertClientPut2ReplicatorPut). If
+	 * empty, the body is serialized from the document
+	 * @return status
+	 */
+	PutStatus replicator_put(Handle h, const json::Value &doc, json::String &rev, const std::string_view &body);
+	///Puts multiple replicated documents in single batch
+	/**
+	 * All documents are validated first, then they are written in single batch, so there
+	 * is one commit and one change event for the whole batch. Conflicted documents are
+	 * merged after the batch is written (see replicator_put)
+	 *
+	 * @param h handle
+	 * @param docs documents to put
+	 * @param status receives status for each document
+	 * @param history (optional) historical revisions of the documents. They are stored in
+	 * the same batch before the documents (see replicator_put_history). Used by initial
+	 * synchronization, which transfers documents ordered by id, so the batch is written
+	 * as sorted bulk
+	 */
+	void replicator_put_bulk(Handle h, const std::basic_string_view<json::Value> &docs, std::vector<PutStatus> &status,
+			const std::basic_string_view<json::Value> &history = std::basic_string_view<json::Value>());
 	///Puts document to the history.
 	/** The document is stored as history, doesn't change current top
 	 *
@@ -101,6 +155,9 @@ public:
 
 	bool listDocs(Handle h, const std::string_view &start, const std::string_view &end, OutputFormat format, ResultCB &&callback);
 
+	///Lists documents with the prefix, continues after given document (see DatabaseCore::enumDocs)
+	bool listDocs(Handle h, const std::string_view &prefix, const std::string_view &after, bool reversed, OutputFormat format, ResultCB &&callback);
+
 	///read changes
 	/**
 	 * @param h handle to database
@@ -173,9 +230,44 @@ public:
 
 	///Converts document sent by client without log to document containing log, timestamp and revision
 	static json::Value convertClientPut2ReplicatorPut(json::Value doc);
+	///Converts document sent by client without log to document containing log, timestamp and revision
+	/**
+	 * @param doc document sent by client
+	 * @param body receives serialized body of the document (conflicts and data). The body
+	 * can be passed to replicator_put to avoid repeated serialization
+	 * @return replicator document
+	 */
+	static json::Value convertClientPut2ReplicatorPut(json::Value doc, std::string &body);
+
 
+	///Calculates revision ID
+	/**
+	 * @param body serialized body of the document (see serializeBody)
+	 * @param timestamp timestamp of the revision
+	 * @param deleted deleted flag
+	 * @return revision ID
+	 */
+	static RevID calcRevisionID(const std::string_view &body, std::uint64_t timestamp, bool deleted);
 
-	static RevID calcRevisionID(json::Value data,json::Value conflicts, json::Value timestamp, json::Value deleted);
+	///Calculates revision ID using original FNV1a hash
+	/** Revisions created before the fast hash was introduced were calculated by this function.
+	 * Such revisions are stored without version_rev_hash flag
+	 */
+	static RevID calcRevisionIDFNV(json::Value data,json::Value conflicts, json::Value timestamp, json::Value deleted);
+
+	///Serializes body of the document (conflicts and data) - appends result to the buffer
+	/** The body is also part of the payload, so it is serialized only once
+	 *
+	 * @param conflicts conflicts in numeric form
+	 * @param data document data
+	 * @param out buffer, serialized body is appended
+	 */
+	static void serializeBody(const json::Value &conflicts, const json::Value &data, std::string &out);
+
+	///Document's version flag - revision ID calculated by calcRevisionID (otherwise calcRevisionIDFNV)
+	static const unsigned char version_rev_hash = 0x01;
+	///Value of "revhash" field in replication format for revisions calculated by calcRevisionID
+	static const unsigned int rev_hash_fast = 1;
 
 	static std::uint64_t getTimestamp();
 
@@ -193,11 +285,37 @@ public:
 
 protected:
 	DatabaseCore &core;
+	std::optional<Worker> worker;
 
 	static PutStatus createPayload(const json::Value &doc, json::Value &payload);
 	static void serializePayload(const json::Value &newhst, const json::Value &conflicts, const json::Value &payload, std::string &tmp);
+	static void serializePayload(const json::Value &newhst, const std::string_view &body, std::string &tmp);
 	static PutStatus json2rawdoc(const json::Value &doc, DatabaseCore::RawDocument  &rawdoc, bool new_edit);
 	static PutStatus loadDataConflictsLog(const json::Value &doc, json::Value *data, json::Value *conflicts, json::Value *log);
+	///Connects validated replicated document to the current top, database must be locked
+	/**
+	 * @param present set to true, if the revision is already stored. Nothing needs to be written
+	 * @param newhst receives log of the new revision
+	 * @retval stored document can be stored
+	 * @retval conflict document is in conflict and must be merged
+	 */
+	PutStatus replicator_connect(Handle h, const DatabaseCore::RawDocument &rawdoc, const json::Value &conflicts,
+			const json::Value &log, bool &present, json::Value &newhst);
+	///Stores validated replicated document, database must be locked
+	/** @retval conflict document is in conflict and must be merged */
+	PutStatus replicator_store(Handle h, DatabaseCore::RawDocument &rawdoc, const json::Value &data,
+			const json::Value &conflicts, const json::Value &log, const std::string_view &body, std::string &tmp);
+	///Calls function for all items split to chunks, chunks are processed by the worker and the calling thread
+	/** Without worker, or when there is single chunk, items are processed in the calling thread.
+	 * Function returns when all items are processed. First exception thrown by the function is rethrown
+	 *
+	 * @param cnt count of items
+	 * @param chunk count of items processed in one call
+	 * @param fn function receives range of items [begin,end)
+	 */
+	void forEachChunk(std::size_t cnt, std::size_t chunk, const std::function<void(std::size_t, std::size_t)> &fn) const;
+	///Merges conflicted replicated document
+	PutStatus replicator_merge(Handle h, const json::Value &doc, json::String &outrev);
 
 
 };
@@ -10,39 +10,105 @@
 
 namespace sofadb {
 
-EventRouter::EventRouter(Worker worker):worker(worker),schrev(0) {
-
+EventRouter::EventRouter(Worker worker)
+	:worker(worker)
+	,epoch(TimePoint::clock::now())
+	,waiterCount(0)
+	,pendingCount(0)
+	,coalesceDelay(0) {
+
+	timer = std::thread([this]{timerWorker();});
 }
 
 
 void EventRouter::receiveEvent(DatabaseCore::ObserverEvent event,
 		Handle h, SeqNum seqnum) {
 
-	Sync _(lock);
-	snm[h] = seqnum;
-	auto b = oph.lower_bound(OPHKey(h,0));
-	auto e = oph.lower_bound(OPHKey(h+1,0));
-	while (b != e) {
-		WaitHandle wh = b->second;
-		auto i = omap.find(wh);
-		if (i != omap.end()) {
-			worker >> [fn = std::move(i->second.observer),g=CntSync(cntd)] {
-				fn(true);
-			};
+	Shard &s = getShard(h);
+	std::size_t delay = coalesceDelay;
+	if (event == DatabaseCore::event_update && delay) {
+		bool wake = false;
+		{
+			Sync _(s.lock);
+			auto r = s.pending.emplace(h, seqnum);
+			if (r.second) {
+				s.pendingQueue.push_back(PendingEvent{getCurrentTick() + (delay + tickMs - 1) / tickMs, h});
+				wake = pendingCount++ == 0;
+			} else {
+				r.first->second = seqnum;
+			}
+		}
+		if (wake) wakeTimer();
+		return;
+	}
+
+	Sync _(s.deliverLock);
+	flushPending(s, h);
+	deliverEvent(s, event, h, seqnum);
+}
+
+void EventRouter::flushPending(Shard &s, Handle h) {
+	SeqNum seqnum;
+	{
+		Sync _(s.lock);
+		auto iter = s.pending.find(h);
+		if (iter == s.pending.end()) return;
+		seqnum = iter->second;
+		s.pending.erase(iter);
+		--pendingCount;
+	}
+	deliverEvent(s, DatabaseCore::event_update, h, seqnum);
+}
+
+void EventRouter::flushShard(Shard &s, Wheel::Tick now) {
+	std::vector<std::pair<Handle, SeqNum> > due;
+	Sync d(s.deliverLock);
+	{
+		Sync _(s.lock);
+		while (!s.pendingQueue.empty() && s.pendingQueue.front().deadline <= now) {
+			Handle h = s.pendingQueue.front().db;
+			s.pendingQueue.pop_front();
+			auto iter = s.pending.find(h);
+			//update could be already delivered before other event
+			if (iter != s.pending.end()) {
+				due.emplace_back(h, iter->second);
+				s.pending.erase(iter);
+			}
 		}
-		omap.erase(i);
-		b = oph.erase(b);
+		pendingCount -= due.size();
 	}
+	for (auto &&x: due) {
+		deliverEvent(s, DatabaseCore::event_update, x.first, x.second);
+	}
+}
+
+void EventRouter::deliverEvent(Shard &s, DatabaseCore::ObserverEvent event, Handle h, SeqNum seqnum) {
+
+	ObserverList fired;
+	{
+		Sync _(s.lock);
+		DBState &st = s.dbs[h];
+		st.seqnum = seqnum;
+		for (WaitHandle wh: st.waiters) {
+			auto iter = s.waiters.find(wh);
+			fired.push_back(std::move(iter->second.observer));
+			s.wheel.remove(wh);
+			s.waiters.erase(iter);
+		}
+		waiterCount -= st.waiters.size();
+		st.waiters.clear();
+		if (event == DatabaseCore::event_close) {
+			s.dbs.erase(h);
+		}
+	}
+	notifyObservers(fired, true);
+
+	Sync _(globlock);
 	for (auto &&c : globlist) {
 		worker >> [event,h,seqnum,fn = GlobalObserver(c),g=CntSync(cntd)] {
 			fn(event,h,seqnum);
 		};
 	}
-	if (event == DatabaseCore::event_close) {
-		snm.erase(h);
-	}
-	reschedule();
-
 }
 
 DatabaseCore::Observer EventRouter::createObserver() {
@@ -54,57 +120,70 @@ DatabaseCore::Observer EventRouter::createObserver() {
 
 EventRouter::WaitHandle EventRouter::waitForEvent(Handle db, SeqNum since, std::size_t timeout, Observer&& observer) {
 
-	Sync _(lock);
+	Shard &s = getShard(db);
+	Sync _(s.lock);
 
-	std::size_t tmp = 1;
-	auto snmiter = snm.find(db);
-	if (snmiter == snm.end() || snmiter->second > since) {
-		worker >> [observer = std::move(observer)] {
+	auto dbiter = s.dbs.find(db);
+	if (dbiter == s.dbs.end() || dbiter->second.seqnum > since) {
+		_.unlock();
+		worker >> [observer = std::move(observer),g=CntSync(cntd)] {
 			observer(true);
 		};
-	} else {
-
-		TimePoint tm = TimePoint::clock::now() + std::chrono::milliseconds(timeout);
-		tmp = std::chrono::duration_cast<std::chrono::milliseconds>(tm.time_since_epoch()).count();
-		while (omap.find(tmp) != omap.end())
-			tmp++;
-
-		Reg &r = omap[tmp];
-		r.db = db;
-		r.observer = std::move(observer);
-
-		oph.insert(OPHKey(db, tmp));
+		return 1;
 	}
-	reschedule();
-	return tmp;
+
+	Wheel::Tick now = getCurrentTick();
+	//wheel is idle, move it to current time, so it doesn't need to catch up
+	if (s.wheel.empty()) s.wheel.advance(now, [](const WaitHandle &){});
+	Wheel::Tick expires = now + (timeout + tickMs - 1) / tickMs;
+
+	WaitHandle wh = (s.nextId++ << shardBits) | getShardIndex(db);
+	DBState &st = dbiter->second;
+	Waiter &w = s.waiters[wh];
+	w.db = db;
+	w.observer = std::move(observer);
+	w.pos = st.waiters.insert(st.waiters.end(), wh);
+	s.wheel.insert(wh, expires);
+	bool wake = waiterCount++ == 0;
+	_.unlock();
+
+	if (wake) wakeTimer();
+	return wh;
 }
 
 bool EventRouter::cancelWait(WaitHandle wh, bool notify_fn) {
-	Sync _(lock);
-	auto i = omap.find(wh);
-	if (i == omap.end()) return false;
+	Shard &s = shards[wh & (shardCount-1)];
+	Observer observer;
+	{
+		Sync _(s.lock);
+		auto iter = s.waiters.find(wh);
+		if (iter == s.waiters.end()) return false;
+
+		observer = std::move(iter->second.observer);
+		auto dbiter = s.dbs.find(iter->second.db);
+		dbiter->second.waiters.erase(iter->second.pos);
+		s.wheel.remove(wh);
+		s.waiters.erase(iter);
+		--waiterCount;
+	}
 
 	if (notify_fn) {
-		worker >> [observer = std::move(i->second.observer)] {
+		worker >> [observer = std::move(observer),g=CntSync(cntd)] {
 			observer(false);
 		};
 	}
-
-	oph.erase(OPHKey(i->second.db, wh));
-	omap.erase(i);
-	reschedule();
 	return true;
 }
 
 EventRouter::ObserverHandle EventRouter::registerObserver(GlobalObserver&& observer) {
 	ObserverHandle h = observer.target<void>();
-	Sync _(lock);
+	Sync _(globlock);
 	globlist.push_back(std::move(observer));
 	return h;
 }
 
 bool EventRouter::removeObserver(ObserverHandle wh) {
-	Sync _(lock);
+	Sync _(globlock);
 	for  (auto iter = globlist.begin(); iter != globlist.end(); ++iter) {
 		if (iter->target<void>() == wh) {
 			globlist.erase(iter);
@@ -118,57 +197,86 @@ EventRouter::~EventRouter() {
 	stop();
 }
 
+EventRouter::Wheel::Tick EventRouter::getCurrentTick() const {
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(TimePoint::clock::now() - epoch);
+	return static_cast<Wheel::Tick>(elapsed.count()) / tickMs;
+}
 
-void EventRouter::reschedule() {
-	using namespace ondra_shared;
-
-	if (schevent) {
-		schevent->notify_all();
-	}
-
-	auto i = omap.begin();
-
-	TimePoint now = TimePoint::clock::now();
-	std::size_t nmili = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
-	auto e = omap.lower_bound(nmili);
-	while (i != e) {
-		worker >> [fn = std::move(i->second.observer),g=CntSync(cntd)] {
-			fn(false);
+void EventRouter::notifyObservers(ObserverList &lst, bool result) {
+	for (auto &&fn: lst) {
+		worker >> [fn = std::move(fn),result,g=CntSync(cntd)] {
+			fn(result);
 		};
-		oph.erase(OPHKey(i->second.db, i->first));
-		i = omap.erase(i);
 	}
-	std::uint64_t rev = ++schrev;
-	if (i == omap.end()) return;
+}
 
-	TimePoint until = now+std::chrono::milliseconds(i->first - nmili);
-	worker >> [this,until,rev,g=CntSync(cntd)] {
+void EventRouter::expireShard(Shard &s, Wheel::Tick now) {
+	ObserverList fired;
+	{
+		Sync _(s.lock);
+		s.wheel.advance(now, [&](const WaitHandle &wh) {
+			auto iter = s.waiters.find(wh);
+			auto dbiter = s.dbs.find(iter->second.db);
+			dbiter->second.waiters.erase(iter->second.pos);
+			fired.push_back(std::move(iter->second.observer));
+			s.waiters.erase(iter);
+		});
+		waiterCount -= fired.size();
+	}
+	notifyObservers(fired, false);
+}
 
-		Sync _(lock);
-		if (rev != schrev) return;
+void EventRouter::wakeTimer() {
+	{
+		std::lock_guard<std::mutex> _(timerLock);
+	}
+	timerEvent.notify_all();
+}
 
-		std::condition_variable cond;
-		schevent = &cond;
-		auto waitres = cond.wait_until(_,until);
-		schevent = nullptr;
-		if (waitres == std::cv_status::timeout) {
-			reschedule();
+void EventRouter::timerWorker() {
+	Sync _(timerLock);
+	while (!timerExit) {
+		//no waiters and pending events, sleep until a waiter or event is registered
+		if (waiterCount == 0 && pendingCount == 0) {
+			timerEvent.wait(_);
+			continue;
 		}
-	};
-
-
+		_.unlock();
+		Wheel::Tick now = getCurrentTick();
+		for (auto &&s: shards) {
+			expireShard(s, now);
+			flushShard(s, now);
+		}
+		_.lock();
+		if (!timerExit) {
+			timerEvent.wait_until(_, epoch + std::chrono::milliseconds((now + 1) * tickMs));
+		}
+	}
 }
 
 void EventRouter::stop() {
 
 	{
-		Sync _(lock);
-
+		Sync _(globlock);
 		globlist.clear();
-		oph.clear();
-		omap.clear();
-		snm.clear();
-		reschedule();
+	}
+	for (auto &&s: shards) {
+		Sync _(s.lock);
+		waiterCount -= s.waiters.size();
+		s.waiters.clear();
+		s.dbs.clear();
+		s.wheel.clear();
+		pendingCount -= s.pending.size();
+		s.pending.clear();
+		s.pendingQueue.clear();
+	}
+	{
+		Sync _(timerLock);
+		timerExit = true;
+	}
+	timerEvent.notify_all();
+	if (timer.joinable() && timer.get_id() != std::this_thread::get_id()) {
+		timer.join();
 	}
 	cntd.wait();
 
@@ -176,4 +284,3 @@ void EventRouter::stop() {
 
 
 } /* namespace sofadb */
-
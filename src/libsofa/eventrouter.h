@@ -11,9 +11,12 @@
 #include <functional>
 #include <list>
 #include <unordered_map>
-#include <map>
-#include <set>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <atomic>
 #include "databasecore.h"
+#include "timingwheel.h"
 #include <shared/worker.h>
 #include <shared/refcnt.h>
 #include <shared/scheduler.h>
@@ -33,6 +36,13 @@ using ondra_shared::WaitableEvent;
 /** It is executed in separate thread(s). There can be many observers for many databases
  * Every observer is registered only for one-shot. When event is emited, all observers
  * are notified and removed from the list. They need to register again.
+ *
+ * Waiting observers are distributed into shards by the database handle. Every shard
+ * has own lock, list of waiters per database and timing wheel for timeouts. Timeouts
+ * are processed by a dedicated timer thread, observers are executed by the worker
+ *
+ * Update events can be coalesced (see setCoalesceDelay). A burst of updates of the same
+ * database is then delivered as single event carrying the latest sequence number.
  */
 class EventRouter: public RefCntObj {
 
@@ -46,21 +56,18 @@ public:
 	typedef std::chrono::time_point<std::chrono::steady_clock> TimePoint;
 	typedef std::size_t WaitHandle;
 
-	struct Reg{
-		Handle db;
-		Observer observer;
-	};
-
-	typedef std::map<WaitHandle, Reg> ObserverMap;
-	typedef std::pair<Handle, WaitHandle> OPHKey;
-	typedef std::set<OPHKey> ObserverPerHandle;
-	typedef std::map<Handle, SeqNum> SeqNumMap;
-
 
 	typedef std::function<void(DatabaseCore::ObserverEvent, Handle, SeqNum)> GlobalObserver;
 	typedef std::vector<GlobalObserver> GlobalObserverList;
 	typedef const void *ObserverHandle;
 
+	///count of bits of the WaitHandle used to store index of the shard
+	static const unsigned int shardBits = 4;
+	///count of shards
+	static const unsigned int shardCount = 1 << shardBits;
+	///resolution of the timeouts in milliseconds
+	static const unsigned int tickMs = 10;
+
 	///EventRouter need Worker as backend. Worker defines threads
 	EventRouter(Worker worker);
 
@@ -80,6 +87,14 @@ public:
 	DatabaseCore::Observer createObserver();
 
 	///Registers observer
+	/**
+	 * @param db database handle
+	 * @param since last known sequence number
+	 * @param timeout timeout in milliseconds
+	 * @param observer observer
+	 * @return wait handle. If the observer is executed immediately (because there is
+	 * already newer sequence number), function returns 1 which is never valid wait handle
+	 */
 	WaitHandle  waitForEvent(Handle db, SeqNum since, std::size_t timeout, Observer &&observer);
 
 	///Cancels waiting
@@ -119,17 +134,20 @@ public:
 
 	template<typename Fn>
 	bool listDBs(Fn &&fn) {
-		std::unique_lock<std::mutex> _(lock);
-		for (auto &x: snm)
-			if (!fn(x)) return false;
+		for (auto &&s: shards) {
+			Sync _(s.lock);
+			for (auto &x: s.dbs)
+				if (!fn(std::pair<Handle, SeqNum>(x.first, x.second.seqnum))) return false;
+		}
 		return true;
 	}
 
 	bool getLastSeqNum(Handle h, SeqNum &sn) {
-		std::unique_lock<std::mutex> _(lock);
-		auto iter = snm.find(h);
-		if (iter == snm.end()) return false;
-		sn = iter->second;
+		Shard &s = getShard(h);
+		Sync _(s.lock);
+		auto iter = s.dbs.find(h);
+		if (iter == s.dbs.end()) return false;
+		sn = iter->second.seqnum;
 		return true;
 	}
 
@@ -138,35 +156,88 @@ public:
 	template<typename Fn>
 	void dispatch(Fn &&fn);
 
-protected:
-
+	///Sets maximum delay of update events
+	/**
+	 * @param ms delay in milliseconds. During this time, update events of the same database
+	 * are collected and then delivered as one event with the latest sequence number. Set 0
+	 * to disable coalescing (default). Other events (create, close) are never delayed, pending
+	 * update is delivered before them
+	 */
+	void setCoalesceDelay(std::size_t ms) {coalesceDelay = ms;}
+	///Retrieves current coalesce delay
+	std::size_t getCoalesceDelay() const {return coalesceDelay;}
 
-	ObserverMap omap;
-	ObserverPerHandle oph;
-	SeqNumMap snm;
+protected:
 
 	typedef std::unique_lock<std::mutex> Sync;
 	typedef ondra_shared::CountdownGuard CntSync;
+	typedef TimingWheel<WaitHandle> Wheel;
+	typedef std::list<WaitHandle> WaitList;
+	typedef std::vector<Observer> ObserverList;
+
+	struct Waiter {
+		Handle db;
+		Observer observer;
+		WaitList::iterator pos;
+	};
+
+	struct DBState {
+		SeqNum seqnum = 0;
+		WaitList waiters;
+	};
+
+	struct PendingEvent {
+		Wheel::Tick deadline;
+		Handle db;
+	};
+
+	struct Shard {
+		std::mutex lock;
+		std::unordered_map<Handle, DBState> dbs;
+		std::unordered_map<WaitHandle, Waiter> waiters;
+		Wheel wheel;
+		WaitHandle nextId = 1;
+		///serializes delivery of events, so they are delivered in order
+		std::mutex deliverLock;
+		///pending (coalesced) updates - latest sequence number per database
+		std::unordered_map<Handle, SeqNum> pending;
+		///deadlines of pending updates in order of arrival
+		std::deque<PendingEvent> pendingQueue;
+	};
+
+	Shard shards[shardCount];
 
 	GlobalObserverList globlist;
+	std::mutex globlock;
 	Worker worker;
-	std::mutex lock;
 	ondra_shared::Countdown cntd;
 
-
-	std::condition_variable *schevent = nullptr;
-	std::atomic<std::uintptr_t>  schrev;
-	void exitAll();
-
-	void reschedule();
+	TimePoint epoch;
+	std::thread timer;
+	std::mutex timerLock;
+	std::condition_variable timerEvent;
+	bool timerExit = false;
+	std::atomic<std::size_t> waiterCount;
+	std::atomic<std::size_t> pendingCount;
+	std::atomic<std::size_t> coalesceDelay;
+
+	static unsigned int getShardIndex(Handle h) {return h & (shardCount-1);}
+	Shard &getShard(Handle h) {return shards[getShardIndex(h)];}
+
+	Wheel::Tick getCurrentTick() const;
+	void timerWorker();
+	void wakeTimer();
+	void expireShard(Shard &s, Wheel::Tick now);
+	void flushShard(Shard &s, Wheel::Tick now);
+	void flushPending(Shard &s, Handle h);
+	void deliverEvent(Shard &s, DatabaseCore::ObserverEvent event, Handle h, SeqNum seqnum);
+	void notifyObservers(ObserverList &lst, bool result);
 
 };
 
 template<typename Fn>
 void EventRouter::dispatch(Fn &&fn) {
 	worker >> std::move(fn);
-	Sync _(lock);
-	reschedule();
 }
 
 using PEventRouter = RefCntPtr<EventRouter>;
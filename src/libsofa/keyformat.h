@@ -30,6 +30,7 @@ enum class IndexType {
 	view_state = 8,			///db,viewid -> seqnum
 	reduce_map = 9,			///key->value for reduce
 	object_index = 10,
+	drop_list = 11,			///<dropped databases waiting to be swept
 
 };
 
@@ -175,6 +176,11 @@ inline void key_object_index(std::string &key, std::uint32_t dbid) {
 	build_key(key, IndexType::object_index,dbid);
 }
 
+inline void key_drop_list(std::string &key) {build_key(key, IndexType::drop_list);}
+inline void key_drop_list(std::string &key, std::uint32_t dbid) {
+	build_key(key, IndexType::drop_list, dbid);
+}
+
 inline unsigned int extract_from_key(const std::string_view &, std::size_t );
 
 inline unsigned int extract_from_key(const std::string_view &, std::size_t skip, KCursor &cursor) {
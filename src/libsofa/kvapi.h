@@ -9,8 +9,11 @@
 #define SRC_LIBSOFA_KVAPI_H_
 
 #include <shared/refcnt.h>
+#include <functional>
+#include <string>
 #include <utility>
 #include <string_view>
+#include <vector>
 
 namespace sofadb {
 
@@ -25,6 +28,23 @@ namespace sofadb {
 
 		virtual bool getNext(KeyValue &row) = 0;
 
+		///Retrieves multiple rows at once
+		/** Scan loops should prefer this function, because it amortizes the virtual
+		 * dispatch of the iteration. Rows are valid until the next call of getNext()
+		 * or getNextBatch(). Default implementation retrieves one row. Iterators whose
+		 * rows are invalidated by the next step (LevelDB, RocksDB) keep it, because
+		 * copying the rows would cost more than the saved calls. Only iterators which
+		 * can return stable rows without copying (MemDB) implement it
+		 *
+		 * @param rows array which receives the rows
+		 * @param count size of the array
+		 * @return count of retrieved rows, it can be less than count. Zero is returned
+		 * at the end of the range
+		 */
+		virtual std::size_t getNextBatch(KeyValue *rows, std::size_t count) {
+			return count && getNext(rows[0])?1:0;
+		}
+
 		virtual ~AbstractIterator() {}
 
 
@@ -42,6 +62,8 @@ namespace sofadb {
 			return getNext(tmp);
 		}
 
+		std::size_t getNextBatch(KeyValue *rows, std::size_t count) {return this->ptr->getNextBatch(rows, count);}
+
 		const KeyValue *operator->() const {return &tmp;}
 		const KeyValue &operator *() const {return tmp;}
 
@@ -50,6 +72,87 @@ namespace sofadb {
 
 	};
 
+	///Object which owns bytes of a pinned value
+	class AbstractPinHolder: public RefCntObj {
+	public:
+		virtual ~AbstractPinHolder() {}
+	};
+
+	///Value retrieved from the storage without copying
+	/** The storage either pins its own buffer, which is kept alive by the holder, or
+	 * copies the value into the buffer of this object (if the storage cannot pin values).
+	 * The buffer is reused by the next lookup, so reusing the same instance avoids
+	 * allocations. The value is valid until the next lookup or until the object is destroyed
+	 */
+	class PinnedValue {
+	public:
+		///Retrieves the value
+		std::string_view data() const {return view;}
+		operator std::string_view() const {return view;}
+
+		///Pins bytes owned by the holder
+		void pin(RefCntPtr<AbstractPinHolder> holder, const std::string_view &data) {
+			this->holder = holder;
+			view = data;
+		}
+		///Retrieves buffer to be filled by the storage. Call setFromBuffer() after the buffer is filled
+		std::string &getBuffer() {
+			holder = nullptr;
+			return buffer;
+		}
+		///Sets value to content of the buffer
+		void setFromBuffer() {
+			view = buffer;
+		}
+		///Releases the value
+		void clear() {
+			holder = nullptr;
+			view = std::string_view();
+		}
+
+	protected:
+		RefCntPtr<AbstractPinHolder> holder;
+		std::string buffer;
+		std::string_view view;
+	};
+
+	///Type of the read operation, used to account cache statistics
+	enum class ReadType {
+		///point reads and short scans of clients
+		interactive = 0,
+		///reading of the changes
+		changes,
+		///enumeration of the documents
+		enum_docs,
+		///reading of the source database by replication or bootstrap
+		replication,
+		///background maintenance
+		maintenance,
+		///reads outside of any read operation (compaction of the storage)
+		background,
+		count
+	};
+
+	///Hints how to perform a read
+	/** Bulk reads should not fill the cache, otherwise a single long scan evicts
+	 * working set of the interactive reads. Storages which don't support a hint ignore it
+	 */
+	struct ReadHint {
+		///type of the read
+		ReadType type = ReadType::interactive;
+		///store blocks read by the operation to the cache
+		bool fill_cache = true;
+		///size of the readahead in bytes for scans (0 = storage default)
+		std::size_t readahead = 0;
+
+		ReadHint() {}
+		ReadHint(ReadType type, bool fill_cache, std::size_t readahead = 0)
+			:type(type),fill_cache(fill_cache),readahead(readahead) {}
+
+		///Hint of a long sequential scan, which bypasses the cache
+		static ReadHint bulk(ReadType type) {return ReadHint(type, false, 2*1024*1024);}
+	};
+
 	class AbstractChangeset: public RefCntObj {
 	public:
 
@@ -59,6 +162,10 @@ namespace sofadb {
 
 		virtual void commit() = 0;
 
+		///Commits the changes and returns after they are written to the disk
+		/** Storages without such option commit normally */
+		virtual void commitSync() {commit();}
+
 		virtual void rollback() = 0;
 
 		///Erases all records with key starting by a prefix
@@ -82,12 +189,45 @@ namespace sofadb {
 
 	class AbstractKeyValueDatabaseSnapshot: public RefCntObj {
 	public:
-		virtual PIterator findRange(const std::string_view &prefix, bool reverse = false) = 0;
-
-		virtual PIterator findRange(const std::string_view &start, const std::string_view &end) = 0;
-
+		virtual PIterator findRange(const std::string_view &prefix, bool reverse = false, const ReadHint &hint = ReadHint()) = 0;
+
+		virtual PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint = ReadHint()) = 0;
+
+
+		virtual bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint = ReadHint())  = 0;
+
+		///Retrieves value without copying it, if the storage supports it
+		/** Default implementation copies the value into the buffer of the PinnedValue
+		 *
+		 * @param key key
+		 * @param value receives the value
+		 * @param hint read hint
+		 * @retval true found
+		 * @retval false not found
+		 */
+		virtual bool lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint = ReadHint()) {
+			if (!lookup(key, value.getBuffer(), hint)) return false;
+			value.setFromBuffer();
+			return true;
+		}
 
-		virtual bool lookup(const std::string_view &key, std::string &value)  = 0;
+		///Retrieves multiple values at once
+		/** Storages which support batched reads look up all keys by single call. Default
+		 * implementation looks up the keys one by one
+		 *
+		 * @param keys keys
+		 * @param callback called for every found key in order of the keys. It receives index
+		 * of the key and the value. The value is valid only during the call
+		 * @param hint read hint
+		 */
+		virtual void lookupMulti(const std::vector<std::string_view> &keys,
+				const std::function<void(std::size_t, const std::string_view &)> &callback,
+				const ReadHint &hint = ReadHint()) {
+			PinnedValue v;
+			for (std::size_t i = 0; i < keys.size(); i++) {
+				if (lookupPinned(keys[i], v, hint)) callback(i, v);
+			}
+		}
 
 		virtual bool exists(const std::string_view &key) = 0;
 
@@ -108,6 +248,13 @@ namespace sofadb {
 
 		virtual PKeyValueDatabaseSnapshot createSnapshot() = 0;
 
+		///Hints the storage, that keys in the range were erased and the range can be compacted
+		/** Default implementation does nothing
+		 * @param start first key (including)
+		 * @param end last key (excluding)
+		 */
+		virtual void compact(const std::string_view &, const std::string_view &) {}
+
 		virtual ~AbstractKeyValueDatabase() {};
 
 
@@ -0,0 +1,467 @@
+/*
+ * kvapi_durable.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <system_error>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <shared/logOutput.h>
+#include "fasthash.h"
+#include "kvapi_durable.h"
+
+namespace sofadb {
+
+using ondra_shared::logInfo;
+using ondra_shared::logError;
+using ondra_shared::logWarning;
+
+static const std::size_t headerSize = 12;
+static const std::size_t readChunk = 1024*1024;
+static const std::size_t snapshotRecord = 1024*1024;
+static const std::size_t snapshotBuffer = 4*1024*1024;
+
+enum RecordCommand: unsigned char {
+	cmd_put = 1,
+	cmd_erase = 2,
+	cmd_first_log = 3
+};
+
+class DurableMemDB::LogFile {
+public:
+	LogFile(int fd):fd(fd) {}
+	~LogFile() {::close(fd);}
+	const int fd;
+};
+
+namespace {
+
+class FD {
+public:
+	FD(int fd):fd(fd) {}
+	~FD() {if (fd >= 0) ::close(fd);}
+	int fd;
+};
+
+}
+
+static void throwErrno(const std::string &what) {
+	throw std::system_error(errno, std::generic_category(), what);
+}
+
+static void writeAll(int fd, const std::string_view &data, const std::string &name) {
+	const char *p = data.data();
+	std::size_t sz = data.size();
+	while (sz) {
+		ssize_t r = ::write(fd, p, sz);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			throwErrno(name);
+		}
+		p += r;
+		sz -= r;
+	}
+}
+
+static std::uint32_t readUInt32(const char *p) {
+	const unsigned char *c = reinterpret_cast<const unsigned char *>(p);
+	return (std::uint32_t(c[0]) << 24) | (std::uint32_t(c[1]) << 16) | (std::uint32_t(c[2]) << 8) | std::uint32_t(c[3]);
+}
+
+static std::uint64_t readUInt64(const char *p) {
+	return (std::uint64_t(readUInt32(p)) << 32) | readUInt32(p+4);
+}
+
+static bool readNumber(std::string_view &data, std::size_t &num) {
+	num = 0;
+	unsigned int shift = 0;
+	while (!data.empty() && shift < 64) {
+		unsigned char c = data[0];
+		data = data.substr(1);
+		num |= static_cast<std::size_t>(c & 0x7F) << shift;
+		if ((c & 0x80) == 0) return true;
+		shift += 7;
+	}
+	return false;
+}
+
+static bool readString(std::string_view &data, std::string_view &str) {
+	std::size_t len;
+	if (!readNumber(data, len) || len > data.size()) return false;
+	str = data.substr(0, len);
+	data = data.substr(len);
+	return true;
+}
+
+void DurableMemDB::addNumber(std::string &out, std::size_t num) {
+	while (num >= 0x80) {
+		out.push_back(static_cast<char>((num & 0x7F) | 0x80));
+		num >>= 7;
+	}
+	out.push_back(static_cast<char>(num));
+}
+
+void DurableMemDB::addString(std::string &out, const std::string_view &str) {
+	addNumber(out, str.size());
+	out.append(str);
+}
+
+void DurableMemDB::addRecord(std::string &out, const std::string_view &payload) {
+	std::uint32_t len = payload.size();
+	std::uint64_t h = FastHash64::hash(payload);
+	for (int i = 24; i >= 0; i-=8) out.push_back(static_cast<char>(len >> i));
+	for (int i = 56; i >= 0; i-=8) out.push_back(static_cast<char>(h >> i));
+	out.append(payload);
+}
+
+DurableMemDB::DurableMemDB(const std::string &path, const Config &cfg)
+	:path(path),cfg(cfg) {
+	load();
+	syncThread = std::thread([=]{syncWorker();});
+}
+
+DurableMemDB::~DurableMemDB() {
+	{
+		Sync _(synclock);
+		exitFlag = true;
+	}
+	synccond.notify_all();
+	if (syncThread.joinable()) syncThread.join();
+	if (compactThread.joinable()) {
+		//last reference can be released by the compaction itself
+		if (compactThread.get_id() == std::this_thread::get_id()) compactThread.detach();
+		else compactThread.join();
+	}
+	log = nullptr;
+	if (destroyed) {
+		removeLogs(static_cast<std::size_t>(-1));
+		::unlink((path+"/snapshot").c_str());
+		::unlink((path+"/snapshot.tmp").c_str());
+		::rmdir(path.c_str());
+	}
+}
+
+std::string DurableMemDB::logName(std::size_t num) const {
+	return path + "/log." + std::to_string(num);
+}
+
+void DurableMemDB::syncDir() {
+	FD d(::open(path.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC));
+	if (d.fd < 0 || ::fsync(d.fd) < 0) throwErrno(path);
+}
+
+static std::vector<std::size_t> listLogs(const std::string &path) {
+	std::vector<std::size_t> res;
+	DIR *d = ::opendir(path.c_str());
+	if (d == nullptr) throwErrno(path);
+	while (struct dirent *e = ::readdir(d)) {
+		std::string_view name(e->d_name);
+		if (name.substr(0,4) == "log." && name.size() > 4) {
+			char *end;
+			std::size_t n = std::strtoull(e->d_name+4, &end, 10);
+			if (*end == 0) res.push_back(n);
+		}
+	}
+	::closedir(d);
+	std::sort(res.begin(), res.end());
+	return res;
+}
+
+void DurableMemDB::removeLogs(std::size_t below) {
+	for (auto &&n: listLogs(path)) {
+		if (n < below) ::unlink(logName(n).c_str());
+	}
+}
+
+void DurableMemDB::load() {
+	if (::mkdir(path.c_str(), 0777) < 0 && errno != EEXIST) throwErrno(path);
+	::unlink((path+"/snapshot.tmp").c_str());
+
+	auto start = std::chrono::steady_clock::now();
+	std::size_t firstLog = 0;
+	std::size_t dummy;
+	loadFile(path+"/snapshot", true, firstLog);
+	std::size_t nextLog = firstLog;
+	for (auto &&n: listLogs(path)) {
+		if (n < firstLog) {
+			::unlink(logName(n).c_str());
+		} else {
+			loadFile(logName(n), false, dummy);
+			nextLog = n+1;
+		}
+	}
+	std::size_t time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start).count();
+	logInfo("Durable memory storage $1 loaded in $2 ms, $3 bytes of logs replayed", path, time_ms, uncompacted);
+	openLog(nextLog);
+}
+
+bool DurableMemDB::loadFile(const std::string &name, bool snapshot, std::size_t &firstLog) {
+	FD f(::open(name.c_str(), O_RDONLY|O_CLOEXEC));
+	if (f.fd < 0) {
+		if (errno == ENOENT) return false;
+		throwErrno(name);
+	}
+	::posix_fadvise(f.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	std::string buff;
+	std::size_t pos = 0;
+	std::size_t offset = 0;
+
+	//ensures that at least need bytes are available after the pos
+	auto fill = [&](std::size_t need) {
+		buff.erase(0, pos);
+		pos = 0;
+		while (buff.size() < need) {
+			std::size_t sz = buff.size();
+			buff.resize(std::max(sz + readChunk, need));
+			ssize_t r = ::read(f.fd, buff.data()+sz, buff.size()-sz);
+			if (r < 0) {
+				buff.resize(sz);
+				if (errno == EINTR) continue;
+				throwErrno(name);
+			}
+			buff.resize(sz + r);
+			if (r == 0) return false;
+		}
+		return true;
+	};
+
+	while (true) {
+		if (buff.size() - pos < headerSize && !fill(headerSize)) break;
+		std::size_t len = readUInt32(buff.data()+pos);
+		std::uint64_t h = readUInt64(buff.data()+pos+4);
+		if (buff.size() - pos < headerSize + len && !fill(headerSize + len)) break;
+		std::string_view payload(buff.data()+pos+headerSize, len);
+		if (FastHash64::hash(payload) != h) break;
+		applyRecord(payload, firstLog);
+		pos += headerSize + len;
+		offset += headerSize + len;
+	}
+
+	if (pos != buff.size()) {
+		//the rest of the log was not confirmed to the writer
+		if (snapshot) throw std::runtime_error("Durable storage - snapshot is corrupted: " + name);
+		logWarning("Durable storage - log $1 is damaged at offset $2, rest of the log is ignored", name, offset);
+	}
+	if (!snapshot) uncompacted += offset;
+	return true;
+}
+
+void DurableMemDB::applyRecord(const std::string_view &payload, std::size_t &firstLog) {
+	std::vector<MemDBChangeset::Command> batch;
+	std::string_view data = payload;
+	while (!data.empty()) {
+		unsigned char cmd = data[0];
+		data = data.substr(1);
+		std::string_view key, value;
+		bool ok;
+		switch (cmd) {
+		case cmd_put:
+			ok = readString(data, key) && readString(data, value);
+			if (ok) {
+				batch.push_back(MemDBChangeset::Command(0, key));
+				batch.push_back(MemDBChangeset::Command(1, value));
+			}
+			break;
+		case cmd_erase:
+			ok = readString(data, key);
+			if (ok) batch.push_back(MemDBChangeset::Command(2, key));
+			break;
+		case cmd_first_log:
+			ok = readNumber(data, firstLog);
+			break;
+		default:
+			ok = false;
+			break;
+		}
+		if (!ok) throw std::runtime_error("Durable storage - unknown record format: " + path);
+	}
+	if (!batch.empty()) MemDB::commitBatch(batch);
+}
+
+void DurableMemDB::openLog(std::size_t num) {
+	std::string name = logName(num);
+	int fd = ::open(name.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0666);
+	if (fd < 0) throwErrno(name);
+	PLogFile f = std::make_shared<LogFile>(fd);
+	syncDir();
+	log = f;
+	logNum = num;
+	logSize = 0;
+}
+
+void DurableMemDB::appendRecord(const std::string &payload) {
+	std::string rec;
+	addRecord(rec, payload);
+	try {
+		writeAll(log->fd, rec, logName(logNum));
+	} catch (...) {
+		//remove partially written record
+		if (::ftruncate(log->fd, logSize) < 0) {
+			logError("Durable storage - unable to truncate the log $1", logName(logNum));
+		}
+		throw;
+	}
+	logSize += rec.size();
+	uncompacted += rec.size();
+}
+
+void DurableMemDB::commitBatch(std::vector<MemDBChangeset::Command> &batch) {
+	if (batch.empty()) return;
+
+	std::string payload;
+	std::string_view key;
+	for (auto &&c: batch) {
+		switch (c.first) {
+		case 0: key = keyView(c.second);break;
+		case 1: payload.push_back(cmd_put);
+				addString(payload, key);
+				addString(payload, keyView(c.second));
+				break;
+		case 2: payload.push_back(cmd_erase);
+				addString(payload, keyView(c.second));
+				break;
+		}
+	}
+
+	std::uint64_t rec;
+	{
+		Sync _(loglock);
+		appendRecord(payload);
+		MemDB::commitBatch(batch);
+		{
+			Sync s(synclock);
+			rec = ++written;
+		}
+		if (uncompacted >= cfg.compact_size) startCompact();
+	}
+	synccond.notify_all();
+	waitSynced(rec);
+}
+
+void DurableMemDB::waitSynced(std::uint64_t rec) {
+	Sync s(synclock);
+	synccond.wait(s, [&]{return synced >= rec || syncError;});
+	if (syncError) throw std::system_error(syncError, std::generic_category(), path);
+}
+
+void DurableMemDB::syncWorker() {
+	Sync s(synclock);
+	while (true) {
+		synccond.wait(s, [&]{return exitFlag || written > synced;});
+		if (written == synced) break;
+		s.unlock();
+		if (cfg.sync_delay) std::this_thread::sleep_for(std::chrono::milliseconds(cfg.sync_delay));
+		PLogFile f;
+		std::uint64_t target;
+		{
+			Sync l(loglock);
+			f = log;
+			Sync s2(synclock);
+			target = written;
+		}
+		int err = ::fdatasync(f->fd) < 0?errno:0;
+		s.lock();
+		if (err) {
+			logError("Durable storage - unable to sync the log $1: $2", path, err);
+			syncError = err;
+		}
+		if (target > synced) synced = target;
+		synccond.notify_all();
+	}
+}
+
+std::size_t DurableMemDB::rotateLog() {
+	if (::fdatasync(log->fd) < 0) throwErrno(logName(logNum));
+	{
+		//all records written to the old log are synced now
+		Sync s(synclock);
+		synced = written;
+	}
+	synccond.notify_all();
+	openLog(logNum+1);
+	uncompacted = 0;
+	return logNum;
+}
+
+void DurableMemDB::startCompact() {
+	Sync c(compactlock);
+	if (compacting) return;
+	std::size_t first;
+	try {
+		first = rotateLog();
+	} catch (std::exception &e) {
+		logError("Durable storage - unable to start new log: $1", e.what());
+		return;
+	}
+	PKeyValueDatabaseSnapshot snap = createSnapshot();
+	compacting = true;
+	if (compactThread.joinable()) compactThread.join();
+	compactThread = std::thread([this, snap, first]() mutable {
+		try {
+			auto start = std::chrono::steady_clock::now();
+			writeSnapshot(snap, first);
+			std::size_t time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - start).count();
+			logInfo("Durable storage $1 - snapshot written in $2 ms", path, time_ms);
+		} catch (std::exception &e) {
+			logError("Durable storage $1 - unable to write snapshot: $2", path, e.what());
+		}
+		{
+			Sync c(compactlock);
+			compacting = false;
+		}
+		//can destroy the database, do not touch this below
+		snap = nullptr;
+	});
+}
+
+void DurableMemDB::writeSnapshot(const PKeyValueDatabaseSnapshot &snap, std::size_t firstLog) {
+	std::string tmpname = path+"/snapshot.tmp";
+	FD f(::open(tmpname.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666));
+	if (f.fd < 0) throwErrno(tmpname);
+
+	std::string buff, payload;
+	payload.push_back(cmd_first_log);
+	addNumber(payload, firstLog);
+	addRecord(buff, payload);
+	payload.clear();
+
+	Iterator iter(snap->findRange(std::string_view()));
+	while (iter.getNext()) {
+		payload.push_back(cmd_put);
+		addString(payload, iter->first);
+		addString(payload, iter->second);
+		if (payload.size() >= snapshotRecord) {
+			addRecord(buff, payload);
+			payload.clear();
+			if (buff.size() >= snapshotBuffer) {
+				writeAll(f.fd, buff, tmpname);
+				buff.clear();
+			}
+		}
+	}
+	if (!payload.empty()) addRecord(buff, payload);
+	writeAll(f.fd, buff, tmpname);
+	if (::fdatasync(f.fd) < 0) throwErrno(tmpname);
+	if (::rename(tmpname.c_str(), (path+"/snapshot").c_str()) < 0) throwErrno(tmpname);
+	syncDir();
+	removeLogs(firstLog);
+}
+
+void DurableMemDB::destroy() {
+	destroyed = true;
+}
+
+}
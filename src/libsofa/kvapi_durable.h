@@ -0,0 +1,120 @@
+/*
+ * kvapi_durable.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_LIBSOFA_KVAPI_DURABLE_H_
+#define SRC_LIBSOFA_KVAPI_DURABLE_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "kvapi_memdb.h"
+
+namespace sofadb {
+
+///Memory database persisted by a write-ahead log and snapshots
+/** Reads and writes are served by the MemDB. Every committed batch is appended
+ * to the log before it is applied, and the commit returns after the log is synced
+ * to the disk. Commits of multiple threads are synced together (group sync).
+ *
+ * When the log exceeds the configured size, new log is started and a snapshot of the
+ * content is written at background. Once the snapshot is complete, the old logs are
+ * deleted. During the startup, the snapshot and the logs are read sequentially
+ *
+ * Files in the directory
+ *
+ * - snapshot - last complete snapshot
+ * - log.<n> - logs, replayed in order of the number. The snapshot contains number of
+ *   the first log which is not included
+ *
+ * All files are sequences of records. Every record has a 12 bytes header
+ * (4 bytes length big endian, 8 bytes FastHash64 of the payload) followed by the payload.
+ * Payload contains commands: 1 - put (key, value), 2 - erase (key), 3 - first log (number).
+ * Strings and numbers are encoded as LEB128 length followed by the bytes.
+ */
+class DurableMemDB: public MemDB {
+public:
+
+	struct Config {
+		///delay of the group sync in milliseconds. Commits arriving during the delay are synced together
+		std::size_t sync_delay = 2;
+		///size of the log in bytes which starts the writing of the snapshot
+		std::size_t compact_size = 64*1024*1024;
+	};
+
+	///Opens the database
+	/**
+	 * @param path path to the directory. It is created if doesn't exist
+	 * @param cfg configuration
+	 *
+	 * @exception std::system_error unable to open or read the files
+	 * @exception std::runtime_error snapshot is corrupted
+	 */
+	DurableMemDB(const std::string &path, const Config &cfg);
+	~DurableMemDB();
+
+	virtual void commitBatch(std::vector<MemDBChangeset::Command> &batch);
+	virtual void destroy();
+
+protected:
+
+	class LogFile;
+	using PLogFile = std::shared_ptr<LogFile>;
+	using Sync = std::unique_lock<std::mutex>;
+
+	std::string path;
+	Config cfg;
+
+	///serializes appending to the log and commits to the MemDB
+	std::mutex loglock;
+	PLogFile log;
+	std::size_t logNum = 0;
+	std::size_t logSize = 0;
+	///size of the logs which are not included in the snapshot
+	std::size_t uncompacted = 0;
+
+	std::mutex synclock;
+	std::condition_variable synccond;
+	///count of appended records
+	std::uint64_t written = 0;
+	///count of synced records
+	std::uint64_t synced = 0;
+	///error of the last sync (errno), the log can't be trusted anymore
+	int syncError = 0;
+	bool exitFlag = false;
+	std::thread syncThread;
+
+	std::mutex compactlock;
+	std::thread compactThread;
+	bool compacting = false;
+	bool destroyed = false;
+
+	void load();
+	bool loadFile(const std::string &name, bool snapshot, std::size_t &firstLog);
+	void applyRecord(const std::string_view &payload, std::size_t &firstLog);
+	void openLog(std::size_t num);
+	void appendRecord(const std::string &payload);
+	void waitSynced(std::uint64_t rec);
+	void syncWorker();
+	///Starts new log, returns number of the new log
+	std::size_t rotateLog();
+	///Starts new log and writes snapshot at background
+	void startCompact();
+	void writeSnapshot(const PKeyValueDatabaseSnapshot &snap, std::size_t firstLog);
+	void removeLogs(std::size_t below);
+	void syncDir();
+	std::string logName(std::size_t num) const;
+
+	static void addRecord(std::string &out, const std::string_view &payload);
+	static void addString(std::string &out, const std::string_view &str);
+	static void addNumber(std::string &out, std::size_t num);
+};
+
+}
+
+#endif /* SRC_LIBSOFA_KVAPI_DURABLE_H_ */
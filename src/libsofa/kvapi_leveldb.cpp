@@ -39,6 +39,10 @@ PKeyValueDatabase leveldb_open(const leveldb::Options& options, const std::strin
 	else throw LevelDBException(st);
 }
 
+leveldb::Cache *leveldb_newCache(std::size_t capacity) {
+	return new LevelDBCountingCache(leveldb::NewLRUCache(capacity));
+}
+
 
 
 }
@@ -9,6 +9,7 @@
 #define SRC_LIBSOFA_KVAPI_LEVELDB_H_
 
 #include "kvapi.h"
+#include <leveldb/cache.h>
 #include <leveldb/db.h>
 
 namespace sofadb {
@@ -31,6 +32,9 @@ protected:
 
 PKeyValueDatabase leveldb_open(const leveldb::Options& options, const std::string& name);
 
+///Creates LRU block cache, which accounts hits and misses to ReadStats
+leveldb::Cache *leveldb_newCache(std::size_t capacity);
+
 
 
 }
@@ -1,6 +1,7 @@
 #include <memory>
 #include "kvapi_leveldb_impl.h"
 #include "kvapi_leveldb.h"
+#include "readstats.h"
 
 namespace sofadb {
 
@@ -36,24 +37,27 @@ PChangeset LevelDBDatabase::createChangeset() {
 	return new LevelDBChangeset(this);
 }
 
-PIterator LevelDBDatabase::findRange(const std::string_view& prefix, bool reverse) {
+leveldb::ReadOptions LevelDBDatabase::readOptions(const ReadHint &hint, const leveldb::Snapshot *snapshot) {
+	//leveldb has neither readahead nor iterator bounds, ranges are bounded by the iterators
 	leveldb::ReadOptions opt;
-	opt.fill_cache = false;
-	return new LevelDBIteratorPrefix(std::string(prefix), db->NewIterator(opt), reverse);
+	opt.fill_cache = hint.fill_cache;
+	opt.snapshot = snapshot;
+	return opt;
+}
+
+PIterator LevelDBDatabase::findRange(const std::string_view& prefix, bool reverse, const ReadHint &hint) {
+	return new LevelDBIteratorPrefix(std::string(prefix), db->NewIterator(readOptions(hint)), reverse, hint.type);
 }
 
 PIterator LevelDBDatabase::findRange(const std::string_view& start,
-		const std::string_view& end) {
-	leveldb::ReadOptions opt;
-	opt.fill_cache = false;
-	return new LevelDBIteratorRange(start, end, db->NewIterator(opt));
+		const std::string_view& end, const ReadHint &hint) {
+	return new LevelDBIteratorRange(start, end, db->NewIterator(readOptions(hint)), hint.type);
 }
 
 
-bool LevelDBDatabase::lookup(const std::string_view& key, std::string& value) {
-	leveldb::ReadOptions opt;
-	opt.fill_cache = false;
-	leveldb::Status s = db->Get(opt, str2slice(key),&value);
+bool LevelDBDatabase::lookup(const std::string_view& key, std::string& value, const ReadHint &hint) {
+	ReadStats::Scope _(hint.type);
+	leveldb::Status s = db->Get(readOptions(hint), str2slice(key),&value);
 	if (s.ok()) return true;
 	if (s.IsNotFound()) return false;
 	throw LevelDBException(s);
@@ -65,6 +69,7 @@ bool LevelDBDatabase::exists(const std::string_view& key) {
 }
 
 bool LevelDBDatabase::existsPrefix(const std::string_view& key) {
+	ReadStats::Scope _(ReadType::interactive);
 	leveldb::ReadOptions opt;
 	opt.fill_cache = false;
 	std::unique_ptr<leveldb::Iterator> iter(db->NewIterator(opt));
@@ -100,6 +105,14 @@ void LevelDBChangeset::commit() {
 	if (!st.ok()) throw LevelDBException(st);
 }
 
+void LevelDBChangeset::commitSync() {
+	leveldb::WriteOptions opt;
+	opt.sync = true;
+	leveldb::Status st = db->getDBObject()->Write(opt,&batch);
+	batch.Clear();
+	if (!st.ok()) throw LevelDBException(st);
+}
+
 void LevelDBChangeset::rollback() {
 	batch.Clear();
 }
@@ -122,12 +135,13 @@ void LevelDBChangeset::erasePrefix(const std::string_view& prefix) {
 	}
 }
 
-LevelDBIteratorBase::LevelDBIteratorBase(leveldb::Iterator *iter)
-	:iter(iter)
+LevelDBIteratorBase::LevelDBIteratorBase(leveldb::Iterator *iter, ReadType type)
+	:iter(iter),type(type)
 {
 }
 
 void LevelDBIteratorBase::init(const std::string_view &start, bool rev) {
+	ReadStats::Scope _(type);
 	if (rev) {
 		if (start.empty()) iter->SeekToLast();
 		else iter->Seek(str2slice(start));
@@ -179,14 +193,15 @@ bool LevelDBIteratorBase::prev(KeyValue &row){
 
 }
 bool LevelDBIteratorBase::getNext(KeyValue &row) {
+	ReadStats::Scope _(type);
 	return (this->*get_next)(row);
 }
 bool LevelDBIteratorBase::end(KeyValue &) {
 	return false;
 }
 
-LevelDBIteratorPrefix::LevelDBIteratorPrefix(std::string &&prefix, leveldb::Iterator *iter, bool rev)
-:LevelDBIteratorBase(iter),prefix(std::move(prefix))
+LevelDBIteratorPrefix::LevelDBIteratorPrefix(std::string &&prefix, leveldb::Iterator *iter, bool rev, ReadType type)
+:LevelDBIteratorBase(iter, type),prefix(std::move(prefix))
 {
 
 	if (rev) {
@@ -199,8 +214,8 @@ bool LevelDBIteratorPrefix::testKey(std::string_view &key) const {
 	return prefix.empty() || key.substr(0,prefix.length()) == prefix;
 }
 
-LevelDBIteratorRange::LevelDBIteratorRange(const std::string_view &start, const std::string_view &end, leveldb::Iterator *iter)
-	:LevelDBIteratorBase(iter),end(end) {
+LevelDBIteratorRange::LevelDBIteratorRange(const std::string_view &start, const std::string_view &end, leveldb::Iterator *iter, ReadType type)
+	:LevelDBIteratorBase(iter, type),end(end) {
 
 	this->rev = start > end;
 	init(start, this->rev);
@@ -230,6 +245,12 @@ PKeyValueDatabaseSnapshot LevelDBDatabase::createSnapshot() {
 	}
 }
 
+void LevelDBDatabase::compact(const std::string_view &start, const std::string_view &end) {
+	leveldb::Slice b = str2slice(start);
+	leveldb::Slice e = str2slice(end);
+	db->CompactRange(&b, &e);
+}
+
 LevelDBSnapshot::LevelDBSnapshot(RefCntPtr<LevelDBDatabase> db, const leveldb::Snapshot *snapshot)
 	:db(db),snapshot(snapshot)
 {
@@ -240,24 +261,19 @@ LevelDBSnapshot::~LevelDBSnapshot() {
 	db->getDBObject()->ReleaseSnapshot(snapshot);
 }
 
-PIterator LevelDBSnapshot::findRange(const std::string_view& prefix,bool reverse) {
-		leveldb::ReadOptions opt;
-		opt.fill_cache = false;
-		opt.snapshot = snapshot;
-		return new LevelDBIteratorPrefix(std::string(prefix), db->getDBObject()->NewIterator(opt), reverse);
+PIterator LevelDBSnapshot::findRange(const std::string_view& prefix,bool reverse, const ReadHint &hint) {
+		leveldb::ReadOptions opt = LevelDBDatabase::readOptions(hint, snapshot);
+		return new LevelDBIteratorPrefix(std::string(prefix), db->getDBObject()->NewIterator(opt), reverse, hint.type);
 }
 
-PIterator LevelDBSnapshot::findRange(const std::string_view& start,const std::string_view& end) {
-	leveldb::ReadOptions opt;
-	opt.fill_cache = false;
-	opt.snapshot = snapshot;
-	return new LevelDBIteratorRange(start, end, db->getDBObject()->NewIterator(opt));
+PIterator LevelDBSnapshot::findRange(const std::string_view& start,const std::string_view& end, const ReadHint &hint) {
+	leveldb::ReadOptions opt = LevelDBDatabase::readOptions(hint, snapshot);
+	return new LevelDBIteratorRange(start, end, db->getDBObject()->NewIterator(opt), hint.type);
 }
 
-bool LevelDBSnapshot::lookup(const std::string_view& key,std::string& value) {
-	leveldb::ReadOptions opt;
-	opt.fill_cache = false;
-	opt.snapshot = snapshot;
+bool LevelDBSnapshot::lookup(const std::string_view& key,std::string& value, const ReadHint &hint) {
+	ReadStats::Scope _(hint.type);
+	leveldb::ReadOptions opt = LevelDBDatabase::readOptions(hint, snapshot);
 	leveldb::Status s = db->getDBObject()->Get(opt, str2slice(key),&value);
 	if (s.ok()) return true;
 	if (s.IsNotFound()) return false;
@@ -270,6 +286,7 @@ bool LevelDBSnapshot::exists(const std::string_view& key) {
 }
 
 bool LevelDBSnapshot::existsPrefix(const std::string_view& key) {
+	ReadStats::Scope _(ReadType::interactive);
 	leveldb::ReadOptions opt;
 	opt.fill_cache = false;
 	opt.snapshot = snapshot;
@@ -279,4 +296,39 @@ bool LevelDBSnapshot::existsPrefix(const std::string_view& key) {
 	else return false;
 }
 
+leveldb::Cache::Handle* LevelDBCountingCache::Insert(const leveldb::Slice& key, void* value, std::size_t charge,
+		void (*deleter)(const leveldb::Slice& key, void* value)) {
+	return cache->Insert(key, value, charge, deleter);
+}
+
+leveldb::Cache::Handle* LevelDBCountingCache::Lookup(const leveldb::Slice& key) {
+	Handle *h = cache->Lookup(key);
+	if (h) ReadStats::hit(); else ReadStats::miss();
+	return h;
+}
+
+void LevelDBCountingCache::Release(Handle* handle) {
+	cache->Release(handle);
+}
+
+void* LevelDBCountingCache::Value(Handle* handle) {
+	return cache->Value(handle);
+}
+
+void LevelDBCountingCache::Erase(const leveldb::Slice& key) {
+	cache->Erase(key);
+}
+
+std::uint64_t LevelDBCountingCache::NewId() {
+	return cache->NewId();
+}
+
+void LevelDBCountingCache::Prune() {
+	cache->Prune();
+}
+
+std::size_t LevelDBCountingCache::TotalCharge() const {
+	return cache->TotalCharge();
+}
+
 }
@@ -9,6 +9,7 @@
 #define SRC_LIBSOFA_KVAPI_LEVELDB_IMPL_H_
 
 #include <memory>
+#include <leveldb/cache.h>
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 #include "kvapi.h"
@@ -18,11 +19,13 @@ namespace sofadb {
 ///Only allows to iterate one direction of a range.
 class LevelDBIteratorBase: public AbstractIterator {
 public:
-	LevelDBIteratorBase(leveldb::Iterator *iter);
+	LevelDBIteratorBase(leveldb::Iterator *iter, ReadType type);
 	virtual bool getNext(KeyValue &row);
 
 protected:
 	std::unique_ptr<leveldb::Iterator> iter;
+	///type of the read, the iterator loads blocks during every step
+	ReadType type;
 	bool (LevelDBIteratorBase::*get_next)(KeyValue &row);
 	bool first(KeyValue &row);
 	bool next(KeyValue &row);
@@ -36,7 +39,7 @@ protected:
 
 class LevelDBIteratorPrefix: public LevelDBIteratorBase {
 public:
-	LevelDBIteratorPrefix(std::string &&prefix, leveldb::Iterator *iter, bool rev);
+	LevelDBIteratorPrefix(std::string &&prefix, leveldb::Iterator *iter, bool rev, ReadType type);
 protected:
 	virtual bool testKey(std::string_view &key) const;
 	std::string prefix;
@@ -45,7 +48,7 @@ protected:
 
 class LevelDBIteratorRange: public LevelDBIteratorBase {
 public:
-	LevelDBIteratorRange(const std::string_view &start, const std::string_view &end, leveldb::Iterator *iter);
+	LevelDBIteratorRange(const std::string_view &start, const std::string_view &end, leveldb::Iterator *iter, ReadType type);
 protected:
 	virtual bool testKey(std::string_view &key) const;
 	std::string end;
@@ -59,19 +62,23 @@ public:
 
 	LevelDBDatabase(leveldb::DB *db, const std::string_view &name);
 	virtual PChangeset createChangeset();
-	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false) ;
-	virtual PIterator findRange(const std::string_view &start, const std::string_view &end) ;
-	virtual bool lookup(const std::string_view &key, std::string &value) ;
+	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false, const ReadHint &hint = ReadHint()) ;
+	virtual PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint = ReadHint()) ;
+	virtual bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint = ReadHint()) ;
 	virtual bool exists(const std::string_view &key) ;
 	virtual bool existsPrefix(const std::string_view &key) ;
 	virtual void destroy();
 	virtual ~LevelDBDatabase();
 	virtual PKeyValueDatabaseSnapshot createSnapshot();
+	virtual void compact(const std::string_view &start, const std::string_view &end);
 	leveldb::DB *getDBObject() {return db;}
 
 
 	bool isDestroyed() const;
 
+	///Creates read options for the hint
+	static leveldb::ReadOptions readOptions(const ReadHint &hint, const leveldb::Snapshot *snapshot = nullptr);
+
 protected:
 	leveldb::DB *db;
 	std::string name;
@@ -88,6 +95,7 @@ public:
 	virtual void put(const std::string_view &key, const std::string_view &value);
 	virtual void erase(const std::string_view &key);
 	virtual void commit() ;
+	virtual void commitSync();
 	virtual void rollback();
 	virtual void erasePrefix(const std::string_view &prefix);
 
@@ -97,14 +105,36 @@ protected:
 
 };
 
+///Block cache which accounts lookups to ReadStats
+/** Lookups are accounted to the type of the read of the current thread. Blocks are looked
+ * up even if the read doesn't fill the cache, so the bulk reads are counted as well
+ */
+class LevelDBCountingCache: public leveldb::Cache {
+public:
+	LevelDBCountingCache(leveldb::Cache *cache):cache(cache) {}
+
+	virtual Handle* Insert(const leveldb::Slice& key, void* value, std::size_t charge,
+			void (*deleter)(const leveldb::Slice& key, void* value));
+	virtual Handle* Lookup(const leveldb::Slice& key);
+	virtual void Release(Handle* handle);
+	virtual void* Value(Handle* handle);
+	virtual void Erase(const leveldb::Slice& key);
+	virtual std::uint64_t NewId();
+	virtual void Prune();
+	virtual std::size_t TotalCharge() const;
+
+protected:
+	std::unique_ptr<leveldb::Cache> cache;
+};
+
 class LevelDBSnapshot: public AbstractKeyValueDatabaseSnapshot {
 public:
 	LevelDBSnapshot(RefCntPtr<LevelDBDatabase> db, const leveldb::Snapshot *snapshot);
 	virtual ~LevelDBSnapshot();
 
-	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false);
-	virtual PIterator findRange(const std::string_view &start, const std::string_view &end);
-	virtual bool lookup(const std::string_view &key, std::string &value) ;
+	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false, const ReadHint &hint = ReadHint());
+	virtual PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint = ReadHint());
+	virtual bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint = ReadHint()) ;
 	virtual bool exists(const std::string_view &key);
 	virtual bool existsPrefix(const std::string_view &key);
 protected:
@@ -5,11 +5,43 @@
  *      Author: ondra
  */
 
+#include <algorithm>
 #include "kvapi_memdb.h"
 
 namespace sofadb {
 
-MemDB::MemDB() {
+MemDB::Node::Node(const Key &key, unsigned int level)
+	:key(key),head(nullptr),level(level),next(new std::atomic<Node *>[level]) {
+	for (unsigned int i = 0; i < level; i++) next[i].store(nullptr, std::memory_order_relaxed);
+}
+
+MemDB::Node::~Node() {
+	Record *r = head.load(std::memory_order_relaxed);
+	while (r) {
+		Record *o = r->older.load(std::memory_order_relaxed);
+		Record::releaseRef(r);
+		r = o;
+	}
+}
+
+MemDB::MemDB():head(Key(), maxLevel),levels(1),committed(1),slots(nullptr) {
+}
+
+MemDB::~MemDB() {
+	Node *n = head.next[0].load(std::memory_order_relaxed);
+	while (n) {
+		Node *x = n->next[0].load(std::memory_order_relaxed);
+		delete n;
+		n = x;
+	}
+	for (auto &&x: unlinked) delete x.second;
+	for (auto &&x: trimmed) Record::releaseRef(x.second);
+	ReaderSlot *s = slots.load(std::memory_order_relaxed);
+	while (s) {
+		ReaderSlot *x = s->nextSlot;
+		delete s;
+		s = x;
+	}
 }
 
 std::string prefixLastKey(const std::string_view &prefix);
@@ -18,60 +50,173 @@ PChangeset MemDB::createChangeset() {
 	return new MemDBChangeset(this);
 }
 
-PIterator MemDB::findRange(const std::string_view& prefix,	bool reverse) {
-	Sync _(lock);
-	auto begin = prefix.empty()?data.begin():data.lower_bound(json::StrViewA(prefix));
-	auto end = prefix.empty()?data.end():data.lower_bound(prefixLastKey(prefix));
-	iterCount++;
-	if (reverse) {
-		return new MemDBIterator<DataMap::reverse_iterator>(
-				std::make_reverse_iterator(begin),
-				std::make_reverse_iterator(end),
-				this);
+MemDB::ReadGuard::ReadGuard(MemDB &db, Version version):slot(db.acquireSlot()),version(version) {
+	if (version) {
+		slot->version.store(version);
+		return;
+	}
+	//the writer can miss the slot while it is being registered, so the version
+	//is accepted only if it is still the last published version
+	Version v = db.committed.load();
+	do {
+		this->version = v;
+		slot->version.store(v);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		v = db.committed.load();
+	} while (v != this->version);
+}
 
-	} else {
-		return new MemDBIterator<DataMap::iterator>(begin,end,this);
+MemDB::ReadGuard::~ReadGuard() {
+	slot->version.store(0, std::memory_order_release);
+	slot->used.store(false, std::memory_order_release);
+}
+
+MemDB::ReaderSlot *MemDB::acquireSlot() {
+	ReaderSlot *s = slots.load(std::memory_order_acquire);
+	while (s) {
+		bool f = false;
+		if (!s->used.load(std::memory_order_relaxed)
+				&& s->used.compare_exchange_strong(f, true, std::memory_order_acquire)) return s;
+		s = s->nextSlot;
 	}
+	s = new ReaderSlot;
+	s->used.store(true, std::memory_order_relaxed);
+	ReaderSlot *h = slots.load(std::memory_order_relaxed);
+	do {
+		s->nextSlot = h;
+	} while (!slots.compare_exchange_weak(h, s, std::memory_order_release, std::memory_order_relaxed));
+	return s;
 }
 
-PIterator MemDB::findRange(const std::string_view& start, const std::string_view& stop) {
-	Sync _(lock);
-	auto begin = data.lower_bound(json::StrViewA(start));
-	auto end = data.lower_bound(json::StrViewA(stop));
-	if (start > stop) {
-		return new MemDBIterator<DataMap::reverse_iterator>(
-				std::make_reverse_iterator(begin),
-				std::make_reverse_iterator(end),
-				this);
+MemDB::Version MemDB::readerVersions() {
+	readers.clear();
+	for (ReaderSlot *s = slots.load(); s; s = s->nextSlot) {
+		Version v = s->version.load();
+		if (v) readers.push_back(v);
+	}
+	std::sort(readers.begin(), readers.end());
+	readers.erase(std::unique(readers.begin(), readers.end()), readers.end());
+	return readers.empty()?committed.load() + 1:readers.front();
+}
 
-	} else {
-		return new MemDBIterator<DataMap::iterator>(begin,end,this);
+MemDB::Node *MemDB::lowerBound(const std::string_view &key) const {
+	const Node *x = &head;
+	Node *n = nullptr;
+	for (unsigned int l = levels.load(std::memory_order_acquire); l-- > 0;) {
+		while ((n = x->next[l].load(std::memory_order_acquire)) != nullptr && keyView(n->key) < key) x = n;
 	}
+	return n;
 }
 
-bool MemDB::lookup(const std::string_view& key, std::string& value) {
-	Sync _(lock);
-	auto iter = data.find(json::StrViewA(key));
-	if (iter == data.end()) return false;
-	if (iter->second.valid) {
-		value = iter->second.data.str();
-		return true;
-	} else {
-		return false;
+MemDB::Node *MemDB::findLess(const std::string_view &key) const {
+	const Node *x = &head;
+	for (unsigned int l = levels.load(std::memory_order_acquire); l-- > 0;) {
+		Node *n;
+		while ((n = x->next[l].load(std::memory_order_acquire)) != nullptr && keyView(n->key) < key) x = n;
+	}
+	return x == &head?nullptr:const_cast<Node *>(x);
+}
+
+MemDB::Node *MemDB::findLast() const {
+	const Node *x = &head;
+	for (unsigned int l = levels.load(std::memory_order_acquire); l-- > 0;) {
+		Node *n;
+		while ((n = x->next[l].load(std::memory_order_acquire)) != nullptr) x = n;
 	}
+	return x == &head?nullptr:const_cast<Node *>(x);
+}
+
+const MemDB::Record *MemDB::visible(const Node *node, Version version) {
+	const Record *r = node->head.load(std::memory_order_acquire);
+	while (r && r->version > version) r = r->older.load(std::memory_order_acquire);
+	return r;
+}
+
+PIterator MemDB::findRange(const std::string_view& prefix,	bool reverse, const ReadHint &) {
+	return findRange(prefix, reverse, 0);
+}
+
+PIterator MemDB::findRange(const std::string_view& start, const std::string_view& stop, const ReadHint &) {
+	return findRange(start, stop, 0);
+}
+
+bool MemDB::lookup(const std::string_view& key, std::string& value, const ReadHint &) {
+	ReadGuard g(*this);
+	return lookup(key, value, g.getVersion());
+}
+
+bool MemDB::lookupPinned(const std::string_view& key, PinnedValue& value, const ReadHint &) {
+	ReadGuard g(*this);
+	return lookupPinned(key, value, g.getVersion());
 }
 
 bool MemDB::exists(const std::string_view& key) {
-	Sync _(lock);
-	auto iter = data.find(json::StrViewA(key));
-	return iter != data.end();
+	ReadGuard g(*this);
+	return exists(key, g.getVersion());
 }
 
 bool MemDB::existsPrefix(const std::string_view& key) {
-	Sync _(lock);
-	auto iter = data.lower_bound(json::StrViewA(key));
-	if (iter == data.end()) return false;
-	return iter->first.substr(0,key.length()) == json::StrViewA(key);
+	ReadGuard g(*this);
+	return existsPrefix(key, g.getVersion());
+}
+
+PIterator MemDB::findRange(const std::string_view& prefix,	bool reverse, Version version) {
+	MemDBIterator::Range r;
+	r.lo = prefix;
+	r.hi = prefixLastKey(prefix);
+	r.hi_inf = r.hi.empty();
+	return new MemDBIterator(this, std::move(r), reverse, version);
+}
+
+PIterator MemDB::findRange(const std::string_view& start, const std::string_view& stop, Version version) {
+	MemDBIterator::Range r;
+	if (start > stop) {
+		r.lo = stop;
+		r.hi = start;
+		r.lo_incl = false;
+		return new MemDBIterator(this, std::move(r), true, version);
+	} else {
+		r.lo = start;
+		r.hi = stop;
+		return new MemDBIterator(this, std::move(r), false, version);
+	}
+}
+
+bool MemDB::lookup(const std::string_view& key, std::string& value, Version version) {
+	Node *n = lowerBound(key);
+	if (n == nullptr || keyView(n->key) != key) return false;
+	const Record *r = visible(n, version);
+	if (r == nullptr || !r->value.valid) return false;
+	value = r->value.data.str();
+	return true;
+}
+
+bool MemDB::lookupPinned(const std::string_view& key, PinnedValue& value, Version version) {
+	Node *n = lowerBound(key);
+	if (n == nullptr || keyView(n->key) != key) return false;
+	const Record *r = visible(n, version);
+	if (r == nullptr || !r->value.valid) return false;
+	//the pin holds the data, not the record, because values of the records
+	//which are no longer visible are released by the writer
+	value.pin(new Pin(r->value.data), json::StrViewA(r->value.data));
+	return true;
+}
+
+bool MemDB::exists(const std::string_view& key, Version version) {
+	Node *n = lowerBound(key);
+	if (n == nullptr || keyView(n->key) != key) return false;
+	const Record *r = visible(n, version);
+	return r != nullptr && r->value.valid;
+}
+
+bool MemDB::existsPrefix(const std::string_view& key, Version version) {
+	Node *n = lowerBound(key);
+	while (n != nullptr && keyView(n->key).substr(0,key.length()) == key) {
+		const Record *r = visible(n, version);
+		if (r != nullptr && r->value.valid) return true;
+		n = n->next[0].load(std::memory_order_acquire);
+	}
+	return false;
 }
 
 void MemDB::destroy() {
@@ -100,256 +245,244 @@ void MemDBChangeset::rollback() {
 }
 
 void MemDBChangeset::erasePrefix(const std::string_view& prefix) {
-	MemDB::Sync _(memdb->lock);
-	json::StrViewA p(prefix);
-	auto iter = memdb->data.lower_bound(json::StrViewA(prefix));
-	while (iter != memdb->data.end() && iter->first.substr(0,prefix.length()) == p) {
+	Iterator iter(memdb->findRange(prefix));
+	while (iter.getNext()) {
 		erase(iter->first);
-		++iter;
 	}
 }
 
-template<typename iterator, typename Owner>
-MemDBIteratorBase<iterator,Owner>::MemDBIteratorBase(iterator begin, iterator end, RefCntPtr<Owner> owner)
-	:begin(begin)
-	,end(end)
-	,owner(owner)
-
-{
+unsigned int MemDB::randomLevel() {
+	unsigned int l = 1;
+	while (l < maxLevel && (rnd() & 3) == 0) ++l;
+	return l;
 }
 
-template<typename iterator>
-MemDBIterator<iterator>::~MemDBIterator() {
-	MemDB::Sync _(this->owner->lock);
-	if (--this->owner->iterCount == 0) {
-		for (auto &&c: this->owner->eraseBatch) {
-			this->owner->data.erase(c);
+void MemDB::write(const Key &key, const Value &value, Version version) {
+	std::string_view k = keyView(key);
+	Node *preds[maxLevel];
+	Node *x = &head;
+	unsigned int lv = levels.load(std::memory_order_relaxed);
+	for (unsigned int l = lv; l < maxLevel; l++) preds[l] = &head;
+	for (unsigned int l = lv; l-- > 0;) {
+		Node *n;
+		while ((n = x->next[l].load(std::memory_order_relaxed)) != nullptr && keyView(n->key) < k) x = n;
+		preds[l] = x;
+	}
+	Node *n = x->next[0].load(std::memory_order_relaxed);
+	if (n != nullptr && keyView(n->key) == k) {
+		Record *h = n->head.load(std::memory_order_relaxed);
+		if (!value.valid && !h->value.valid) return;
+		n->head.store(new Record(version, value, h), std::memory_order_release);
+		++written;
+		if (!n->dirty) {
+			n->dirty = true;
+			dirty.push_back(n);
 		}
-		this->owner->eraseBatch.clear();
+	} else if (value.valid) {
+		n = new Node(key, randomLevel());
+		n->head.store(new Record(version, value, nullptr), std::memory_order_relaxed);
+		for (unsigned int l = 0; l < n->level; l++)
+			n->next[l].store(preds[l]->next[l].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		for (unsigned int l = 0; l < n->level; l++)
+			preds[l]->next[l].store(n, std::memory_order_release);
+		if (n->level > levels.load(std::memory_order_relaxed)) levels.store(n->level, std::memory_order_release);
 	}
 }
 
-template<typename iterator, typename Owner>
-bool MemDBIteratorBase<iterator,Owner>::next() {
-	MemDB::Sync _(owner->lock);
-	if (begin == end) return false;
-	++begin;
-	return true;
-}
-template<typename iterator, typename Owner>
-const MemDBCommon::Key &MemDBIteratorBase<iterator,Owner>::getKey() const {
-	return begin->first;
-}
-template<typename iterator, typename Owner>
-const MemDBCommon::Value &MemDBIteratorBase<iterator,Owner>::getValue() const {
-	return begin->second;
-}
-template<typename iterator, typename Owner>
-bool MemDBIteratorBase<iterator,Owner>::hasItems() const {
-	return begin != end;
+void MemDB::unlink(Node *node) {
+	std::string_view k = keyView(node->key);
+	Node *x = &head;
+	for (unsigned int l = node->level; l-- > 0;) {
+		Node *n;
+		while ((n = x->next[l].load(std::memory_order_relaxed)) != nullptr && keyView(n->key) < k) x = n;
+		if (n == node) x->next[l].store(node->next[l].load(std::memory_order_relaxed), std::memory_order_release);
+	}
 }
 
+void MemDB::collectGarbage() {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	Version oldest = readerVersions();
+	//nothing can be released while the readers are the same, unless enough versions were written
+	if (oldest == lastOldest && written < lastDirty + 64) return;
 
-template<typename iterator, typename Owner>
-bool MemDBIteratorBase<iterator,Owner>::getNext(KeyValue& row) {
-	MemDB::Sync _(owner->lock);
-	bool valid;
-	do {
-		if (begin == end) return false;
-		valid = begin->second.valid;
-		last_value = begin->second.data.str();
-		row.first = json::StrViewA(begin->first);
-		row.second = last_value;
-		++begin;
-	}
-	while (!valid);
-	return true;
+	auto e = std::remove_if(unlinked.begin(), unlinked.end(), [&](const std::pair<Version, Node *> &x) {
+		if (x.first >= oldest) return false;
+		delete x.second;
+		return true;
+	});
+	unlinked.erase(e, unlinked.end());
+	auto t = std::remove_if(trimmed.begin(), trimmed.end(), [&](const std::pair<Version, Record *> &x) {
+		if (x.first >= oldest) return false;
+		Record::releaseRef(x.second);
+		return true;
+	});
+	trimmed.erase(t, trimmed.end());
+
+	Version cur = committed.load(std::memory_order_relaxed);
+	//record is visible to a reader, if the reader's version is between the record and its newer record
+	auto needed = [&](const Record *r, const Record *newer) {
+		auto iter = std::lower_bound(readers.begin(), readers.end(), r->version);
+		return iter != readers.end() && *iter < newer->version;
+	};
+	auto d = std::remove_if(dirty.begin(), dirty.end(), [&](Node *n) {
+		Record *h = n->head.load(std::memory_order_relaxed);
+		Record *p = h;
+		Record *r = h->older.load(std::memory_order_relaxed);
+		//versions above the oldest reader, which are not visible to any reader, are removed
+		//from the list. A reader can still pass through them, so they are released later,
+		//but nobody reads their values
+		while (r && r->version > oldest) {
+			Record *o = r->older.load(std::memory_order_relaxed);
+			if (needed(r, p)) {
+				p = r;
+			} else {
+				p->older.store(o, std::memory_order_release);
+				r->value = Value();
+				trimmed.push_back(std::pair(cur, r));
+			}
+			r = o;
+		}
+		if (h->version <= oldest) r = h;
+		if (r == nullptr) return false;
+		Record *x = r->older.exchange(nullptr, std::memory_order_relaxed);
+		while (x) {
+			Record *o = x->older.load(std::memory_order_relaxed);
+			Record::releaseRef(x);
+			x = o;
+		}
+		if (r != h) return false;
+		n->dirty = false;
+		if (!h->value.valid) {
+			unlink(n);
+			unlinked.push_back(std::pair(cur, n));
+		}
+		return true;
+	});
+	dirty.erase(d, dirty.end());
+	lastOldest = oldest;
+	lastDirty = dirty.size();
+	written = 0;
 }
 
 void MemDB::commitBatch(std::vector<MemDBChangeset::Command> &batch) {
-	MemDB::Sync _(lock);
+	WriteSync _(lock);
+	Version ver = committed.load(std::memory_order_relaxed) + 1;
 	json::String key;
 	for (auto &&c : batch) {
 		switch (c.first) {
 		case 0: std::swap(key, c.second);break;
 		case 1: {
-			MemDB::Value &val = data[key];
-			for (auto &c: snapshots) c->copyOnWrite(key,val);
-			val.data =  c.second;
+			Value val;
+			val.data = c.second;
 			val.valid = true;
+			write(key, val, ver);
 			break;
 			}
-		case 2: {
-			auto iter = data.find(c.second);
-			if (iter != data.end()) {
-				for (auto &c: snapshots) c->copyOnWrite(iter->first,iter->second);
-				if (iterCount) {
-					iter->second.valid = false;
-					iter->second.data = json::String();
-					eraseBatch.push_back(c.second);
-				} else {
-					data.erase(iter);
-				}
-			}
-
-		} break;
+		case 2: write(c.second, Value(), ver);
+			break;
 		}
 	}
+	committed.store(ver);
+	collectGarbage();
 	batch.clear();
 
 }
 
 PKeyValueDatabaseSnapshot MemDB::createSnapshot() {
-	MemDBSnapshot *msnp = new MemDBSnapshot(this);
-	PKeyValueDatabaseSnapshot snp = msnp;
-	addSnapshot(msnp);
-	return snp;
+	return new MemDBSnapshot(this);
 }
 
 MemDBSnapshot::MemDBSnapshot(RefCntPtr<MemDB> owner)
-	:owner(owner){
-
+	:owner(owner),guard(*owner) {
 }
 
-PIterator MemDBSnapshot::findRange(const std::string_view& prefix, bool reverse) {
-	Sync _(lock);
-	PMemDBIterBase iter1 = PMemDBIterBase::staticCast(owner->findRange(prefix,reverse));
-
-	auto begin = prefix.empty()?data.begin():data.lower_bound(json::StrViewA(prefix));
-	auto end = prefix.empty()?data.end():data.lower_bound(prefixLastKey(prefix));
-
-	if (reverse) {
-		PMemDBIterBase iter2 =  new MemDBIteratorBase<DataMap::reverse_iterator, MemDBSnapshot>(
-				std::make_reverse_iterator(begin),
-				std::make_reverse_iterator(end),
-				this);
-		return new MemDBSnapshotIterator<std::greater<json::String> >(iter1,iter2,std::greater<json::String>());
-	} else {
-		PMemDBIterBase iter2 =  new MemDBIteratorBase<DataMap::iterator, MemDBSnapshot>(begin,end,this);
-		return new MemDBSnapshotIterator<std::less<json::String> >(iter1,iter2,std::less<json::String>());
-	}
-
+PIterator MemDBSnapshot::findRange(const std::string_view& prefix, bool reverse, const ReadHint &) {
+	return owner->findRange(prefix, reverse, guard.getVersion());
 }
 
-PIterator MemDBSnapshot::findRange(const std::string_view& start, const std::string_view& stop) {
-	Sync _(lock);
-	PMemDBIterBase iter1 = PMemDBIterBase::staticCast(owner->findRange(start,stop));
-	auto begin = data.lower_bound(json::StrViewA(start));
-	auto end = data.lower_bound(json::StrViewA(stop));
-	if (start > stop) {
-		PMemDBIterBase iter2 = new MemDBIteratorBase<DataMap::reverse_iterator,MemDBSnapshot>(
-				std::make_reverse_iterator(begin),
-				std::make_reverse_iterator(end),
-				this);
-		return new MemDBSnapshotIterator<std::greater<json::String> >(iter1,iter2,std::greater<json::String>());
-	} else {
-		PMemDBIterBase iter2 = new MemDBIteratorBase<DataMap::iterator,MemDBSnapshot>(begin,end,this);
-		return new MemDBSnapshotIterator<std::less<json::String> >(iter1,iter2,std::less<json::String>());
-	}
+PIterator MemDBSnapshot::findRange(const std::string_view& start, const std::string_view& stop, const ReadHint &) {
+	return owner->findRange(start, stop, guard.getVersion());
 }
 
-bool MemDBSnapshot::lookup(const std::string_view& key, std::string& value) {
-	Sync _(lock);
-	auto iter = data.find(json::StrViewA(key));
-	if (iter == data.end()) return owner->lookup(key,value);
-	if (iter->second.valid) {
-		value = iter->second.data.str();
-		return true;
-	} else {
-		return false;
-	}
-
+bool MemDBSnapshot::lookup(const std::string_view& key, std::string& value, const ReadHint &) {
+	return owner->lookup(key, value, guard.getVersion());
 }
 
-bool MemDBSnapshot::exists(const std::string_view& key) {
-	Sync _(lock);
-	auto iter = data.find(json::StrViewA(key));
-	if (iter != data.end()) {
-		return iter->second.valid;
-	} else {
-		return owner->exists(key);
-	}
+bool MemDBSnapshot::lookupPinned(const std::string_view& key, PinnedValue& value, const ReadHint &) {
+	return owner->lookupPinned(key, value, guard.getVersion());
 }
 
-MemDBSnapshot::~MemDBSnapshot() {
-	owner->removeSnapshot(this);
+bool MemDBSnapshot::exists(const std::string_view& key) {
+	return owner->exists(key, guard.getVersion());
 }
 
 bool MemDBSnapshot::existsPrefix(const std::string_view& key) {
-	Iterator iter ( findRange(key,false));
-	return iter.getNext();
-}
-
-void MemDBSnapshot::copyOnWrite(const Key& key, const Value& value) {
-	Sync _(lock);
-	auto iter = data.find(key);
-	if (iter == data.end()) {
-		data.insert(std::pair(key,value));
-	}
+	return owner->existsPrefix(key, guard.getVersion());
 }
 
-void MemDB::addSnapshot(MemDBSnapshot* snapshot) {
-	Sync _(lock);
-
-	snapshots.push_back(snapshot);
-
-}
-
-void MemDB::removeSnapshot(MemDBSnapshot* snapshot) {
-	Sync _(lock);
-	auto iter = std::find(snapshots.begin(),snapshots.end(),snapshot);
-	if (iter != snapshots.end()) {
-		snapshots.erase(iter);
+MemDBIterator::MemDBIterator(RefCntPtr<MemDB> owner, Range &&range, bool reverse, MemDB::Version version)
+	:owner(owner)
+	,guard(*owner, version)
+	,range(std::move(range)),reverse(reverse) {
+	if (reverse) {
+		cur = this->range.hi_inf?owner->findLast():owner->findLess(this->range.hi);
+	} else {
+		cur = owner->lowerBound(this->range.lo);
 	}
-
+	settle();
 }
 
-template< typename Cmp>
-inline MemDBSnapshotIterator<Cmp>::MemDBSnapshotIterator(
-		PIter iter1, PIter iter2, Cmp cmp):iter1(iter1),iter2(iter2),cmp(cmp) {
+void MemDBIterator::advance() {
+	if (reverse) cur = owner->findLess(MemDB::keyView(cur->key));
+	else cur = cur->next[0].load(std::memory_order_acquire);
 }
 
-template<typename Cmp>
-inline bool sofadb::MemDBSnapshotIterator<Cmp>::getNext(KeyValue& row) {
-
-	bool hv1 = iter1->hasItems();
-	bool hv2 = iter2->hasItems();
-	while (hv1 && hv2) {
-		auto k1 = iter1->getKey();
-		auto k2 = iter2->getKey();
-		if (cmp(k1, k2)) {
-			if (iter1->getValue().valid) {
-				iter1->getNext(row);
-				return true;
-			} else {
-				iter1->next();
-			}
-		} else if (cmp(k2 , k1)) {
-			if (iter1->getValue().valid) {
-				iter2->getNext(row);
-				return true;
-			} else {
-				iter2->next();
-			}
+void MemDBIterator::settle() {
+	while (cur) {
+		std::string_view k = MemDB::keyView(cur->key);
+		if (reverse) {
+			if (k < range.lo || (!range.lo_incl && k == range.lo)) break;
 		} else {
-			if (iter2->getValue().valid) {
-				iter2->getNext(row);
-				iter1->next();
-				return true;
-			} else {
-				iter1->next();
-				iter2->next();
-			}
+			if (!range.hi_inf && k >= range.hi) break;
 		}
+		rec = MemDB::visible(cur, guard.getVersion());
+		if (rec) return;
+		advance();
 	}
-	if (hv1) {
-		return iter1->getNext(row);
-	} else if (hv2) {
-		return iter2->getNext(row);
-	} else {
-		return false;
+	cur = nullptr;
+	rec = nullptr;
+}
+
+bool MemDBIterator::getNext(KeyValue &row) {
+	while (cur) {
+		const MemDB::Node *n = cur;
+		const MemDB::Record *r = rec;
+		advance();
+		settle();
+		if (r->value.valid) {
+			//records are not released while the iterator exists
+			row.first = MemDB::keyView(n->key);
+			row.second = json::StrViewA(r->value.data);
+			return true;
+		}
 	}
-
+	return false;
+}
+
+std::size_t MemDBIterator::getNextBatch(KeyValue *rows, std::size_t count) {
+	std::size_t n = 0;
+	while (n < count && cur) {
+		const MemDB::Node *nd = cur;
+		const MemDB::Record *r = rec;
+		advance();
+		settle();
+		if (r->value.valid) {
+			rows[n].first = MemDB::keyView(nd->key);
+			rows[n].second = json::StrViewA(r->value.data);
+			++n;
+		}
+	}
+	return n;
 }
 
 }
@@ -10,16 +10,16 @@
 
 #include <imtjson/string.h>
 #include "kvapi.h"
-#include <map>
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <random>
 #include <vector>
 
 
 namespace sofadb {
 
 class MemDB;
-template<typename> class MemDBIterator;
 
 class MemDBChangeset: public AbstractChangeset {
 public:
@@ -45,132 +45,233 @@ public:
 		bool valid = false;
 		json::String data;
 	};
-	using Sync = std::unique_lock<std::recursive_mutex>;
-	using DataMap = std::map<Key, Value, std::less<json::StrViewA> >;
 
 };
 
 
-///Memory snapshot
-/**
- * @note we will only emulate snapshot by keeping lock to avoid changes from other threads
- * It expects that snapshot is not kept for long time
+///Memory database
+/** Data are stored in a skiplist ordered by the key. Writes are serialized by a mutex, readers
+ * never lock. Every commit creates a new version of the database. Written values are
+ * prepended to the list of versions of the key, and the commit becomes visible to the
+ * readers when the version is published, so the readers always see whole batches.
+ *
+ * Every reader (lookup, iterator or snapshot) registers its version in a reader slot. Old versions
+ * and erased keys are released by the writer once no registered reader can see them. Versions
+ * between the readers (not visible to any of them) are removed from the list and their values
+ * are released immediately, so an open snapshot doesn't keep all versions of the hot keys
  */
-class MemDBSnapshot: public AbstractKeyValueDatabaseSnapshot, public MemDBCommon {
+class MemDB: public AbstractKeyValueDatabase, public MemDBCommon {
 public:
-	MemDBSnapshot(RefCntPtr<MemDB> owner);
-	~MemDBSnapshot();
+	using Version = std::uint64_t;
+	using WriteSync = std::unique_lock<std::mutex>;
+
+	///Version of a value
+	/** The record is owned by the database */
+	struct Record: public AbstractPinHolder {
+		///version of the commit which created the record
+		Version version;
+		///value, invalid value is tombstone
+		Value value;
+		///previous version
+		std::atomic<Record *> older;
+
+		Record(Version version, const Value &value, Record *older)
+			:version(version),value(value),older(older) {addRef();}
+		///Releases the reference owned by the database
+		static void releaseRef(Record *r) {if (r->release()) delete r;}
+	};
 
-	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false);
-	virtual PIterator findRange(const std::string_view &start, const std::string_view &end);
-	virtual bool lookup(const std::string_view &key, std::string &value);
-	virtual bool exists(const std::string_view &key);
-	virtual bool existsPrefix(const std::string_view &key);
-	void copyOnWrite(const Key &key, const Value &value);
-protected:
-	RefCntPtr<MemDB> owner;
-	std::recursive_mutex lock;
-	DataMap data;
+	///Holds data of a pinned value
+	struct Pin: public AbstractPinHolder {
+		json::String data;
+		Pin(const json::String &data):data(data) {}
+	};
 
-	template<typename,typename> friend class MemDBIteratorBase;
+	///Node of the skiplist
+	struct Node {
+		Key key;
+		///newest version
+		std::atomic<Record *> head;
+		///count of levels
+		unsigned int level;
+		///true if the node is in the list of the nodes to collect (writer only)
+		bool dirty = false;
+		std::unique_ptr<std::atomic<Node *>[]> next;
+
+		Node(const Key &key, unsigned int level);
+		~Node();
+	};
 
-};
+	///Slot of a registered reader
+	struct ReaderSlot {
+		///version of the reader, zero if not reading
+		std::atomic<Version> version;
+		std::atomic<bool> used;
+		ReaderSlot *nextSlot = nullptr;
 
+		ReaderSlot():version(0),used(false) {}
+	};
 
+	///Registers reader for its lifetime
+	/** Versions visible to the reader are not released until the guard is destroyed */
+	class ReadGuard {
+	public:
+		///Registers reader
+		/**
+		 * @param db database
+		 * @param version version to read. It must be already held by other guard. Use
+		 * 0 to read the last published version
+		 */
+		ReadGuard(MemDB &db, Version version = 0);
+		~ReadGuard();
+		ReadGuard(const ReadGuard &) = delete;
+		ReadGuard &operator=(const ReadGuard &) = delete;
+
+		Version getVersion() const {return version;}
+	protected:
+		ReaderSlot *slot;
+		Version version;
+	};
 
-class MemDB: public AbstractKeyValueDatabase, public MemDBCommon {
-public:
 	MemDB();
+	~MemDB();
 
 	virtual PChangeset createChangeset();
-	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false) ;
-	virtual PIterator findRange(const std::string_view &start, const std::string_view &end) ;
-	virtual bool lookup(const std::string_view &key, std::string &value) ;
+	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false, const ReadHint &hint = ReadHint()) ;
+	virtual PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint = ReadHint()) ;
+	virtual bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint = ReadHint()) ;
+	virtual bool lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint = ReadHint());
 	virtual bool exists(const std::string_view &key) ;
 	virtual bool existsPrefix(const std::string_view &key) ;
 	virtual void destroy();
 	virtual PKeyValueDatabaseSnapshot createSnapshot();
 
-	void commitBatch(std::vector<MemDBChangeset::Command> &batch);
+	virtual void commitBatch(std::vector<MemDBChangeset::Command> &batch);
+
+	///Reads range of given version
+	/**
+	 * @param prefix prefix
+	 * @param reverse reverse order
+	 * @param version version, must be held by a ReadGuard. Use 0 to read last version
+	 */
+	PIterator findRange(const std::string_view &prefix, bool reverse, Version version);
+	///Reads range of given version
+	PIterator findRange(const std::string_view &start, const std::string_view &end, Version version);
+	///Reads key of given version (must be held by a ReadGuard)
+	bool lookup(const std::string_view &key, std::string &value, Version version);
+	///Reads key of given version (must be held by a ReadGuard)
+	bool lookupPinned(const std::string_view &key, PinnedValue &value, Version version);
+	///Checks key of given version (must be held by a ReadGuard)
+	bool exists(const std::string_view &key, Version version);
+	///Checks prefix of given version (must be held by a ReadGuard)
+	bool existsPrefix(const std::string_view &key, Version version);
+
+	///Finds first node which key is equal or above the key
+	Node *lowerBound(const std::string_view &key) const;
+	///Finds last node which key is below the key
+	Node *findLess(const std::string_view &key) const;
+	///Finds last node
+	Node *findLast() const;
+	///Returns version of the node visible for the reader, or nullptr if the key doesn't exist in this version
+	static const Record *visible(const Node *node, Version version);
+
+	static std::string_view keyView(const Key &key) {return json::StrViewA(key);}
 
-	void addSnapshot(MemDBSnapshot *snapshot);
-	void removeSnapshot(MemDBSnapshot *snapshot);
 protected:
 
-
-
-
-	std::recursive_mutex lock;
-	DataMap data;
-	unsigned int iterCount = 0;
-	std::vector<json::String> eraseBatch;
-	std::vector<MemDBSnapshot *> snapshots;
-
+	static const unsigned int maxLevel = 24;
+
+	std::mutex lock;
+	Node head;
+	///count of levels in use
+	std::atomic<unsigned int> levels;
+	///last published version
+	std::atomic<Version> committed;
+	std::atomic<ReaderSlot *> slots;
+	///nodes which have older versions or they are erased
+	std::vector<Node *> dirty;
+	///nodes removed from the list, which can be still accessed by readers up to given version
+	std::vector<std::pair<Version, Node *> > unlinked;
+	///records removed from the list of versions, which can be still passed by readers up to given version
+	std::vector<std::pair<Version, Record *> > trimmed;
+	///versions of the registered readers, sorted (writer only)
+	std::vector<Version> readers;
+	Version lastOldest = 0;
+	std::size_t lastDirty = 0;
+	///count of versions written to existing keys since last collection
+	std::size_t written = 0;
+	std::minstd_rand rnd;
+
+	ReaderSlot *acquireSlot();
+	///Retrieves sorted versions of the registered readers into the readers, returns the oldest
+	Version readerVersions();
+	void write(const Key &key, const Value &value, Version version);
+	void unlink(Node *node);
+	void collectGarbage();
+	unsigned int randomLevel();
 
 	friend class MemDBChangeset;
-	template<typename> friend class MemDBIterator;
-	template<typename,typename> friend class MemDBIteratorBase;
-	friend class MemDBSnapshot;
 
 };
 
-class MemDBIteratorGen: public  AbstractIterator {
+///Iterator over the range of the MemDB
+/** Iterator sees version of the database at the time of its creation, or version of the snapshot */
+class MemDBIterator: public AbstractIterator {
 public:
-	virtual bool hasItems() const = 0;
-	virtual const MemDBCommon::Key &getKey() const = 0;
-	virtual const MemDBCommon::Value &getValue() const = 0;
-	virtual bool next() = 0;
-
-};
-
-template<typename iterator, typename Owner>
-class MemDBIteratorBase: public MemDBIteratorGen {
-public:
-	MemDBIteratorBase(iterator begin,
-			iterator end,
-			RefCntPtr<Owner> owner);
+	struct Range {
+		///lower bound
+		std::string lo;
+		///upper bound (excluded)
+		std::string hi;
+		///lower bound is included
+		bool lo_incl = true;
+		///there is no upper bound
+		bool hi_inf = false;
+	};
 
+	///Creates iterator
+	/**
+	 * @param owner database
+	 * @param range range
+	 * @param reverse reverse order
+	 * @param version version held by a ReadGuard, or 0 to read the last version
+	 */
+	MemDBIterator(RefCntPtr<MemDB> owner, Range &&range, bool reverse, MemDB::Version version);
 
 	virtual bool getNext(KeyValue &row);
-	virtual bool hasItems() const ;
-	virtual const MemDBCommon::Key &getKey() const;
-	virtual const MemDBCommon::Value &getValue() const;
-	virtual bool next() ;
+	///Rows are not copied, they are valid while the iterator exists
+	virtual std::size_t getNextBatch(KeyValue *rows, std::size_t count);
 
 protected:
-	iterator begin;
-	iterator end;
-	RefCntPtr<Owner> owner;
-
-	std::string last_value;
-};
-
-
-
-template<typename iterator>
-class MemDBIterator: public MemDBIteratorBase<iterator,MemDB> {
-public:
-	using MemDBIteratorBase<iterator,MemDB>::MemDBIteratorBase;
-
-	~MemDBIterator();
+	RefCntPtr<MemDB> owner;
+	MemDB::ReadGuard guard;
+	Range range;
+	bool reverse;
+	MemDB::Node *cur;
+	const MemDB::Record *rec = nullptr;
+
+	void advance();
+	void settle();
 };
 
-using PMemDBIterBase =  RefCntPtr<MemDBIteratorGen>;
-
-
-template<typename Cmp>
-class MemDBSnapshotIterator: public AbstractIterator {
+///Memory snapshot
+/** Snapshot is a version of the database held by a reader slot. Creating the snapshot doesn't
+ * copy anything and writers are not affected by the count of the snapshots. Older
+ * versions of the keys are kept until the snapshot is released
+ */
+class MemDBSnapshot: public AbstractKeyValueDatabaseSnapshot {
 public:
-	using PIter = RefCntPtr<MemDBIteratorGen>;
-	MemDBSnapshotIterator(PIter iter1, PIter iter2, Cmp cmp);
-
-
-	virtual bool getNext(KeyValue &row);
+	MemDBSnapshot(RefCntPtr<MemDB> owner);
 
+	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false, const ReadHint &hint = ReadHint());
+	virtual PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint = ReadHint());
+	virtual bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint = ReadHint());
+	virtual bool lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint = ReadHint());
+	virtual bool exists(const std::string_view &key);
+	virtual bool existsPrefix(const std::string_view &key);
 protected:
-	PIter iter1;
-	PIter iter2;
-	Cmp cmp;
+	RefCntPtr<MemDB> owner;
+	MemDB::ReadGuard guard;
 };
 
 }
@@ -0,0 +1,493 @@
+/*
+ * kvapi_rocksdb.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <algorithm>
+#include <rocksdb/cache.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/options.h>
+#include <rocksdb/perf_context.h>
+#include <rocksdb/perf_level.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/table.h>
+#include "keyformat.h"
+#include "kvapi_rocksdb.h"
+#include "kvapi_rocksdb_impl.h"
+#include "readstats.h"
+
+namespace sofadb {
+
+std::string prefixLastKey(const std::string_view &prefix);
+
+static const std::string destroy_key="~destroy";
+
+namespace {
+
+struct FamilyDef {
+	const char *name;
+	///keys start by type and dbid, use prefix extractor
+	bool prefix;
+	///family is used for point lookups, use bloom filter
+	bool bloom;
+	///keys are appended in order of sequence numbers, use universal compaction
+	bool universal;
+	///family is rarely read, use cold cache
+	bool cold;
+};
+
+//order must match RocksDBDatabase::Family
+const FamilyDef families[RocksDBDatabase::fam_count] = {
+		{"default", false, false, false, false},
+		{"docs", true, true, false, false},
+		{"seq", true, false, true, false},
+		{"doc_revs", true, true, false, true},
+		{"object_index", true, true, true, true},
+		{"view_map", true, false, false, false},
+		{"view_docs", true, true, false, false},
+};
+
+class PinnedSlice: public AbstractPinHolder {
+public:
+	rocksdb::PinnableSlice slice;
+};
+
+///Accounts block cache hits and misses of the current thread to ReadStats
+class PerfScope {
+public:
+	PerfScope(ReadType type):type(type) {
+		if (rocksdb::GetPerfLevel() < rocksdb::kEnableCount) rocksdb::SetPerfLevel(rocksdb::kEnableCount);
+		ctx = rocksdb::get_perf_context();
+		hits = ctx->block_cache_hit_count;
+		misses = ctx->block_read_count;
+	}
+	~PerfScope() {
+		ReadStats::add(type, ctx->block_cache_hit_count - hits, ctx->block_read_count - misses);
+	}
+protected:
+	ReadType type;
+	rocksdb::PerfContext *ctx;
+	std::uint64_t hits, misses;
+};
+
+}
+
+inline rocksdb::Slice str2slice(const std::string_view &w) {
+	return rocksdb::Slice(w.data(),w.length());
+}
+inline std::string_view slice2str(const rocksdb::Slice &w) {
+	return std::string_view(w.data(),w.size());
+}
+
+static rocksdb::ColumnFamilyOptions familyOptions(const RocksDBConfig &cfg, const FamilyDef &def,
+		const std::shared_ptr<rocksdb::Cache> &cache) {
+	rocksdb::ColumnFamilyOptions opt;
+	opt.write_buffer_size = cfg.write_buffer_size;
+	if (def.universal) {
+		opt.compaction_style = rocksdb::kCompactionStyleUniversal;
+	} else {
+		opt.compaction_style = rocksdb::kCompactionStyleLevel;
+		opt.level_compaction_dynamic_level_bytes = true;
+	}
+	if (def.prefix) {
+		opt.prefix_extractor.reset(rocksdb::NewFixedPrefixTransform(RocksDBDatabase::prefixLen));
+	}
+	rocksdb::BlockBasedTableOptions topt;
+	topt.block_cache = cache;
+	if (cfg.bloom_bits) {
+		//families without point lookups still use prefix bloom for scans
+		if (def.bloom || def.prefix) topt.filter_policy.reset(rocksdb::NewBloomFilterPolicy(cfg.bloom_bits, false));
+		topt.whole_key_filtering = def.bloom;
+	}
+	opt.table_factory.reset(rocksdb::NewBlockBasedTableFactory(topt));
+	return opt;
+}
+
+PKeyValueDatabase rocksdb_open(const RocksDBConfig &cfg, const std::string &name) {
+	rocksdb::DBOptions dbopts;
+	dbopts.create_if_missing = cfg.create_if_missing;
+	dbopts.create_missing_column_families = true;
+	dbopts.max_background_jobs = cfg.max_background_jobs;
+
+	std::shared_ptr<rocksdb::Cache> hot = rocksdb::NewLRUCache(cfg.hot_cache);
+	std::shared_ptr<rocksdb::Cache> cold = rocksdb::NewLRUCache(cfg.cold_cache);
+	std::vector<rocksdb::ColumnFamilyDescriptor> cfds;
+	for (auto &&f: families) {
+		cfds.push_back(rocksdb::ColumnFamilyDescriptor(f.name, familyOptions(cfg, f, f.cold?cold:hot)));
+	}
+
+	rocksdb::DB *db;
+	std::vector<rocksdb::ColumnFamilyHandle *> handles;
+	rocksdb::Status st = rocksdb::DB::Open(dbopts, name, cfds, &handles, &db);
+	if (!st.ok()) throw RocksDBException(st.ToString());
+	RocksDBDatabase *d;
+	PKeyValueDatabase kvdb = d = new RocksDBDatabase(db, std::move(handles), name);
+	if (d->isDestroyed()) {
+		///this should delete database because it is deleted in destructor
+		kvdb = nullptr;
+		return rocksdb_open(cfg, name);
+	}
+	return kvdb;
+}
+
+RocksDBDatabase::RocksDBDatabase(rocksdb::DB *db, std::vector<rocksdb::ColumnFamilyHandle *> &&handles, const std::string_view &name)
+	:db(db),handles(std::move(handles)),name(name) {
+}
+
+RocksDBDatabase::~RocksDBDatabase() {
+	bool d = isDestroyed();
+	for (auto &&h: handles) db->DestroyColumnFamilyHandle(h);
+	delete db;
+	if (d) rocksdb::DestroyDB(name, rocksdb::Options());
+}
+
+RocksDBDatabase::Family RocksDBDatabase::familyOfType(unsigned char type) {
+	switch (static_cast<IndexType>(type)) {
+	case IndexType::docs: return fam_docs;
+	case IndexType::seq: return fam_seq;
+	case IndexType::doc_revs: return fam_doc_revs;
+	case IndexType::object_index: return fam_object_index;
+	case IndexType::view_map: return fam_view_map;
+	case IndexType::view_docs: return fam_view_docs;
+	default: return fam_default;
+	}
+}
+
+bool RocksDBDatabase::hasPrefixExtractor(Family f) {
+	return families[f].prefix;
+}
+
+rocksdb::ColumnFamilyHandle *RocksDBDatabase::family(const std::string_view &key) const {
+	return handles[key.empty()?fam_default:familyOfType(static_cast<unsigned char>(key[0]))];
+}
+
+PChangeset RocksDBDatabase::createChangeset() {
+	return new RocksDBChangeset(this);
+}
+
+PIterator RocksDBDatabase::findRange(const std::string_view &prefix, bool reverse, const ReadHint &hint) {
+	return findRange(prefix, reverse, hint, nullptr);
+}
+
+PIterator RocksDBDatabase::findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint) {
+	return findRange(start, end, hint, nullptr);
+}
+
+bool RocksDBDatabase::lookup(const std::string_view &key, std::string &value, const ReadHint &hint) {
+	return lookup(key, value, hint, nullptr);
+}
+
+bool RocksDBDatabase::lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint) {
+	return lookupPinned(key, value, hint, nullptr);
+}
+
+void RocksDBDatabase::lookupMulti(const std::vector<std::string_view> &keys,
+		const std::function<void(std::size_t, const std::string_view &)> &callback, const ReadHint &hint) {
+	lookupMulti(keys, callback, hint, nullptr);
+}
+
+bool RocksDBDatabase::exists(const std::string_view &key) {
+	return exists(key, nullptr);
+}
+
+bool RocksDBDatabase::existsPrefix(const std::string_view &key) {
+	return existsPrefix(key, nullptr);
+}
+
+rocksdb::ReadOptions RocksDBDatabase::readOptions(const ReadHint &hint, const rocksdb::Snapshot *snap) {
+	rocksdb::ReadOptions opt;
+	opt.fill_cache = hint.fill_cache;
+	opt.readahead_size = hint.readahead;
+	opt.snapshot = snap;
+	return opt;
+}
+
+PIterator RocksDBDatabase::findRange(const std::string_view &prefix, bool reverse, const ReadHint &hint, const rocksdb::Snapshot *snap) {
+	RocksDBIterator::Range r;
+	r.lo = prefix;
+	r.hi = prefixLastKey(prefix);
+	r.hi_inf = r.hi.empty();
+	return new RocksDBIterator(this, std::move(r), reverse, prefix.length() >= prefixLen, hint, snap);
+}
+
+PIterator RocksDBDatabase::findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint, const rocksdb::Snapshot *snap) {
+	RocksDBIterator::Range r;
+	bool ps = start.length() >= prefixLen && end.length() >= prefixLen
+			&& start.substr(0, prefixLen) == end.substr(0, prefixLen);
+	if (start > end) {
+		r.lo = end;
+		r.hi = start;
+		r.lo_incl = false;
+		return new RocksDBIterator(this, std::move(r), true, ps, hint, snap);
+	} else {
+		r.lo = start;
+		r.hi = end;
+		return new RocksDBIterator(this, std::move(r), false, ps, hint, snap);
+	}
+}
+
+bool RocksDBDatabase::lookup(const std::string_view &key, std::string &value, const ReadHint &hint, const rocksdb::Snapshot *snap) {
+	PerfScope _(hint.type);
+	rocksdb::Status s = db->Get(readOptions(hint, snap), family(key), str2slice(key), &value);
+	if (s.ok()) return true;
+	if (s.IsNotFound()) return false;
+	throw RocksDBException(s.ToString());
+}
+
+bool RocksDBDatabase::lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint, const rocksdb::Snapshot *snap) {
+	PerfScope _(hint.type);
+	RefCntPtr<PinnedSlice> p = new PinnedSlice;
+	rocksdb::Status s = db->Get(readOptions(hint, snap), family(key), str2slice(key), &p->slice);
+	if (s.ok()) {
+		value.pin(p, slice2str(p->slice));
+		return true;
+	}
+	if (s.IsNotFound()) return false;
+	throw RocksDBException(s.ToString());
+}
+
+void RocksDBDatabase::lookupMulti(const std::vector<std::string_view> &keys,
+		const std::function<void(std::size_t, const std::string_view &)> &callback,
+		const ReadHint &hint, const rocksdb::Snapshot *snap) {
+	std::size_t cnt = keys.size();
+	if (cnt == 0) return;
+	PerfScope _(hint.type);
+	rocksdb::ReadOptions opt = readOptions(hint, snap);
+	std::vector<rocksdb::ColumnFamilyHandle *> cfs;
+	std::vector<rocksdb::Slice> slices;
+	cfs.reserve(cnt);
+	slices.reserve(cnt);
+	for (auto &&k: keys) {
+		cfs.push_back(family(k));
+		slices.push_back(str2slice(k));
+	}
+	std::vector<rocksdb::PinnableSlice> values(cnt);
+	std::vector<rocksdb::Status> st(cnt);
+	db->MultiGet(opt, cnt, cfs.data(), slices.data(), values.data(), st.data());
+	for (std::size_t i = 0; i < cnt; i++) {
+		if (st[i].ok()) callback(i, slice2str(values[i]));
+		else if (!st[i].IsNotFound()) throw RocksDBException(st[i].ToString());
+	}
+}
+
+bool RocksDBDatabase::exists(const std::string_view &key, const rocksdb::Snapshot *snap) {
+	rocksdb::ReadOptions opt;
+	opt.snapshot = snap;
+	rocksdb::ColumnFamilyHandle *cf = family(key);
+	std::string tmp;
+	bool found = false;
+	//bloom filter answers most of negative queries
+	if (!db->KeyMayExist(opt, cf, str2slice(key), &tmp, &found)) return false;
+	if (found) return true;
+	rocksdb::PinnableSlice v;
+	rocksdb::Status s = db->Get(opt, cf, str2slice(key), &v);
+	if (s.ok()) return true;
+	if (s.IsNotFound()) return false;
+	throw RocksDBException(s.ToString());
+}
+
+bool RocksDBDatabase::existsPrefix(const std::string_view &key, const rocksdb::Snapshot *snap) {
+	Iterator iter(findRange(key, false, ReadHint(), snap));
+	return iter.getNext();
+}
+
+void RocksDBDatabase::destroy() {
+	db->Put(rocksdb::WriteOptions(), family(fam_default), destroy_key, rocksdb::Slice());
+}
+
+bool RocksDBDatabase::isDestroyed() const {
+	std::string dummy;
+	return db->Get(rocksdb::ReadOptions(), handles[fam_default], destroy_key, &dummy).ok();
+}
+
+PKeyValueDatabaseSnapshot RocksDBDatabase::createSnapshot() {
+	const rocksdb::Snapshot *sht = db->GetSnapshot();
+	try {
+		return new RocksDBSnapshot(this, sht);
+	} catch (...) {
+		db->ReleaseSnapshot(sht);
+		throw;
+	}
+}
+
+void RocksDBDatabase::compact(const std::string_view &start, const std::string_view &end) {
+	rocksdb::Slice b = str2slice(start);
+	rocksdb::Slice e = str2slice(end);
+	for (auto &&h: handles) db->CompactRange(rocksdb::CompactRangeOptions(), h, &b, &e);
+}
+
+RocksDBIterator::RocksDBIterator(RefCntPtr<RocksDBDatabase> db, Range &&range, bool reverse, bool prefix_seek, const ReadHint &hint, const rocksdb::Snapshot *snap)
+	:db(db),reverse(reverse),prefix_seek(prefix_seek),hint(hint),snap(snap) {
+
+	unsigned int b0 = range.lo.empty()?0:static_cast<unsigned char>(range.lo[0]);
+	unsigned int b1;
+	if (range.hi_inf) {
+		b1 = 255;
+	} else if (range.hi.empty()) {
+		return;
+	} else {
+		b1 = static_cast<unsigned char>(range.hi[0]);
+		if (range.hi.length() == 1) {
+			//keys below single byte have lower first byte
+			if (b1 == 0) return;
+			--b1;
+		}
+	}
+
+	for (unsigned int b = b0; b <= b1;) {
+		RocksDBDatabase::Family f = RocksDBDatabase::familyOfType(b);
+		unsigned int e = b;
+		while (e < b1 && RocksDBDatabase::familyOfType(e+1) == f) ++e;
+		Segment s;
+		s.family = f;
+		if (b == b0) {
+			s.lo = range.lo;
+			s.lo_incl = range.lo_incl;
+		} else {
+			s.lo = std::string(1, static_cast<char>(b));
+			s.lo_incl = true;
+		}
+		if (e == b1) {
+			s.hi = range.hi;
+			s.hi_inf = range.hi_inf;
+		} else {
+			s.hi = std::string(1, static_cast<char>(e+1));
+			s.hi_inf = false;
+		}
+		segments.push_back(std::move(s));
+		b = e+1;
+	}
+	if (reverse) std::reverse(segments.begin(), segments.end());
+}
+
+bool RocksDBIterator::openSegment() {
+	iter.reset();
+	if (curSeg >= segments.size()) return false;
+	const Segment &s = segments[curSeg];
+	rocksdb::ReadOptions opt = RocksDBDatabase::readOptions(hint, snap);
+	lower = str2slice(s.lo);
+	opt.iterate_lower_bound = &lower;
+	if (!s.hi_inf) {
+		upper = str2slice(s.hi);
+		opt.iterate_upper_bound = &upper;
+	}
+	if (prefix_seek && !reverse && RocksDBDatabase::hasPrefixExtractor(s.family)) opt.prefix_same_as_start = true;
+	else opt.total_order_seek = true;
+	iter.reset(db->getDBObject()->NewIterator(opt, db->family(s.family)));
+	if (reverse) {
+		iter->SeekToLast();
+	} else {
+		iter->Seek(lower);
+		if (!s.lo_incl && iter->Valid() && iter->key() == lower) iter->Next();
+	}
+	return true;
+}
+
+bool RocksDBIterator::getNext(KeyValue &row) {
+	PerfScope _(hint.type);
+	if (iter == nullptr) {
+		if (!openSegment()) return false;
+	} else if (reverse) {
+		iter->Prev();
+	} else {
+		iter->Next();
+	}
+	while (true) {
+		rocksdb::Status st = iter->status();
+		if (!st.ok()) throw RocksDBException(st.ToString());
+		if (iter->Valid()) {
+			rocksdb::Slice k = iter->key();
+			//lower bound of the reverse range is excluded
+			if (!reverse || segments[curSeg].lo_incl || k != lower) {
+				row.first = slice2str(k);
+				row.second = slice2str(iter->value());
+				return true;
+			}
+		}
+		++curSeg;
+		if (!openSegment()) return false;
+	}
+}
+
+RocksDBChangeset::RocksDBChangeset(RefCntPtr<RocksDBDatabase> db):db(db) {
+}
+
+void RocksDBChangeset::put(const std::string_view &key, const std::string_view &value) {
+	batch.Put(db->family(key), str2slice(key), str2slice(value));
+}
+
+void RocksDBChangeset::erase(const std::string_view &key) {
+	batch.Delete(db->family(key), str2slice(key));
+}
+
+void RocksDBChangeset::commit() {
+	rocksdb::Status st = db->getDBObject()->Write(rocksdb::WriteOptions(), &batch);
+	batch.Clear();
+	if (!st.ok()) throw RocksDBException(st.ToString());
+}
+
+void RocksDBChangeset::commitSync() {
+	rocksdb::WriteOptions opt;
+	opt.sync = true;
+	rocksdb::Status st = db->getDBObject()->Write(opt, &batch);
+	batch.Clear();
+	if (!st.ok()) throw RocksDBException(st.ToString());
+}
+
+void RocksDBChangeset::rollback() {
+	batch.Clear();
+}
+
+void RocksDBChangeset::erasePrefix(const std::string_view &prefix) {
+	//note: unlike to iteration, the range deletion removes also keys put by this batch before
+	std::string end = prefixLastKey(prefix);
+	if (!prefix.empty() && !end.empty()) {
+		batch.DeleteRange(db->family(prefix), str2slice(prefix), str2slice(end));
+	} else {
+		Iterator iter(db->findRange(prefix));
+		while (iter.getNext()) {
+			batch.Delete(db->family(iter->first), str2slice(iter->first));
+		}
+	}
+}
+
+RocksDBSnapshot::RocksDBSnapshot(RefCntPtr<RocksDBDatabase> db, const rocksdb::Snapshot *snapshot)
+	:db(db),snapshot(snapshot) {
+}
+
+RocksDBSnapshot::~RocksDBSnapshot() {
+	db->getDBObject()->ReleaseSnapshot(snapshot);
+}
+
+PIterator RocksDBSnapshot::findRange(const std::string_view &prefix, bool reverse, const ReadHint &hint) {
+	return db->findRange(prefix, reverse, hint, snapshot);
+}
+
+PIterator RocksDBSnapshot::findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint) {
+	return db->findRange(start, end, hint, snapshot);
+}
+
+bool RocksDBSnapshot::lookup(const std::string_view &key, std::string &value, const ReadHint &hint) {
+	return db->lookup(key, value, hint, snapshot);
+}
+
+bool RocksDBSnapshot::lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint) {
+	return db->lookupPinned(key, value, hint, snapshot);
+}
+
+void RocksDBSnapshot::lookupMulti(const std::vector<std::string_view> &keys,
+		const std::function<void(std::size_t, const std::string_view &)> &callback, const ReadHint &hint) {
+	db->lookupMulti(keys, callback, hint, snapshot);
+}
+
+bool RocksDBSnapshot::exists(const std::string_view &key) {
+	return db->exists(key, snapshot);
+}
+
+bool RocksDBSnapshot::existsPrefix(const std::string_view &key) {
+	return db->existsPrefix(key, snapshot);
+}
+
+}
@@ -0,0 +1,59 @@
+/*
+ * kvapi_rocksdb.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_LIBSOFA_KVAPI_ROCKSDB_H_
+#define SRC_LIBSOFA_KVAPI_ROCKSDB_H_
+
+#include <string>
+#include "kvapi.h"
+
+namespace sofadb {
+
+///Configuration of the RocksDB backend
+/** The backend is compiled only when SOFADB_ROCKSDB is defined (cmake option SOFADB_ROCKSDB) */
+struct RocksDBConfig {
+	///size of the block cache shared by hot column families (docs, seq, views, default)
+	std::size_t hot_cache = 256*1024*1024;
+	///size of the block cache shared by cold column families (doc_revs, object_index)
+	std::size_t cold_cache = 32*1024*1024;
+	///bits per key of the bloom filters, 0 disables filters
+	int bloom_bits = 10;
+	///size of the memtable of every column family
+	std::size_t write_buffer_size = 64*1024*1024;
+	///count of background threads (flush and compaction)
+	int max_background_jobs = 4;
+	bool create_if_missing = true;
+};
+
+class RocksDBException: public std::exception {
+public:
+
+	RocksDBException(const std::string &msg):msg(msg) {}
+	const char *what() const noexcept {return msg.c_str();}
+
+protected:
+	std::string msg;
+};
+
+///Opens RocksDB database
+/**
+ * Every IndexType is stored in its own column family (see keyformat.h)
+ *
+ * @note the backend is experimental. Its performance compared to LevelDB has not been
+ * measured yet, measure your workload by kvstore_bench (src/bench) before switching
+ *
+ * @param cfg configuration
+ * @param name path to the database
+ * @return database
+ *
+ * @exception RocksDBException unable to open database
+ */
+PKeyValueDatabase rocksdb_open(const RocksDBConfig &cfg, const std::string &name);
+
+}
+
+#endif /* SRC_LIBSOFA_KVAPI_ROCKSDB_H_ */
@@ -0,0 +1,175 @@
+/*
+ * kvapi_rocksdb_impl.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_LIBSOFA_KVAPI_ROCKSDB_IMPL_H_
+#define SRC_LIBSOFA_KVAPI_ROCKSDB_IMPL_H_
+
+#include <memory>
+#include <vector>
+#include <rocksdb/db.h>
+#include <rocksdb/write_batch.h>
+#include "kvapi.h"
+
+namespace sofadb {
+
+class RocksDBDatabase: public AbstractKeyValueDatabase {
+public:
+
+	///Column families, every IndexType is mapped to one family
+	enum Family {
+		///db_map, dbconfig, view_state, reduce_map and unknown types
+		fam_default = 0,
+		fam_docs,
+		fam_seq,
+		fam_doc_revs,
+		fam_object_index,
+		fam_view_map,
+		fam_view_docs,
+		fam_count
+	};
+
+	///Length of the prefix extracted for bloom filters and prefix seeks: type + dbid
+	static const std::size_t prefixLen = 5;
+
+	RocksDBDatabase(rocksdb::DB *db, std::vector<rocksdb::ColumnFamilyHandle *> &&handles, const std::string_view &name);
+	virtual ~RocksDBDatabase();
+
+	virtual PChangeset createChangeset();
+	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false, const ReadHint &hint = ReadHint()) ;
+	virtual PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint = ReadHint()) ;
+	virtual bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint = ReadHint()) ;
+	virtual bool lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint = ReadHint());
+	virtual void lookupMulti(const std::vector<std::string_view> &keys,
+			const std::function<void(std::size_t, const std::string_view &)> &callback,
+			const ReadHint &hint = ReadHint());
+	virtual bool exists(const std::string_view &key) ;
+	virtual bool existsPrefix(const std::string_view &key) ;
+	virtual void destroy();
+	virtual PKeyValueDatabaseSnapshot createSnapshot();
+	virtual void compact(const std::string_view &start, const std::string_view &end);
+
+	rocksdb::DB *getDBObject() {return db;}
+	///Retrieves column family of the key
+	rocksdb::ColumnFamilyHandle *family(const std::string_view &key) const;
+	rocksdb::ColumnFamilyHandle *family(Family f) const {return handles[f];}
+	///Retrieves family of the first byte of the key (type)
+	static Family familyOfType(unsigned char type);
+	///Returns true, if the family has prefix extractor
+	static bool hasPrefixExtractor(Family f);
+
+	bool isDestroyed() const;
+
+	///Creates read options for the hint
+	static rocksdb::ReadOptions readOptions(const ReadHint &hint, const rocksdb::Snapshot *snap);
+
+	///Implementation of reading (shared with snapshots)
+	PIterator findRange(const std::string_view &prefix, bool reverse, const ReadHint &hint, const rocksdb::Snapshot *snap);
+	PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint, const rocksdb::Snapshot *snap);
+	bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint, const rocksdb::Snapshot *snap);
+	bool lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint, const rocksdb::Snapshot *snap);
+	void lookupMulti(const std::vector<std::string_view> &keys,
+			const std::function<void(std::size_t, const std::string_view &)> &callback,
+			const ReadHint &hint, const rocksdb::Snapshot *snap);
+	bool exists(const std::string_view &key, const rocksdb::Snapshot *snap);
+	bool existsPrefix(const std::string_view &key, const rocksdb::Snapshot *snap);
+
+protected:
+	rocksdb::DB *db;
+	std::vector<rocksdb::ColumnFamilyHandle *> handles;
+	std::string name;
+};
+
+///Iterates range, which can span multiple column families
+/** The range is split into segments by the first byte of the key. Consecutive bytes
+ * mapped to the same family form single segment, so common ranges (inside one IndexType)
+ * are read by single rocksdb iterator
+ */
+class RocksDBIterator: public AbstractIterator {
+public:
+	struct Range {
+		///lower bound
+		std::string lo;
+		///upper bound (excluded)
+		std::string hi;
+		///lower bound is included
+		bool lo_incl = true;
+		///there is no upper bound
+		bool hi_inf = false;
+	};
+
+	///Constructs iterator
+	/**
+	 * @param db database
+	 * @param range range
+	 * @param reverse iterate in reverse order (from hi to lo)
+	 * @param prefix_seek range is a prefix longer than the extracted prefix, so the prefix bloom filter can be used
+	 * @param hint read hint
+	 * @param snap snapshot or nullptr
+	 */
+	RocksDBIterator(RefCntPtr<RocksDBDatabase> db, Range &&range, bool reverse, bool prefix_seek, const ReadHint &hint, const rocksdb::Snapshot *snap);
+	virtual bool getNext(KeyValue &row);
+
+protected:
+	struct Segment {
+		RocksDBDatabase::Family family;
+		std::string lo, hi;
+		bool lo_incl, hi_inf;
+	};
+
+	RefCntPtr<RocksDBDatabase> db;
+	std::vector<Segment> segments;
+	std::size_t curSeg = 0;
+	bool reverse;
+	bool prefix_seek;
+	bool started = false;
+	ReadHint hint;
+	const rocksdb::Snapshot *snap;
+	std::unique_ptr<rocksdb::Iterator> iter;
+	//bounds must live as long as the iterator
+	rocksdb::Slice lower, upper;
+
+	bool openSegment();
+};
+
+class RocksDBChangeset: public AbstractChangeset {
+public:
+	RocksDBChangeset(RefCntPtr<RocksDBDatabase> db);
+
+	virtual void put(const std::string_view &key, const std::string_view &value);
+	virtual void erase(const std::string_view &key);
+	virtual void commit() ;
+	virtual void commitSync();
+	virtual void rollback();
+	virtual void erasePrefix(const std::string_view &prefix);
+
+protected:
+	RefCntPtr<RocksDBDatabase> db;
+	rocksdb::WriteBatch batch;
+};
+
+class RocksDBSnapshot: public AbstractKeyValueDatabaseSnapshot {
+public:
+	RocksDBSnapshot(RefCntPtr<RocksDBDatabase> db, const rocksdb::Snapshot *snapshot);
+	virtual ~RocksDBSnapshot();
+
+	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false, const ReadHint &hint = ReadHint());
+	virtual PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint = ReadHint());
+	virtual bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint = ReadHint()) ;
+	virtual bool lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint = ReadHint());
+	virtual void lookupMulti(const std::vector<std::string_view> &keys,
+			const std::function<void(std::size_t, const std::string_view &)> &callback,
+			const ReadHint &hint = ReadHint());
+	virtual bool exists(const std::string_view &key);
+	virtual bool existsPrefix(const std::string_view &key);
+protected:
+	RefCntPtr<RocksDBDatabase> db;
+	const rocksdb::Snapshot *snapshot;
+};
+
+}
+
+#endif /* SRC_LIBSOFA_KVAPI_ROCKSDB_IMPL_H_ */
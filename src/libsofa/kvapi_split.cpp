@@ -0,0 +1,372 @@
+/*
+ * kvapi_split.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <shared/logOutput.h>
+#include "keyformat.h"
+#include "kvapi_split.h"
+
+namespace sofadb {
+
+std::string prefixLastKey(const std::string_view &prefix);
+
+using ondra_shared::logInfo;
+using ondra_shared::logWarning;
+
+const std::string SplitKeyValueDatabase::intentKey("\xFF" "split_intent");
+const std::string SplitKeyValueDatabase::appliedKey("\xFF" "split_applied");
+
+static const unsigned char op_put = 1;
+static const unsigned char op_erase = 2;
+
+static void addNumber(std::string &out, std::uint64_t num) {
+	while (num >= 0x80) {
+		out.push_back(static_cast<char>((num & 0x7F) | 0x80));
+		num >>= 7;
+	}
+	out.push_back(static_cast<char>(num));
+}
+
+static void addString(std::string &out, const std::string_view &str) {
+	addNumber(out, str.size());
+	out.append(str);
+}
+
+static bool readNumber(std::string_view &data, std::uint64_t &num) {
+	num = 0;
+	unsigned int shift = 0;
+	while (!data.empty() && shift < 64) {
+		unsigned char c = data[0];
+		data = data.substr(1);
+		num |= static_cast<std::uint64_t>(c & 0x7F) << shift;
+		if ((c & 0x80) == 0) return true;
+		shift += 7;
+	}
+	return false;
+}
+
+static bool readString(std::string_view &data, std::string_view &str) {
+	std::uint64_t len;
+	if (!readNumber(data, len) || len > data.size()) return false;
+	str = data.substr(0, len);
+	data = data.substr(len);
+	return true;
+}
+
+SplitKeyValueDatabase::SplitKeyValueDatabase(PKeyValueDatabase hot, PKeyValueDatabase cold)
+	:hot(hot),cold(cold) {
+	recover();
+	migrate();
+}
+
+bool SplitKeyValueDatabase::isCold(unsigned char type) {
+	switch (static_cast<IndexType>(type)) {
+	case IndexType::doc_revs:
+	case IndexType::object_index: return true;
+	default: return false;
+	}
+}
+
+bool SplitKeyValueDatabase::sameDB(const std::string_view &start, const std::string_view &end) {
+	const std::string_view &lo = start < end?start:end;
+	const std::string_view &hi = start < end?end:start;
+	unsigned int b0 = lo.empty()?0:static_cast<unsigned char>(lo[0]);
+	unsigned int b1 = hi.empty()?0:static_cast<unsigned char>(hi[0]);
+	bool c = isCold(b0);
+	for (unsigned int b = b0+1; b <= b1; b++) if (isCold(b) != c) return false;
+	return true;
+}
+
+void SplitKeyValueDatabase::recover() {
+	std::string intent, applied;
+	if (!cold->lookup(intentKey, intent)) return;
+	std::string_view data(intent);
+	std::uint64_t id, appliedId = 0;
+	if (!readNumber(data, id)) throw std::runtime_error("Split database: invalid intent record");
+	if (hot->lookup(appliedKey, applied)) {
+		std::string_view a(applied);
+		readNumber(a, appliedId);
+	}
+	nextIntent = id+1;
+	if (appliedId == id) return;
+
+	logWarning("Split database: applying unfinished batch $1", id);
+	PChangeset chng = hot->createChangeset();
+	if (!SplitChangeset::apply(data, *chng)) throw std::runtime_error("Split database: invalid intent record");
+	std::string idstr;
+	addNumber(idstr, id);
+	chng->put(appliedKey, idstr);
+	chng->commitSync();
+}
+
+void SplitKeyValueDatabase::migrate() {
+	//data are copied to the cold database first and synced, so the operation can be repeated after crash
+	static const std::size_t chunkSize = 10000;
+	for (unsigned int t = 0; t < 256; t++) {
+		if (!isCold(t)) continue;
+		std::string prefix(1, static_cast<char>(t));
+		std::string end = prefixLastKey(prefix);
+		//next chunk continues after the last moved key, so it doesn't skip over tombstones of the previous chunks
+		std::string start = prefix;
+		std::size_t count = 0;
+		std::size_t n;
+		do {
+			PChangeset c = cold->createChangeset();
+			PChangeset h = hot->createChangeset();
+			Iterator iter(hot->findRange(start, end));
+			n = 0;
+			while (n < chunkSize && iter.getNext()) {
+				c->put(iter->first, iter->second);
+				h->erase(iter->first);
+				start = iter->first;
+				++n;
+			}
+			start.push_back(0);
+			c->commitSync();
+			h->commit();
+			count += n;
+		} while (n == chunkSize);
+		if (count) logInfo("Split database: moved $1 records of type $2 to the cold database", count, t);
+	}
+}
+
+PChangeset SplitKeyValueDatabase::createChangeset() {
+	return new SplitChangeset(this);
+}
+
+PIterator SplitKeyValueDatabase::findRange(const std::string_view &prefix, bool reverse, const ReadHint &hint) {
+	if (!prefix.empty()) return select(prefix)->findRange(prefix, reverse, hint);
+	std::vector<PIterator> iters;
+	iters.push_back(hot->findRange(prefix, reverse, hint));
+	iters.push_back(cold->findRange(prefix, reverse, hint));
+	return new SplitMergeIterator(std::move(iters), reverse);
+}
+
+PIterator SplitKeyValueDatabase::findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint) {
+	if (sameDB(start, end)) return select(start)->findRange(start, end, hint);
+	std::vector<PIterator> iters;
+	iters.push_back(hot->findRange(start, end, hint));
+	iters.push_back(cold->findRange(start, end, hint));
+	return new SplitMergeIterator(std::move(iters), start > end);
+}
+
+bool SplitKeyValueDatabase::lookup(const std::string_view &key, std::string &value, const ReadHint &hint) {
+	return select(key)->lookup(key, value, hint);
+}
+
+bool SplitKeyValueDatabase::lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint) {
+	return select(key)->lookupPinned(key, value, hint);
+}
+
+void SplitKeyValueDatabase::lookupMulti(const std::vector<std::string_view> &keys,
+		const std::function<void(std::size_t, const std::string_view &)> &callback, const ReadHint &hint) {
+	if (keys.empty()) return;
+	const PKeyValueDatabase &db = select(keys[0]);
+	for (auto &&k: keys) {
+		if (select(k) != db) {
+			AbstractKeyValueDatabase::lookupMulti(keys, callback, hint);
+			return;
+		}
+	}
+	db->lookupMulti(keys, callback, hint);
+}
+
+bool SplitKeyValueDatabase::exists(const std::string_view &key) {
+	return select(key)->exists(key);
+}
+
+bool SplitKeyValueDatabase::existsPrefix(const std::string_view &key) {
+	if (!key.empty()) return select(key)->existsPrefix(key);
+	return hot->existsPrefix(key) || cold->existsPrefix(key);
+}
+
+void SplitKeyValueDatabase::destroy() {
+	hot->destroy();
+	cold->destroy();
+}
+
+PKeyValueDatabaseSnapshot SplitKeyValueDatabase::createSnapshot() {
+	std::unique_lock<std::shared_mutex> _(snapLock);
+	return new SplitSnapshot(hot->createSnapshot(), cold->createSnapshot());
+}
+
+void SplitKeyValueDatabase::compact(const std::string_view &start, const std::string_view &end) {
+	hot->compact(start, end);
+	cold->compact(start, end);
+}
+
+SplitChangeset::SplitChangeset(RefCntPtr<SplitKeyValueDatabase> db)
+	:db(db),hot(db->hot->createChangeset()),cold(db->cold->createChangeset()) {
+}
+
+void SplitChangeset::addPut(std::string &out, const std::string_view &key, const std::string_view &value) {
+	out.push_back(op_put);
+	addString(out, key);
+	addString(out, value);
+}
+
+void SplitChangeset::addErase(std::string &out, const std::string_view &key) {
+	out.push_back(op_erase);
+	addString(out, key);
+}
+
+bool SplitChangeset::apply(std::string_view ops, AbstractChangeset &chng) {
+	while (!ops.empty()) {
+		unsigned char op = ops[0];
+		ops = ops.substr(1);
+		std::string_view key, value;
+		if (!readString(ops, key)) return false;
+		if (op == op_put) {
+			if (!readString(ops, value)) return false;
+			chng.put(key, value);
+		} else if (op == op_erase) {
+			chng.erase(key);
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+void SplitChangeset::put(const std::string_view &key, const std::string_view &value) {
+	if (db->select(key) == db->cold) {
+		cold->put(key, value);
+		coldUsed = true;
+	} else {
+		hot->put(key, value);
+		addPut(hotOps, key, value);
+		hotUsed = true;
+	}
+}
+
+void SplitChangeset::erase(const std::string_view &key) {
+	if (db->select(key) == db->cold) {
+		cold->erase(key);
+		coldUsed = true;
+	} else {
+		hot->erase(key);
+		addErase(hotOps, key);
+		hotUsed = true;
+	}
+}
+
+void SplitChangeset::erasePrefix(const std::string_view &prefix) {
+	if (!prefix.empty() && db->select(prefix) == db->cold) {
+		cold->erasePrefix(prefix);
+		coldUsed = true;
+	} else {
+		//keys of the hot part must be recorded for the intent
+		Iterator iter(db->findRange(prefix));
+		while (iter.getNext()) erase(iter->first);
+	}
+}
+
+void SplitChangeset::commit() {
+	if (hotUsed && coldUsed) {
+		std::shared_lock<std::shared_mutex> _(db->snapLock);
+		std::lock_guard<std::mutex> __(db->commitLock);
+		std::uint64_t id = db->nextIntent++;
+		std::string rec;
+		addNumber(rec, id);
+		rec.append(hotOps);
+		//the intent must reach the disk before the hot part, otherwise a power failure
+		//could keep the hot part without the cold part and without the intent to repair it
+		cold->put(SplitKeyValueDatabase::intentKey, rec);
+		cold->commitSync();
+		rec.clear();
+		addNumber(rec, id);
+		hot->put(SplitKeyValueDatabase::appliedKey, rec);
+		//there is only one intent record, the next mixed batch overwrites it. So the hot
+		//part must be on the disk before the commit lock is released
+		hot->commitSync();
+	} else if (coldUsed) {
+		cold->commit();
+	} else if (hotUsed) {
+		hot->commit();
+	}
+	rollback();
+}
+
+void SplitChangeset::rollback() {
+	hot->rollback();
+	cold->rollback();
+	hotOps.clear();
+	hotUsed = coldUsed = false;
+}
+
+SplitSnapshot::SplitSnapshot(PKeyValueDatabaseSnapshot hot, PKeyValueDatabaseSnapshot cold)
+	:hot(hot),cold(cold) {
+}
+
+PIterator SplitSnapshot::findRange(const std::string_view &prefix, bool reverse, const ReadHint &hint) {
+	if (!prefix.empty()) return select(prefix)->findRange(prefix, reverse, hint);
+	std::vector<PIterator> iters;
+	iters.push_back(hot->findRange(prefix, reverse, hint));
+	iters.push_back(cold->findRange(prefix, reverse, hint));
+	return new SplitMergeIterator(std::move(iters), reverse);
+}
+
+PIterator SplitSnapshot::findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint) {
+	if (SplitKeyValueDatabase::sameDB(start, end)) return select(start)->findRange(start, end, hint);
+	std::vector<PIterator> iters;
+	iters.push_back(hot->findRange(start, end, hint));
+	iters.push_back(cold->findRange(start, end, hint));
+	return new SplitMergeIterator(std::move(iters), start > end);
+}
+
+bool SplitSnapshot::lookup(const std::string_view &key, std::string &value, const ReadHint &hint) {
+	return select(key)->lookup(key, value, hint);
+}
+
+bool SplitSnapshot::lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint) {
+	return select(key)->lookupPinned(key, value, hint);
+}
+
+void SplitSnapshot::lookupMulti(const std::vector<std::string_view> &keys,
+		const std::function<void(std::size_t, const std::string_view &)> &callback, const ReadHint &hint) {
+	if (keys.empty()) return;
+	const PKeyValueDatabaseSnapshot &db = select(keys[0]);
+	for (auto &&k: keys) {
+		if (select(k) != db) {
+			AbstractKeyValueDatabaseSnapshot::lookupMulti(keys, callback, hint);
+			return;
+		}
+	}
+	db->lookupMulti(keys, callback, hint);
+}
+
+bool SplitSnapshot::exists(const std::string_view &key) {
+	return select(key)->exists(key);
+}
+
+bool SplitSnapshot::existsPrefix(const std::string_view &key) {
+	if (!key.empty()) return select(key)->existsPrefix(key);
+	return hot->existsPrefix(key) || cold->existsPrefix(key);
+}
+
+SplitMergeIterator::SplitMergeIterator(std::vector<PIterator> &&iters, bool reverse)
+	:reverse(reverse) {
+	for (auto &&x: iters) {
+		Source s;
+		s.iter = std::move(x);
+		s.valid = s.iter->getNext(s.row);
+		sources.push_back(std::move(s));
+	}
+}
+
+bool SplitMergeIterator::getNext(KeyValue &row) {
+	if (last) last->valid = last->iter->getNext(last->row);
+	last = nullptr;
+	for (auto &&s: sources) {
+		if (!s.valid) continue;
+		if (last == nullptr || (reverse?s.row.first > last->row.first:s.row.first < last->row.first)) last = &s;
+	}
+	if (last == nullptr) return false;
+	row = last->row;
+	return true;
+}
+
+}
@@ -0,0 +1,161 @@
+/*
+ * kvapi_split.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_LIBSOFA_KVAPI_SPLIT_H_
+#define SRC_LIBSOFA_KVAPI_SPLIT_H_
+
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include "kvapi.h"
+
+namespace sofadb {
+
+///Routes key families to two databases - hot and cold
+/** Keys are routed by their first byte (IndexType). Historical data (doc_revs, object_index)
+ * are stored in the cold database, everything else in the hot database. Both databases
+ * can have own cache and write buffer, so the history doesn't evict hot blocks and
+ * rewriting of the documents doesn't compact history.
+ *
+ * Batch which writes to both databases is committed in two steps. The cold part is
+ * written along with an intent record containing the hot part. Then the hot part is written
+ * along with a mark, that the intent has been applied. Both steps are synced to the disk,
+ * because the next mixed batch overwrites the intent record.
+ * If the process or the system crashes between the steps, the intent is applied during
+ * the next open. Keys starting by 0xFF are reserved for these records.
+ *
+ * Snapshots are created under a lock, which excludes commits of mixed batches,
+ * so snapshot never sees a half of such batch
+ */
+class SplitKeyValueDatabase: public AbstractKeyValueDatabase {
+public:
+
+	///Opens split database
+	/**
+	 * @param hot database of frequently accessed families
+	 * @param cold database of historical data. If it is empty and the hot database
+	 * contains historical data, the data are moved to the cold database
+	 */
+	SplitKeyValueDatabase(PKeyValueDatabase hot, PKeyValueDatabase cold);
+
+	virtual PChangeset createChangeset();
+	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false, const ReadHint &hint = ReadHint()) ;
+	virtual PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint = ReadHint()) ;
+	virtual bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint = ReadHint()) ;
+	virtual bool lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint = ReadHint());
+	virtual void lookupMulti(const std::vector<std::string_view> &keys,
+			const std::function<void(std::size_t, const std::string_view &)> &callback,
+			const ReadHint &hint = ReadHint());
+	virtual bool exists(const std::string_view &key) ;
+	virtual bool existsPrefix(const std::string_view &key) ;
+	virtual void destroy();
+	virtual PKeyValueDatabaseSnapshot createSnapshot();
+	virtual void compact(const std::string_view &start, const std::string_view &end);
+
+	///Returns true, if the type is stored in the cold database
+	static bool isCold(unsigned char type);
+
+	///Selects database for the key
+	const PKeyValueDatabase &select(const std::string_view &key) const {
+		return !key.empty() && isCold(static_cast<unsigned char>(key[0]))?cold:hot;
+	}
+	///Returns true, if all keys of the range are in the same database
+	static bool sameDB(const std::string_view &start, const std::string_view &end);
+
+	static const std::string intentKey;
+	static const std::string appliedKey;
+
+protected:
+	PKeyValueDatabase hot, cold;
+	///serializes commits of mixed batches
+	std::mutex commitLock;
+	///shared by mixed commits, exclusive for snapshots
+	std::shared_mutex snapLock;
+	std::uint64_t nextIntent = 1;
+
+	void recover();
+	void migrate();
+
+	friend class SplitChangeset;
+};
+
+///Changeset of the SplitKeyValueDatabase
+class SplitChangeset: public AbstractChangeset {
+public:
+	SplitChangeset(RefCntPtr<SplitKeyValueDatabase> db);
+
+	virtual void put(const std::string_view &key, const std::string_view &value);
+	virtual void erase(const std::string_view &key);
+	virtual void commit();
+	virtual void rollback();
+	virtual void erasePrefix(const std::string_view &prefix);
+
+	///Serializes put operation to the intent
+	static void addPut(std::string &out, const std::string_view &key, const std::string_view &value);
+	///Serializes erase operation to the intent
+	static void addErase(std::string &out, const std::string_view &key);
+	///Applies serialized operations to the changeset
+	/**
+	 * @param ops operations
+	 * @param chng target changeset
+	 * @retval true success
+	 * @retval false invalid format
+	 */
+	static bool apply(std::string_view ops, AbstractChangeset &chng);
+
+protected:
+	RefCntPtr<SplitKeyValueDatabase> db;
+	PChangeset hot, cold;
+	bool hotUsed = false, coldUsed = false;
+	///serialized operations of the hot part
+	std::string hotOps;
+};
+
+///Snapshot of the SplitKeyValueDatabase
+class SplitSnapshot: public AbstractKeyValueDatabaseSnapshot {
+public:
+	SplitSnapshot(PKeyValueDatabaseSnapshot hot, PKeyValueDatabaseSnapshot cold);
+
+	virtual PIterator findRange(const std::string_view &prefix, bool reverse = false, const ReadHint &hint = ReadHint());
+	virtual PIterator findRange(const std::string_view &start, const std::string_view &end, const ReadHint &hint = ReadHint());
+	virtual bool lookup(const std::string_view &key, std::string &value, const ReadHint &hint = ReadHint()) ;
+	virtual bool lookupPinned(const std::string_view &key, PinnedValue &value, const ReadHint &hint = ReadHint());
+	virtual void lookupMulti(const std::vector<std::string_view> &keys,
+			const std::function<void(std::size_t, const std::string_view &)> &callback,
+			const ReadHint &hint = ReadHint());
+	virtual bool exists(const std::string_view &key);
+	virtual bool existsPrefix(const std::string_view &key);
+
+protected:
+	PKeyValueDatabaseSnapshot hot, cold;
+
+	const PKeyValueDatabaseSnapshot &select(const std::string_view &key) const {
+		return !key.empty() && SplitKeyValueDatabase::isCold(static_cast<unsigned char>(key[0]))?cold:hot;
+	}
+};
+
+///Merges ordered iterators of disjoint key sets
+class SplitMergeIterator: public AbstractIterator {
+public:
+	SplitMergeIterator(std::vector<PIterator> &&iters, bool reverse);
+	virtual bool getNext(KeyValue &row);
+
+protected:
+	struct Source {
+		PIterator iter;
+		KeyValue row;
+		bool valid;
+	};
+	std::vector<Source> sources;
+	bool reverse;
+	///source returned by the previous call, it is advanced by the next call
+	Source *last = nullptr;
+};
+
+}
+
+#endif /* SRC_LIBSOFA_KVAPI_SPLIT_H_ */
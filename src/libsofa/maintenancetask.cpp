@@ -5,6 +5,9 @@
  *      Author: ondra
  */
 
+#include <limits>
+#include <sched.h>
+#include <pthread.h>
 #include <imtjson/value.h>
 #include <libsofa/keyformat.h>
 #include <shared/logOutput.h>
@@ -17,9 +20,11 @@ namespace sofadb {
 
 
 using ondra_shared::logInfo;
+using ondra_shared::logError;
 using namespace json;
 
 MaintenanceTask::MaintenanceTask(DatabaseCore& dbcore):dbcore(dbcore) {
+	setConfig(cfg);
 }
 
 void MaintenanceTask::init(PEventRouter router) {
@@ -31,24 +36,89 @@ void MaintenanceTask::init(PEventRouter router) {
 	this->router = router;
 	std::vector<std::pair<Handle,SeqNum> > dblist;
 	router->listDBs([&](auto &&item) {dblist.push_back(item);return true;});
-	for (auto &&item:dblist) {
-		Handle h = item.first;
-		SeqNum n = item.second;
-		init_task(router,h,n);
+	{
+		Lock _(lock);
+		for (auto &&item:dblist) {
+			addDB(item.first, item.second);
+		}
+		for (Handle h: dbcore.getDropped()) {
+			dropped.insert(h);
+		}
 	}
 
 
 	this->oh = this->router->registerObserver([=,g=Sync(cntd)](DatabaseCore::ObserverEvent ev, Handle h, SeqNum sq){
-		if (ev == DatabaseCore::event_create) {
-			init_task(router,h,sq);
-		}
+		onEvent(ev,h,sq);
 		return true;
 	});
+
+	if (!thr.joinable()) {
+		thr = std::thread([this]{worker();});
+	}
+	event.notify_all();
+}
+
+void MaintenanceTask::setConfig(const Config &cfg) {
+	Lock _(lock);
+	this->cfg = cfg;
+	if (this->cfg.batch_size == 0) this->cfg.batch_size = 1;
+	if (this->cfg.sweep_batch == 0) this->cfg.sweep_batch = 1;
+	docBudget.setRate(cfg.docs_per_sec);
+	opsBudget.setRate(cfg.ops_per_sec);
+	event.notify_all();
+}
+
+bool MaintenanceTask::getStats(Handle h, Stats &stats) const {
+	Lock _(lock);
+	auto iter = tasks.find(h);
+	if (iter == tasks.end()) return false;
+	stats = iter->second.stats;
+	if (iter->second.dirty && stats.lastSeq > stats.checkpoint) stats.backlog = stats.lastSeq - stats.checkpoint;
+	else stats.backlog = 0;
+	return true;
+}
+
+void MaintenanceTask::addDB(Handle h, SeqNum s) {
+	DBTask &t = tasks[h];
+	Value cp;
+	SeqNum checkpoint = 0;
+	if (dbcore.loadProperty(h, "maintenance", cp)) checkpoint = cp.getUInt();
+	//database can be older than the checkpoint (memory database)
+	if (checkpoint > s) checkpoint = s;
+	t.stats.checkpoint = checkpoint;
+	t.stats.lastSeq = s;
+	t.dirty = checkpoint < s;
+	logInfo("Maintenance monitoring is ACTIVE on db $1 since $2", h, checkpoint);
+}
+
+void MaintenanceTask::onEvent(DatabaseCore::ObserverEvent ev, Handle h, SeqNum s) {
+	Lock _(lock);
+	switch (ev) {
+	case DatabaseCore::event_create:
+		addDB(h, s);
+		break;
+	case DatabaseCore::event_update: {
+			auto iter = tasks.find(h);
+			if (iter == tasks.end()) {
+				addDB(h, s);
+			} else {
+				iter->second.stats.lastSeq = s;
+				iter->second.dirty = true;
+			}
+		}
+		break;
+	case DatabaseCore::event_close:
+		tasks.erase(h);
+		dropped.insert(h);
+		logInfo("Maintenance monitoring was REMOVED on db $1", h);
+		break;
+	}
+	event.notify_all();
 }
 
 bool MaintenanceTask::init_rev_map(DatabaseCore::RevMap &revision_map,
 			Handle h, const std::string_view &id) {
-	std::string tmp;
+	PinnedValue tmp;
 	DatabaseCore::RawDocument rawdoc;
 	if (dbcore.findDoc(h,id,rawdoc,tmp)) {
 
@@ -87,36 +157,292 @@ bool MaintenanceTask::init_rev_map(DatabaseCore::RevMap &revision_map,
 	}
 }
 
-void MaintenanceTask::init_task(PEventRouter rt, Handle h, SeqNum s) {
-	logInfo("Maintenance monitoring is ACTIVE on db $1 since $2", h, s);
-	auto task = [this,rt,h,s,g=Sync(cntd)](bool){
-		SeqNum sq;
-		if (rt->getLastSeqNum(h,sq)) {
-			if (sq != s) {
-				logInfo("Maintenance is RUNNING on db $1 since $2", h, s);
-				DatabaseCore::RevMap revision_map;
+static void setLowPriority() {
+#ifdef SCHED_IDLE
+	sched_param p = {};
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &p);
+#endif
+}
+
+std::map<MaintenanceTask::Handle, MaintenanceTask::DBTask>::iterator MaintenanceTask::findDirty() {
+	//pick next dirty database (round robin)
+	auto iter = tasks.upper_bound(lastHandle);
+	while (iter != tasks.end() && !iter->second.dirty) ++iter;
+	if (iter == tasks.end()) {
+		iter = tasks.begin();
+		while (iter != tasks.end() && !iter->second.dirty) ++iter;
+	}
+	return iter;
+}
+
+void MaintenanceTask::worker() {
+	setLowPriority();
 
-				dbcore.readChanges(h,s,false,[&](const DatabaseCore::ChangeRec &rc) {
-					revision_map.clear();
-					if (init_rev_map(revision_map,h, rc.docid))
-						dbcore.cleanHistory(h,rc.docid, revision_map);
-					return true;
-				});
+	Lock _(lock);
+	while (!exitFlag) {
+		TimePoint now = std::chrono::steady_clock::now();
+		if (!dropped.empty()) {
+			//sweep of dropped databases takes turns with the other work
+			sweepTurn = !sweepTurn;
+			if (sweepTurn) {
+				runSweep(_, now);
+				continue;
+			}
+		}
+		auto iter = findDirty();
+		bool purge = false;
+		if (iter == tasks.end()) {
+			//no history to clean, find database to purge
+			TimePoint wakeup = TimePoint::max();
+			for (iter = tasks.begin(); iter != tasks.end(); ++iter) {
+				if (iter->second.nextPurge <= now) break;
+				wakeup = std::min(wakeup, iter->second.nextPurge);
+			}
+			if (iter == tasks.end()) {
+				if (!dropped.empty()) {
+					runSweep(_, now);
+					continue;
+				}
+				if (wakeup == TimePoint::max()) event.wait(_);
+				else event.wait_until(_, wakeup);
+				continue;
 			}
-			init_task(rt,h,sq);
-		} else {
-			logInfo("Maintenance monitoring was REMOVED on db $1 since $2", h, s);
+			purge = true;
+		}
+
+		std::size_t docs = docBudget.available(now);
+		if (docs == 0 || opsBudget.available(now) == 0) {
+			event.wait_until(_, std::max(docBudget.nextToken(now), opsBudget.nextToken(now)));
+			continue;
 		}
-	};
-	rt->waitForEvent(h,s,1000*86400, task);
+
+		Handle h = iter->first;
+		std::size_t limit = std::min(docs, cfg.batch_size);
+		lastHandle = h;
+
+		if (purge) {
+			PurgeState st = iter->second.purge;
+			_.unlock();
+			PurgeResult res;
+			try {
+				res = runPurge(h, st, limit);
+			} catch (std::exception &e) {
+				logError("Purge failed on db $1: $2", h, e.what());
+				res.done = true;
+			}
+			_.lock();
+
+			docBudget.consume(res.docs);
+			opsBudget.consume(res.purged);
+			iter = tasks.find(h);
+			if (iter == tasks.end()) continue;
+			DBTask &t = iter->second;
+			t.stats.purged += res.purged;
+			if (res.done) {
+				t.purge = PurgeState();
+				t.nextPurge = std::chrono::steady_clock::now() + std::chrono::milliseconds(cfg.purge_interval);
+			} else {
+				t.purge = std::move(st);
+			}
+			continue;
+		}
+
+		SeqNum from = iter->second.stats.checkpoint;
+		_.unlock();
+		BatchResult res;
+		bool ok = true;
+		try {
+			res = runBatch(h, from, limit);
+		} catch (std::exception &e) {
+			logError("Maintenance failed on db $1: $2", h, e.what());
+			ok = false;
+		}
+		_.lock();
+
+		docBudget.consume(res.docs);
+		opsBudget.consume(res.erased);
+		iter = tasks.find(h);
+		if (iter == tasks.end()) continue;
+		DBTask &t = iter->second;
+		if (!ok) {
+			t.dirty = false;
+			continue;
+		}
+		if (res.checkpoint > t.stats.checkpoint) t.stats.checkpoint = res.checkpoint;
+		t.stats.processed += res.docs;
+		t.stats.erased += res.erased;
+		//less documents than requested, all changes are processed
+		if (res.docs < limit) t.dirty = false;
+	}
 }
 
-MaintenanceTask::~MaintenanceTask() {
+MaintenanceTask::BatchResult MaintenanceTask::runBatch(Handle h, SeqNum from, std::size_t limit) {
+	BatchResult res;
+	std::vector<std::string> docs;
+	res.checkpoint = dbcore.readChanges(h, from, false, [&](const DatabaseCore::ChangeRec &rc) {
+		docs.push_back(std::string(rc.docid));
+		return docs.size() < limit;
+	}, ReadHint::bulk(ReadType::maintenance));
+	res.docs = docs.size();
+	if (docs.empty()) return res;
+
+	//all changes and the checkpoint are written in single batch
+	auto lk = dbcore.lockWrite(h);
+	if (!dbcore.beginBatch(h)) return res;
+	try {
+		DatabaseCore::RevMap revision_map;
+		for (auto &&id: docs) {
+			revision_map.clear();
+			if (init_rev_map(revision_map,h, id))
+				dbcore.cleanHistory(h,id, revision_map, &res.erased);
+		}
+		dbcore.storeProperty(h, "maintenance", res.checkpoint);
+		dbcore.endBatch(h);
+	} catch (...) {
+		dbcore.endBatch(h);
+		throw;
+	}
+	return res;
+}
+
+MaintenanceTask::PurgeResult MaintenanceTask::runPurge(Handle h, PurgeState &st, std::size_t limit) {
+	PurgeResult res;
+	DatabaseCore::DBConfig cfg;
+	if (!dbcore.getConfig(h, cfg) || cfg.tombstone_ttl == 0) {
+		res.done = true;
+		return res;
+	}
+
+	//tombstone can't be purged until all replications process it
+	SeqNum maxSeq = std::numeric_limits<SeqNum>::max();
+	dbcore.getMinCheckpoint(h, maxSeq);
+	Timestamp now = DocumentDB::getTimestamp();
+	Timestamp cutoff = now > cfg.tombstone_ttl?now - cfg.tombstone_ttl:0;
+
+	std::vector<std::string> docs;
+	SeqNum last = st.cursor;
+	bool stopped = false;
+	dbcore.readChanges(h, st.cursor, false, [&](const DatabaseCore::ChangeRec &rc) {
+		if (rc.seqnum > maxSeq) {
+			stopped = true;
+			return false;
+		}
+		last = rc.seqnum;
+		docs.push_back(std::string(rc.docid));
+		return docs.size() < limit;
+	}, ReadHint::bulk(ReadType::maintenance));
+	res.docs = docs.size();
+	res.done = stopped || docs.size() < limit;
+
+	if (!docs.empty()) {
+		auto lk = dbcore.lockWrite(h);
+		if (dbcore.beginBatch(h)) {
+			try {
+				DatabaseCore::RawDocument doc;
+				DatabaseCore::KeySet modifiedKeys;
+				PinnedValue tmp;
+				for (auto &&id: docs) {
+					//document could be changed meanwhile, so check it again under the lock
+					if (dbcore.findDoc(h, id, doc, tmp) && doc.deleted
+							&& doc.timestamp < cutoff && doc.seq_number <= maxSeq) {
+						dbcore.eraseDoc(h, id, modifiedKeys);
+						if (st.purged == 0) {
+							st.firstSeq = doc.seq_number;
+							st.firstDoc = id;
+							st.lastDoc = id;
+						} else {
+							if (id < st.firstDoc) st.firstDoc = id;
+							if (id > st.lastDoc) st.lastDoc = id;
+						}
+						st.lastSeq = doc.seq_number;
+						++st.purged;
+						++res.purged;
+					}
+				}
+				dbcore.endBatch(h);
+			} catch (...) {
+				dbcore.endBatch(h);
+				throw;
+			}
+		}
+	}
+	st.cursor = last;
+
+	if (res.done && st.purged) {
+		logInfo("Purged $1 tombstones on db $2", st.purged, h);
+		dbcore.compact(h, st.firstSeq, st.lastSeq, st.firstDoc, st.lastDoc);
+	}
+	return res;
+}
+
+void MaintenanceTask::runSweep(Lock &lk, TimePoint now) {
+	std::size_t ops = opsBudget.available(now);
+	if (ops == 0) {
+		event.wait_until(lk, opsBudget.nextToken(now));
+		return;
+	}
+	Handle h = *dropped.begin();
+	std::size_t limit = std::min(ops, cfg.sweep_batch);
+	lk.unlock();
+	std::size_t erased = 0;
+	bool ok = true;
+	try {
+		erased = dbcore.sweepDropped(h, limit);
+	} catch (std::exception &e) {
+		//database stays on the drop list, the sweep is retried after restart
+		logError("Sweep failed on dropped db $1: $2", h, e.what());
+		ok = false;
+	}
+	lk.lock();
+	opsBudget.consume(erased);
+	if (!ok || erased < limit) {
+		dropped.erase(h);
+		if (ok) logInfo("Dropped db $1 has been swept", h);
+	}
+}
+
+void MaintenanceTask::stop() {
 	if (this->router != nullptr) {
 		this->router->removeObserver(this->oh);
-		cntd.wait();
+		this->router = nullptr;
 	}
+	{
+		Lock _(lock);
+		exitFlag = true;
+	}
+	event.notify_all();
+	if (thr.joinable()) thr.join();
+	cntd.wait();
+}
+
+MaintenanceTask::~MaintenanceTask() {
+	stop();
+}
+
+void MaintenanceTask::Budget::setRate(std::size_t rate) {
+	this->rate = static_cast<double>(rate);
+	tokens = this->rate;
+	last = std::chrono::steady_clock::now();
+}
+
+std::size_t MaintenanceTask::Budget::available(TimePoint now) {
+	if (rate == 0) return static_cast<std::size_t>(-1);
+	double elapsed = std::chrono::duration<double>(now - last).count();
+	last = now;
+	//capacity of the bucket is one second of the rate
+	tokens = std::min(rate, tokens + elapsed * rate);
+	return tokens >= 1?static_cast<std::size_t>(tokens):0;
+}
+
+void MaintenanceTask::Budget::consume(std::size_t count) {
+	if (rate == 0) return;
+	tokens -= static_cast<double>(count);
+}
 
+MaintenanceTask::TimePoint MaintenanceTask::Budget::nextToken(TimePoint now) const {
+	if (rate == 0 || tokens >= 1) return now;
+	auto wait = std::chrono::duration<double>((1 - tokens) / rate);
+	return last + std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait);
 }
 
 
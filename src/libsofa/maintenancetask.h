@@ -7,31 +7,164 @@
 
 #ifndef MAINTENANCETASK_H_
 #define MAINTENANCETASK_H_
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 #include "databasecore.h"
 #include "eventrouter.h"
 
 namespace sofadb {
 
+///Background maintenance of the databases
+/** Processes changes of every database and removes old revisions from the history. The
+ * task runs in its own low-priority thread. The work is limited by budgets (documents per
+ * second and write operations per second). Progress is stored per database as a checkpoint,
+ * which is written in the same batch as changes made by the maintenance, so the
+ * maintenance continues where it stopped after restart.
+ *
+ * When there is no history to clean, the task periodically purges expired tombstones
+ * (see DatabaseCore::DBConfig::tombstone_ttl)
+ *
+ * Keys of dropped databases are deleted by the task as well (see DatabaseCore::sweepDropped).
+ * The sweep takes turns with the other work and it is limited by the budget of write operations
+ */
 class MaintenanceTask {
 public:
 	using Handle = DatabaseCore::Handle;
 
+	struct Config {
+		///maximum count of documents processed per second (0 = unlimited)
+		std::size_t docs_per_sec = 1000;
+		///maximum count of write operations (erased revisions) per second (0 = unlimited)
+		std::size_t ops_per_sec = 5000;
+		///maximum count of documents processed in one batch
+		std::size_t batch_size = 100;
+		///interval between two purges of tombstones in milliseconds
+		std::size_t purge_interval = 60000;
+		///maximum count of keys of dropped databases deleted in one batch
+		std::size_t sweep_batch = 1000;
+	};
+
+	struct Stats {
+		///sequence number of the last processed change (checkpoint)
+		SeqNum checkpoint = 0;
+		///last known sequence number of the database
+		SeqNum lastSeq = 0;
+		///count of changes waiting to be processed (estimation)
+		SeqNum backlog = 0;
+		///count of documents processed since start
+		std::size_t processed = 0;
+		///count of revisions erased since start
+		std::size_t erased = 0;
+		///count of tombstones purged since start
+		std::size_t purged = 0;
+	};
+
 	MaintenanceTask(DatabaseCore &dbcore);
 
+	///Starts the maintenance
 	void init(PEventRouter router);
 
+	///Changes configuration
+	void setConfig(const Config &cfg);
+
+	///Retrieves statistics of the database
+	/**
+	 * @param h handle to database
+	 * @param stats receives statistics
+	 * @retval true success
+	 * @retval false database is not monitored
+	 */
+	bool getStats(Handle h, Stats &stats) const;
+
+	///Stops the maintenance
+	void stop();
+
 	virtual ~MaintenanceTask();
 protected:
 
-	void init_task(PEventRouter rt, Handle h, SeqNum s);
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	///Token bucket
+	class Budget {
+	public:
+		void setRate(std::size_t rate);
+		///returns count of tokens available now
+		std::size_t available(TimePoint now);
+		///consumes tokens (can go below zero)
+		void consume(std::size_t count);
+		///returns time, when at least one token will be available
+		TimePoint nextToken(TimePoint now) const;
+	protected:
+		double rate = 0;
+		double tokens = 0;
+		TimePoint last;
+	};
+
+	///State of the current purge pass
+	struct PurgeState {
+		///last processed change
+		SeqNum cursor = 0;
+		///count of tombstones purged during the pass
+		std::size_t purged = 0;
+		///range of purged changes and documents - it is compacted when pass is done
+		SeqNum firstSeq = 0;
+		SeqNum lastSeq = 0;
+		std::string firstDoc;
+		std::string lastDoc;
+	};
+
+	struct DBTask {
+		Stats stats;
+		bool dirty = false;
+		PurgeState purge;
+		TimePoint nextPurge;
+	};
+
+	struct BatchResult {
+		SeqNum checkpoint = 0;
+		std::size_t docs = 0;
+		std::size_t erased = 0;
+	};
+
+	struct PurgeResult {
+		std::size_t docs = 0;
+		std::size_t purged = 0;
+		bool done = false;
+	};
 
 	using Sync = ondra_shared::CountdownGuard;
+	using Lock = std::unique_lock<std::mutex>;
 	ondra_shared::Countdown cntd;
 	PEventRouter router;
 	EventRouter::ObserverHandle oh;
 
+	mutable std::mutex lock;
+	std::condition_variable event;
+	std::map<Handle, DBTask> tasks;
+	///dropped databases waiting to sweep
+	std::set<Handle> dropped;
+	///sweep and other work take turns
+	bool sweepTurn = false;
+	Handle lastHandle = 0;
+	Config cfg;
+	Budget docBudget, opsBudget;
+	std::thread thr;
+	bool exitFlag = false;
+
 	bool init_rev_map(DatabaseCore::RevMap &revision_map, Handle h, const std::string_view &id);
 
+	void addDB(Handle h, SeqNum s);
+	void onEvent(DatabaseCore::ObserverEvent ev, Handle h, SeqNum s);
+	void worker();
+	BatchResult runBatch(Handle h, SeqNum from, std::size_t limit);
+	PurgeResult runPurge(Handle h, PurgeState &st, std::size_t limit);
+	void runSweep(Lock &lk, TimePoint now);
+	std::map<Handle, DBTask>::iterator findDirty();
+
 
 	DatabaseCore &dbcore;
 };
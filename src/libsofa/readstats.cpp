@@ -0,0 +1,42 @@
+/*
+ * readstats.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include "readstats.h"
+
+namespace sofadb {
+
+std::atomic<std::uint64_t> ReadStats::hits[static_cast<int>(ReadType::count)] = {};
+std::atomic<std::uint64_t> ReadStats::misses[static_cast<int>(ReadType::count)] = {};
+thread_local ReadType ReadStats::cur = ReadType::background;
+
+void ReadStats::add(ReadType type, std::uint64_t h, std::uint64_t m) {
+	int idx = static_cast<int>(type);
+	if (h) hits[idx].fetch_add(h, std::memory_order_relaxed);
+	if (m) misses[idx].fetch_add(m, std::memory_order_relaxed);
+}
+
+ReadStats::Counters ReadStats::get(ReadType type) {
+	int idx = static_cast<int>(type);
+	Counters c;
+	c.hits = hits[idx].load(std::memory_order_relaxed);
+	c.misses = misses[idx].load(std::memory_order_relaxed);
+	return c;
+}
+
+const char *ReadStats::name(ReadType type) {
+	switch (type) {
+	case ReadType::interactive: return "interactive";
+	case ReadType::changes: return "changes";
+	case ReadType::enum_docs: return "enum_docs";
+	case ReadType::replication: return "replication";
+	case ReadType::maintenance: return "maintenance";
+	case ReadType::background: return "background";
+	default: return "unknown";
+	}
+}
+
+}
@@ -0,0 +1,67 @@
+/*
+ * readstats.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_LIBSOFA_READSTATS_H_
+#define SRC_LIBSOFA_READSTATS_H_
+
+#include <atomic>
+#include <cstdint>
+#include "kvapi.h"
+
+namespace sofadb {
+
+///Counters of the block cache hits and misses per type of the read
+/** The storage sets type of the read for the current thread (see Scope) before it
+ * accesses its cache, the cache then accounts every lookup to that type. Lookups
+ * made outside of any Scope (for example by compaction of the storage) are
+ * accounted to ReadType::background
+ */
+class ReadStats {
+public:
+
+	struct Counters {
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+	};
+
+	///Sets type of the reads performed by the current thread
+	/** Previous type is restored when the object is destroyed */
+	class Scope {
+	public:
+		Scope(ReadType type):prev(cur) {cur = type;}
+		~Scope() {cur = prev;}
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+	protected:
+		ReadType prev;
+	};
+
+	///Retrieves type of the read performed by the current thread
+	static ReadType current() {return cur;}
+
+	///Accounts cache hit to the current type
+	static void hit() {add(cur, 1, 0);}
+	///Accounts cache miss to the current type
+	static void miss() {add(cur, 0, 1);}
+	///Accounts hits and misses to the type
+	static void add(ReadType type, std::uint64_t hits, std::uint64_t misses);
+
+	///Retrieves counters of the type
+	static Counters get(ReadType type);
+
+	///Retrieves name of the type
+	static const char *name(ReadType type);
+
+protected:
+	static std::atomic<std::uint64_t> hits[static_cast<int>(ReadType::count)];
+	static std::atomic<std::uint64_t> misses[static_cast<int>(ReadType::count)];
+	static thread_local ReadType cur;
+};
+
+}
+
+#endif /* SRC_LIBSOFA_READSTATS_H_ */
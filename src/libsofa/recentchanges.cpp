@@ -0,0 +1,86 @@
+/*
+ * recentchanges.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include "recentchanges.h"
+
+namespace sofadb {
+
+RecentChanges::RecentChanges(std::size_t capacity, bool keepDocs, SeqNum base)
+	:keepDocs(keepDocs),base(base) {
+	ring.resize(capacity);
+}
+
+void RecentChanges::reset(std::size_t capacity, bool keepDocs, SeqNum base) {
+	std::lock_guard<std::mutex> _(lock);
+	docmap.clear();
+	ring.clear();
+	ring.resize(capacity);
+	pushed = 0;
+	count = 0;
+	this->keepDocs = keepDocs;
+	this->base = base;
+}
+
+void RecentChanges::push(RecordList &records) {
+	std::lock_guard<std::mutex> _(lock);
+	if (ring.empty()) return;
+	for (auto &&r: records) {
+		if (count == ring.size()) {
+			//evict the oldest record, changes up to its seqnum are no longer covered
+			Record &old = at(pushed - count);
+			auto iter = docmap.find(old.docid);
+			if (iter != docmap.end() && iter->second == pushed - count) docmap.erase(iter);
+			base = old.seqnum;
+			--count;
+		}
+		auto iter = docmap.find(r.docid);
+		if (iter != docmap.end()) {
+			at(iter->second).superseded = true;
+			docmap.erase(iter);
+		}
+		Record &nr = at(pushed);
+		nr = std::move(r);
+		nr.superseded = false;
+		if (!keepDocs) nr.value = nullptr;
+		docmap.emplace(nr.docid, pushed);
+		++pushed;
+		++count;
+	}
+	records.clear();
+}
+
+void RecentChanges::erase(const std::string_view &docid) {
+	std::lock_guard<std::mutex> _(lock);
+	auto iter = docmap.find(docid);
+	if (iter != docmap.end()) {
+		at(iter->second).superseded = true;
+		docmap.erase(iter);
+	}
+}
+
+bool RecentChanges::read(SeqNum from, std::size_t limit, RecordList &out) const {
+	out.clear();
+	std::lock_guard<std::mutex> _(lock);
+	if (ring.empty() || from < base) return false;
+
+	//records are ordered by seqnum, find first record above 'from'
+	std::uint64_t l = pushed - count;
+	std::uint64_t h = pushed;
+	while (l < h) {
+		std::uint64_t m = (l + h) / 2;
+		if (at(m).seqnum <= from) l = m + 1;
+		else h = m;
+	}
+	while (l < pushed && out.size() < limit) {
+		const Record &r = at(l);
+		if (!r.superseded) out.push_back(r);
+		++l;
+	}
+	return true;
+}
+
+}
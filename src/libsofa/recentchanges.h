@@ -0,0 +1,110 @@
+/*
+ * recentchanges.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_LIBSOFA_RECENTCHANGES_H_
+#define SRC_LIBSOFA_RECENTCHANGES_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "types.h"
+
+namespace sofadb {
+
+///Ring buffer of recent changes of single database
+/** The buffer is filled by the write path once the batch is committed. Readers
+ * which read changes from a sequence number inside of the window covered by the
+ * buffer are served from memory without scanning the database. Optionally the
+ * buffer also holds serialized documents, so readers don't need to lookup them.
+ *
+ * The buffer covers all changes above the base sequence number. Changes of the documents,
+ * which have been updated again, are marked as superseded and skipped during
+ * reading (as they are removed from the seq index)
+ *
+ * The object is MT safe
+ */
+class RecentChanges {
+public:
+
+	struct Record {
+		///document id
+		std::string docid;
+		///revision
+		RevID revid;
+		///sequence number
+		SeqNum seqnum;
+		///serialized document (as it is stored in the database), can be nullptr
+		std::shared_ptr<const std::string> value;
+		///record has been superseded by newer change of the same document
+		bool superseded = false;
+	};
+
+	typedef std::vector<Record> RecordList;
+
+	///Construct the buffer
+	/**
+	 * @param capacity count of records. Zero disables the buffer
+	 * @param keepDocs true to keep serialized documents
+	 * @param base sequence number covered by the database - buffer covers all changes above it
+	 */
+	RecentChanges(std::size_t capacity, bool keepDocs, SeqNum base);
+
+	///Changes settings of the buffer. The buffer is cleared
+	/**
+	 * @param capacity count of records. Zero disables the buffer
+	 * @param keepDocs true to keep serialized documents
+	 * @param base sequence number covered by the database - buffer covers all changes above it
+	 */
+	void reset(std::size_t capacity, bool keepDocs, SeqNum base);
+
+	///Returns true, when serialized documents should be stored
+	bool isKeepDocs() const {return keepDocs;}
+
+	///Appends records in order of sequence numbers
+	/**
+	 * @param records records to append. The content is moved out
+	 */
+	void push(RecordList &records);
+
+	///Marks document's record as superseded (for instance, when document is erased)
+	void erase(const std::string_view &docid);
+
+	///Reads records
+	/**
+	 * @param from sequence number, returns records above this number
+	 * @param limit maximum count of returned records
+	 * @param out receives the records
+	 * @retval true success, the records are in the out. If the out is empty, there are no more records
+	 * @retval false the sequence number is not covered by the buffer, you need to read the database
+	 */
+	bool read(SeqNum from, std::size_t limit, RecordList &out) const;
+
+protected:
+
+	mutable std::mutex lock;
+	std::vector<Record> ring;
+	///count of pushed records (absolute position of next record)
+	std::uint64_t pushed = 0;
+	///count of records in the ring
+	std::size_t count = 0;
+	bool keepDocs;
+	SeqNum base;
+	///maps document ID to absolute position of its last record
+	std::unordered_map<std::string_view, std::uint64_t> docmap;
+
+	Record &at(std::uint64_t pos) {return ring[pos % ring.size()];}
+	const Record &at(std::uint64_t pos) const {return ring[pos % ring.size()];}
+};
+
+}
+
+
+
+#endif /* SRC_LIBSOFA_RECENTCHANGES_H_ */
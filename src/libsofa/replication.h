@@ -70,6 +70,20 @@ public:
 	using PutStatusList = std::basic_string_view<PutStatus>;
 	using WaitHandle = std::size_t;
 
+	///Range of documents read by initial synchronization
+	struct DocRange {
+		///current revisions ordered by document id
+		DocumentList docs;
+		///historical revisions of the documents
+		DocumentList history;
+		///id of the last document of the range (documents removed by the filter are also counted)
+		std::string last;
+		///true, if there are more documents
+		bool more = false;
+		///true, if error happened
+		bool error = false;
+	};
+
 
 	///Reads manifest from the source
 	/**
@@ -162,6 +176,58 @@ public:
 				std::function<void(const DocumentList &)> &&callback) = 0;
 
 
+	///Opens snapshot of the source database for initial synchronization
+	/** Initial synchronization transfers whole database ordered by document id instead
+	 * of reading manifests of changes. Once all documents are transfered, the replication
+	 * continues by reading changes from the sequence number of the snapshot.
+	 *
+	 * @param callback receives sequence number of the snapshot. If it receives
+	 * IReplicationProtocol::error, the initial synchronization is not supported.
+	 *
+	 * Default implementation doesn't support initial synchronization
+	 */
+	virtual void openSnapshot(std::function<void(SeqNum)> &&callback) {
+		callback(error);
+	}
+
+	///Reads range of documents from the snapshot
+	/**
+	 * @param start_after id of the last document of the previous range (DocRange::last). Use
+	 * empty string for the first range
+	 * @param limit maximum count of documents
+	 * @param filter filter (see readManifest)
+	 * @param callback function receives the range
+	 */
+	virtual void readDocRange(const std::string &, std::size_t , json::Value ,
+			std::function<void(const DocRange &)> &&callback) {
+		DocRange r;
+		r.error = true;
+		callback(r);
+	}
+
+	///Releases the snapshot
+	virtual void closeSnapshot() {}
+
+	///Uploads documents read by readDocRange
+	/**
+	 * @param documents current revisions of documents ordered by id
+	 * @param history historical revisions
+	 * @param callback receives status of each document
+	 *
+	 * Default implementation uploads the historical revisions by uploadHistoricalDocs() and
+	 * then the documents by uploadDocs(). The documents must stay valid until the callback is called
+	 */
+	virtual void uploadSortedDocs(const DocumentList &documents, const DocumentList &history,
+			std::function<void(const PutStatusList &)> &&callback) {
+		if (history.empty()) {
+			uploadDocs(documents, std::move(callback));
+			return;
+		}
+		uploadHistoricalDocs(history, [this, documents, callback = std::move(callback)](const PutStatusList &) mutable {
+			uploadDocs(documents, std::move(callback));
+		});
+	}
+
 	///Registers callbacks to deliver warning appears during communication
 	/** Warnings can help to find problems during replication - because the
 	 * replication protocol should be robust and stable, it won't probably generate
@@ -26,7 +26,7 @@ void ReplicationServer::readManifest(SeqNum since, std::size_t limit,
 
 
 	DatabaseCore &dbcore = docdb.getDBCore();
-	std::string tmp;
+	PinnedValue tmp;
 
 	DocFilter flt = createFilter(filter);
 	std::vector<DocRef> docs;
@@ -35,13 +35,13 @@ void ReplicationServer::readManifest(SeqNum since, std::size_t limit,
 		Cdg _(cd);
 		if (flt != nullptr) {
 			DatabaseCore::RawDocument rawdoc;
-			if (!dbcore.findDoc(h,chrec.docid, chrec.revid, rawdoc, tmp)) return true;
+			if (!dbcore.findDoc(h,chrec, rawdoc, tmp, ReadHint::bulk(ReadType::replication))) return true;
 			json::Value doc = DocumentDB::parseDocument(rawdoc,OutputFormat::replication);
 			if (!flt(doc).defined()) return true;
 		}
 		docs.push_back(DocRef(std::string(chrec.docid),chrec.revid));
 		return --limit > 0;
-	});
+	}, ReadHint::bulk(ReadType::replication));
 
 	if (!docs.empty() || !longpoll) {
 		result(Manifest(docs.data(),docs.size()), lastSeq);
@@ -65,11 +65,11 @@ void ReplicationServer::downloadDocs(const DownloadRequest& dwreq,
 
 	std::vector<json::Value> lst;
 	DatabaseCore &dbcore = docdb.getDBCore();
-	std::string tmp;
+	PinnedValue tmp;
 
 	for (auto &&c : dwreq) {
 		DatabaseCore::RawDocument rawdoc;
-		if (dbcore.findDoc(h,c.id, c.rev, rawdoc, tmp)) {
+		if (dbcore.findDoc(h,c.id, c.rev, rawdoc, tmp, ReadHint::bulk(ReadType::replication))) {
 			json::Value v = DocumentDB::parseDocument(rawdoc,OutputFormat::replication);
 			lst.push_back(v);
 		}
@@ -87,11 +87,11 @@ void ReplicationServer::downloadDocs(const DownloadTopRequest& dwreq,
 
 	std::vector<json::Value> lst;
 	DatabaseCore &dbcore = docdb.getDBCore();
-	std::string tmp;
+	PinnedValue tmp;
 
 	for (auto &&c : dwreq) {
 		DatabaseCore::RawDocument rawdoc;
-		if (dbcore.findDoc(h,c, rawdoc, tmp)) {
+		if (dbcore.findDoc(h,c, rawdoc, tmp, ReadHint::bulk(ReadType::replication))) {
 			json::Value v = DocumentDB::parseDocument(rawdoc,OutputFormat::replication);
 			lst.push_back(v);
 		}
@@ -126,13 +126,13 @@ void ReplicationServer::sendManifest(const Manifest& manifest,
 
 	Cdg _(cd);
 
-	std::string tmp;
+	PinnedValue tmp;
 	DatabaseCore &dbcore = docdb.getDBCore();
 	std::vector<DocRef> request;
 
 	for (auto &&c: manifest) {
 		DatabaseCore::RawDocument rawdoc;
-		if (dbcore.findDoc(h,c.id, rawdoc, tmp)) {
+		if (dbcore.findDoc(h,c.id, rawdoc, tmp, ReadHint::bulk(ReadType::replication))) {
 			if (c.rev == rawdoc.revision) continue;
 			std::string_view p = rawdoc.payload;
 			json::Value log = DocumentDB::parseLog(p);
@@ -150,10 +150,7 @@ void ReplicationServer::uploadDocs(const DocumentList& documents,
 	Cdg _(cd);
 
 	std::vector<PutStatus> st;
-	json::String dummy;
-	for (auto &&c: documents) {
-		st.push_back(docdb.replicator_put(h,c,dummy));
-	}
+	docdb.replicator_put_bulk(h, documents, st);
 	callback(PutStatusList(st.data(),st.size()));
 
 }
@@ -163,15 +160,123 @@ void ReplicationServer::resolveConflicts(const DocumentList &documents,
 
 	Cdg _(cd);
 
-	std::vector<json::Value> result;
+	const DocumentDB::Worker *w = docdb.getWorker();
+	if (documents.size() <= resolveChunk || w == nullptr) {
+		std::vector<json::Value> result;
+
+		for (auto &&doc: documents) {
+			json::Value merged;
+			docdb.resolveConflict(h,doc,merged);
+			if (merged.defined())
+				result.push_back(merged);
+		}
+		callback(DocumentList(result.data(),result.size()));
+		return;
+	}
+
+	//large set of conflicts is resolved in parallel by the compute worker. The router's worker
+	//is not used, it would delay delivery of the events
+	struct State {
+		std::vector<json::Value> docs;
+		std::vector<json::Value> merged;
+		std::atomic<std::size_t> remain;
+		std::function<void(const DocumentList &)> callback;
+		Cdg g;
+		State(Countdown &cd):g(cd) {}
+	};
+	auto st = std::make_shared<State>(cd);
+	st->docs.assign(documents.begin(), documents.end());
+	st->merged.resize(documents.size());
+	st->callback = std::move(callback);
+	std::size_t cnt = documents.size();
+	st->remain = (cnt + resolveChunk - 1) / resolveChunk;
+	Worker worker = *w;
+	for (std::size_t i = 0; i < cnt; i+=resolveChunk) {
+		worker >> [st, i, this] {
+			std::size_t e = std::min(i+resolveChunk, st->docs.size());
+			for (std::size_t j = i; j < e; j++)
+				docdb.resolveConflict(h, st->docs[j], st->merged[j]);
+			if (--st->remain == 0) {
+				std::vector<json::Value> result;
+				for (auto &&c: st->merged) if (c.defined()) result.push_back(c);
+				st->callback(DocumentList(result.data(),result.size()));
+			}
+		};
+	}
+}
+
+void ReplicationServer::openSnapshot(std::function<void(SeqNum)> &&callback) {
+
+	Cdg _(cd);
+
+	SeqNum seqnum;
+	PKeyValueDatabaseSnapshot snap = docdb.getDBCore().createSnapshot(h, seqnum);
+	if (snap == nullptr) {
+		callback(error);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> _(snapLock);
+		snapshot = snap;
+	}
+	callback(seqnum);
+}
+
+void ReplicationServer::readDocRange(const std::string &start_after, std::size_t limit, json::Value filter,
+		std::function<void(const DocRange &)> &&callback) {
 
-	for (auto &&doc: documents) {
-		json::Value merged;
-		docdb.resolveConflict(h,doc,merged);
-		if (merged.defined())
-			result.push_back(merged);
+	Cdg _(cd);
+
+	DatabaseCore &dbcore = docdb.getDBCore();
+	PKeyValueDatabaseSnapshot snap;
+	{
+		std::lock_guard<std::mutex> _(snapLock);
+		snap = snapshot;
+	}
+	if (snap == nullptr) {
+		SeqNum dummy;
+		snap = dbcore.createSnapshot(h, dummy);
+	}
+	DocRange range;
+	if (snap == nullptr) {
+		range.error = true;
+		callback(range);
+		return;
 	}
-	callback(DocumentList(result.data(),result.size()));
+
+	DocFilter flt = createFilter(filter);
+	std::vector<json::Value> docs, history;
+	bool skip = false;
+	range.last = start_after;
+	range.more = dbcore.readDocRange(snap, h, start_after, limit,
+			[&](const DatabaseCore::RawDocument &rawdoc, bool hst) {
+		json::Value doc = DocumentDB::parseDocument(rawdoc,OutputFormat::replication);
+		if (!hst) {
+			range.last = rawdoc.docId;
+			skip = flt != nullptr && !flt(doc).defined();
+			if (!skip) docs.push_back(doc);
+		} else if (!skip) {
+			history.push_back(doc);
+		}
+	});
+	range.docs = DocumentList(docs.data(), docs.size());
+	range.history = DocumentList(history.data(), history.size());
+	callback(range);
+}
+
+void ReplicationServer::closeSnapshot() {
+	std::lock_guard<std::mutex> _(snapLock);
+	snapshot = nullptr;
+}
+
+void ReplicationServer::uploadSortedDocs(const DocumentList &documents, const DocumentList &history,
+		std::function<void(const PutStatusList &)> &&callback) {
+
+	Cdg _(cd);
+
+	std::vector<PutStatus> st;
+	docdb.replicator_put_bulk(h, documents, st, history);
+	callback(PutStatusList(st.data(),st.size()));
 }
 
 void ReplicationServer::setWarningCallback(WarningCallback &&callback) {
@@ -41,6 +41,12 @@ public:
 	virtual void resolveConflicts(const DocumentList &documents,
 				std::function<void(const DocumentList &)> &&callback);
 	virtual void setWarningCallback(WarningCallback &&callback);
+	virtual void openSnapshot(std::function<void(SeqNum)> &&callback);
+	virtual void readDocRange(const std::string &start_after, std::size_t limit, json::Value filter,
+			std::function<void(const DocRange &)> &&callback);
+	virtual void closeSnapshot();
+	virtual void uploadSortedDocs(const DocumentList &documents, const DocumentList &history,
+			std::function<void(const PutStatusList &)> &&callback);
 
 
 protected:
@@ -49,8 +55,15 @@ protected:
 	DatabaseCore::Handle h;
 	WarningCallback wcb;
 	std::atomic<EventRouter::WaitHandle> wh = 0;
-	ondra_shared::Countdown cd;
+	using Countdown = ondra_shared::Countdown;
+	Countdown cd;
 	using Cdg = ondra_shared::CountdownGuard;
+	///snapshot pinned by the initial synchronization
+	PKeyValueDatabaseSnapshot snapshot;
+	std::mutex snapLock;
+
+	///count of conflicts resolved by single worker
+	static const std::size_t resolveChunk = 16;
 
 
 
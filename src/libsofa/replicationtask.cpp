@@ -9,6 +9,26 @@
 
 namespace sofadb {
 
+///Estimates size of serialized document
+static std::size_t estimateSize(const json::Value &v) {
+	switch (v.type()) {
+	case json::string: {
+		std::string_view str = v.getString();
+		return str.length() + 2;
+	}
+	case json::array:
+	case json::object: {
+		std::size_t sz = 2;
+		for (json::Value x: v) {
+			std::string_view key = x.getKey();
+			sz += estimateSize(x) + key.length() + 4;
+		}
+		return sz;
+	}
+	default: return 8;
+	}
+}
+
 ReplicationTask::ReplicationTask(PProtocol &&source, PProtocol &&target)
 	:source(std::move(source)),target(std::move(target)), started(false)
 {
@@ -36,64 +56,497 @@ void ReplicationTask::start(SeqNum since, json::Value filter, bool continuous) {
 	this->seqnum = since;
 	this->filter = filter;
 	this->continuous = continuous;
+	{
+		Sync _(lock);
+		batches.clear();
+		inflightIds.clear();
+		firstBatch = 0;
+		readSeq = since;
+		active = 0;
+		depth = cfg.pipeline_depth;
+		reading = false;
+		eof = false;
+		cur_batch = std::max<std::size_t>(cfg.min_batch, 1);
+		avgDocSize = 0;
+		lastComplete = std::chrono::steady_clock::now();
+		stats = Stats();
+		stats.batch_size = cur_batch;
+		syncMore = false;
+		syncRepump = false;
+	}
 
-
-	doWork(initial_batch_size);
+	if (since == 0 && cfg.initial_sync) initialSync();
+	else pump();
 
 
 }
 
-void ReplicationTask::doWork(std::size_t limit) {
-	if (!started) return;
+void ReplicationTask::pump() {
+	Sync _(lock);
+	//avoid recursion when protocol calls callbacks synchronously
+	if (pumping) {
+		repump = true;
+		return;
+	}
+	pumping = true;
 	do {
-		async_detect = 1;
-		this->old_seqnum = this->seqnum;
-		source->readManifest(seqnum, limit,filter, continuous, [=,g=Grd(exitWait)](IReplicationProtocol::Manifest m, SeqNum seqnum){
+		repump = false;
+		while (!reading && !eof && batches.size() < depth && !checkStop()) {
+			std::size_t limit = cur_batch;
+			if (avgDocSize > 0) {
+				//limit documents in flight
+				std::size_t room = stats.inflight_bytes < cfg.max_inflight_bytes
+						?static_cast<std::size_t>((cfg.max_inflight_bytes - stats.inflight_bytes) / avgDocSize):0;
+				if (room == 0 && active) break;
+				limit = std::max<std::size_t>(1, std::min(limit, room));
+			}
+			SeqNum since = readSeq;
+			reading = true;
+			_.unlock();
+			readNext(since, limit);
+			_.lock();
+		}
+	} while (repump);
+	pumping = false;
+	bool done = eof && !reading && active == 0;
+	_.unlock();
+	if (done) finish();
+}
+
+void ReplicationTask::readNext(SeqNum since, std::size_t limit) {
+	source->readManifest(since, limit, filter, continuous, [=,g=Grd(exitWait)](const IReplicationProtocol::Manifest &m, SeqNum seqnum){
+		if (checkStop()) return;
+		onManifest(m, seqnum, limit);
+	});
+}
+
+void ReplicationTask::onManifest(const IReplicationProtocol::Manifest &m, SeqNum seqnum, std::size_t limit) {
+	BatchID id;
+	bool waiting;
+	{
+		Sync _(lock);
+		reading = false;
+		if (seqnum == IReplicationProtocol::error) {
+			//finish replication once the batches in flight are done
+			eof = true;
+			_.unlock();
+			pump();
+			return;
+		}
+		readSeq = seqnum;
+		//empty manifest - nothing to transfer, but checkpoint can advance
+		if (m.empty() && !continuous) eof = true;
+		//reserve memory for documents by average size until real size is known
+		std::size_t reserved = static_cast<std::size_t>(m.size() * avgDocSize);
+		batches.push_back(Batch{seqnum, false, false, m.size() >= limit,
+				std::chrono::steady_clock::now(), m.size(), reserved, {}, false, {}});
+		stats.inflight_bytes += reserved;
+		++active;
+		id = firstBatch + batches.size() - 1;
+		//document changed again after an earlier batch was read. The batch must wait,
+		//otherwise the older revision could be written after the newer one
+		Batch &b = batches.back();
+		b.ids.reserve(m.size());
+		for (auto &&c: m) {
+			if (inflightIds[c.id]++) b.waiting = true;
+			b.ids.push_back(c.id);
+		}
+		if (b.waiting) b.manifest.assign(m.begin(), m.end());
+		waiting = b.waiting;
+	}
+	if (m.empty()) {
+		completeBatch(id, true);
+		return;
+	}
+	//prefetch next manifest while this batch is being transfered (or waiting)
+	pump();
+	if (waiting) return;
+	Manifest manifest(m.begin(), m.end());
+	processBatch(id, std::move(manifest));
+}
+
+void ReplicationTask::releaseIds(Batch &b) {
+	for (auto &&c: b.ids) {
+		auto iter = inflightIds.find(c);
+		if (iter != inflightIds.end() && --iter->second == 0) inflightIds.erase(iter);
+	}
+	b.ids.clear();
+}
+
+void ReplicationTask::processBatch(BatchID id, Manifest &&manifest) {
+	target->sendManifest(IReplicationProtocol::Manifest(manifest.data(), manifest.size()), [=,g=Grd(exitWait)](const IReplicationProtocol::DownloadRequest &req) {
+		if (checkStop()) return;
+		if (req.empty()) {
+			accountBatch(id, 0, 0);
+			completeBatch(id, true);
+			return;
+		}
+		std::size_t count = req.size();
+		source->downloadDocs(req,[=,g=Grd(exitWait)](const IReplicationProtocol::DocumentList &docs) {
+			if (checkStop()) return;
+			//incomplete response means error (remote protocol)
+			if (docs.size() != count) {
+				completeBatch(id, false);
+				return;
+			}
+			uploadBatch(id, docs);
+		});
+	});
+}
+
+void ReplicationTask::uploadBatch(BatchID id, const IReplicationProtocol::DocumentList &docs) {
+	std::vector<json::Value> doclist;
+	doclist.reserve(docs.size());
+	for (auto &&c: docs) {
+		if (c != nullptr) doclist.push_back(c);
+	}
+	if (doclist.empty()) {
+		accountBatch(id, 0, 0);
+		completeBatch(id, true);
+		return;
+	}
+	std::size_t bytes = 0;
+	for (auto &&c: doclist) bytes += estimateSize(c);
+	accountBatch(id, doclist.size(), bytes);
+	IReplicationProtocol::DocumentList upload(doclist.data(), doclist.size());
+	target->uploadDocs(upload, [=,doclist=std::move(doclist),g=Grd(exitWait)](const IReplicationProtocol::PutStatusList &status){
+		if (checkStop()) return;
+		std::size_t cnt = doclist.size();
+		if (status.size() != cnt) {
+			completeBatch(id, false);
+			return;
+		}
+		std::vector<json::Value> conflicts;
+		for (std::size_t i = 0; i < cnt; i++) {
+			if (status[i] == PutStatus::conflict) {
+				conflicts.push_back(doclist[i]);
+			} else if (!isSuccess(status[i])) {
+				if (!onError(doclist[i],status[i])) {
+					completeBatch(id, false);
+					return;
+				}
+			}
+		}
+		if (!conflicts.empty()) {
+			//the batch is completed once conflicts are resolved, other batches continue
+			resolveBatch(std::move(conflicts), 0, [=](bool ok) {completeBatch(id, ok);});
+			return;
+		}
+		completeBatch(id, true);
+	});
+}
+
+void ReplicationTask::resolveBatch(std::vector<json::Value> &&conflicts, std::size_t round, DoneFn &&done) {
+	std::vector<std::string> ids;
+	ids.reserve(conflicts.size());
+	for (auto &&c: conflicts) {
+		std::string_view docid = c["id"].getString();
+		ids.push_back(std::string(docid));
+	}
+	IReplicationProtocol::DownloadTopRequest req(ids.data(), ids.size());
+	target->downloadDocs(req, [=,conflicts=std::move(conflicts),done=std::move(done),g=Grd(exitWait)](const IReplicationProtocol::DocumentList &tops) {
+		if (checkStop()) return;
+		if (tops.size() != conflicts.size()) {
+			done(false);
+			return;
+		}
+		//top revisions of the target are merged with the source, which can have
+		//history unknown to the target
+		std::vector<json::Value> toplist;
+		for (auto &&c: tops) if (c != nullptr) toplist.push_back(c);
+		source->resolveConflicts(IReplicationProtocol::DocumentList(toplist.data(), toplist.size()),
+				[=,g=Grd(exitWait)](const IReplicationProtocol::DocumentList &merged) {
 			if (checkStop()) return;
-			this->seqnum = seqnum;
-			target->sendManifest(m, [=,g=Grd(exitWait)](IReplicationProtocol::DownloadRequest req) {
-				if (checkStop()) return;
-				if (!req.empty()) {
-					source->downloadDocs(req,[=](IReplicationProtocol::DocumentList docs) {
-						std::vector<json::Value> doclist;
-						if (checkStop()) return;
-						doclist.reserve(docs.size());
-						for (auto &&c: docs) {
-							if (c != nullptr) doclist.push_back(c);
-						}
-						if (!doclist.empty()) {
-							target->uploadDocs(docs, [=,doclist=std::move(doclist),g=Grd(exitWait)](IReplicationProtocol::PutStatusList status){
-								std::size_t cnt = doclist.size();
-								std::vector<json::Value> conflicts;
-								for (std::size_t i = 0; i < cnt; i++) {
-									if (status[i] == PutStatus::conflict) {
-										conflicts.push_back(docs[i]);
-									} else if (status[i] != PutStatus::stored) {
-										if (!onError(doclist[i],status[i])) {
-											finish();
-											return;
-										}
-									}
-								}
-								if (!conflicts.empty()) {
-	//								resolveConflicts(conflicts);
-								}
-								else {
-									retryWork();
-								}
-							});
-						} else {
-							retryWork();
-						}
-					});
-				} else {
-					retryWork();
+			uploadResolved(conflicts, std::vector<json::Value>(merged.begin(), merged.end()), round, done);
+		});
+	});
+}
+
+void ReplicationTask::uploadResolved(const std::vector<json::Value> &conflicts, std::vector<json::Value> &&merged, std::size_t round, DoneFn done) {
+	//conflicted revisions are stored to the history first, so the merged revisions are connected to them
+	IReplicationProtocol::DocumentList hst(conflicts.data(), conflicts.size());
+	target->uploadHistoricalDocs(hst, [=,merged=std::move(merged),g=Grd(exitWait)](const IReplicationProtocol::PutStatusList &) {
+		if (checkStop()) return;
+		//documents which were not merged are left in conflict
+		std::vector<bool> resolved(conflicts.size(), false);
+		for (auto &&m: merged) {
+			json::Value docid = m["id"];
+			for (std::size_t i = 0; i < conflicts.size(); i++)
+				if (conflicts[i]["id"] == docid) resolved[i] = true;
+		}
+		for (std::size_t i = 0; i < conflicts.size(); i++) {
+			if (!resolved[i] && !onError(conflicts[i], PutStatus::conflict)) {
+				done(false);
+				return;
+			}
+		}
+		if (merged.empty()) {
+			done(true);
+			return;
+		}
+		IReplicationProtocol::DocumentList upload(merged.data(), merged.size());
+		target->uploadDocs(upload, [=,g=Grd(exitWait)](const IReplicationProtocol::PutStatusList &status) {
+			if (checkStop()) return;
+			if (status.size() != merged.size()) {
+				done(false);
+				return;
+			}
+			std::vector<json::Value> residual;
+			for (std::size_t i = 0; i < status.size(); i++) {
+				if (status[i] == PutStatus::conflict) {
+					//target has been changed meanwhile, retry with the original revision
+					json::Value docid = merged[i]["id"];
+					for (auto &&c: conflicts) if (c["id"] == docid) residual.push_back(c);
+				} else if (!isSuccess(status[i]) && !onError(merged[i], status[i])) {
+					done(false);
+					return;
 				}
-			});
+			}
+			if (residual.empty()) {
+				done(true);
+			} else if (round + 1 >= cfg.conflict_retries) {
+				for (auto &&c: residual) {
+					if (!onError(c, PutStatus::conflict)) {
+						done(false);
+						return;
+					}
+				}
+				done(true);
+			} else {
+				resolveBatch(std::move(residual), round + 1, DoneFn(done));
+			}
 		});
+	});
+}
+
+void ReplicationTask::accountBatch(BatchID id, std::size_t docs, std::size_t bytes) {
+	Sync _(lock);
+	Batch &b = batches[id - firstBatch];
+	stats.inflight_bytes = stats.inflight_bytes - b.bytes + bytes;
+	b.docs = docs;
+	b.bytes = bytes;
+}
+
+void ReplicationTask::adjustBatchSize(const Batch &b, TimePoint now) {
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - b.started).count();
+	//multiplicative decrease when batch takes too long, additive increase otherwise
+	if (static_cast<std::size_t>(elapsed) > cfg.target_time) {
+		cur_batch = std::max<std::size_t>(std::max<std::size_t>(cfg.min_batch, 1), cur_batch / 2);
+	} else if (b.full) {
+		cur_batch = std::min(cfg.max_batch, cur_batch + cfg.batch_increment);
+	}
+	stats.batch_size = cur_batch;
+
+	if (b.docs) {
+		double sz = static_cast<double>(b.bytes) / b.docs;
+		avgDocSize = avgDocSize > 0?avgDocSize * 0.8 + sz * 0.2:sz;
 	}
-	while (--async_detect < 0);
-	onUpdate(this->seqnum);
+
+	double dt = std::chrono::duration<double>(now - lastComplete).count();
+	lastComplete = now;
+	stats.docs += b.docs;
+	stats.bytes += b.bytes;
+	if (dt > 0) {
+		stats.docs_per_sec = stats.docs_per_sec * 0.7 + (b.docs / dt) * 0.3;
+		stats.bytes_per_sec = stats.bytes_per_sec * 0.7 + (b.bytes / dt) * 0.3;
+	}
+}
+
+void ReplicationTask::completeBatch(BatchID id, bool ok) {
+	bool advanced = false;
+	SeqNum sq;
+	std::vector<std::pair<BatchID, Manifest> > resume;
+	{
+		Sync _(lock);
+		Batch &b = batches[id - firstBatch];
+		if (!b.done && !b.failed) --active;
+		stats.inflight_bytes -= b.bytes;
+		b.bytes = 0;
+		releaseIds(b);
+		if (ok) {
+			b.done = true;
+			adjustBatchSize(b, std::chrono::steady_clock::now());
+		} else {
+			b.failed = true;
+			eof = true;
+		}
+		//start waiting batches, whose earlier batches are all transfered. After failure,
+		//the replication stops, so waiting batches are failed as well
+		bool allDone = true;
+		for (std::size_t i = 0; i < batches.size(); i++) {
+			Batch &w = batches[i];
+			if (w.waiting) {
+				if (!ok) {
+					w.waiting = false;
+					w.failed = true;
+					--active;
+					stats.inflight_bytes -= w.bytes;
+					w.bytes = 0;
+					releaseIds(w);
+					w.manifest.clear();
+				} else if (allDone) {
+					w.waiting = false;
+					resume.push_back(std::pair(firstBatch + i, std::move(w.manifest)));
+				}
+			}
+			allDone = allDone && w.done;
+		}
+		//advance checkpoint over transfered batches
+		while (!batches.empty() && batches.front().done) {
+			sq = batches.front().seqnum;
+			batches.pop_front();
+			++firstBatch;
+			advanced = true;
+		}
+		if (advanced) seqnum = sq;
+	}
+	if (advanced) {
+		//report only the most recent checkpoint
+		std::lock_guard<std::mutex> _(updateLock);
+		if (sq == seqnum) onUpdate(sq);
+	}
+	for (auto &&r: resume) processBatch(r.first, std::move(r.second));
+	pump();
+}
+
+void ReplicationTask::initialSync() {
+	source->openSnapshot([=,g=Grd(exitWait)](SeqNum snapSeq) {
+		if (checkStop()) return;
+		if (snapSeq == IReplicationProtocol::error) {
+			//not supported by the source, replicate by manifests
+			pump();
+		} else {
+			{
+				Sync _(lock);
+				syncLast.clear();
+				syncMore = true;
+			}
+			syncPump(snapSeq);
+		}
+	});
+}
+
+void ReplicationTask::syncPump(SeqNum snapSeq) {
+	Sync _(lock);
+	//avoid recursion when protocol calls callbacks synchronously
+	if (syncPumping) {
+		syncRepump = true;
+		return;
+	}
+	syncPumping = true;
+	do {
+		syncRepump = false;
+		std::string last = syncLast;
+		bool more = syncMore;
+		_.unlock();
+		if (more) readRange(snapSeq, last);
+		else finishInitialSync(snapSeq);
+		_.lock();
+	} while (syncRepump);
+	syncPumping = false;
+}
+
+void ReplicationTask::readRange(SeqNum snapSeq, const std::string &start_after) {
+	std::size_t limit;
+	{
+		Sync _(lock);
+		limit = cur_batch;
+	}
+	TimePoint started = std::chrono::steady_clock::now();
+	source->readDocRange(start_after, limit, filter, [=,g=Grd(exitWait)](const IReplicationProtocol::DocRange &r) {
+		if (checkStop()) return;
+		if (r.error) {
+			//checkpoint stays at zero, next start repeats initial synchronization
+			source->closeSnapshot();
+			finish();
+			return;
+		}
+		uploadRange(snapSeq,
+				std::vector<json::Value>(r.docs.begin(), r.docs.end()),
+				std::vector<json::Value>(r.history.begin(), r.history.end()),
+				r.last, r.more, limit, started);
+	});
+}
+
+void ReplicationTask::uploadRange(SeqNum snapSeq, std::vector<json::Value> &&docs, std::vector<json::Value> &&history,
+		const std::string &last, bool more, std::size_t limit, TimePoint started) {
+
+	auto next = [=](std::size_t count, std::size_t bytes) {
+		{
+			Sync _(lock);
+			adjustBatchSize(Batch{snapSeq, true, false, count >= limit, started, count, bytes, {}, false, {}},
+					std::chrono::steady_clock::now());
+			syncLast = last;
+			syncMore = more;
+		}
+		syncPump(snapSeq);
+	};
+
+	if (docs.empty()) {
+		next(0,0);
+		return;
+	}
+	std::size_t bytes = 0;
+	for (auto &&c: docs) bytes += estimateSize(c);
+	for (auto &&c: history) bytes += estimateSize(c);
+	IReplicationProtocol::DocumentList updocs(docs.data(), docs.size());
+	IReplicationProtocol::DocumentList uphst(history.data(), history.size());
+	//history is kept alive until the upload is finished
+	target->uploadSortedDocs(updocs, uphst, [=,docs=std::move(docs),history=std::move(history),g=Grd(exitWait)](const IReplicationProtocol::PutStatusList &status) {
+		if (checkStop()) return;
+		std::size_t cnt = docs.size();
+		bool ok = status.size() == cnt;
+		std::vector<json::Value> conflicts;
+		for (std::size_t i = 0; ok && i < cnt; i++) {
+			if (status[i] == PutStatus::conflict) conflicts.push_back(docs[i]);
+			else if (!isSuccess(status[i])) ok = onError(docs[i], status[i]);
+		}
+		if (!ok) {
+			source->closeSnapshot();
+			finish();
+			return;
+		}
+		if (conflicts.empty()) {
+			next(cnt, bytes);
+			return;
+		}
+		//documents already existing on the target are merged as during replication by manifests,
+		//the checkpoint moves to the snapshot, so they would never be transfered otherwise
+		resolveBatch(std::move(conflicts), 0, [=](bool resolved) {
+			if (resolved) {
+				next(cnt, bytes);
+			} else {
+				source->closeSnapshot();
+				finish();
+			}
+		});
+	});
+}
+
+void ReplicationTask::finishInitialSync(SeqNum snapSeq) {
+	source->closeSnapshot();
+	seqnum = snapSeq;
+	{
+		Sync _(lock);
+		readSeq = snapSeq;
+	}
+	{
+		std::lock_guard<std::mutex> _(updateLock);
+		onUpdate(snapSeq);
+	}
+	//continue by changes made after the snapshot
+	pump();
+}
+
+void ReplicationTask::setConfig(const Config &cfg) {
+	Sync _(lock);
+	this->cfg = cfg;
+	if (this->cfg.pipeline_depth == 0) this->cfg.pipeline_depth = 1;
+}
+
+ReplicationTask::Stats ReplicationTask::getStats() const {
+	Sync _(lock);
+	return stats;
 }
 
 void ReplicationTask::onUpdate(SeqNum) {
@@ -104,20 +557,15 @@ void ReplicationTask::onWarning(Side , int, std::string&& ) {
 	//nothing here
 }
 
-void ReplicationTask::retryWork() {
-	if (--async_detect < 0) {
-		doWork(batch_size);
-	}
-}
-
 void ReplicationTask::stop() {
-	if (started) {
-		stopSignal = true;
-		continuous = false;
-		source->stop();
-		target->stop();
-		exitWait.wait();
-	}
+	stopSignal = true;
+	continuous = false;
+	source->stop();
+	target->stop();
+	source->closeSnapshot();
+	//also waits for callbacks of finished replication
+	exitWait.wait();
+	started = false;
 }
 
 bool ReplicationTask::isRunning() const {
@@ -141,9 +589,9 @@ bool ReplicationTask::checkStop() {
 	}
 }
 void ReplicationTask::finish() {
-	this->started = false;
-	checkStop();
-	onFinish(this->seqnum);
+	if (this->started.exchange(false)) {
+		onFinish(this->seqnum);
+	}
 }
 
 
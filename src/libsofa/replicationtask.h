@@ -8,10 +8,17 @@
 #ifndef SRC_LIBSOFA_REPLICATIONTASK_H_
 #define SRC_LIBSOFA_REPLICATIONTASK_H_
 #include <shared/worker.h>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "types.h"
 #include "replication.h"
 #include <atomic>
+#include <chrono>
 
 using ondra_shared::Worker;
 
@@ -19,7 +26,20 @@ namespace sofadb {
 using ondra_shared::Worker;
 
 ///Controls replication from one database to other
-/** The replication works with two interfaces where first interface is used as source and seconds as target. */
+/** The replication works with two interfaces where first interface is used as source and seconds as target.
+ *
+ * The replication is pipelined. While a batch is being transfered, the manifest of the next batch is
+ * read from the source, so more batches can be in flight (see setPipelineDepth()). The sequence number
+ * (checkpoint) advances only over batches which have been fully transfered, so when the replication is
+ * stopped, it can be restarted from the checkpoint without losing any document. A batch which contains
+ * a document of an earlier batch in flight waits until all earlier batches are transfered, so revisions
+ * of the same document are never written out of order
+ *
+ * When the replication starts from zero, the task performs initial synchronization (if the
+ * source supports it). The documents are transfered ordered by id from a snapshot of the
+ * source and the target stores them as sorted bulks. Then the replication continues from the
+ * sequence number of the snapshot. The checkpoint doesn't advance during initial synchronization
+ */
 class ReplicationTask {
 public:
 	using PProtocol = std::unique_ptr<IReplicationProtocol>;
@@ -61,6 +81,63 @@ public:
 	 */
 	std::size_t getSeqNum() const {return seqnum;}
 
+	///Sets maximum count of batches in flight
+	/**
+	 * @param depth count of batches. Value 1 disables pipelining - next batch is read after
+	 * the previous batch is transfered. Change takes effect on next start()
+	 */
+	void setPipelineDepth(std::size_t depth) {cfg.pipeline_depth = depth?depth:1;}
+	///Retrieves maximum count of batches in flight
+	std::size_t getPipelineDepth() const {return cfg.pipeline_depth;}
+
+	///Configuration of the batches
+	/** Size of the batch is controlled adaptively (AIMD). It starts at min_batch. When the batch
+	 * is transfered in shorter time than target_time, the size is increased by batch_increment. When
+	 * the transfer takes longer, the size is halved. Total size of documents in flight is limited
+	 * by max_inflight_bytes
+	 */
+	struct Config {
+		///count of batches in flight
+		std::size_t pipeline_depth = 4;
+		///minimum (and initial) batch size
+		std::size_t min_batch = 10;
+		///maximum batch size
+		std::size_t max_batch = 5000;
+		///additive increase of the batch size
+		std::size_t batch_increment = 100;
+		///target time to transfer one batch in milliseconds
+		std::size_t target_time = 1000;
+		///maximum size of documents in flight in bytes (estimation)
+		std::size_t max_inflight_bytes = 32*1024*1024;
+		///use initial synchronization when replication starts from zero
+		bool initial_sync = true;
+		///count of attempts to resolve conflicts of a batch. Documents left in conflict are reported by onError()
+		std::size_t conflict_retries = 3;
+	};
+
+	///Changes configuration. Change takes effect on next start()
+	void setConfig(const Config &cfg);
+	///Retrieves configuration
+	const Config &getConfig() const {return cfg;}
+
+	struct Stats {
+		///current batch size
+		std::size_t batch_size = 0;
+		///count of transfered documents per second
+		double docs_per_sec = 0;
+		///count of transfered bytes per second (estimation)
+		double bytes_per_sec = 0;
+		///size of documents in flight (estimation)
+		std::size_t inflight_bytes = 0;
+		///total count of transfered documents
+		std::size_t docs = 0;
+		///total count of transfered bytes (estimation)
+		std::size_t bytes = 0;
+	};
+
+	///Retrieves statistics of the running replication
+	Stats getStats() const;
+
 	enum class Side {
 		source,target
 	};
@@ -86,26 +163,102 @@ protected:
 
 	PProtocol source, target;
 
-	std::size_t initial_batch_size = 10;
-	std::size_t batch_size = 1000;
+	Config cfg;
+
+	using Manifest = std::vector<IReplicationProtocol::DocRef>;
+	using BatchID = std::uint64_t;
+	using TimePoint = std::chrono::steady_clock::time_point;
+	///called when conflicts are resolved, false means failure
+	using DoneFn = std::function<void(bool)>;
 
+	///Batch in flight
+	struct Batch {
+		///sequence number of the last change in the batch
+		SeqNum seqnum;
+		///batch is transfered
+		bool done;
+		///batch failed
+		bool failed;
+		///manifest was full (source has probably more changes)
+		bool full;
+		///time when manifest arrived
+		TimePoint started;
+		///count of documents
+		std::size_t docs;
+		///bytes accounted to the in flight documents
+		std::size_t bytes;
+		///ids of the documents, released when the batch is transfered
+		std::vector<std::string> ids;
+		///batch waits for the earlier batches, because some of its documents are still in flight
+		bool waiting = false;
+		///manifest of the waiting batch
+		Manifest manifest;
+	};
 
-	void doWork(std::size_t limit);
+	void pump();
+	void readNext(SeqNum since, std::size_t limit);
+	void onManifest(const IReplicationProtocol::Manifest &m, SeqNum seqnum, std::size_t limit);
+	void accountBatch(BatchID id, std::size_t docs, std::size_t bytes);
+	void adjustBatchSize(const Batch &b, TimePoint now);
+	void processBatch(BatchID id, Manifest &&manifest);
+	void uploadBatch(BatchID id, const IReplicationProtocol::DocumentList &docs);
+	void resolveBatch(std::vector<json::Value> &&conflicts, std::size_t round, DoneFn &&done);
+	void uploadResolved(const std::vector<json::Value> &conflicts, std::vector<json::Value> &&merged, std::size_t round, DoneFn done);
+	void completeBatch(BatchID id, bool ok);
+	void releaseIds(Batch &b);
 	bool checkStop();
 	void finish();
-	void retryWork();
+	void initialSync();
+	void syncPump(SeqNum snapSeq);
+	void readRange(SeqNum snapSeq, const std::string &start_after);
+	void uploadRange(SeqNum snapSeq, std::vector<json::Value> &&docs, std::vector<json::Value> &&history,
+			const std::string &last, bool more, std::size_t limit, TimePoint started);
+	void finishInitialSync(SeqNum snapSeq);
 
 
-	SeqNum seqnum;
-	SeqNum old_seqnum;
+	std::atomic<SeqNum> seqnum;
 	json::Value filter;
 	bool continuous;
 	ondra_shared::Countdown exitWait;
 	using Grd = ondra_shared::CountdownGuard;
+	using Sync = std::unique_lock<std::mutex>;
 
 	std::atomic<bool> started;
 	std::atomic<bool> stopSignal;
-	std::atomic<int> async_detect;
+
+	mutable std::mutex lock;
+	std::mutex updateLock;
+	///batches in flight ordered by sequence numbers
+	std::deque<Batch> batches;
+	///documents of the batches in flight - count of batches per document id
+	std::unordered_map<std::string, std::size_t> inflightIds;
+	///id of the first batch in the queue
+	BatchID firstBatch = 0;
+	///sequence number where the next manifest is read from
+	SeqNum readSeq = 0;
+	///count of batches which are not yet transfered
+	std::size_t active = 0;
+	///count of batches in flight for this run
+	std::size_t depth = 1;
+	///manifest is being read
+	bool reading = false;
+	///no more manifests (source is at the end, or error)
+	bool eof = false;
+	bool pumping = false;
+	bool repump = false;
+	///current batch size
+	std::size_t cur_batch = 0;
+	///average size of a document (estimation)
+	double avgDocSize = 0;
+	///time of the last completed batch
+	TimePoint lastComplete;
+	Stats stats;
+	///initial synchronization - id of the last transfered document
+	std::string syncLast;
+	///initial synchronization - more documents to transfer
+	bool syncMore = false;
+	bool syncPumping = false;
+	bool syncRepump = false;
 
 
 };
@@ -0,0 +1,824 @@
+/*
+ * replicationtcp.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <imtjson/array.h>
+#include <imtjson/object.h>
+#include <shared/logOutput.h>
+#include "keyformat.h"
+#include "replicationtcp.h"
+
+namespace sofadb {
+
+using namespace json;
+using ondra_shared::logWarning;
+
+static const int protocolVersion = 1;
+
+static void putUInt32(std::string &out, std::size_t pos, std::uint32_t v) {
+	out[pos] = static_cast<char>((v >> 24) & 0xFF);
+	out[pos+1] = static_cast<char>((v >> 16) & 0xFF);
+	out[pos+2] = static_cast<char>((v >> 8) & 0xFF);
+	out[pos+3] = static_cast<char>(v & 0xFF);
+}
+
+static std::uint32_t getUInt32(const char *buff) {
+	const unsigned char *b = reinterpret_cast<const unsigned char *>(buff);
+	return (static_cast<std::uint32_t>(b[0]) << 24)
+			| (static_cast<std::uint32_t>(b[1]) << 16)
+			| (static_cast<std::uint32_t>(b[2]) << 8)
+			| static_cast<std::uint32_t>(b[3]);
+}
+
+static Value docRefs2json(const IReplicationProtocol::Manifest &refs) {
+	Array out;
+	out.reserve(refs.size());
+	for (auto &&c: refs) {
+		out.push_back({c.id, DocumentDB::serializeStrRev(c.rev)});
+	}
+	return out;
+}
+
+static std::vector<IReplicationProtocol::DocRef> json2docRefs(const Value &v) {
+	std::vector<IReplicationProtocol::DocRef> out;
+	out.reserve(v.size());
+	for (Value c: v) {
+		std::string_view id = c[0].getString();
+		std::string_view rev = c[1].getString();
+		out.push_back(IReplicationProtocol::DocRef(std::string(id), DocumentDB::parseStrRev(rev)));
+	}
+	return out;
+}
+
+static Value docList2json(const IReplicationProtocol::DocumentList &docs) {
+	Array out;
+	out.reserve(docs.size());
+	for (auto &&c: docs) out.push_back(c);
+	return out;
+}
+
+static std::vector<Value> json2docList(const Value &v) {
+	std::vector<Value> out;
+	out.reserve(v.size());
+	for (Value c: v) out.push_back(c);
+	return out;
+}
+
+static Value status2json(const IReplicationProtocol::PutStatusList &st) {
+	Array out;
+	out.reserve(st.size());
+	for (auto &&c: st) out.push_back(static_cast<int>(c));
+	return out;
+}
+
+static std::vector<PutStatus> json2status(const Value &v) {
+	std::vector<PutStatus> out;
+	out.reserve(v.size());
+	for (Value c: v) out.push_back(static_cast<PutStatus>(c.getInt()));
+	return out;
+}
+
+void ReplicationTcpFrame::serialize(Type type, std::uint32_t stream, const json::Value &payload, bool compress, std::string &out) {
+	std::size_t start = out.size();
+	out.resize(start+headerSize);
+	payload.serializeBinary(JsonTarget(out), compress?json::compressKeys:0);
+	putUInt32(out, start, static_cast<std::uint32_t>(out.size() - start - headerSize));
+	putUInt32(out, start+4, stream);
+	out[start+8] = static_cast<char>(type);
+	out[start+9] = static_cast<char>(compress?compressed:0);
+}
+
+ReplicationTcpSocket::ReplicationTcpSocket(int fd):fd(fd),compress(false) {
+	int flag = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+ReplicationTcpSocket::~ReplicationTcpSocket() {
+	::close(fd);
+}
+
+std::shared_ptr<ReplicationTcpSocket> ReplicationTcpSocket::connect(const std::string &host, const std::string &port) {
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *res = nullptr;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return nullptr;
+	std::shared_ptr<ReplicationTcpSocket> out;
+	for (addrinfo *p = res; p && out == nullptr; p = p->ai_next) {
+		int s = ::socket(p->ai_family, p->ai_socktype|SOCK_CLOEXEC, p->ai_protocol);
+		if (s < 0) continue;
+		if (::connect(s, p->ai_addr, p->ai_addrlen) == 0) {
+			out = std::make_shared<ReplicationTcpSocket>(s);
+		} else {
+			::close(s);
+		}
+	}
+	freeaddrinfo(res);
+	return out;
+}
+
+bool ReplicationTcpSocket::readAll(char *buff, std::size_t size) {
+	while (size) {
+		int r = ::recv(fd, buff, size, 0);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		buff += r;
+		size -= r;
+	}
+	return true;
+}
+
+bool ReplicationTcpSocket::writeAll(const char *buff, std::size_t size) {
+	while (size) {
+		int r = ::send(fd, buff, size, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) {
+			//wake up the reader, connection is broken
+			shutdown();
+			return false;
+		}
+		buff += r;
+		size -= r;
+	}
+	return true;
+}
+
+bool ReplicationTcpSocket::readFrame(ReplicationTcpFrame &frame) {
+	char hdr[ReplicationTcpFrame::headerSize];
+	if (!readAll(hdr, sizeof(hdr))) return false;
+	std::uint32_t len = getUInt32(hdr);
+	if (len > ReplicationTcpFrame::maxPayload) return false;
+	frame.stream = getUInt32(hdr+4);
+	frame.type = static_cast<ReplicationTcpFrame::Type>(hdr[8]);
+	frame.flags = static_cast<unsigned char>(hdr[9]);
+	rdbuff.resize(len);
+	if (!readAll(rdbuff.data(), len)) return false;
+	std::string_view src(rdbuff);
+	try {
+		frame.payload = Value::parseBinary(JsonSource(src), base64);
+	} catch (std::exception &e) {
+		logWarning("Replication: invalid frame - $1", e.what());
+		return false;
+	}
+	return true;
+}
+
+bool ReplicationTcpSocket::writeFrame(ReplicationTcpFrame::Type type, std::uint32_t stream, const json::Value &payload) {
+	std::string buff;
+	ReplicationTcpFrame::serialize(type, stream, payload, compress, buff);
+	return writeFrame(buff);
+}
+
+bool ReplicationTcpSocket::writeFrame(const std::string_view &frame) {
+	std::lock_guard<std::mutex> _(wrlock);
+	return writeAll(frame.data(), frame.size());
+}
+
+void ReplicationTcpSocket::shutdown() {
+	::shutdown(fd, SHUT_RDWR);
+}
+
+ReplicationTcpClient::ReplicationTcpClient(const std::string &host, const std::string &port, const std::string &dbname, const Config &cfg)
+	:host(host),port(port),dbname(dbname),cfg(cfg) {
+	reader = std::thread([this]{readerThread();});
+}
+
+ReplicationTcpClient::~ReplicationTcpClient() {
+	Sync _(lock);
+	exitFlag = true;
+	PReplicationTcpSocket c = conn;
+	cond.notify_all();
+	_.unlock();
+	if (c) c->shutdown();
+	reader.join();
+}
+
+ReplicationTcpClient *ReplicationTcpClient::create(const json::Value &def) {
+	std::string_view url = def.getString();
+	std::string_view prefix = "sofadb://";
+	if (url.substr(0,prefix.size()) != prefix) return nullptr;
+	url = url.substr(prefix.size());
+	auto sep = url.find('/');
+	if (sep == url.npos) return nullptr;
+	std::string_view addr = url.substr(0,sep);
+	std::string_view db = url.substr(sep+1);
+	auto colon = addr.rfind(':');
+	if (colon == addr.npos || db.empty()) return nullptr;
+	std::string_view host = addr.substr(0,colon);
+	//IPv6 in brackets [::1]:port
+	if (host.size() > 1 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size()-2);
+	return new ReplicationTcpClient(std::string(host), std::string(addr.substr(colon+1)), std::string(db), Config());
+}
+
+void ReplicationTcpClient::warning(int code, std::string &&msg) {
+	Sync _(lock);
+	WarningCallback cb = wcb;
+	_.unlock();
+	if (cb) cb(code, std::move(msg));
+}
+
+PReplicationTcpSocket ReplicationTcpClient::connect() {
+	PReplicationTcpSocket s = ReplicationTcpSocket::connect(host, port);
+	if (s == nullptr) {
+		warning(503, "Unable to connect "+host+":"+port);
+		return nullptr;
+	}
+	if (!s->writeFrame(ReplicationTcpFrame::hello, 0, Object
+			("db", dbname)
+			("version", protocolVersion)
+			("compress", cfg.compress))) {
+		warning(503, "Connection lost during handshake");
+		return nullptr;
+	}
+	ReplicationTcpFrame resp;
+	if (!s->readFrame(resp)) {
+		warning(503, "Connection lost during handshake");
+		return nullptr;
+	}
+	if (resp.type != ReplicationTcpFrame::response) {
+		std::string_view msg = resp.payload["message"].getString();
+		warning(resp.payload["code"].getUInt(), std::string(msg));
+		return nullptr;
+	}
+	s->setCompress(resp.payload["compress"].getBool());
+	return s;
+}
+
+void ReplicationTcpClient::readerThread() {
+	Sync _(lock);
+	while (!exitFlag) {
+		_.unlock();
+		PReplicationTcpSocket s = connect();
+		_.lock();
+		if (s == nullptr) {
+			cond.wait_for(_, std::chrono::milliseconds(cfg.reconnect_delay), [&]{return exitFlag;});
+			continue;
+		}
+		if (exitFlag) break;
+		//requests made while the connection was down, or lost with the previous connection
+		std::vector<std::string> resend;
+		for (auto &&c: pending) resend.push_back(c.second.frame);
+		conn = s;
+		_.unlock();
+		for (auto &&c: resend) s->writeFrame(c);
+		ReplicationTcpFrame frame;
+		while (s->readFrame(frame)) {
+			_.lock();
+			auto iter = pending.find(frame.stream);
+			if (iter == pending.end()) {
+				//canceled request
+				_.unlock();
+				continue;
+			}
+			ResponseCB cb = std::move(iter->second.cb);
+			inflight -= iter->second.frame.size();
+			pending.erase(iter);
+			cond.notify_all();
+			ondra_shared::CountdownGuard g(cbcnt);
+			_.unlock();
+			if (frame.type == ReplicationTcpFrame::response) {
+				cb(frame.payload);
+			} else {
+				std::string_view msg = frame.payload["message"].getString();
+				warning(frame.payload["code"].getUInt(), std::string(msg));
+				cb(Value());
+			}
+		}
+		_.lock();
+		conn = nullptr;
+		if (!exitFlag) {
+			_.unlock();
+			warning(503, "Connection lost "+host+":"+port);
+			_.lock();
+		}
+	}
+}
+
+void ReplicationTcpClient::request(ReplicationTcpFrame::Type type, const json::Value &payload, ResponseCB &&cb) {
+	std::string frame;
+	Sync _(lock);
+	std::uint32_t stream = nextStream++;
+	if (nextStream == 0) nextStream = 1;
+	ReplicationTcpFrame::serialize(type, stream, payload, cfg.compress, frame);
+	std::size_t sz = frame.size();
+	//callbacks are called from the reader, it must not wait, otherwise it would block itself
+	if (std::this_thread::get_id() != reader.get_id()) {
+		cond.wait(_, [&]{return exitFlag || inflight == 0 || inflight + sz <= cfg.window;});
+	}
+	if (exitFlag) {
+		_.unlock();
+		cb(Value());
+		return;
+	}
+	inflight += sz;
+	PReplicationTcpSocket c = conn;
+	std::string_view data = pending.emplace(stream, Request{type, std::move(frame), std::move(cb)}).first->second.frame;
+	//when disconnected, the request is sent after reconnect
+	if (c) {
+		std::string cpy(data);
+		_.unlock();
+		c->writeFrame(cpy);
+	}
+}
+
+void ReplicationTcpClient::readManifest(SeqNum since, std::size_t limit,
+		json::Value filter, bool longpoll,
+		std::function<void(const Manifest&, SeqNum)>&& result) {
+	request(ReplicationTcpFrame::readManifest, {since, limit, filter, longpoll},
+			[result = std::move(result)](const Value &resp) {
+		if (!resp.defined()) {
+			result(Manifest(), IReplicationProtocol::error);
+		} else {
+			auto refs = json2docRefs(resp[1]);
+			result(Manifest(refs.data(), refs.size()), resp[0].getUInt());
+		}
+	});
+}
+
+void ReplicationTcpClient::downloadDocs(const DownloadRequest& dwreq,
+		std::function<void(const DocumentList&)>&& callback) {
+	request(ReplicationTcpFrame::downloadDocs, docRefs2json(dwreq),
+			[callback = std::move(callback)](const Value &resp) {
+		auto docs = json2docList(resp);
+		callback(DocumentList(docs.data(), docs.size()));
+	});
+}
+
+void ReplicationTcpClient::downloadDocs(const DownloadTopRequest& dwreq,
+		std::function<void(const DocumentList&)>&& callback) {
+	Array ids;
+	ids.reserve(dwreq.size());
+	for (auto &&c: dwreq) ids.push_back(c);
+	request(ReplicationTcpFrame::downloadTopDocs, ids,
+			[callback = std::move(callback)](const Value &resp) {
+		auto docs = json2docList(resp);
+		callback(DocumentList(docs.data(), docs.size()));
+	});
+}
+
+void ReplicationTcpClient::sendManifest(const Manifest& manifest,
+		std::function<void(const DownloadRequest&)>&& callback) {
+	Value req = docRefs2json(manifest);
+	request(ReplicationTcpFrame::sendManifest, req,
+			[callback = std::move(callback), req](const Value &resp) {
+		//on error, request whole manifest - the download reports the error
+		auto refs = json2docRefs(resp.defined()?resp:req);
+		callback(DownloadRequest(refs.data(), refs.size()));
+	});
+}
+
+void ReplicationTcpClient::uploadDocs(const DocumentList& documents,
+		std::function<void(const PutStatusList&)>&& callback) {
+	request(ReplicationTcpFrame::uploadDocs, docList2json(documents),
+			[callback = std::move(callback)](const Value &resp) {
+		auto st = json2status(resp);
+		callback(PutStatusList(st.data(), st.size()));
+	});
+}
+
+void ReplicationTcpClient::uploadHistoricalDocs(const DocumentList& documents,
+		std::function<void(const PutStatusList&)>&& callback) {
+	request(ReplicationTcpFrame::uploadHistoricalDocs, docList2json(documents),
+			[callback = std::move(callback)](const Value &resp) {
+		auto st = json2status(resp);
+		callback(PutStatusList(st.data(), st.size()));
+	});
+}
+
+void ReplicationTcpClient::resolveConflicts(const DocumentList& documents,
+		std::function<void(const DocumentList&)>&& callback) {
+	request(ReplicationTcpFrame::resolveConflicts, docList2json(documents),
+			[callback = std::move(callback)](const Value &resp) {
+		auto docs = json2docList(resp);
+		callback(DocumentList(docs.data(), docs.size()));
+	});
+}
+
+void ReplicationTcpClient::openSnapshot(std::function<void(SeqNum)> &&callback) {
+	request(ReplicationTcpFrame::openSnapshot, nullptr,
+			[callback = std::move(callback)](const Value &resp) {
+		callback(resp.defined()?resp.getUInt():IReplicationProtocol::error);
+	});
+}
+
+void ReplicationTcpClient::readDocRange(const std::string &start_after, std::size_t limit, json::Value filter,
+		std::function<void(const DocRange &)> &&callback) {
+	request(ReplicationTcpFrame::readDocRange, {start_after, limit, filter},
+			[callback = std::move(callback)](const Value &resp) {
+		DocRange r;
+		if (!resp.defined()) {
+			r.error = true;
+			callback(r);
+		} else {
+			auto docs = json2docList(resp[0]);
+			auto history = json2docList(resp[1]);
+			std::string_view last = resp[2].getString();
+			r.docs = DocumentList(docs.data(), docs.size());
+			r.history = DocumentList(history.data(), history.size());
+			r.last = last;
+			r.more = resp[3].getBool();
+			callback(r);
+		}
+	});
+}
+
+void ReplicationTcpClient::closeSnapshot() {
+	Sync _(lock);
+	PReplicationTcpSocket c = conn;
+	_.unlock();
+	//lost connection releases the snapshot as well
+	if (c) c->writeFrame(ReplicationTcpFrame::closeSnapshot, 0, nullptr);
+}
+
+void ReplicationTcpClient::uploadSortedDocs(const DocumentList &documents, const DocumentList &history,
+		std::function<void(const PutStatusList &)> &&callback) {
+	request(ReplicationTcpFrame::uploadSortedDocs, {docList2json(documents), docList2json(history)},
+			[callback = std::move(callback)](const Value &resp) {
+		auto st = json2status(resp);
+		callback(PutStatusList(st.data(), st.size()));
+	});
+}
+
+void ReplicationTcpClient::stop() {
+	std::map<std::uint32_t, Request> canceled;
+	Sync _(lock);
+	std::swap(canceled, pending);
+	inflight = 0;
+	cond.notify_all();
+	PReplicationTcpSocket c = conn;
+	_.unlock();
+	//callbacks are destroyed without calling
+	canceled.clear();
+	if (c) c->writeFrame(ReplicationTcpFrame::stop, 0, nullptr);
+	if (std::this_thread::get_id() != reader.get_id()) cbcnt.wait();
+}
+
+void ReplicationTcpClient::setWarningCallback(WarningCallback &&callback) {
+	Sync _(lock);
+	wcb = std::move(callback);
+}
+
+class ReplicationTcpListener::Connection: public std::enable_shared_from_this<Connection> {
+public:
+	Connection(ReplicationTcpListener &owner, PReplicationTcpSocket sock, std::string peer)
+		:owner(owner),sock(sock),peer(std::move(peer)) {}
+
+	void run();
+	void close() {sock->shutdown();}
+
+protected:
+	using PServer = std::shared_ptr<ReplicationServer>;
+	using Manifest = IReplicationProtocol::Manifest;
+	using DownloadRequest = IReplicationProtocol::DownloadRequest;
+	using DownloadTopRequest = IReplicationProtocol::DownloadTopRequest;
+	using DocumentList = IReplicationProtocol::DocumentList;
+	using PutStatusList = IReplicationProtocol::PutStatusList;
+	using DocRange = IReplicationProtocol::DocRange;
+	using Sync = std::unique_lock<std::mutex>;
+
+	ReplicationTcpListener &owner;
+	PReplicationTcpSocket sock;
+	///address of the peer
+	std::string peer;
+	PServer server;
+	DatabaseCore::Handle h = DatabaseCore::invalid_handle;
+	///last stored checkpoint of the peer
+	SeqNum checkpoint = 0;
+	std::mutex lock;
+	std::condition_variable cond;
+	std::size_t active = 0;
+
+	bool hello(const ReplicationTcpFrame &frame);
+	void process(const PServer &srv, const ReplicationTcpFrame &frame);
+	void storeCheckpoint(SeqNum since);
+	void respond(std::uint32_t stream, const Value &payload) {
+		sock->writeFrame(ReplicationTcpFrame::response, stream, payload);
+	}
+	void error(std::uint32_t stream, int code, const std::string_view &msg) {
+		sock->writeFrame(ReplicationTcpFrame::error, stream, Object("code", code)("message", StrViewA(msg)));
+	}
+};
+
+bool ReplicationTcpListener::Connection::hello(const ReplicationTcpFrame &frame) {
+	if (frame.type != ReplicationTcpFrame::hello) {
+		error(frame.stream, 400, "Hello expected");
+		return false;
+	}
+	if (frame.payload["version"].getInt() != protocolVersion) {
+		error(frame.stream, 505, "Unsupported version");
+		return false;
+	}
+	std::string_view dbname = frame.payload["db"].getString();
+	if (!dbname.empty() && dbname[0] == '_') {
+		error(frame.stream, 403, "System database can't be replicated");
+		return false;
+	}
+	h = owner.docdb.getDBCore().getHandle(dbname);
+	if (h == DatabaseCore::invalid_handle) {
+		error(frame.stream, 404, "Database not found");
+		return false;
+	}
+	bool compress = frame.payload["compress"].getBool();
+	sock->setCompress(compress);
+	server = std::make_shared<ReplicationServer>(owner.docdb, owner.router, h);
+	respond(frame.stream, Object("version", protocolVersion)("compress", compress));
+	return true;
+}
+
+void ReplicationTcpListener::Connection::run() {
+	ReplicationTcpFrame frame;
+	if (!sock->readFrame(frame) || !hello(frame)) return;
+	while (sock->readFrame(frame)) {
+		if (frame.type == ReplicationTcpFrame::stop) {
+			//stopped server cannot be reused (longpoll is disabled), create new one
+			PServer old = std::move(server);
+			old->stop();
+			server = std::make_shared<ReplicationServer>(owner.docdb, owner.router, h);
+			continue;
+		}
+		if (frame.type == ReplicationTcpFrame::closeSnapshot) {
+			server->closeSnapshot();
+			continue;
+		}
+		Sync _(lock);
+		cond.wait(_, [&]{return active < maxActiveRequests;});
+		++active;
+		_.unlock();
+		owner.worker >> [me = shared_from_this(), srv = server, frame, g = ondra_shared::CountdownGuard(owner.cntd)] {
+			me->process(srv, frame);
+			Sync _(me->lock);
+			--me->active;
+			me->cond.notify_all();
+		};
+	}
+	Sync _(lock);
+	cond.wait(_, [&]{return active == 0;});
+	_.unlock();
+	server->stop();
+}
+
+void ReplicationTcpListener::Connection::storeCheckpoint(SeqNum since) {
+	//peer has seen all changes up to since, tombstones above it must not be purged
+	//(see MaintenanceTask). Peers are identified by the address
+	{
+		Sync _(lock);
+		if (since == checkpoint) return;
+		checkpoint = since;
+	}
+	owner.docdb.getDBCore().storeCheckpoint(h, "tcp:" + peer, since);
+}
+
+void ReplicationTcpListener::Connection::process(const PServer &srv, const ReplicationTcpFrame &frame) {
+	std::uint32_t stream = frame.stream;
+	const Value &args = frame.payload;
+	auto me = shared_from_this();
+	try {
+		switch (frame.type) {
+		case ReplicationTcpFrame::readManifest:
+			storeCheckpoint(args[0].getUInt());
+			srv->readManifest(args[0].getUInt(), args[1].getUInt(), args[2], args[3].getBool(),
+					[me, stream](const Manifest &m, SeqNum seq) {
+				if (seq == IReplicationProtocol::error) me->error(stream, 500, "Unable to read manifest");
+				else me->respond(stream, {seq, docRefs2json(m)});
+			});
+			break;
+		case ReplicationTcpFrame::downloadDocs: {
+				auto refs = json2docRefs(args);
+				srv->downloadDocs(DownloadRequest(refs.data(), refs.size()), [me, stream](const DocumentList &docs) {
+					me->respond(stream, docList2json(docs));
+				});
+			} break;
+		case ReplicationTcpFrame::downloadTopDocs: {
+				std::vector<std::string> ids;
+				ids.reserve(args.size());
+				for (Value c: args) ids.push_back(std::string(std::string_view(c.getString())));
+				srv->downloadDocs(DownloadTopRequest(ids.data(), ids.size()), [me, stream](const DocumentList &docs) {
+					me->respond(stream, docList2json(docs));
+				});
+			} break;
+		case ReplicationTcpFrame::sendManifest: {
+				auto refs = json2docRefs(args);
+				srv->sendManifest(Manifest(refs.data(), refs.size()), [me, stream](const DownloadRequest &req) {
+					me->respond(stream, docRefs2json(req));
+				});
+			} break;
+		case ReplicationTcpFrame::uploadDocs: {
+				auto docs = json2docList(args);
+				srv->uploadDocs(DocumentList(docs.data(), docs.size()), [me, stream](const PutStatusList &st) {
+					me->respond(stream, status2json(st));
+				});
+			} break;
+		case ReplicationTcpFrame::uploadHistoricalDocs: {
+				auto docs = json2docList(args);
+				srv->uploadHistoricalDocs(DocumentList(docs.data(), docs.size()), [me, stream](const PutStatusList &st) {
+					me->respond(stream, status2json(st));
+				});
+			} break;
+		case ReplicationTcpFrame::resolveConflicts: {
+				auto docs = json2docList(args);
+				srv->resolveConflicts(DocumentList(docs.data(), docs.size()), [me, stream](const DocumentList &res) {
+					me->respond(stream, docList2json(res));
+				});
+			} break;
+		case ReplicationTcpFrame::openSnapshot:
+			srv->openSnapshot([me, stream](SeqNum seq) {
+				if (seq == IReplicationProtocol::error) me->error(stream, 500, "Unable to open snapshot");
+				else me->respond(stream, seq);
+			});
+			break;
+		case ReplicationTcpFrame::readDocRange: {
+				std::string_view after = args[0].getString();
+				srv->readDocRange(std::string(after), args[1].getUInt(), args[2], [me, stream](const DocRange &r) {
+					if (r.error) me->error(stream, 500, "Unable to read documents");
+					else me->respond(stream, {docList2json(r.docs), docList2json(r.history), r.last, r.more});
+				});
+			} break;
+		case ReplicationTcpFrame::uploadSortedDocs: {
+				auto docs = json2docList(args[0]);
+				auto history = json2docList(args[1]);
+				srv->uploadSortedDocs(DocumentList(docs.data(), docs.size()), DocumentList(history.data(), history.size()),
+						[me, stream](const PutStatusList &st) {
+					me->respond(stream, status2json(st));
+				});
+			} break;
+		default:
+			error(stream, 400, "Unknown request");
+			break;
+		}
+	} catch (std::exception &e) {
+		error(stream, 500, e.what());
+	}
+}
+
+ReplicationTcpListener::ReplicationTcpListener(DocumentDB &docdb, PEventRouter router, Worker worker)
+	:docdb(docdb),router(router),worker(worker),exitFlag(false) {
+}
+
+ReplicationTcpListener::~ReplicationTcpListener() {
+	stop();
+}
+
+static bool parseAddr(const std::string &str, unsigned char *addr) {
+	in_addr a4;
+	if (inet_pton(AF_INET, str.c_str(), &a4) == 1) {
+		std::memset(addr, 0, 10);
+		addr[10] = addr[11] = 0xFF;
+		std::memcpy(addr+12, &a4, 4);
+		return true;
+	}
+	return inet_pton(AF_INET6, str.c_str(), addr) == 1;
+}
+
+void ReplicationTcpListener::setAllowList(const std::vector<std::string> &allow) {
+	std::vector<AllowedNet> nets;
+	bool all = false;
+	for (auto &&item: allow) {
+		if (item == "*") {
+			all = true;
+			continue;
+		}
+		AllowedNet n;
+		auto sep = item.find('/');
+		std::string addr = item.substr(0, sep);
+		if (!parseAddr(addr, n.addr)) throw std::invalid_argument("Replication listener: invalid address "+item);
+		bool v4 = addr.find(':') == addr.npos;
+		n.bits = 128;
+		if (sep != item.npos) {
+			char *end;
+			unsigned long bits = std::strtoul(item.c_str()+sep+1, &end, 10);
+			if (*end || end == item.c_str()+sep+1 || bits > (v4?32:128))
+				throw std::invalid_argument("Replication listener: invalid prefix length "+item);
+			n.bits = static_cast<unsigned int>(v4?bits+96:bits);
+		}
+		nets.push_back(n);
+	}
+	Sync _(lock);
+	allowList = std::move(nets);
+	allowAll = all;
+}
+
+bool ReplicationTcpListener::isAllowed(const sockaddr_storage &addr) const {
+	if (allowAll) return true;
+	unsigned char a[16];
+	if (addr.ss_family == AF_INET) {
+		const sockaddr_in &in = reinterpret_cast<const sockaddr_in &>(addr);
+		std::memset(a, 0, 10);
+		a[10] = a[11] = 0xFF;
+		std::memcpy(a+12, &in.sin_addr, 4);
+	} else if (addr.ss_family == AF_INET6) {
+		const sockaddr_in6 &in6 = reinterpret_cast<const sockaddr_in6 &>(addr);
+		std::memcpy(a, &in6.sin6_addr, 16);
+	} else {
+		return false;
+	}
+	auto match = [&](const unsigned char *net, unsigned int bits) {
+		unsigned int i = 0;
+		for (; bits >= 8; i++, bits -= 8) if (a[i] != net[i]) return false;
+		return bits == 0 || ((a[i] ^ net[i]) & (0xFF00 >> bits) & 0xFF) == 0;
+	};
+	if (allowList.empty()) {
+		//loopback only - 127.0.0.0/8 and ::1
+		static const unsigned char lo4[16] = {0,0,0,0,0,0,0,0,0,0,0xFF,0xFF,127,0,0,0};
+		static const unsigned char lo6[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1};
+		return match(lo4, 104) || match(lo6, 128);
+	}
+	for (auto &&n: allowList) if (match(n.addr, n.bits)) return true;
+	return false;
+}
+
+void ReplicationTcpListener::start(const std::string &host, const std::string &port) {
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo *res = nullptr;
+	//the protocol is not authenticated, so the loopback is bound unless all interfaces are requested
+	int e = getaddrinfo(host == "*"?nullptr:host.empty()?"localhost":host.c_str(), port.c_str(), &hints, &res);
+	if (e) throw std::runtime_error(std::string("Replication listener: ")+gai_strerror(e));
+	int s = -1;
+	e = 0;
+	for (addrinfo *p = res; p && s < 0; p = p->ai_next) {
+		s = ::socket(p->ai_family, p->ai_socktype|SOCK_CLOEXEC, p->ai_protocol);
+		if (s < 0) {e = errno;continue;}
+		int flag = 1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+		if (::bind(s, p->ai_addr, p->ai_addrlen) != 0 || ::listen(s, SOMAXCONN) != 0) {
+			e = errno;
+			::close(s);
+			s = -1;
+		}
+	}
+	freeaddrinfo(res);
+	if (s < 0) throw std::system_error(e, std::generic_category(), "Replication listener: "+host+":"+port);
+	listenfd = s;
+	exitFlag = false;
+	acceptThread = std::thread([this]{acceptWorker();});
+}
+
+void ReplicationTcpListener::acceptWorker() {
+	while (!exitFlag) {
+		sockaddr_storage addr = {};
+		socklen_t addrlen = sizeof(addr);
+		int s = ::accept4(listenfd, reinterpret_cast<sockaddr *>(&addr), &addrlen, SOCK_CLOEXEC);
+		if (s < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (!exitFlag) logWarning("Replication listener: accept failed - $1", strerror(errno));
+			break;
+		}
+		char name[NI_MAXHOST];
+		if (getnameinfo(reinterpret_cast<sockaddr *>(&addr), addrlen, name, sizeof(name), nullptr, 0, NI_NUMERICHOST) != 0)
+			name[0] = 0;
+		Sync _(lock);
+		if (!isAllowed(addr)) {
+			_.unlock();
+			logWarning("Replication listener: connection from $1 rejected - not in the allow list", name);
+			::close(s);
+			continue;
+		}
+		if (exitFlag) {
+			::close(s);
+			break;
+		}
+		PConnection conn = std::make_shared<Connection>(*this, std::make_shared<ReplicationTcpSocket>(s), name);
+		connections.push_back(conn);
+		std::thread([this, conn, g = ondra_shared::CountdownGuard(cntd)]{
+			conn->run();
+			closed(conn.get());
+		}).detach();
+	}
+}
+
+void ReplicationTcpListener::closed(Connection *conn) {
+	Sync _(lock);
+	connections.remove_if([&](const PConnection &c){return c.get() == conn;});
+}
+
+void ReplicationTcpListener::stop() {
+	if (listenfd < 0) return;
+	exitFlag = true;
+	::shutdown(listenfd, SHUT_RDWR);
+	acceptThread.join();
+	::close(listenfd);
+	listenfd = -1;
+	Sync _(lock);
+	for (auto &&c: connections) c->close();
+	_.unlock();
+	//waits for connections and requests being processed
+	cntd.wait();
+}
+
+} /* namespace sofadb */
@@ -0,0 +1,317 @@
+/*
+ * replicationtcp.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_LIBSOFA_REPLICATIONTCP_H_
+#define SRC_LIBSOFA_REPLICATIONTCP_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <shared/countdown.h>
+#include <shared/worker.h>
+#include "docdb.h"
+#include "eventrouter.h"
+#include "replication.h"
+#include "replicationserver.h"
+
+namespace sofadb {
+
+using ondra_shared::Worker;
+
+///Frame of the TCP replication protocol
+/** Every frame starts with 10 bytes header followed by the payload
+ *
+ * - 4 bytes - length of the payload (big endian)
+ * - 4 bytes - stream id (big endian) - request and its response share the same id
+ * - 1 byte - type of the frame (see Type)
+ * - 1 byte - flags (see Flags)
+ *
+ * The payload is value serialized by imtjson binary serialization. Multiple requests
+ * can be in flight on single connection, responses are delivered in any order.
+ *
+ * The first request on the connection must be hello: {"db":name,"version":1,"compress":bool},
+ * the server responds {"version":1,"compress":bool}. Then all other requests are related
+ * to the selected database
+ */
+class ReplicationTcpFrame {
+public:
+	enum Type: unsigned char {
+		hello = 1,
+		///[since, limit, filter, longpoll] -> [seqnum, [[id,rev],...]]
+		readManifest = 2,
+		///[[id,rev],...] -> [doc,...]
+		downloadDocs = 3,
+		///[id,...] -> [doc,...]
+		downloadTopDocs = 4,
+		///[[id,rev],...] -> [[id,rev],...]
+		sendManifest = 5,
+		///[doc,...] -> [status,...]
+		uploadDocs = 6,
+		///[doc,...] -> [status,...]
+		uploadHistoricalDocs = 7,
+		///[doc,...] -> [doc,...]
+		resolveConflicts = 8,
+		///stops all running operations (no response)
+		stop = 9,
+		///null -> seqnum
+		openSnapshot = 10,
+		///[start_after, limit, filter] -> [[doc,...], [doc,...], last, more]
+		readDocRange = 11,
+		///releases snapshot (no response)
+		closeSnapshot = 12,
+		///[[doc,...],[doc,...]] -> [status,...]
+		uploadSortedDocs = 13,
+		///response to request
+		response = 0x80,
+		///error response {"code":number,"message":string}
+		error = 0x81,
+	};
+
+	enum Flags: unsigned char {
+		///keys in the payload are compressed
+		compressed = 1
+	};
+
+	static const std::size_t headerSize = 10;
+	static const std::size_t maxPayload = 256*1024*1024;
+
+	Type type;
+	unsigned char flags;
+	std::uint32_t stream;
+	json::Value payload;
+
+	///Serializes the frame
+	/**
+	 * @param type type of the frame
+	 * @param stream stream id
+	 * @param payload payload
+	 * @param compress compress keys
+	 * @param out buffer, the frame is appended
+	 */
+	static void serialize(Type type, std::uint32_t stream, const json::Value &payload, bool compress, std::string &out);
+};
+
+///Connection of the TCP replication protocol
+/** Reading must be done from a single thread, writing is MT safe */
+class ReplicationTcpSocket {
+public:
+	ReplicationTcpSocket(int fd);
+	~ReplicationTcpSocket();
+
+	///Connects to the server
+	/**
+	 * @param host host
+	 * @param port port
+	 * @return connected socket or nullptr
+	 */
+	static std::shared_ptr<ReplicationTcpSocket> connect(const std::string &host, const std::string &port);
+
+	///Reads frame
+	/**
+	 * @param frame receives the frame
+	 * @retval true success
+	 * @retval false connection closed or error
+	 */
+	bool readFrame(ReplicationTcpFrame &frame);
+	///Writes frame
+	/**
+	 * @retval true success
+	 * @retval false connection closed or error
+	 */
+	bool writeFrame(ReplicationTcpFrame::Type type, std::uint32_t stream, const json::Value &payload);
+	///Writes serialized frame
+	bool writeFrame(const std::string_view &frame);
+	///Enables compression of outgoing frames
+	void setCompress(bool c) {compress = c;}
+	bool isCompress() const {return compress;}
+	///Closes connection - pending read is interrupted
+	void shutdown();
+
+protected:
+	int fd;
+	std::mutex wrlock;
+	std::atomic<bool> compress;
+	std::string rdbuff;
+
+	bool readAll(char *buff, std::size_t size);
+	bool writeAll(const char *buff, std::size_t size);
+};
+
+using PReplicationTcpSocket = std::shared_ptr<ReplicationTcpSocket>;
+
+///Client side of the TCP replication protocol
+/** Connects to remote ReplicationTcpListener and works as replication protocol of the remote
+ * database. Connection is established at background. When connection is lost, the client
+ * reconnects and repeats unfinished requests (all requests are idempotent). Connection issues
+ * are reported as warnings.
+ *
+ * Flow control: total size of requests in flight is limited by the window. Requests
+ * above the window are blocked until responses of previous requests are received
+ */
+class ReplicationTcpClient: public IReplicationProtocol {
+public:
+
+	struct Config {
+		///maximum size of requests in flight in bytes
+		std::size_t window = 8*1024*1024;
+		///request compression of the keys
+		bool compress = true;
+		///delay between reconnect attempts in milliseconds
+		std::size_t reconnect_delay = 2000;
+	};
+
+	ReplicationTcpClient(const std::string &host, const std::string &port, const std::string &dbname, const Config &cfg);
+	~ReplicationTcpClient();
+
+	///Creates client from definition of the replication
+	/**
+	 * @param def definition - string in form "sofadb://host:port/database"
+	 * @return pointer to client, or nullptr if the definition is not recognized
+	 */
+	static ReplicationTcpClient *create(const json::Value &def);
+
+	virtual void readManifest(SeqNum since,
+			std::size_t limit,
+			json::Value filter,
+			bool longpoll,
+			std::function<void(const Manifest &, SeqNum)> &&result);
+	virtual void downloadDocs(const DownloadRequest &dwreq,
+			std::function<void(const DocumentList &)> &&callback);
+	virtual void downloadDocs(const DownloadTopRequest &dwreq,
+			std::function<void(const DocumentList &)> &&callback);
+	virtual void stop();
+	virtual void sendManifest(const Manifest &manifest,
+			std::function<void(const DownloadRequest &)> &&callback);
+	virtual void uploadDocs(const DocumentList &documents,
+			std::function<void(const PutStatusList &)> &&callback);
+	virtual void uploadHistoricalDocs(const DocumentList &documents,
+			std::function<void(const PutStatusList&)> &&callback);
+	virtual void resolveConflicts(const DocumentList &documents,
+				std::function<void(const DocumentList &)> &&callback);
+	virtual void setWarningCallback(WarningCallback &&callback);
+	virtual void openSnapshot(std::function<void(SeqNum)> &&callback);
+	virtual void readDocRange(const std::string &start_after, std::size_t limit, json::Value filter,
+			std::function<void(const DocRange &)> &&callback);
+	virtual void closeSnapshot();
+	virtual void uploadSortedDocs(const DocumentList &documents, const DocumentList &history,
+			std::function<void(const PutStatusList &)> &&callback);
+
+protected:
+	///Response callback - receives payload, or undefined on error
+	using ResponseCB = std::function<void(const json::Value &)>;
+
+	struct Request {
+		ReplicationTcpFrame::Type type;
+		std::string frame;
+		ResponseCB cb;
+	};
+
+	using Sync = std::unique_lock<std::mutex>;
+
+	std::string host, port, dbname;
+	Config cfg;
+
+	std::mutex lock;
+	std::condition_variable cond;
+	std::map<std::uint32_t, Request> pending;
+	std::uint32_t nextStream = 1;
+	std::size_t inflight = 0;
+	PReplicationTcpSocket conn;
+	bool exitFlag = false;
+	WarningCallback wcb;
+	ondra_shared::Countdown cbcnt;
+	std::thread reader;
+
+	void request(ReplicationTcpFrame::Type type, const json::Value &payload, ResponseCB &&cb);
+	void readerThread();
+	PReplicationTcpSocket connect();
+	void warning(int code, std::string &&msg);
+};
+
+///Server side of the TCP replication protocol
+/** Accepts connections and serves requests through ReplicationServer of the selected database.
+ * Requests are processed by the worker, so more requests of the connection can be processed
+ * at the same time. When too many requests are being processed, the connection is not read
+ * until some of the requests are finished (flow control)
+ *
+ * The protocol has no authentication. Every accepted peer can read and write any user
+ * database, so the listener binds the loopback by default and accepts only peers
+ * from the allow list. System databases (name starting by underscore) are not served
+ *
+ * Position of each peer's manifest reads is stored as a checkpoint "tcp:<address>" of
+ * the database, so tombstones are not purged before the peer sees them. The checkpoint
+ * of a peer which no longer replicates holds the purge until it is erased
+ * (see DatabaseCore::eraseCheckpoint)
+ */
+class ReplicationTcpListener {
+public:
+	ReplicationTcpListener(DocumentDB &docdb, PEventRouter router, Worker worker);
+	~ReplicationTcpListener();
+
+	///Sets addresses of the peers allowed to connect
+	/**
+	 * @param allow list of addresses or networks (address/prefix length), IPv4 or IPv6.
+	 * Item "*" allows every address. Connections from other addresses are closed
+	 * without response. Empty list allows loopback only (default)
+	 *
+	 * @exception std::invalid_argument invalid address
+	 */
+	void setAllowList(const std::vector<std::string> &allow);
+
+	///Starts listening
+	/**
+	 * @param host address to bind. Empty binds the loopback, "*" binds all interfaces
+	 * @param port port
+	 *
+	 * @exception std::system_error unable to bind or listen
+	 */
+	void start(const std::string &host, const std::string &port);
+	///Stops listening, closes all connections
+	void stop();
+
+	///maximum count of requests processed in parallel on single connection
+	static const std::size_t maxActiveRequests = 16;
+
+protected:
+	class Connection;
+	using PConnection = std::shared_ptr<Connection>;
+	using Sync = std::unique_lock<std::mutex>;
+
+	///allowed network, IPv4 addresses are stored as IPv4-mapped IPv6 addresses
+	struct AllowedNet {
+		unsigned char addr[16];
+		unsigned int bits;
+	};
+
+	DocumentDB docdb;
+	PEventRouter router;
+	Worker worker;
+	std::vector<AllowedNet> allowList;
+	bool allowAll = false;
+	int listenfd = -1;
+	std::thread acceptThread;
+	std::mutex lock;
+	std::list<PConnection> connections;
+	std::atomic<bool> exitFlag;
+	///counts connection threads and requests being processed
+	ondra_shared::Countdown cntd;
+
+	void acceptWorker();
+	void closed(Connection *conn);
+	bool isAllowed(const sockaddr_storage &addr) const;
+};
+
+} /* namespace sofadb */
+
+#endif /* SRC_LIBSOFA_REPLICATIONTCP_H_ */
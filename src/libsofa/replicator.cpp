@@ -61,7 +61,9 @@ void Replicator::worker() {
 		return true;
 
 	});
+	std::vector<PReplication> fin;
 	Sync _(lock);
+	std::swap(fin, finished);
 	if (exitWait) {
 		workerExit();
 	} else {
@@ -80,23 +82,38 @@ static void setError(Document &doc, int code, std::string_view text) {
 
 class Replicator::MyTask: public ReplicationTask  {
 public:
-	MyTask(Replicator &owner, std::string name, PProtocol &&source, PProtocol &&target)
+	MyTask(Replicator &owner, std::string name, PProtocol &&source, PProtocol &&target, Handle srcdb)
 			:ReplicationTask(std::move(source), std::move(target))
-			 , owner(owner),name(name),logObj("Replication "+name) {
+			 , owner(owner),name(name),logObj("Replication "+name),srcdb(srcdb) {
 		logObj.info("started");
 
 	}
+
+	///Stores checkpoint to the local source database, so tombstones are not purged before they are replicated
+	void storeCheckpoint(SeqNum seqnum) {
+		if (srcdb != DatabaseCore::invalid_handle)
+			owner.db.getDBCore().storeCheckpoint(srcdb, name, seqnum);
+	}
+
+	///Removes checkpoint from the local source database
+	void eraseCheckpoint() {
+		if (srcdb != DatabaseCore::invalid_handle)
+			owner.db.getDBCore().eraseCheckpoint(srcdb, name);
+	}
+
 	~MyTask() {
 		logObj.info("exiting");
 	}
 
 	virtual void onFinish(SeqNum seqnum) {
+		storeCheckpoint(seqnum);
 		owner.onFinish(name,seqnum);
 		logObj.info("finished");
 	}
 
 	virtual void onUpdate(SeqNum seqnum) {
-		owner.onUpdate(name,seqnum);
+		storeCheckpoint(seqnum);
+		owner.onUpdate(name,seqnum,getStats());
 		logObj.info("update $1", seqnum);
 	}
 	virtual void onWarning(Side side, int code, std::string &&msg) {
@@ -108,6 +125,7 @@ protected:
 	Replicator &owner;
 	std::string name;
 	LogObject logObj;
+	Handle srcdb;
 };
 
 void Replicator::update(Document doc) {
@@ -123,7 +141,12 @@ void Replicator::update(Document doc) {
 
 				PReplication &r = iter->second;
 				if (r->isRunning()) r->stop();
+				r->eraseCheckpoint();
 				replMap.erase(iter);
+			} else if (doc["source"].defined()) {
+				DatabaseCore &core = db.getDBCore();
+				Handle srcdb = core.getHandle(doc["source"].toString().str());
+				if (srcdb != DatabaseCore::invalid_handle) core.eraseCheckpoint(srcdb, name);
 			}
 		} else {
 			bool enabled = doc["enabled"].getBool();
@@ -149,6 +172,7 @@ void Replicator::update(Document doc) {
 					Value filter = doc["filter"];
 					SeqNum since = bootstrap?0LL:doc["since"].getUInt();
 					bool continuous = doc["continuous"].getBool();
+					task->storeCheckpoint(since);
 					task->start(since,filter,continuous);
 				}
 			} else if (running && !enabled) {
@@ -193,7 +217,23 @@ Replicator::PReplication Replicator::createTask(const std::string &name,Document
 	if (ptrg == nullptr) {
 		setError(doc, 2, "Unable to open target");return nullptr;
 	}
-	return PReplication ( new MyTask(*this,name,std::move(psrc), std::move(ptrg)) );
+	DatabaseCore &core = db.getDBCore();
+	Handle srcdb = core.getHandle(source.toString().str());
+	PReplication task ( new MyTask(*this,name,std::move(psrc), std::move(ptrg), srcdb) );
+	ReplicationTask::Config cfg = task->getConfig();
+	Value v = doc["pipeline"];
+	if (v.defined()) cfg.pipeline_depth = v.getUInt();
+	v = doc["batch"];
+	if (v.defined()) cfg.max_batch = v.getUInt();
+	v = doc["batch_time"];
+	if (v.defined()) cfg.target_time = v.getUInt();
+	v = doc["max_inflight"];
+	if (v.defined()) cfg.max_inflight_bytes = v.getUInt();
+	v = doc["initial_sync"];
+	if (v.defined()) cfg.initial_sync = v.getBool();
+	if (cfg.min_batch > cfg.max_batch) cfg.min_batch = cfg.max_batch;
+	task->setConfig(cfg);
+	return task;
 
 }
 
@@ -208,16 +248,26 @@ void Replicator::onFinish(const std::string& name, SeqNum seqnum) {
 	}
 
 	Sync _(lock);
-	replMap.erase(name);
+	auto iter = replMap.find(name);
+	if (iter != replMap.end()) {
+		finished.push_back(std::move(iter->second));
+		replMap.erase(iter);
+	}
 }
 
-void Replicator::onUpdate(const std::string& name, SeqNum seqnum) {
+void Replicator::onUpdate(const std::string& name, SeqNum seqnum, const ReplicationTask::Stats &stats) {
 	Value vdoc = db.get(h,name,OutputFormat::data);
 	if (vdoc != nullptr) {
 		Value tmp;
 		Document doc(vdoc);
 		doc.set("running",true);
 		doc.set("since", seqnum);
+		doc.set("stats", Object("batch", stats.batch_size)
+				("docs_per_sec", stats.docs_per_sec)
+				("bytes_per_sec", stats.bytes_per_sec)
+				("inflight_bytes", stats.inflight_bytes)
+				("docs", stats.docs)
+				("bytes", stats.bytes));
 		db.client_put(h,doc,tmp);
 	}
 }
@@ -11,6 +11,7 @@
 #include <mutex>
 #include <functional>
 #include <unordered_map>
+#include <vector>
 
 #include "eventrouter.h"
 #include "docdb.h"
@@ -24,16 +25,24 @@ namespace sofadb {
  *  data:{
  *   //user controlled fields
  *  	source: "name or url",
- *  	target: "name or url",
+ *  	target: "name or url", - url of remote database: sofadb://host:port/database
  *  	filter: {... filter definition ...},
  *  	since: seq_number, - this field is updated by replicator when replication is finished/stopped
  *  	continuous: true - to continuuos replication
- *  	batch: <size_of_batch> - default 1000 - only applies on external replication
+ *  	batch: <size_of_batch> - default 5000 - maximum size of the batch. The size is adjusted adaptively
+ *  	batch_time: <ms> - default 1000 - target time to transfer one batch
+ *  	max_inflight: <bytes> - default 32MB - maximum size of documents in flight
+ *  	pipeline: <count> - default 4 - count of batches in flight. Set 1 to disable pipelining
+ *  	initial_sync: true/false - default true - when since is zero, whole database is transfered from a snapshot
+ *  			ordered by document id, then the replication continues by changes
  *  	enabled: true/false - replication runs only if enabled is true
  *  //replicator controlled fields
  *		running: true - if replication is running. If this field is false, the replication finished.
  *		User must clear this field to restart replication
  *		error: { - last error description }
+ *		stats: { - current batch size and throughput
+ *			batch, docs_per_sec, bytes_per_sec, inflight_bytes, docs, bytes
+ *		}
  *
  *  }
  *
@@ -71,6 +80,8 @@ protected:
 	bool bootstrap = true;
 
 	ReplMap replMap;
+	///finished tasks - they are destroyed by the worker, because they can't be destroyed inside of own callback
+	std::vector<PReplication> finished;
 
 	void dispatchRequests();
 	void worker();
@@ -81,7 +92,7 @@ protected:
 	IReplicationProtocol *createProtocol(json::Value def);
 
 	void onFinish(const std::string &name,SeqNum seqnum);
-	void onUpdate(const std::string &name,SeqNum seqnum);
+	void onUpdate(const std::string &name,SeqNum seqnum, const ReplicationTask::Stats &stats);
 	void onWarning(const std::string &name,ReplicationTask::Side side, int code, std::string &&msg);
 
 
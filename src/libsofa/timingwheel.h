@@ -0,0 +1,173 @@
+/*
+ * timingwheel.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_LIBSOFA_TIMINGWHEEL_H_
+#define SRC_LIBSOFA_TIMINGWHEEL_H_
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+namespace sofadb {
+
+///Hierarchical timing wheel
+/** Stores timers identified by a key. Insert, remove and expiration of a timer are O(1).
+ * The wheel has 4 levels of 64 slots. The first level has resolution of one tick, every
+ * next level has 64x coarser resolution. Timers from the higher levels are moved to
+ * lower levels when the lower level wraps (cascading).
+ *
+ * Timers which are beyond range of the wheel (2^24 ticks) are placed to the last slot
+ * and rescheduled once they reach it.
+ *
+ * The class is not MT safe
+ *
+ * @tparam Key type of the key, must be hashable
+ */
+template<typename Key>
+class TimingWheel {
+public:
+	typedef std::uint64_t Tick;
+
+	static const unsigned int slotBits = 6;
+	static const unsigned int levels = 4;
+	static const Tick slotCount = Tick(1) << slotBits;
+	static const Tick slotMask = slotCount - 1;
+	static const Tick maxDelta = (Tick(1) << (slotBits * levels)) - 1;
+
+	///Construct the wheel
+	/**
+	 * @param start first tick to process
+	 */
+	TimingWheel(Tick start = 0):cur(start) {}
+
+	///Inserts timer
+	/**
+	 * @param key key of the timer. If the key already exists, the timer is rescheduled
+	 * @param expires tick when timer expires. If the tick is already processed, the timer
+	 * expires during next advance()
+	 */
+	void insert(const Key &key, Tick expires) {
+		remove(key);
+		auto r = entries.emplace(key, Entry{expires,0,0,{}});
+		place(r.first);
+	}
+
+	///Removes timer
+	/**
+	 * @param key key of the timer
+	 * @retval true removed
+	 * @retval false not found
+	 */
+	bool remove(const Key &key) {
+		auto iter = entries.find(key);
+		if (iter == entries.end()) return false;
+		slots[iter->second.level][iter->second.slot].erase(iter->second.pos);
+		entries.erase(iter);
+		return true;
+	}
+
+	///Processes all ticks up to given tick (including)
+	/**
+	 * @param now current tick
+	 * @param fn function called for every expired timer - void(const Key &). The timer
+	 * is already removed when function is called. The function must not modify the wheel
+	 */
+	template<typename Fn>
+	void advance(Tick now, Fn &&fn) {
+		if (entries.empty()) {
+			if (now >= cur) cur = now + 1;
+			return;
+		}
+		while (cur <= now) {
+			Tick idx = cur & slotMask;
+			if (idx == 0) cascade(1);
+			List fired;
+			fired.splice(fired.end(), slots[0][idx]);
+			while (!fired.empty()) {
+				auto iter = entries.find(fired.front());
+				fired.pop_front();
+				if (iter->second.expires > cur) {
+					//clamped timer, not yet expired
+					place(iter);
+				} else {
+					Key k = iter->first;
+					entries.erase(iter);
+					fn(k);
+				}
+			}
+			++cur;
+		}
+	}
+
+	///Removes all timers
+	void clear() {
+		entries.clear();
+		for (auto &&l: slots)
+			for (auto &&s: l) s.clear();
+	}
+
+	///Returns true, if there is no timer
+	bool empty() const {return entries.empty();}
+	///Returns count of timers
+	std::size_t size() const {return entries.size();}
+	///Returns next tick to process
+	Tick getNextTick() const {return cur;}
+
+protected:
+
+	typedef std::list<Key> List;
+
+	struct Entry {
+		Tick expires;
+		unsigned int level;
+		unsigned int slot;
+		typename List::iterator pos;
+	};
+
+	typedef std::unordered_map<Key, Entry> EntryMap;
+
+	EntryMap entries;
+	List slots[levels][slotCount];
+	Tick cur;
+
+	void place(typename EntryMap::iterator iter) {
+		Entry &e = iter->second;
+		Tick exp = e.expires;
+		if (exp < cur) exp = cur;
+		Tick delta = exp - cur;
+		if (delta > maxDelta) {
+			delta = maxDelta;
+			exp = cur + maxDelta;
+		}
+		unsigned int level = 0;
+		while (level + 1 < levels && delta >= (Tick(1) << (slotBits * (level + 1)))) ++level;
+		unsigned int slot = static_cast<unsigned int>((exp >> (slotBits * level)) & slotMask);
+		List &l = slots[level][slot];
+		e.level = level;
+		e.slot = slot;
+		e.pos = l.insert(l.end(), iter->first);
+	}
+
+	void cascade(unsigned int level) {
+		unsigned int idx = static_cast<unsigned int>((cur >> (slotBits * level)) & slotMask);
+		List tmp;
+		tmp.splice(tmp.end(), slots[level][idx]);
+		while (!tmp.empty()) {
+			auto iter = entries.find(tmp.front());
+			tmp.pop_front();
+			place(iter);
+		}
+		if (idx == 0 && level + 1 < levels) cascade(level + 1);
+	}
+
+};
+
+}
+
+
+
+#endif /* SRC_LIBSOFA_TIMINGWHEEL_H_ */
@@ -49,7 +49,8 @@ enum class PutStatus {
 	error_timestamp_must_be_number,
 	error_data_is_manadatory,
 	error_log_is_mandatory,
-	error_log_item_must_be_string
+	error_log_item_must_be_string,
+	aborted ///< not stored - other document of the atomic batch failed
 };
 
 inline bool isSuccess(PutStatus st) {return st == PutStatus::stored || st == PutStatus::merged;}
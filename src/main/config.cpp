@@ -7,6 +7,7 @@
 
 
 #include "config.h"
+#include "../libsofa/kvapi_leveldb.h"
 #include <simpleServer/exceptions.h>
 #include <shared/virtualMember.h>
 #include <shared/stringview.h>
@@ -42,12 +43,45 @@ void ServerConfig::parse(const std::string& name) {
 	rpc_enable_console = rpc["console"].getBool(true);
 	rpc_enable_tcp = rpc["tcp"].getBool(true);
 	rpc_enable_ws = rpc["ws"].getBool(true);
+	rpc_stream_threads = rpc["stream_threads"].getUInt(4);
+
+
+	const IniConfig::KeyValueMap &maintenance = cfg["maintenance"];
+	maint_docs_per_sec = maintenance["docs_per_sec"].getUInt(1000);
+	maint_ops_per_sec = maintenance["ops_per_sec"].getUInt(5000);
+	maint_batch = maintenance["batch"].getUInt(100);
+	maint_purge_interval = maintenance["purge_interval"].getUInt(60000);
+	maint_sweep_batch = maintenance["sweep_batch"].getUInt(1000);
+
+	const IniConfig::KeyValueMap &replication = cfg["replication"];
+	IniConfig::Value rl = replication["listen"];
+	repl_listen = rl.defined()?std::string(rl.getString()):std::string();
+	repl_threads = replication["threads"].getUInt(4);
+	IniConfig::Value ra = replication["allow"];
+	if (ra.defined()) {
+		std::string_view list = ra.getString();
+		while (!list.empty()) {
+			auto sep = list.find_first_of(" ,");
+			std::string_view item = list.substr(0, sep);
+			if (!item.empty()) repl_allow.push_back(std::string(item));
+			list = sep == list.npos?std::string_view():list.substr(sep+1);
+		}
+	}
 
+	const IniConfig::KeyValueMap &durable = cfg["durable"];
+	IniConfig::Value dp = durable["path"];
+	durable_path = dp.defined() && !dp.getString().empty()?std::string(dp.getPath()):std::string();
+	durable_sync_delay = durable["sync_delay"].getUInt(2);
+	durable_compact_size = durable["compact_size"].getUInt(64*1024*1024);
 
 	const IniConfig::KeyValueMap &database = cfg["database"];
 	datapath = database.mandatory["path"].getPath();
+	event_coalesce = database["event_coalesce"].getUInt(0);
+	bootstrap_threads = database["bootstrap_threads"].getUInt(4);
+	compute_threads = database["compute_threads"].getUInt(4);
+	//the cache is always created, because it collects statistics of the reads (default size of leveldb)
 	IniConfig::Value v = database["cache"];
-	if (v.defined()) dbopts.block_cache = (cacheptr = std::shared_ptr<leveldb::Cache>(leveldb::NewLRUCache(v.getUInt()))).get();
+	dbopts.block_cache = (cacheptr = std::shared_ptr<leveldb::Cache>(leveldb_newCache(v.getUInt(8*1024*1024)))).get();
 	v = database["block_restart_interval"];
 	if (v.defined()) dbopts.block_restart_interval = v.getUInt();
 	v = database["block_size"];
@@ -67,6 +101,37 @@ void ServerConfig::parse(const std::string& name) {
 	filterptr = std::shared_ptr<leveldb::FilterPolicy>(const_cast<leveldb::FilterPolicy *>(leveldb::NewBloomFilterPolicy(v.getUInt(10))));
 	dbopts.filter_policy = filterptr.get();
 
+	v = database["backend"];
+	backend = v.defined()?std::string(v.getString()):std::string("leveldb");
+	rocksopts.bloom_bits = database["bloom_bits"].getUInt(10);
+	rocksopts.create_if_missing = dbopts.create_if_missing;
+	v = database["cache"];
+	if (v.defined()) rocksopts.hot_cache = v.getUInt();
+	v = database["cold_cache"];
+	if (v.defined()) rocksopts.cold_cache = v.getUInt();
+	v = database["write_buffer_size"];
+	if (v.defined()) rocksopts.write_buffer_size = v.getUInt();
+	v = database["background_jobs"];
+	if (v.defined()) rocksopts.max_background_jobs = v.getUInt();
+
+	const IniConfig::KeyValueMap &history = cfg["history"];
+	v = history["path"];
+	hist_path = v.defined() && !v.getString().empty()?std::string(v.getPath()):std::string();
+	histopts = dbopts;
+	v = history["cache"];
+	if (v.defined()) histopts.block_cache = (histcacheptr = std::shared_ptr<leveldb::Cache>(leveldb_newCache(v.getUInt()))).get();
+	v = history["block_size"];
+	if (v.defined()) histopts.block_size = v.getUInt();
+	v = history["max_file_size"];
+	if (v.defined()) histopts.max_file_size = v.getUInt();
+	v = history["write_buffer_size"];
+	if (v.defined()) histopts.write_buffer_size = v.getUInt();
+	v = history["bloom_bits"];
+	if (v.defined()) {
+		histfilterptr = std::shared_ptr<leveldb::FilterPolicy>(const_cast<leveldb::FilterPolicy *>(leveldb::NewBloomFilterPolicy(v.getUInt())));
+		histopts.filter_policy = histfilterptr.get();
+	}
+
 }
 
 
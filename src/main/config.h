@@ -10,9 +10,11 @@
 #include <istream>
 #include <memory>
 #include <string>
+#include <vector>
 #include <leveldb/cache.h>
 #include <leveldb/options.h>
 #include <leveldb/filter_policy.h>
+#include "../libsofa/kvapi_rocksdb.h"
 
 namespace sofadb {
 
@@ -32,14 +34,42 @@ public:
 	bool rpc_enable_console;
 	bool rpc_enable_tcp;
 	bool rpc_enable_ws;
+	int rpc_stream_threads;
 	std::size_t http_maxreqsize;
 
+	std::size_t event_coalesce;
+	int bootstrap_threads;
+	int compute_threads;
 
+	std::size_t maint_docs_per_sec;
+	std::size_t maint_ops_per_sec;
+	std::size_t maint_batch;
+	std::size_t maint_purge_interval;
+	std::size_t maint_sweep_batch;
+
+	std::string repl_listen;
+	std::vector<std::string> repl_allow;
+	int repl_threads;
+
+	std::string durable_path;
+	std::size_t durable_sync_delay;
+	std::size_t durable_compact_size;
+
+
+	///storage backend: leveldb or rocksdb
+	std::string backend;
 	leveldb::Options dbopts;
+	RocksDBConfig rocksopts;
 
 	std::shared_ptr<leveldb::Cache> cacheptr;
 	std::shared_ptr<leveldb::FilterPolicy> filterptr;
 
+	///path of the history database (doc_revs, object_index), empty = history is stored with the other data
+	std::string hist_path;
+	leveldb::Options histopts;
+	std::shared_ptr<leveldb::Cache> histcacheptr;
+	std::shared_ptr<leveldb::FilterPolicy> histfilterptr;
+
 	void parse(const std::string &name);
 
 protected:
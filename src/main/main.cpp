@@ -13,11 +13,14 @@
 #include <leveldb/env.h>
 #include "config.h"
 #include "../libsofa/kvapi_leveldb.h"
+#include "../libsofa/kvapi_durable.h"
+#include "../libsofa/kvapi_split.h"
 #include "../libsofa/databasecore.h"
 #include "../libsofa/docdb.h"
 #include "../libsofa/systemdbs.h"
 #include "../libsofa/maintenancetask.h"
 #include "../libsofa/replicator.h"
+#include "../libsofa/replicationtcp.h"
 #include "rpcapi.h"
 #include "debugapi.h"
 
@@ -67,8 +70,28 @@ int main(int argc, char **argv) {
 
 		auto logger = std::make_unique<LevelDBLogger>();
 		cfg.dbopts.info_log = logger.get();
-
-		sofadb::PKeyValueDatabase kvdb = sofadb::leveldb_open(cfg.dbopts,cfg.datapath);
+		cfg.histopts.info_log = logger.get();
+
+		sofadb::PKeyValueDatabase kvdb;
+		if (cfg.backend == "rocksdb") {
+#ifdef SOFADB_ROCKSDB
+			kvdb = sofadb::rocksdb_open(cfg.rocksopts, cfg.datapath);
+#else
+			throw std::runtime_error("RocksDB backend is not available in this build (cmake -DSOFADB_ROCKSDB=ON)");
+#endif
+		} else {
+			kvdb = sofadb::leveldb_open(cfg.dbopts,cfg.datapath);
+			if (!cfg.hist_path.empty()) {
+				kvdb = new sofadb::SplitKeyValueDatabase(kvdb, sofadb::leveldb_open(cfg.histopts, cfg.hist_path));
+			}
+		}
+		sofadb::PKeyValueDatabase durabledb;
+		if (!cfg.durable_path.empty()) {
+			sofadb::DurableMemDB::Config dcfg;
+			dcfg.sync_delay = cfg.durable_sync_delay;
+			dcfg.compact_size = cfg.durable_compact_size;
+			durabledb = new sofadb::DurableMemDB(cfg.durable_path, dcfg);
+		}
 
 
 
@@ -87,11 +110,34 @@ int main(int argc, char **argv) {
 		serverObj.addRPCPath("/RPC", scfg);
 		serverObj.add_ping();
 		serverObj.add_listMethods();
-		auto sdb = std::make_shared<sofadb::SofaDB>(kvdb);
-		sofadb::Replicator replicator(sdb->getDocDB(), sdb->getEventRouter(), nullptr);
+		auto sdb = std::make_shared<sofadb::SofaDB>(kvdb, durabledb);
+		sdb->getEventRouter()->setCoalesceDelay(cfg.event_coalesce);
+		sdb->getDocDB().setWorker(ondra_shared::Worker::create(cfg.compute_threads));
+		sofadb::MaintenanceTask::Config mcfg;
+		mcfg.docs_per_sec = cfg.maint_docs_per_sec;
+		mcfg.ops_per_sec = cfg.maint_ops_per_sec;
+		mcfg.batch_size = cfg.maint_batch;
+		mcfg.purge_interval = cfg.maint_purge_interval;
+		mcfg.sweep_batch = cfg.maint_sweep_batch;
+		sdb->getMaintenanceTask().setConfig(mcfg);
+		sdb->getBootstrapTask().start(sdb->getEventRouter(), cfg.bootstrap_threads);
+		sofadb::Replicator replicator(sdb->getDocDB(), sdb->getEventRouter(), [](json::Value def) {
+			return sofadb::ReplicationTcpClient::create(def);
+		});
+		std::unique_ptr<sofadb::ReplicationTcpListener> replListener;
+		if (!cfg.repl_listen.empty()) {
+			std::string_view l = cfg.repl_listen;
+			auto sep = l.rfind(':');
+			std::string host(sep == l.npos?std::string_view():l.substr(0,sep));
+			std::string port(sep == l.npos?l:l.substr(sep+1));
+			replListener = std::make_unique<sofadb::ReplicationTcpListener>(sdb->getDocDB(), sdb->getEventRouter(),
+					ondra_shared::Worker::create(cfg.repl_threads));
+			replListener->setAllowList(cfg.repl_allow);
+			replListener->start(host, port);
+		}
 
 
-		sofadb::RpcAPI rpcApi(sdb);
+		sofadb::RpcAPI rpcApi(sdb, ondra_shared::Worker::create(cfg.rpc_stream_threads));
 		rpcApi.init(serverObj);
 		sofadb::DebugAPI debugApi(kvdb);
 		debugApi.init(serverObj);
@@ -5,11 +5,14 @@
  *      Author: ondra
  */
 
+#include <limits>
+#include <memory>
 #include <imtjson/array.h>
 #include <imtjson/object.h>
 #include <main/rpcapi.h>
 #include <shared/logOutput.h>
 #include <shared/shared_function.h>
+#include "../libsofa/readstats.h"
 
 using json::Object;
 
@@ -17,7 +20,8 @@ namespace sofadb {
 
 using namespace json;
 
-RpcAPI::RpcAPI(PSofaDB db):db(db),ntfmap(std::make_shared<NotifyMap>()) {}
+RpcAPI::RpcAPI(PSofaDB db, ondra_shared::Worker streamWorker)
+	:db(db),streamWorker(streamWorker),ntfmap(std::make_shared<NotifyMap>()) {}
 
 void RpcAPI::init(json::RpcServer& server) {
 	server.add("DB.create",this,&RpcAPI::databaseCreate);
@@ -28,20 +32,23 @@ void RpcAPI::init(json::RpcServer& server) {
 	server.add("DB.changes",this,&RpcAPI::databaseChanges);
 	server.add("DB.stopChanges",this,&RpcAPI::databaseStopChanges);
 	server.add("Doc.put",this,&RpcAPI::documentPut);
+	server.add("Doc.putAtomic",this,&RpcAPI::documentPutAtomic);
 	server.add("Doc.get",this,&RpcAPI::documentGet);
 	server.add("Doc.changes",this,&RpcAPI::documentChanges);
+	server.add("Server.readStats",this,&RpcAPI::serverReadStats);
 }
 
 void RpcAPI::databaseCreate(json::RpcRequest req) {
 	static Value args(json::array,{"string",{"undefined",Object
-			("storage",{"'permanent","'memory"})
+			("storage",{"'permanent","'memory","'durable"})
 	}});
 
 	if (!req.checkArgs(args)) return req.setArgError();
 	Value a = req.getArgs();
 	String name = a[0].toString();
 	Value cfg = a[1];
-	Storage storage = cfg["storage"].getString() == "memory"?Storage::memory:Storage::permanent;
+	std::string_view st = cfg["storage"].getString();
+	Storage storage = st == "memory"?Storage::memory:st == "durable"?Storage::durable:Storage::permanent;
 	auto h = db->createDB(name.str(),storage);
 	if (h == db->invalid_handle) return req.setError(400, "Invalid database name",name);
 	req.setResult(true);
@@ -85,7 +92,23 @@ void RpcAPI::databaseList(json::RpcRequest req) {
 		nfo.set("name",StrViewA(name))
 			   ("id",h)
 			   ("config",dbconfig2json(cfg))
-			   ("storage",h & DatabaseCore::memdb_mask?"memory":"permanent");
+			   ("storage",h & DatabaseCore::memdb_mask?"memory":h & DatabaseCore::durable_mask?"durable":"permanent");
+		MaintenanceTask::Stats mst;
+		if (db->getMaintenanceTask().getStats(h, mst)) {
+			nfo.set("maintenance",Object("checkpoint",mst.checkpoint)
+					("backlog",mst.backlog)
+					("processed",mst.processed)
+					("erased",mst.erased)
+					("purged",mst.purged));
+		}
+		BootstrapTask::Stats bst;
+		if (db->getBootstrapTask().getStats(h, bst)) {
+			nfo.set("bootstrap",Object("source",bst.source)
+					("loading",bst.loading)
+					("docs",bst.docs)
+					("time_ms",bst.time_ms)
+					("seqnum",bst.seqnum));
+		}
 
 		out.push_back(nfo);
 		return true;
@@ -93,6 +116,18 @@ void RpcAPI::databaseList(json::RpcRequest req) {
 	req.setResult(out);
 }
 
+void RpcAPI::serverReadStats(json::RpcRequest req) {
+	static Value args(json::array,{});
+	if (!req.checkArgs(args)) return req.setArgError();
+	Object out;
+	for (int i = 0; i < static_cast<int>(ReadType::count); i++) {
+		ReadType t = static_cast<ReadType>(i);
+		ReadStats::Counters c = ReadStats::get(t);
+		out.set(ReadStats::name(t), Object("hits",c.hits)("misses",c.misses));
+	}
+	req.setResult(out);
+}
+
 void RpcAPI::databaseRename(json::RpcRequest req) {
 	static Value aform = {{"string","number"},"string"};
 	if (!req.checkArgs(aform)) return req.setArgError();
@@ -122,16 +157,137 @@ bool RpcAPI::arg0ToHandle(json::RpcRequest req, DatabaseCore::Handle &h) {
 
 static std::size_t getLimit(const Value &v)  {
 	Value x = v["limit"];
-	if (x.defined()) return v.getUInt();
+	if (x.defined()) return x.getUInt();
 	else return static_cast<std::size_t>(-1);
 }
 
 static std::size_t getOffset(const Value &v)  {
-	Value x = v["skip"];
-	if (x.defined()) return v.getUInt();
+	Value x = v["offset"];
+	if (!x.defined()) x = v["skip"];
+	if (x.defined()) return x.getUInt();
 	else return 0;
 }
 
+///Creates continuation token
+/** Token contains type of the listing and position of the last returned row
+ * (document id, sequence number or timestamp). The next page seeks directly to the
+ * position, so the cost of the page doesn't depend on its depth. The token is opaque
+ * for the client
+ */
+static Value makeToken(char type, const std::string_view &pos) {
+	static const char hexChars[] = "0123456789abcdef";
+	std::string out(1, type);
+	for (char c: pos) {
+		unsigned char b = static_cast<unsigned char>(c);
+		out.push_back(hexChars[b >> 4]);
+		out.push_back(hexChars[b & 0xF]);
+	}
+	return Value(StrViewA(out));
+}
+
+static Value makeToken(char type, std::uint64_t pos) {
+	char buff[8];
+	for (int i = 0; i < 8; i++) buff[i] = static_cast<char>((pos >> (8*(7-i))) & 0xFF);
+	return makeToken(type, std::string_view(buff, 8));
+}
+
+///Parses continuation token
+/**
+ * @param token token. Empty string or null is accepted as the first page
+ * @param type expected type
+ * @param pos receives position. It is empty for the first page
+ * @retval true valid
+ * @retval false invalid token
+ */
+static bool parseToken(const Value &token, char type, std::string &pos) {
+	pos.clear();
+	if (token.type() != json::string) return token.isNull() || !token.defined();
+	std::string_view str = token.getString();
+	if (str.empty()) return true;
+	if (str[0] != type || (str.length() & 1) == 0) return false;
+	auto hexVal = [](char c) {
+		return c >= '0' && c <= '9'?c - '0':c >= 'a' && c <= 'f'?c - 'a' + 10:-1;
+	};
+	for (std::size_t i = 1; i < str.length(); i+=2) {
+		int hi = hexVal(str[i]), lo = hexVal(str[i+1]);
+		if (hi < 0 || lo < 0) return false;
+		pos.push_back(static_cast<char>(hi * 16 + lo));
+	}
+	return true;
+}
+
+///Delivers rows of the result through notifications in chunks
+/** Rows are not accumulated, so memory used by the request doesn't depend on the size
+ * of the result. The chunk is written to the connection before the scan continues, so
+ * a slow client slows down the scan instead of growing the buffers
+ */
+class RowStream {
+public:
+	RowStream(json::RpcRequest req, String name, std::size_t chunkSize)
+		:req(req),name(name),chunkSize(chunkSize) {
+		chunk.reserve(chunkSize);
+	}
+
+	///Adds row
+	/** @retval false connection is not able to receive notifications, stop the scan */
+	bool push(const Value &row) {
+		chunk.push_back(row);
+		++count;
+		if (chunk.size() >= chunkSize) return flush();
+		return ok;
+	}
+	///Sends rest of rows
+	bool flush() {
+		if (ok && !chunk.empty()) {
+			ok = req.sendNotify(name, chunk);
+			if (ok) {
+				delivered = count;
+				lastDelivered = chunk[chunk.size()-1];
+			}
+		}
+		chunk = Array();
+		chunk.reserve(chunkSize);
+		return ok;
+	}
+	std::size_t getCount() const {return count;}
+	bool isOk() const {return ok;}
+	///Count of rows which have been sent to the client
+	std::size_t getDelivered() const {return delivered;}
+	///Last row sent to the client (undefined, if none)
+	const Value &getLastDelivered() const {return lastDelivered;}
+
+	///Retrieves count of rows per notification from the request
+	static std::size_t getChunkSize(const Value &v) {
+		Value c = v["chunk"];
+		std::size_t n = c.defined()?c.getUInt():defaultChunk;
+		return std::max<std::size_t>(1,std::min(n, maxChunk));
+	}
+
+	static constexpr std::size_t defaultChunk = 100;
+	static constexpr std::size_t maxChunk = 10000;
+
+protected:
+	json::RpcRequest req;
+	String name;
+	std::size_t chunkSize;
+	Array chunk;
+	Value lastDelivered;
+	std::size_t count = 0;
+	std::size_t delivered = 0;
+	bool ok = true;
+};
+
+static bool parseToken(const Value &token, char type, std::uint64_t &pos, bool &present) {
+	std::string s;
+	if (!parseToken(token, type, s)) return false;
+	present = !s.empty();
+	if (!present) return true;
+	if (s.length() != 8) return false;
+	pos = 0;
+	for (char c: s) pos = (pos << 8) | static_cast<unsigned char>(c);
+	return true;
+}
+
 static OutputFormat getOutputFormat(OutputFormat lf, Value v) {
 	Value log = v["log"];
 	Value del = v["deleted"];
@@ -186,24 +342,72 @@ void RpcAPI::documentGet(json::RpcRequest req) {
 				}
 			} else if (prefix.defined() || start_key.defined() || end_key.defined()) {
 				std::size_t limit = getLimit(v);
+				Value token = v["token"];
+				std::string after, last;
+				if (!parseToken(token, 'd', after)) {
+					Object errobj(RpcServer::defaultFormatError(400, "invalid_token",Value()));
+					errobj.merge(v);
+					errobj.set("error",true);
+					result.push_back(errobj);
+					continue;
+				}
 				Array l;
+				Value stream = v["stream"];
+				std::unique_ptr<RowStream> rs;
+				if (stream.defined()) rs = std::make_unique<RowStream>(req, stream.toString(), RowStream::getChunkSize(v));
 				if (limit) {
 					std::size_t offset = getOffset(v);
 					auto cb =  [&](const Value &v) {
 						if (offset) {
 							--offset;return true;
 						}
-						l.push_back(v);
+						if (rs != nullptr) {
+							if (!rs->push(v)) return false;
+						} else {
+							l.push_back(v);
+						}
+						last = v["id"].getString();
 						return 	--limit > 0;
 					};
 					if (prefix.defined()) {
 						bool rev = v["descending"].getBool();
-						db->allDocs(h, lf, prefix.getString(), rev, std::move(cb));
+						db->allDocs(h, lf, prefix.getString(), after, rev, std::move(cb));
 					} else {
-						db->allDocs(h, lf, start_key.getString(), end_key.getString(), std::move(cb));
+						std::string_view start = start_key.getString();
+						std::string_view end = end_key.getString();
+						//descending range excludes the start key, ascending range includes it
+						if (!after.empty()) {
+							if (start < end) after.push_back(0);
+							start = after;
+						}
+						db->allDocs(h, lf, start, end, std::move(cb));
 					}
 				}
-				res = l;
+				if (rs != nullptr) {
+					if (!rs->flush()) {
+						//client can continue after the last row it has received
+						Object errobj(RpcServer::defaultFormatError(400, "notifications_not_available",Value()));
+						errobj.merge(v);
+						errobj.set("error",true);
+						errobj.set("count", rs->getDelivered());
+						if (rs->getDelivered()) errobj.set("next", makeToken('d', rs->getLastDelivered()["id"].getString()));
+						else errobj.set("next", token);
+						result.push_back(errobj);
+						continue;
+					}
+					Object page;
+					page.set("count", rs->getCount());
+					if (limit == 0 && !last.empty()) page.set("next", makeToken('d', last));
+					res = page;
+				} else if (token.defined()) {
+					Object page;
+					page.set("rows", l);
+					//page is full, there can be more rows
+					if (limit == 0 && !last.empty()) page.set("next", makeToken('d', last));
+					res = page;
+				} else {
+					res = l;
+				}
 			} else {
 				f = lf;
 			}
@@ -224,7 +428,7 @@ void RpcAPI::documentGet(json::RpcRequest req) {
 }
 
 
-PutStatus2Error status2error[13]={
+PutStatus2Error status2error[14]={
 		{PutStatus::stored, 0, "stored"},
 		{PutStatus::merged, 0, "merged"},
 		{PutStatus::conflict, 409, "conflict"},
@@ -237,7 +441,8 @@ PutStatus2Error status2error[13]={
 		{PutStatus::error_timestamp_must_be_number,456,"'timestamp' must be number"},
 		{PutStatus::error_data_is_manadatory,457,"'data' is mandatory"},
 		{PutStatus::error_log_is_mandatory,458,"'log' is mandatory"},
-		{PutStatus::error_log_item_must_be_string,459,"'log' item must be string"}
+		{PutStatus::error_log_item_must_be_string,459,"'log' item must be string"},
+		{PutStatus::aborted,424,"aborted"}
 };
 
 typedef ondra_shared::shared_function<void(bool)> SharedObserver;
@@ -258,6 +463,10 @@ void RpcAPI::databaseChanges(json::RpcRequest req) {
 	std::size_t offset = getOffset(cfg);
 	std::size_t limit = getLimit(cfg);
 	bool reversed = cfg["descending"].getBool();
+	std::uint64_t tokenSeq;
+	bool hasToken;
+	if (!parseToken(cfg["token"], 's', tokenSeq, hasToken)) return req.setError(400, "invalid_token", cfg["token"]);
+	if (hasToken) since = tokenSeq;
 	std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
 	auto abstm = now + std::chrono::milliseconds(timeout);
 	PSofaDB rdb = db;
@@ -313,8 +522,17 @@ void RpcAPI::databaseChanges(json::RpcRequest req) {
 		observer(true);
 	} else {
 
+		Value stream = cfg["stream"];
+		String streamName = stream.defined()?stream.toString():String();
+		std::size_t chunkSize = RowStream::getChunkSize(cfg);
+		ondra_shared::Worker wrk = streamWorker;
+
 		SharedObserver observer = [=](SharedObserver self, bool not_timeout) mutable {
 			Array res;
+			std::unique_ptr<RowStream> rs;
+			if (stream.defined()) rs = std::make_unique<RowStream>(req, streamName, chunkSize);
+			std::size_t count = 0;
+			SeqNum from = since;
 			if (not_timeout && limit) {
 				since = rdb->readChanges(h, since, reversed, fmt, std::move(flt), [&](const Value &x) {
 					if (offset) {
@@ -322,21 +540,49 @@ void RpcAPI::databaseChanges(json::RpcRequest req) {
 						return true;
 					}
 					else {
-						res.push_back(x);
+						++count;
+						if (rs != nullptr) {
+							if (!rs->push(x)) return false;
+						} else {
+							res.push_back(x);
+						}
 						return --limit>0;
 					}
 				});
-				if (res.empty()) {
+				if (rs != nullptr && !rs->flush()) {
+					//client can continue after the last row it has received
+					Object errdata;
+					errdata.set("stream", stream);
+					errdata.set("count", rs->getDelivered());
+					Value lastSeq = rs->getLastDelivered()["seq"];
+					if (!rs->getDelivered()) errdata.set("next", makeToken('s', from));
+					else if (lastSeq.type() == json::number) errdata.set("next", makeToken('s', lastSeq.getUInt()));
+					req.setError(400, "notifications_not_available", errdata);
+					return;
+				}
+				if (count == 0) {
 					std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
 					if (now < abstm) {
 						std::size_t tm = std::chrono::duration_cast<std::chrono::milliseconds>(abstm-now).count();
-						rdb->waitForChanges(h, since, tm, self);
+						if (rs != nullptr) {
+							//streaming is blocked by a slow client, so it doesn't run on the thread of the event router
+							rdb->waitForChanges(h, since, tm, [self, wrk](bool nt) mutable {
+								wrk >> [self, nt]() mutable {self(nt);};
+							});
+						} else {
+							rdb->waitForChanges(h, since, tm, self);
+						}
 						return;
 					}
 				}
 			}
-			req.setResult(Object("seq", since)
-						        ("rows",res));
+			Object out;
+			out.set("seq", since);
+			if (rs != nullptr) out.set("count", count);
+			else out.set("rows",res);
+			//page is full, there can be more changes
+			if (limit == 0 && count) out.set("next", makeToken('s', since));
+			req.setResult(out);
 		};
 		observer(true);
 	}
@@ -351,6 +597,14 @@ Value RpcAPI::statusToError(PutStatus st) {
 }
 
 void RpcAPI::documentPut(json::RpcRequest req) {
+	documentPutBulk(req, false);
+}
+
+void RpcAPI::documentPutAtomic(json::RpcRequest req) {
+	documentPutBulk(req, true);
+}
+
+void RpcAPI::documentPutBulk(json::RpcRequest req, bool atomic) {
 
 	Value args = req.getArgs();
 
@@ -359,17 +613,24 @@ void RpcAPI::documentPut(json::RpcRequest req) {
 	DatabaseCore::Handle h;
 	if (!arg0ToHandle(req,h)) return;
 
+	std::vector<Value> docs;
+	docs.reserve(cnt);
+	for (std::uintptr_t i = 1; i < cnt ; i++) docs.push_back(args[i]);
+
+	std::vector<PutStatus> status;
+	std::vector<Value> newrevs;
+	db->put(h, std::basic_string_view<Value>(docs.data(), docs.size()), atomic, status, newrevs);
 
 	Array result;
-	for (std::uintptr_t i = 1; i < cnt ; i++) {
+	result.reserve(docs.size());
+	for (std::size_t i = 0; i < docs.size(); i++) {
 
-		Value doc = args[i];
-		Value newrev;
-		PutStatus st = db->put(h,doc,newrev);
+		const Value &doc = docs[i];
+		PutStatus st = status[i];
 		if (isSuccess(st)) {
 			Object res;
 			res("id",doc["id"])
-			   ("rev",newrev);
+			   ("rev",newrevs[i]);
 			result.push_back(res);
 
 		} else {
@@ -434,6 +695,7 @@ void RpcAPI::documentChanges(json::RpcRequest req) {
 					("offset",{"number","undefined"})
 					("limit",{"number","undefined"})
 					("descending",{"boolean","undefined"})
+					("token",{"string","null","undefined"})
 			}
 	};
 
@@ -446,22 +708,64 @@ void RpcAPI::documentChanges(json::RpcRequest req) {
 	Value cfg = args[2];
 	std::size_t since = cfg["since"].getUInt();
 	OutputFormat fmt = getOutputFormat(OutputFormat::deleted, cfg);
-	std::size_t offset = getOffset(cfg["offset"]);
-	std::size_t limit = getLimit(cfg["limit"]);
+	std::size_t offset = getOffset(cfg);
+	std::size_t limit = getLimit(cfg);
 	bool reverse = cfg["descending"].getBool();
+	Value token = cfg["token"];
+	std::uint64_t until = std::numeric_limits<std::uint64_t>::max();
+	//the token contains timestamp and revision of the last returned row. More revisions
+	//can share the timestamp, so the page starts at the timestamp and skips revisions
+	//up to the revision (revisions of the same timestamp are ordered by their ID)
+	std::string tokenPos;
+	if (!parseToken(token, 't', tokenPos) || (!tokenPos.empty() && tokenPos.length() != 16))
+		return req.setError(400, "invalid_token", token);
+	std::uint64_t tokenTm = 0, tokenRev = 0;
+	bool hasToken = !tokenPos.empty();
+	for (std::size_t i = 0; i < tokenPos.length(); i++) {
+		std::uint64_t &n = i < 8?tokenTm:tokenRev;
+		n = (n << 8) | static_cast<unsigned char>(tokenPos[i]);
+	}
+	if (hasToken) {
+		if (reverse) until = tokenTm < until?tokenTm+1:until;
+		else if (since < tokenTm) since = tokenTm-1;
+		else hasToken = false;
+	}
 
 	Array result;
-
-	db->readDocChanges(h,args[1].getString(), since, reverse, fmt, [&](Value v) {
-		if (offset) {
-			--offset;
-			return true;
-		} else {
-			result.push_back(v);
-			return --limit > 0;
+	std::uint64_t lastTm = 0, lastRev = 0;
+
+	if (limit) {
+		db->readDocChanges(h,args[1].getString(), since, until, reverse, fmt, [&](Value v) {
+			std::uint64_t tm = v["timestamp"].getUInt();
+			RevID rev = DocumentDB::parseStrRev(v["rev"].getString());
+			if (hasToken && tm == tokenTm && (reverse?rev >= tokenRev:rev <= tokenRev)) return true;
+			if (offset) {
+				--offset;
+				return true;
+			} else {
+				result.push_back(v);
+				lastTm = tm;
+				lastRev = rev;
+				return --limit > 0;
+			}
+		});
+	}
+	if (token.defined()) {
+		Object page;
+		page.set("rows", result);
+		//page is full, there can be more revisions
+		if (limit == 0 && !result.empty()) {
+			char buff[16];
+			for (int i = 0; i < 8; i++) {
+				buff[i] = static_cast<char>((lastTm >> (8*(7-i))) & 0xFF);
+				buff[i+8] = static_cast<char>((lastRev >> (8*(7-i))) & 0xFF);
+			}
+			page.set("next", makeToken('t', std::string_view(buff, 16)));
 		}
-	});
-	req.setResult(result);
+		req.setResult(page);
+	} else {
+		req.setResult(result);
+	}
 }
 
 } /* namespace sofadb */
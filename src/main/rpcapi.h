@@ -9,6 +9,7 @@
 #define SRC_MAIN_RPCAPI_H_
 
 #include <imtjson/rpc.h>
+#include <shared/worker.h>
 #include "../libsofa/api.h"
 
 namespace sofadb {
@@ -18,7 +19,13 @@ class RpcAPI {
 	typedef SofaDB::Handle Handle;
 	typedef std::shared_ptr<SofaDB> PSofaDB;
 public:
-	RpcAPI(PSofaDB db);
+	///Constructor
+	/**
+	 * @param db database
+	 * @param streamWorker worker which delivers streamed results after waiting for changes. The scan
+	 * is blocked by a slow client, so it must not run on the thread of the event router
+	 */
+	RpcAPI(PSofaDB db, ondra_shared::Worker streamWorker);
 
 	void init(json::RpcServer &server);
 
@@ -32,15 +39,19 @@ public:
 	void databaseStopChanges(json::RpcRequest req);
 	void documentGet(json::RpcRequest req);
 	void documentPut(json::RpcRequest req);
+	void documentPutAtomic(json::RpcRequest req);
 	void documentChanges(json::RpcRequest req);
+	void serverReadStats(json::RpcRequest req);
 
 
 protected:
 	PSofaDB db;
+	ondra_shared::Worker streamWorker;
 
 
 	bool arg0ToHandle(json::RpcRequest req, DatabaseCore::Handle &h);
 	json::Value statusToError(PutStatus st);
+	void documentPutBulk(json::RpcRequest req, bool atomic);
 
 
 	struct NotifyMap {